@@ -0,0 +1,35 @@
+#pragma once
+
+#include "dcmtk/config/osconfig.h"    /* make sure OS specific configuration is included first */
+
+#include "dcmtk/dcmdata/dcfilefo.h"
+
+#include <QJsonObject>
+#include <QStringList>
+
+#include <memory>
+
+namespace xrf {
+namespace bench {
+
+/* each mode takes the arguments behind its name and prints one JSON document to stdout */
+int header(const QStringList& args);
+int receive(const QStringList& args);
+int cine(const QStringList& args);
+int window(const QStringList& args);
+int associate(const QStringList& args);
+int verify(const QStringList& args);
+int rawcine(const QStringList& args);
+int projection(const QStringList& args);
+
+/* value of "--name value" in args, or fallback */
+QString option(const QStringList& args, const QString& name, const QString& fallback = QString());
+void printJson(const QJsonObject& result);
+
+/* synthetic XA multi-frame loop with geometry, uncompressed; the UIDs which are not
+ * given are generated. Every thread needs its own, dcmdata is not thread safe. */
+std::shared_ptr<DcmFileFormat> syntheticLoop(int frames, int rows, int columns, int bits,
+                                             const char* studyInstanceUID = NULL, const char* seriesInstanceUID = NULL);
+
+}
+}
@@ -0,0 +1,171 @@
+#include "bench.h"
+#include "xrfcinelooprcv.h"
+
+#include "dcmtk/dcmdata/dcuid.h"
+
+#include <QElapsedTimer>
+#include <QJsonArray>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <QThread>
+#include <QVector>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+namespace xrf {
+namespace bench {
+
+struct AssociateConfig
+{
+    int port = 11112;
+    int associations = 1000;        // per requestor
+    int requestors = 1;
+    int contexts = 128;             // the most a presentation context ID allows
+    bool promiscuous = false;       // every fourth context proposes a private SOP class
+};
+
+/* opens and releases associations one after the other, proposing cfg.contexts contexts each */
+class Requestor : public QThread
+{
+public:
+    Requestor(const AssociateConfig& cfg, int id) : cfg(cfg), id(id) {}
+
+    void run() Q_DECL_OVERRIDE;
+
+    QVector<qint64> setupNs;
+    int accepted = 0;               // contexts of the last association
+    int failed = 0;
+    OFString error;
+
+private:
+    AssociateConfig cfg;
+    int id;
+};
+
+void Requestor::run()
+{
+    OFString temp_str;
+    T_ASC_Network *net = NULL;
+    if (ASC_initializeNetwork(NET_REQUESTOR, 0, 30, &net).bad())
+    {
+        failed = cfg.associations;
+        return;
+    }
+    const char *transferSyntaxes[] = { UID_JPEGProcess14SV1TransferSyntax, UID_LittleEndianExplicitTransferSyntax,
+                                       UID_LittleEndianImplicitTransferSyntax };
+    std::vector<QByteArray> privateClasses;
+    for (int i = 0; i < cfg.contexts; ++i)
+        privateClasses.push_back(QByteArray("1.2.826.0.1.3680043.2.1143.99.") + QByteArray::number(i));
+
+    QElapsedTimer timer;
+    for (int n = 0; n < cfg.associations; ++n)
+    {
+        T_ASC_Parameters *params = NULL;
+        T_ASC_Association *assoc = NULL;
+        timer.start();
+        OFCondition cond = ASC_createAssociationParameters(&params, ASC_DEFAULTMAXPDU);
+        if (cond.good()) cond = ASC_setAPTitles(params, QString("XRFBENCH%1").arg(id).toLatin1().constData(), APPLICATIONTITLE, NULL);
+        if (cond.good()) cond = ASC_setPresentationAddresses(params, "localhost", QString("127.0.0.1:%1").arg(cfg.port).toLatin1().constData());
+        for (int i = 0; i < cfg.contexts && cond.good(); ++i)
+        {
+            const char *abstractSyntax = (cfg.promiscuous && i % 4 == 3)
+                ? privateClasses[size_t(i)].constData() : dcmAllStorageSOPClassUIDs[i % numberOfAllDcmStorageSOPClassUIDs];
+            cond = ASC_addPresentationContext(params, T_ASC_PresentationContextID(2 * i + 1), abstractSyntax,
+                                              transferSyntaxes, DIM_OF(transferSyntaxes));
+        }
+        if (cond.good()) cond = ASC_requestAssociation(net, params, &assoc);
+        if (cond.good())
+        {
+            setupNs.append(timer.nsecsElapsed());
+            accepted = ASC_countAcceptedPresentationContexts(params);
+            ASC_releaseAssociation(assoc);
+        }
+        else
+        {
+            ++failed;
+            error = DimseCondition::dump(temp_str, cond);
+        }
+        if (assoc) ASC_destroyAssociation(&assoc);
+        else if (params) ASC_destroyAssociationParameters(&params);
+    }
+    ASC_dropNetwork(&net);
+}
+
+int associate(const QStringList &args)
+{
+    AssociateConfig cfg;
+    cfg.port = option(args, "--port", QString::number(cfg.port)).toInt();
+    cfg.associations = qMax(1, option(args, "--associations", QString::number(cfg.associations)).toInt());
+    cfg.requestors = qMax(1, option(args, "--requestors", QString::number(cfg.requestors)).toInt());
+    cfg.contexts = qBound(1, option(args, "--contexts", QString::number(cfg.contexts)).toInt(), 128);
+    cfg.promiscuous = args.contains("--promiscuous");
+    const bool legacy = args.contains("--legacy");
+
+    QTemporaryDir outdir;
+    CineLoopRcv rcv(outdir.path(), ".dcm", unsigned(cfg.port), -1, cfg.promiscuous);
+    rcv.setMaxConcurrentAssociations(cfg.requestors);
+    rcv.setHashedAcceptance(!legacy);
+    if (!rcv.init())
+    {
+        QTextStream(stderr) << "associate: cannot initialize the receiver on port " << cfg.port << "\n";
+        return 1;
+    }
+    rcv.start();
+
+    std::vector<std::unique_ptr<Requestor>> requestors;
+    for (int i = 0; i < cfg.requestors; ++i)
+        requestors.emplace_back(new Requestor(cfg, i));
+    QElapsedTimer wall;
+    wall.start();
+    for (auto& requestor : requestors)
+        requestor->start();
+    for (auto& requestor : requestors)
+        requestor->wait();
+    const qint64 wallNs = wall.nsecsElapsed();
+    rcv.stop();
+    rcv.wait();
+
+    QVector<qint64> setupNs;
+    int failed = 0, accepted = 0;
+    QJsonArray errors;
+    for (auto& requestor : requestors)
+    {
+        setupNs += requestor->setupNs;
+        failed += requestor->failed;
+        accepted = qMax(accepted, requestor->accepted);
+        if (!requestor->error.empty())
+            errors.append(QString(requestor->error.c_str()));
+    }
+    std::sort(setupNs.begin(), setupNs.end());
+    const auto percentile = [&setupNs](double p) {
+        return setupNs.isEmpty() ? 0.0 : setupNs.at(qMin(setupNs.size() - 1, int(p * setupNs.size()))) / 1e6;
+    };
+
+    QJsonObject config;
+    config["associations_per_requestor"] = cfg.associations;
+    config["requestors"] = cfg.requestors;
+    config["contexts"] = cfg.contexts;
+    config["promiscuous"] = cfg.promiscuous;
+    config["acceptance"] = legacy ? "dcmtk" : "hashed";
+
+    const double seconds = wallNs / 1e9;
+    QJsonObject result;
+    result["mode"] = "associate";
+    result["config"] = config;
+    result["associations"] = setupNs.size();
+    result["failed"] = failed;
+    result["accepted_contexts"] = accepted;
+    result["wall_s"] = seconds;
+    result["associations_per_s"] = seconds > 0 ? setupNs.size() / seconds : 0.0;
+    result["p50_ms"] = percentile(0.50);
+    result["p99_ms"] = percentile(0.99);
+    if (!errors.isEmpty())
+        result["errors"] = errors;
+    printJson(result);
+    return failed == 0 ? 0 : 1;
+}
+
+}
+}
@@ -0,0 +1,93 @@
+#include "bench.h"
+#include "xrfcineplayer.h"
+
+#include "dcmtk/dcmdata/dcdeftag.h"
+
+#include <QEventLoop>
+#include <QTextStream>
+#include <QTimer>
+
+namespace xrf {
+namespace bench {
+
+int cine(const QStringList &args)
+{
+    const int seconds = qMax(1, option(args, "--seconds", "10").toInt());
+    const double fps = option(args, "--fps", "0").toDouble();
+    const int cache = option(args, "--cache", "32").toInt();
+    const int threads = option(args, "--threads", "0").toInt();
+
+    CineLoopPtr loop;
+    QString source = "synthetic";
+    if (!args.isEmpty() && !args.first().startsWith("--"))
+    {
+        OFCondition cond;
+        source = args.first();
+        loop = CineLoop::fromFile(source, &cond);
+        if (!loop)
+        {
+            QTextStream(stderr) << "cine: " << source << ": " << cond.text() << "\n";
+            return 1;
+        }
+    }
+    else
+    {
+        OFCondition cond;
+        std::shared_ptr<DcmFileFormat> fileformat = syntheticLoop(qMax(1, option(args, "--frames", "60").toInt()),
+                                                                  option(args, "--rows", "1024").toInt(), option(args, "--cols", "1024").toInt(),
+                                                                  qBound(8, option(args, "--bits", "12").toInt(), 16));
+        DcmDataset *dataset = fileformat->getDataset();
+        dataset->putAndInsertString(DCM_RecommendedDisplayFrameRate, QByteArray::number(fps > 0.0 ? fps : 30.0).constData());
+        // fromFileFormat() takes the encoding from the original transfer syntax
+        dataset->updateOriginalXfer();
+        loop = CineLoop::fromFileFormat(fileformat, &cond);
+        if (!loop)
+        {
+            QTextStream(stderr) << "cine: cannot build the synthetic loop: " << cond.text() << "\n";
+            return 1;
+        }
+    }
+
+    CinePlayer player(cache, threads);
+    if (fps > 0.0)
+        player.setFrameRate(fps);
+    if (!player.setLoop(loop))
+    {
+        QTextStream(stderr) << "cine: the loop cannot be played\n";
+        return 1;
+    }
+
+    // the player schedules on this thread's event loop, as it would on the UI thread
+    QEventLoop events;
+    QTimer::singleShot(seconds * 1000, &events, SLOT(quit()));
+    player.play();
+    events.exec();
+    player.stop();
+
+    const JitterStats stats = player.jitterStats();
+    QJsonObject result;
+    result["source"] = source;
+    result["frames"] = loop->frameCount();
+    result["rows"] = loop->info().rows;
+    result["cols"] = loop->info().columns;
+    result["bits_allocated"] = loop->info().bitsAllocated;
+    result["first_frame"] = player.firstFrame() + 1;
+    result["last_frame"] = player.lastFrame() + 1;
+    result["cache_frames"] = cache;
+    result["seconds"] = seconds;
+    result["interval_ms"] = stats.intervalMs;
+    result["presented"] = double(stats.presented);
+    result["skipped"] = double(stats.skipped);
+    result["underruns"] = double(stats.underruns);
+    result["mean_abs_error_ms"] = stats.meanAbsErrorMs;
+    result["p99_abs_error_ms"] = stats.p99AbsErrorMs;
+    result["max_abs_error_ms"] = stats.maxAbsErrorMs;
+    result["mean_interval_ms"] = stats.meanIntervalMs;
+    result["max_interval_ms"] = stats.maxIntervalMs;
+    result["achieved_fps"] = stats.meanIntervalMs > 0.0 ? 1000.0 / stats.meanIntervalMs : 0.0;
+    printJson(result);
+    return 0;
+}
+
+}
+}
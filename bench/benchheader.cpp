@@ -0,0 +1,121 @@
+#include "bench.h"
+#include "xrfheaderreader.h"
+
+#include "dcmtk/dcmdata/dcfilefo.h"
+#include "dcmtk/dcmdata/dcdeftag.h"
+
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QVector>
+#include <QTextStream>
+
+#include <algorithm>
+
+namespace xrf {
+namespace bench {
+
+/* the IMPORTANT elements of docs/DICOM-TAG.txt */
+static std::vector<DcmTagKey> importantTags()
+{
+    return {
+        DCM_SOPInstanceUID, DCM_NumberOfFrames, DCM_FrameTime,
+        DCM_DistanceSourceToDetector, DCM_DistanceSourceToPatient,
+        DCM_EstimatedRadiographicMagnificationFactor, DCM_PositionerPrimaryAngle,
+        DcmTagKey(0x0021, 0x1017), DcmTagKey(0x0021, 0x1071)
+    };
+}
+
+struct Timing
+{
+    QVector<qint64> ns;
+    qint64 bytes = 0;
+    int failed = 0;
+
+    QJsonObject json() const
+    {
+        QVector<qint64> sorted = ns;
+        std::sort(sorted.begin(), sorted.end());
+        qint64 total = 0;
+        for (qint64 t : sorted) total += t;
+        const auto percentile = [&sorted](double p) {
+            return sorted.isEmpty() ? 0.0 : sorted.at(qMin(sorted.size() - 1, int(p * sorted.size()))) / 1000.0;
+        };
+        QJsonObject o;
+        o["files"] = sorted.size();
+        o["failed"] = failed;
+        o["total_ms"] = total / 1e6;
+        o["mean_us"] = sorted.isEmpty() ? 0.0 : total / 1000.0 / sorted.size();
+        o["p50_us"] = percentile(0.50);
+        o["p99_us"] = percentile(0.99);
+        o["bytes_read"] = double(bytes);
+        o["mb_per_s"] = total > 0 ? (bytes / 1048576.0) / (total / 1e9) : 0.0;
+        return o;
+    }
+};
+
+int header(const QStringList &args)
+{
+    if (args.isEmpty() || args.first().startsWith("--"))
+    {
+        QTextStream(stderr) << "header: directory missing\n";
+        return 1;
+    }
+
+    const QDir dir(args.first());
+    const QString ext = option(args, "--ext", ".dcm");
+    const QString tagSet = option(args, "--tags", "important");
+    const int repeat = qMax(1, option(args, "--repeat", "1").toInt());
+    const std::vector<DcmTagKey> tags = (tagSet == "default") ? DatasetScanner::defaultCaptureTags() : importantTags();
+
+    const QStringList files = dir.entryList(QStringList() << QString("*%1").arg(ext), QDir::Files, QDir::Name);
+    if (files.isEmpty())
+    {
+        QTextStream(stderr) << "header: no *" << ext << " files in " << dir.path() << "\n";
+        return 1;
+    }
+
+    Timing headerOnly, full;
+    qint64 fileBytes = 0;
+    QElapsedTimer timer;
+    for (int r = 0; r < repeat; ++r)
+    {
+        for (const QString& name : files)
+        {
+            const QString path = dir.filePath(name);
+            if (r == 0) fileBytes += QFileInfo(path).size();
+
+            HeaderReader reader(path);
+            reader.setCaptureTags(tags);
+            timer.start();
+            OFCondition cond = reader.read();
+            headerOnly.ns.append(timer.nsecsElapsed());
+            headerOnly.bytes += reader.bytesRead();
+            if (cond.bad()) ++headerOnly.failed;
+
+            // the reference: what getting at the same tags costs today
+            DcmFileFormat fileformat;
+            timer.start();
+            cond = fileformat.loadFile(path.toLocal8Bit().constData());
+            full.ns.append(timer.nsecsElapsed());
+            full.bytes += QFileInfo(path).size();
+            if (cond.bad()) ++full.failed;
+        }
+    }
+
+    QJsonObject result;
+    result["mode"] = "header";
+    result["directory"] = dir.absolutePath();
+    result["tags"] = tagSet;
+    result["repeat"] = repeat;
+    result["file_bytes"] = double(fileBytes);
+    result["header_only"] = headerOnly.json();
+    result["full_load"] = full.json();
+    const double headerMean = headerOnly.json()["mean_us"].toDouble();
+    result["speedup"] = headerMean > 0 ? full.json()["mean_us"].toDouble() / headerMean : 0.0;
+    printJson(result);
+    return (headerOnly.failed || full.failed) ? 2 : 0;
+}
+
+}
+}
@@ -0,0 +1,68 @@
+#include "bench.h"
+
+#include "dcmtk/dcmdata/dcdeftag.h"
+#include "dcmtk/dcmdata/dcuid.h"
+
+#include <vector>
+
+namespace xrf {
+namespace bench {
+
+std::shared_ptr<DcmFileFormat> syntheticLoop(int frames, int rows, int columns, int bits,
+                                             const char* studyInstanceUID, const char* seriesInstanceUID)
+{
+    char uid[100];
+    std::shared_ptr<DcmFileFormat> fileformat = std::make_shared<DcmFileFormat>();
+    DcmDataset *dataset = fileformat->getDataset();
+    dataset->putAndInsertString(DCM_SOPClassUID, UID_XRayAngiographicImageStorage);
+    dataset->putAndInsertString(DCM_SOPInstanceUID, dcmGenerateUniqueIdentifier(uid, SITE_INSTANCE_UID_ROOT));
+    dataset->putAndInsertString(DCM_StudyInstanceUID, studyInstanceUID ? studyInstanceUID : dcmGenerateUniqueIdentifier(uid, SITE_STUDY_UID_ROOT));
+    dataset->putAndInsertString(DCM_SeriesInstanceUID, seriesInstanceUID ? seriesInstanceUID : dcmGenerateUniqueIdentifier(uid, SITE_SERIES_UID_ROOT));
+    dataset->putAndInsertString(DCM_Modality, "XA");
+    dataset->putAndInsertString(DCM_PatientName, "XRFBENCH^LOOP");
+    dataset->putAndInsertString(DCM_PatientID, "XRFBENCH");
+    dataset->putAndInsertString(DCM_FrameTime, "66.7");
+    dataset->putAndInsertString(DCM_NumberOfFrames, QByteArray::number(frames).constData());
+    dataset->putAndInsertString(DCM_DistanceSourceToDetector, "1195");
+    dataset->putAndInsertString(DCM_DistanceSourceToPatient, "785");
+    dataset->putAndInsertString(DCM_EstimatedRadiographicMagnificationFactor, "1.522");
+    dataset->putAndInsertString(DCM_PositionerPrimaryAngle, "-29.7");
+    dataset->putAndInsertString(DCM_PositionerSecondaryAngle, "20.1");
+    dataset->putAndInsertString(DCM_ImagerPixelSpacing, "0.154\\0.154");
+    dataset->putAndInsertString(DCM_PhotometricInterpretation, "MONOCHROME2");
+    dataset->putAndInsertUint16(DCM_SamplesPerPixel, 1);
+    dataset->putAndInsertUint16(DCM_Rows, Uint16(rows));
+    dataset->putAndInsertUint16(DCM_Columns, Uint16(columns));
+    dataset->putAndInsertUint16(DCM_BitsAllocated, bits > 8 ? 16 : 8);
+    dataset->putAndInsertUint16(DCM_BitsStored, Uint16(bits));
+    dataset->putAndInsertUint16(DCM_HighBit, Uint16(bits - 1));
+    dataset->putAndInsertUint16(DCM_PixelRepresentation, 0);
+
+    // a gradient which moves from frame to frame plus a little noise, so that the
+    // compressed transfer syntaxes see something closer to an image than to a pattern
+    const size_t count = size_t(frames) * rows * columns;
+    const unsigned mask = (1u << bits) - 1;
+    std::vector<Uint16> values(count);
+    Uint32 noise = 12345;
+    size_t i = 0;
+    for (int f = 0; f < frames; ++f)
+        for (int y = 0; y < rows; ++y)
+            for (int x = 0; x < columns; ++x)
+            {
+                noise = noise * 1103515245u + 12345u;
+                const unsigned level = unsigned(quint64(x + y) * mask / unsigned(rows + columns)) + unsigned(f) * 2;
+                values[i++] = Uint16((level + (noise >> 30)) & mask);
+            }
+
+    if (bits > 8)
+        dataset->putAndInsertUint16Array(DCM_PixelData, values.data(), OFstatic_cast(unsigned long, values.size()));
+    else
+    {
+        std::vector<Uint8> pixels(values.begin(), values.end());
+        dataset->putAndInsertUint8Array(DCM_PixelData, pixels.data(), OFstatic_cast(unsigned long, pixels.size()));
+    }
+    return fileformat;
+}
+
+}
+}
@@ -0,0 +1,395 @@
+#include "bench.h"
+#include "xrfdcmscan.h"
+#include "xrfprojection.h"
+
+#include "dcmtk/dcmdata/dcdeftag.h"
+#include "dcmtk/dcmdata/dcostrmb.h"
+#include "dcmtk/dcmdata/dcuid.h"
+
+#include <QElapsedTimer>
+#include <QJsonArray>
+
+#include <cmath>
+#include <vector>
+
+namespace xrf {
+namespace bench {
+
+static const ProjectionKernel kernels[] = { ProjectionKernel::Scalar, ProjectionKernel::AVX2 };
+static const double degrees = 3.14159265358979323846 / 180.0;
+
+/* pixels a projection may be off by and still count as right */
+static const double tolerance = 1e-6;
+
+static CineLoopInfo makeInfo(int frames, int rows, int cols, double primary, double secondary, double rotation,
+                             double sid, double dsi, double rowSpacing, double columnSpacing)
+{
+    CineLoopInfo info;
+    info.numberOfFrames = frames;
+    info.rows = quint16(rows);
+    info.columns = quint16(cols);
+    CineGeometry& g = info.geometry;
+    g.fields = CineGeometry::HasPositionerPrimaryAngle | CineGeometry::HasPositionerSecondaryAngle | CineGeometry::HasDetectorRotation
+        | CineGeometry::HasDistanceSourceToDetector | CineGeometry::HasSourceToIsocenter | CineGeometry::HasImagerPixelSpacing;
+    g.positionerPrimaryAngle = primary;
+    g.positionerSecondaryAngle = secondary;
+    g.detectorRotation = rotation;
+    g.distanceSourceToDetector = sid;
+    g.sourceToIsocenter = dsi;
+    g.imagerPixelSpacing[0] = rowSpacing;
+    g.imagerPixelSpacing[1] = columnSpacing;
+    return info;
+}
+
+/* v turned about the unit vector axis by angle (rad), Rodrigues' formula */
+static void rotate(double v[3], const double axis[3], double angle)
+{
+    const double c = std::cos(angle), s = std::sin(angle);
+    const double dot = axis[0] * v[0] + axis[1] * v[1] + axis[2] * v[2];
+    const double cross[3] = { axis[1] * v[2] - axis[2] * v[1], axis[2] * v[0] - axis[0] * v[2], axis[0] * v[1] - axis[1] * v[0] };
+    for (int i = 0; i < 3; ++i)
+        v[i] = v[i] * c + cross[i] * s + axis[i] * dot * (1.0 - c);
+}
+
+/*
+ * The projection of point the long way round, independent of ProjectionSet: turn the
+ * AP C-arm into place one rotation at a time, put source and detector on the central
+ * ray and intersect the ray through the point with the detector plane.
+ */
+static bool rayProjection(const CineLoopInfo& info, double primary, double secondary, const double point[3],
+                          double& column, double& row)
+{
+    const CineGeometry& g = info.geometry;
+    double d[3] = { 0.0, -1.0, 0.0 }, u[3] = { 1.0, 0.0, 0.0 }, v[3] = { 0.0, 0.0, -1.0 };
+    const double headFeet[3] = { 0.0, 0.0, 1.0 };
+    rotate(d, headFeet, primary * degrees);
+    rotate(u, headFeet, primary * degrees);
+    rotate(v, headFeet, primary * degrees);
+    // cranial tilts the beam towards the head, about the column direction
+    const double axis[3] = { u[0], u[1], u[2] };
+    rotate(d, axis, -secondary * degrees);
+    rotate(v, axis, -secondary * degrees);
+    const double beam[3] = { d[0], d[1], d[2] };
+    rotate(u, beam, -g.detectorRotation * degrees);
+    rotate(v, beam, -g.detectorRotation * degrees);
+
+    double source[3], center[3], ray[3];
+    for (int i = 0; i < 3; ++i)
+    {
+        source[i] = -g.sourceToIsocenter * d[i];
+        center[i] = source[i] + g.distanceSourceToDetector * d[i];
+        ray[i] = point[i] - source[i];
+    }
+    const double along = ray[0] * d[0] + ray[1] * d[1] + ray[2] * d[2];
+    if (along <= 0.0)
+        return false;
+    double offset[3];
+    for (int i = 0; i < 3; ++i)
+        offset[i] = source[i] + ray[i] * g.distanceSourceToDetector / along - center[i];
+    column = (info.columns - 1) / 2.0 + (offset[0] * u[0] + offset[1] * u[1] + offset[2] * u[2]) / g.imagerPixelSpacing[1];
+    row = (info.rows - 1) / 2.0 + (offset[0] * v[0] + offset[1] * v[1] + offset[2] * v[2]) / g.imagerPixelSpacing[0];
+    return true;
+}
+
+/* a point whose projection is known by construction */
+struct ReferencePoint
+{
+    const char* name;
+    CineLoopInfo info;
+    double point[3];
+    double column;
+    double row;
+};
+
+static QJsonArray referenceCases(int& failed)
+{
+    // SID 938, source to isocenter 750: 0.2 mm pixels see 1 mm at the isocenter as 6.2533 pixels
+    const double m = 938.0 / 750.0 / 0.2;
+    const CineLoopInfo ap = makeInfo(1, 512, 512, 0.0, 0.0, 0.0, 938.0, 750.0, 0.2, 0.2);
+    const CineLoopInfo lao90 = makeInfo(1, 512, 512, 90.0, 0.0, 0.0, 938.0, 750.0, 0.2, 0.2);
+    const CineLoopInfo cra30 = makeInfo(1, 512, 512, 0.0, 30.0, 0.0, 938.0, 750.0, 0.2, 0.2);
+    const CineLoopInfo rot90 = makeInfo(1, 512, 512, 0.0, 0.0, 90.0, 938.0, 750.0, 0.2, 0.2);
+    const CineLoopInfo wide = makeInfo(1, 480, 640, 0.0, 0.0, 0.0, 1200.0, 800.0, 0.3, 0.15);
+    const double s30 = std::sin(30.0 * degrees), c30 = std::cos(30.0 * degrees);
+    const ReferencePoint points[] = {
+        { "ap_isocenter", ap, { 0.0, 0.0, 0.0 }, 255.5, 255.5 },
+        { "ap_left", ap, { 10.0, 0.0, 0.0 }, 255.5 + 10.0 * m, 255.5 },
+        { "ap_head", ap, { 0.0, 0.0, 10.0 }, 255.5, 255.5 - 10.0 * m },
+        { "ap_anterior", ap, { 10.0, -50.0, 0.0 }, 255.5 + 10.0 * 938.0 / 800.0 / 0.2, 255.5 },
+        { "lao90_anterior", lao90, { 0.0, -10.0, 0.0 }, 255.5 - 10.0 * m, 255.5 },
+        { "lao90_left_head", lao90, { 10.0, 0.0, 10.0 }, 255.5, 255.5 - 10.0 * 938.0 / 760.0 / 0.2 },
+        { "cra30_central_ray", cra30, { 0.0, -100.0 * c30, 100.0 * s30 }, 255.5, 255.5 },
+        { "cra30_left", cra30, { 10.0, 0.0, 0.0 }, 255.5 + 10.0 * m, 255.5 },
+        { "rotation90_left", rot90, { 10.0, 0.0, 0.0 }, 255.5, 255.5 - 10.0 * m },
+        { "rotation90_head", rot90, { 0.0, 0.0, 10.0 }, 255.5 - 10.0 * m, 255.5 },
+        { "anisotropic", wide, { 10.0, 0.0, 10.0 }, 319.5 + 10.0 * 1.5 / 0.15, 239.5 - 10.0 * 1.5 / 0.3 },
+    };
+
+    QJsonArray cases;
+    for (const ReferencePoint& p : points)
+    {
+        for (ProjectionKernel kernel : kernels)
+        {
+            if (!isProjectionKernelSupported(kernel))
+                continue;
+            ProjectionSetPtr set = ProjectionSet::compute(p.info, kernel);
+            double column = 0.0, row = 0.0;
+            const bool ok = set && set->project(0, p.point, column, row)
+                && std::fabs(column - p.column) <= tolerance && std::fabs(row - p.row) <= tolerance;
+            if (!ok)
+                ++failed;
+            QJsonObject o;
+            o["case"] = p.name;
+            o["kernel"] = projectionKernelName(kernel);
+            o["column"] = column;
+            o["row"] = row;
+            o["expected_column"] = p.column;
+            o["expected_row"] = p.row;
+            o["ok"] = ok;
+            cases.append(o);
+        }
+    }
+    return cases;
+}
+
+/* random geometries and points against the ray intersection; the largest error in pixels */
+static double randomCases(int count, int& failed)
+{
+    Uint32 state = 2463534242u;
+    auto uniform = [&state](double low, double high) {
+        state ^= state << 13; state ^= state >> 17; state ^= state << 5;
+        return low + (high - low) * (state / 4294967296.0);
+    };
+
+    double worst = 0.0;
+    for (int i = 0; i < count; ++i)
+    {
+        const CineLoopInfo info = makeInfo(1, int(uniform(256, 1025)), int(uniform(256, 1025)), uniform(-120.0, 120.0),
+                                           uniform(-45.0, 45.0), uniform(-180.0, 180.0), uniform(900.0, 1300.0),
+                                           uniform(600.0, 850.0), uniform(0.1, 0.4), uniform(0.1, 0.4));
+        const double point[3] = { uniform(-100.0, 100.0), uniform(-100.0, 100.0), uniform(-100.0, 100.0) };
+        double column, row, refColumn, refRow;
+        ProjectionSetPtr set = ProjectionSet::compute(info);
+        if (!set || !set->project(0, point, column, row)
+            || !rayProjection(info, info.geometry.positionerPrimaryAngle, info.geometry.positionerSecondaryAngle, point, refColumn, refRow))
+        {
+            ++failed;
+            continue;
+        }
+        const double error = qMax(std::fabs(column - refColumn), std::fabs(row - refRow));
+        worst = qMax(worst, error);
+        if (error > tolerance)
+            ++failed;
+    }
+    return worst;
+}
+
+/* every frame of a set against the projection of the frame's own angles */
+static bool framesMatch(const ProjectionSet& set, const CineLoopInfo& info, const std::vector<double>& primary,
+                        const std::vector<double>& secondary)
+{
+    if (set.frameCount() != int(primary.size()))
+        return false;
+    const double point[3] = { 30.0, -20.0, 40.0 };
+    for (int f = 0; f < set.frameCount(); ++f)
+    {
+        double column, row, refColumn, refRow;
+        if (!set.project(f, point, column, row) || !rayProjection(info, primary[f], secondary[f], point, refColumn, refRow)
+            || std::fabs(column - refColumn) > tolerance || std::fabs(row - refRow) > tolerance)
+            return false;
+    }
+    return true;
+}
+
+/* a rotational run with angle increments, and an enhanced object with per-frame functional
+ * groups, read from memory and streamed through the scanner */
+static QJsonObject perFrameCases(int& failed)
+{
+    const int frames = 9;
+    std::vector<double> primary, secondary;
+    QByteArray primaryIncrements, secondaryIncrements;
+    for (int f = 0; f < frames; ++f)
+    {
+        primary.push_back(-40.0 + 10.0 * f);
+        secondary.push_back(5.0 - 2.5 * f);
+        primaryIncrements += (f ? "\\" : "") + QByteArray::number(10.0 * f);
+        secondaryIncrements += (f ? "\\" : "") + QByteArray::number(-2.5 * f);
+    }
+
+    DcmDataset increments;
+    increments.putAndInsertString(DCM_SOPClassUID, UID_XRayAngiographicImageStorage);
+    increments.putAndInsertString(DCM_NumberOfFrames, QByteArray::number(frames).constData());
+    increments.putAndInsertUint16(DCM_Rows, 512);
+    increments.putAndInsertUint16(DCM_Columns, 512);
+    increments.putAndInsertUint16(DCM_BitsAllocated, 16);
+    increments.putAndInsertString(DCM_DistanceSourceToDetector, "1100");
+    increments.putAndInsertString(DCM_DistanceSourceToPatient, "780");
+    increments.putAndInsertString(DCM_ImagerPixelSpacing, "0.3\\0.3");
+    increments.putAndInsertString(DCM_PositionerPrimaryAngle, "-40");
+    increments.putAndInsertString(DCM_PositionerSecondaryAngle, "5");
+    increments.putAndInsertString(DCM_PositionerPrimaryAngleIncrement, primaryIncrements.constData());
+    increments.putAndInsertString(DCM_PositionerSecondaryAngleIncrement, secondaryIncrements.constData());
+
+    // the same run as an enhanced object: distances and spacing shared, angles per frame
+    DcmDataset enhanced;
+    enhanced.putAndInsertString(DCM_SOPClassUID, UID_EnhancedXAImageStorage);
+    enhanced.putAndInsertString(DCM_NumberOfFrames, QByteArray::number(frames).constData());
+    enhanced.putAndInsertUint16(DCM_Rows, 512);
+    enhanced.putAndInsertUint16(DCM_Columns, 512);
+    enhanced.putAndInsertUint16(DCM_BitsAllocated, 16);
+    DcmItem *shared = NULL, *item = NULL;
+    enhanced.findOrCreateSequenceItem(DCM_SharedFunctionalGroupsSequence, shared, 0);
+    shared->findOrCreateSequenceItem(DCM_XRayGeometrySequence, item, 0);
+    item->putAndInsertString(DCM_DistanceSourceToDetector, "1100");
+    item->putAndInsertString(DCM_DistanceSourceToIsocenter, "780");
+    shared->findOrCreateSequenceItem(DCM_FramePixelDataPropertiesSequence, item, 0);
+    item->putAndInsertString(DCM_ImagerPixelSpacing, "0.3\\0.3");
+    for (int f = 0; f < frames; ++f)
+    {
+        DcmItem *group = NULL;
+        enhanced.findOrCreateSequenceItem(DCM_PerFrameFunctionalGroupsSequence, group, -2);
+        group->findOrCreateSequenceItem(DCM_PositionerPositionSequence, item, 0);
+        item->putAndInsertString(DCM_PositionerPrimaryAngle, QByteArray::number(primary[f]).constData());
+        item->putAndInsertString(DCM_PositionerSecondaryAngle, QByteArray::number(secondary[f]).constData());
+    }
+
+    QJsonObject o;
+    DcmDataset *const datasets[] = { &increments, &enhanced };
+    const char *const names[] = { "angle_increments", "functional_groups" };
+    for (int i = 0; i < 2; ++i)
+    {
+        CineLoopInfo info;
+        bool ok = info.read(*datasets[i]).good();
+        // the reference puts the source where the loop does
+        info.geometry.sourceToIsocenter = 780.0;
+        ProjectionSetPtr set = ok ? ProjectionSet::compute(info) : ProjectionSetPtr();
+        ok = set && framesMatch(*set, info, primary, secondary);
+        if (!ok)
+            ++failed;
+        o[names[i]] = ok;
+    }
+
+    // the enhanced object as the receiver sees it on the streaming path: encoded, fed to
+    // the scanner in small chunks, with undefined and with explicit sequence lengths
+    const E_EncodingType encodings[] = { EET_UndefinedLength, EET_ExplicitLength };
+    const char *const streamedNames[] = { "functional_groups_streamed", "functional_groups_streamed_explicit_length" };
+    for (int i = 0; i < 2; ++i)
+    {
+        std::vector<Uint8> buffer(1024 * 1024);
+        DcmOutputBufferStream out(buffer.data(), offile_off_t(buffer.size()));
+        enhanced.transferInit();
+        bool ok = enhanced.write(out, EXS_LittleEndianExplicit, encodings[i], NULL).good();
+        enhanced.transferEnd();
+        void *encoded = NULL;
+        offile_off_t length = 0;
+        out.flushBuffer(encoded, length);
+
+        DatasetScanner scanner(EXS_LittleEndianExplicit);
+        const Uint8 *bytes = OFstatic_cast(const Uint8 *, encoded);
+        for (offile_off_t pos = 0; ok && pos < length; pos += 7)
+            scanner.feed(bytes + pos, size_t(qMin<offile_off_t>(7, length - pos)));
+        scanner.finish();
+
+        CineLoopInfo info;
+        ok = ok && scanner.done() && info.read(scanner).good();
+        info.geometry.sourceToIsocenter = 780.0;
+        ProjectionSetPtr set = ok ? ProjectionSet::compute(info) : ProjectionSetPtr();
+        ok = set && framesMatch(*set, info, primary, secondary);
+        if (!ok)
+            ++failed;
+        o[streamedNames[i]] = ok;
+    }
+
+    // a loop computes its set once and hands out the same one after that
+    CineLoopInfo info;
+    info.read(increments);
+    std::shared_ptr<std::vector<Uint8> > pixels = std::make_shared<std::vector<Uint8> >(info.frameBytes() * frames);
+    const CineLoop loop(info, pixels, pixels->data(), pixels->size());
+    const bool cached = loop.projections() && loop.projections() == loop.projections();
+    if (!cached)
+        ++failed;
+    o["cached_with_loop"] = cached;
+    return o;
+}
+
+/* largest difference of any element from the scalar reference, relative to its size */
+static double kernelDifference(const ProjectionSet& reference, const ProjectionSet& set)
+{
+    double worst = 0.0;
+    for (int r = 0; r < 3; ++r)
+    {
+        for (int c = 0; c < 4; ++c)
+        {
+            const double *a = reference.element(r, c), *b = set.element(r, c);
+            for (int f = 0; f < reference.frameCount(); ++f)
+                worst = qMax(worst, std::fabs(a[f] - b[f]) / qMax(1.0, std::fabs(a[f])));
+        }
+    }
+    return worst;
+}
+
+int projection(const QStringList &args)
+{
+    const int frames = qMax(1, option(args, "--frames", "4096").toInt());
+    const int repeat = qMax(1, option(args, "--repeat", "200").toInt());
+    const int samples = qMax(1, option(args, "--random", "10000").toInt());
+
+    int failed = 0;
+    const QJsonArray references = referenceCases(failed);
+    const double worstRandom = randomCases(samples, failed);
+    const QJsonObject perFrame = perFrameCases(failed);
+
+    // a rotational run: one set of angles per frame
+    CineLoopInfo info = makeInfo(frames, 1024, 1024, 0.0, 0.0, 3.0, 1195.0, 785.0, 0.154, 0.154);
+    for (int f = 0; f < frames; ++f)
+    {
+        info.geometry.framePrimaryAngles.push_back(-100.0 + 200.0 * f / frames);
+        info.geometry.frameSecondaryAngles.push_back(10.0 * std::sin(f * 0.01));
+    }
+    ProjectionSetPtr reference = ProjectionSet::compute(info, ProjectionKernel::Scalar);
+
+    QJsonArray results;
+    QElapsedTimer timer;
+    double scalarNs = 0.0;
+    for (ProjectionKernel kernel : kernels)
+    {
+        if (!isProjectionKernelSupported(kernel))
+            continue;
+        ProjectionSetPtr set = ProjectionSet::compute(info, kernel);
+        timer.start();
+        for (int r = 0; r < repeat; ++r)
+            set = ProjectionSet::compute(info, kernel);
+        const double ns = double(timer.nsecsElapsed()) / repeat;
+        if (kernel == ProjectionKernel::Scalar)
+            scalarNs = ns;
+        const double difference = (set && reference) ? kernelDifference(*reference, *set) : 1.0;
+        if (difference > 1e-12)
+            ++failed;
+
+        QJsonObject o;
+        o["kernel"] = projectionKernelName(kernel);
+        o["us_per_loop"] = ns / 1e3;
+        o["ns_per_frame"] = ns / frames;
+        o["mframes_per_s"] = ns > 0.0 ? frames * 1e3 / ns : 0.0;
+        o["speedup"] = ns > 0.0 ? scalarNs / ns : 0.0;
+        o["max_relative_difference"] = difference;
+        results.append(o);
+    }
+
+    QJsonObject result;
+    result["mode"] = "projection";
+    result["frames"] = frames;
+    result["repeat"] = repeat;
+    result["best_kernel"] = projectionKernelName(ProjectionKernel::Best);
+    result["reference_cases"] = references;
+    result["random_cases"] = samples;
+    result["random_max_error_px"] = worstRandom;
+    result["per_frame"] = perFrame;
+    result["results"] = results;
+    result["failed"] = failed;
+    printJson(result);
+    return failed ? 2 : 0;
+}
+
+}
+}
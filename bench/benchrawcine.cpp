@@ -0,0 +1,196 @@
+#include "bench.h"
+#include "xrfrawcine.h"
+
+#include "dcmtk/dcmdata/dcfilefo.h"
+
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <QVector>
+
+#include <algorithm>
+#include <cstring>
+
+namespace xrf {
+namespace bench {
+
+/* time from a file name to a frame which can be read, per file */
+struct LoadTimes
+{
+    QVector<qint64> ns;
+    int failed = 0;
+
+    QJsonObject json() const
+    {
+        QVector<qint64> sorted = ns;
+        std::sort(sorted.begin(), sorted.end());
+        qint64 total = 0;
+        for (qint64 t : sorted) total += t;
+        QJsonObject o;
+        o["loads"] = sorted.size();
+        o["failed"] = failed;
+        o["mean_us"] = sorted.isEmpty() ? 0.0 : total / 1000.0 / sorted.size();
+        o["p50_us"] = sorted.isEmpty() ? 0.0 : sorted.at(sorted.size() / 2) / 1000.0;
+        o["p99_us"] = sorted.isEmpty() ? 0.0 : sorted.at(qMin(sorted.size() - 1, int(0.99 * sorted.size()))) / 1000.0;
+        return o;
+    }
+};
+
+/* reads one byte of every page of a frame, so that its pages are really there */
+static quint64 touch(const Uint8* frame, size_t bytes)
+{
+    quint64 sum = 0;
+    for (size_t i = 0; i < bytes; i += 4096)
+        sum += frame[i];
+    return sum + (bytes ? frame[bytes - 1] : 0);
+}
+
+int rawcine(const QStringList &args)
+{
+    const int repeat = qMax(1, option(args, "--repeat", "5").toInt());
+    const QString ext = option(args, "--ext", ".dcm");
+    QTemporaryDir work;
+    if (!work.isValid())
+    {
+        QTextStream(stderr) << "rawcine: cannot create a temporary directory\n";
+        return 1;
+    }
+
+    // stored files of a directory, or a synthetic loop
+    QStringList dicomFiles;
+    QString source = "synthetic";
+    if (!args.isEmpty() && !args.first().startsWith("--"))
+    {
+        const QDir dir(args.first());
+        source = dir.absolutePath();
+        for (const QString& name : dir.entryList(QStringList() << QString("*%1").arg(ext), QDir::Files, QDir::Name))
+            dicomFiles << dir.filePath(name);
+    }
+    else
+    {
+        const QString name = QDir(work.path()).filePath("synthetic.dcm");
+        std::shared_ptr<DcmFileFormat> loop = syntheticLoop(qMax(1, option(args, "--frames", "120").toInt()),
+                                                            option(args, "--rows", "1024").toInt(), option(args, "--cols", "1024").toInt(),
+                                                            qBound(8, option(args, "--bits", "12").toInt(), 16));
+        OFCondition cond = loop->saveFile(name.toLocal8Bit().constData(), EXS_LittleEndianExplicit);
+        if (cond.bad())
+        {
+            QTextStream(stderr) << "rawcine: cannot write the synthetic loop: " << cond.text() << "\n";
+            return 1;
+        }
+        dicomFiles << name;
+    }
+    if (dicomFiles.isEmpty())
+    {
+        QTextStream(stderr) << "rawcine: no *" << ext << " files in " << source << "\n";
+        return 1;
+    }
+
+    // the converter, and what it costs per file
+    QStringList rawFiles;
+    LoadTimes convert;
+    QElapsedTimer timer;
+    qint64 dicomBytes = 0, rawBytes = 0;
+    for (const QString& name : dicomFiles)
+    {
+        const QString rawFile = QDir(work.path()).filePath(QFileInfo(rawCineFileName(name)).fileName());
+        timer.start();
+        OFCondition cond = convertToRawCine(name, rawFile);
+        convert.ns.append(timer.nsecsElapsed());
+        if (cond.bad())
+        {
+            QTextStream(stderr) << "rawcine: " << name << ": " << cond.text() << "\n";
+            ++convert.failed;
+            rawFiles << QString();
+            continue;
+        }
+        rawFiles << rawFile;
+        dicomBytes += QFileInfo(name).size();
+        rawBytes += QFileInfo(rawFile).size();
+    }
+
+    // from the name of a file to its middle frame, the way a reconstruction gets at it
+    LoadTimes dcmdata, mappedDicom, raw, rawAllFrames;
+    int mismatched = 0;
+    volatile quint64 sink = 0;
+    for (int r = 0; r < repeat; ++r)
+    {
+        for (int i = 0; i < dicomFiles.size(); ++i)
+        {
+            if (rawFiles.at(i).isEmpty())
+                continue;
+            const QString& name = dicomFiles.at(i);
+            OFCondition cond;
+
+            timer.start();
+            std::shared_ptr<DcmFileFormat> fileformat = std::make_shared<DcmFileFormat>();
+            cond = fileformat->loadFile(name.toLocal8Bit().constData());
+            CineLoopPtr loaded = cond.good() ? CineLoop::fromFileFormat(fileformat, &cond) : CineLoopPtr();
+            if (loaded)
+                sink += touch(loaded->frame(loaded->frameCount() / 2), loaded->frameBytes());
+            dcmdata.ns.append(timer.nsecsElapsed());
+            if (!loaded) ++dcmdata.failed;
+
+            timer.start();
+            CineLoopPtr mapped = CineLoop::fromFile(name, &cond);
+            if (mapped)
+                sink += touch(mapped->frame(mapped->frameCount() / 2), mapped->frameBytes());
+            mappedDicom.ns.append(timer.nsecsElapsed());
+            if (!mapped) ++mappedDicom.failed;
+
+            timer.start();
+            std::shared_ptr<const RawCineFile> file = RawCineFile::open(rawFiles.at(i), &cond);
+            if (file)
+                sink += touch(file->frame(file->frameCount() / 2), file->frameBytes());
+            raw.ns.append(timer.nsecsElapsed());
+            if (!file) ++raw.failed;
+
+            timer.start();
+            file = RawCineFile::open(rawFiles.at(i), &cond);
+            for (int f = 0; file && f < file->frameCount(); ++f)
+                sink += touch(file->frame(f), file->frameBytes());
+            rawAllFrames.ns.append(timer.nsecsElapsed());
+            if (!file) ++rawAllFrames.failed;
+
+            // the raw file must hold the same frames and attributes as the DICOM file
+            if (r == 0 && file && loaded)
+            {
+                bool same = file->frameCount() == loaded->frameCount() && file->frameBytes() == loaded->frameBytes()
+                    && file->header().info().sopInstanceUID == loaded->info().sopInstanceUID
+                    && file->header().geometryFields == loaded->info().geometry.fields;
+                for (int f = 0; same && f < file->frameCount(); ++f)
+                    same = memcmp(file->frame(f), loaded->frame(f), file->frameBytes()) == 0
+                        && quintptr(file->frame(f)) % RawCineHeader::Alignment == 0;
+                if (!same)
+                {
+                    QTextStream(stderr) << "rawcine: " << rawFiles.at(i) << " does not match " << name << "\n";
+                    ++mismatched;
+                }
+            }
+        }
+    }
+
+    QJsonObject result;
+    result["mode"] = "rawcine";
+    result["source"] = source;
+    result["files"] = dicomFiles.size();
+    result["repeat"] = repeat;
+    result["dicom_bytes"] = double(dicomBytes);
+    result["raw_bytes"] = double(rawBytes);
+    result["convert"] = convert.json();
+    result["dcmdata_load"] = dcmdata.json();
+    result["dicom_mapped"] = mappedDicom.json();
+    result["raw_open"] = raw.json();
+    result["raw_all_frames"] = rawAllFrames.json();
+    const double rawMean = raw.json()["mean_us"].toDouble();
+    result["speedup_vs_dcmdata"] = rawMean > 0 ? dcmdata.json()["mean_us"].toDouble() / rawMean : 0.0;
+    result["speedup_vs_mapped"] = rawMean > 0 ? mappedDicom.json()["mean_us"].toDouble() / rawMean : 0.0;
+    result["mismatched"] = mismatched;
+    printJson(result);
+    return (convert.failed || raw.failed || mismatched) ? 2 : 0;
+}
+
+}
+}
@@ -0,0 +1,599 @@
+#include "bench.h"
+#include "xrfcinelooprcv.h"
+
+#include "dcmtk/dcmdata/dcuid.h"
+#include "dcmtk/dcmdata/dcrleerg.h"
+
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QJsonArray>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <QThread>
+#include <QVector>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace xrf {
+namespace bench {
+
+struct LoadConfig
+{
+    int port = 11112;
+    int associations = 4;
+    int objects = 10;               // per association
+    int frames = 30;
+    int rows = 512;
+    int columns = 512;
+    int bits = 8;
+    int workers = 4;                // receiver worker pool
+    int idle = 0;                   // associations which are opened but send nothing
+    bool writeFiles = true;
+    bool bitPreserving = false;
+    bool mappedFiles = false;
+    bool writeBehind = false;
+    bool compress = false;
+    bool loopDelivery = false;
+    bool projections = false;       // projection matrices of every delivered loop
+    int poolMb = 0;                 // PixelBufferPool capacity, 0: no pool
+    bool hugePages = false;
+    int ring = 0;                   // FrameRing capacity, 0: no ring
+    RingPolicy ringPolicy = RingPolicy::DropOldest;
+    int displayFps = 30;            // rate at which the display thread pulls from the ring
+    int resend = 0;                 // times every object is sent again, with the same SOP Instance UID
+    bool instanceIndex = false;
+    bool digests = false;
+    DigestAlgorithm digestAlgorithm = DigestAlgorithm::Best;
+    DuplicatePolicy duplicatePolicy = DuplicatePolicy::Skip;
+    E_TransferSyntax xfer = EXS_LittleEndianExplicit;   // what the senders propose
+
+    size_t pixelBytes() const { return size_t(frames) * rows * columns * (bits > 8 ? 2 : 1); }
+};
+
+/* one SCU association sending cfg.objects loops */
+class Sender : public QThread
+{
+public:
+    Sender(const LoadConfig& cfg, int id, const OFString& studyInstanceUID)
+        : cfg(cfg), id(id), studyInstanceUID(studyInstanceUID) {}
+
+    void run() Q_DECL_OVERRIDE;
+
+    QVector<qint64> setupNs;
+    QVector<qint64> storeNs;
+    int stored = 0;
+    int failed = 0;
+    OFString error;
+
+private:
+    LoadConfig cfg;
+    int id;
+    OFString studyInstanceUID;
+};
+
+void Sender::run()
+{
+    OFString temp_str;
+    char uid[100];
+    // every sender has its own loop, dcmdata is not thread safe
+    std::shared_ptr<DcmFileFormat> loop = syntheticLoop(cfg.frames, cfg.rows, cfg.columns, cfg.bits, studyInstanceUID.c_str(),
+                                                        dcmGenerateUniqueIdentifier(uid, SITE_SERIES_UID_ROOT));
+    DcmDataset *dataset = loop->getDataset();
+    // encapsulated syntaxes are encoded once up front, the benchmark measures the receiver
+    // (deflate is applied by DIMSE while sending)
+    if (DcmXfer(cfg.xfer).isEncapsulated() && dataset->chooseRepresentation(cfg.xfer, NULL).bad())
+    {
+        error = "cannot encode the loop in the requested transfer syntax";
+        failed = cfg.objects;
+        return;
+    }
+
+    T_ASC_Network *net = NULL;
+    T_ASC_Parameters *params = NULL;
+    T_ASC_Association *assoc = NULL;
+    OFCondition cond = ASC_initializeNetwork(NET_REQUESTOR, 0, 30, &net);
+
+    QElapsedTimer timer;
+    timer.start();
+    if (cond.good()) cond = ASC_createAssociationParameters(&params, ASC_DEFAULTMAXPDU);
+    if (cond.good()) cond = ASC_setAPTitles(params, QString("XRFBENCH%1").arg(id).toLatin1().constData(), APPLICATIONTITLE, NULL);
+    if (cond.good()) cond = ASC_setPresentationAddresses(params, "localhost", QString("127.0.0.1:%1").arg(cfg.port).toLatin1().constData());
+    const char *transferSyntaxes[] = { DcmXfer(cfg.xfer).getXferID() };
+    if (cond.good()) cond = ASC_addPresentationContext(params, 1, UID_XRayAngiographicImageStorage, transferSyntaxes, 1);
+    if (cond.good()) cond = ASC_requestAssociation(net, params, &assoc);
+    if (cond.good() && ASC_countAcceptedPresentationContexts(params) == 0)
+        cond = DIMSE_NOVALIDPRESENTATIONCONTEXTID;
+    if (cond.bad())
+    {
+        error = DimseCondition::dump(temp_str, cond);
+        failed = cfg.objects;
+        if (assoc) ASC_destroyAssociation(&assoc);
+        else if (params) ASC_destroyAssociationParameters(&params);
+        ASC_dropNetwork(&net);
+        return;
+    }
+    setupNs.append(timer.nsecsElapsed());
+
+    // resent objects keep their SOP Instance UID
+    std::vector<OFString> instanceUIDs(size_t(cfg.objects));
+    for (OFString& instanceUID : instanceUIDs)
+        instanceUID = dcmGenerateUniqueIdentifier(uid, SITE_INSTANCE_UID_ROOT);
+
+    const T_ASC_PresentationContextID presId = ASC_findAcceptedPresentationContextID(assoc, UID_XRayAngiographicImageStorage);
+    for (int i = 0; i < cfg.objects * (cfg.resend + 1) && cond.good(); ++i)
+    {
+        T_DIMSE_C_StoreRQ req;
+        T_DIMSE_C_StoreRSP rsp;
+        DcmDataset *statusDetail = NULL;
+        memset(&req, 0, sizeof(req));
+        req.MessageID = assoc->nextMsgID++;
+        req.DataSetType = DIMSE_DATASET_PRESENT;
+        req.Priority = DIMSE_PRIORITY_MEDIUM;
+        OFStandard::strlcpy(req.AffectedSOPClassUID, UID_XRayAngiographicImageStorage, sizeof(req.AffectedSOPClassUID));
+        OFStandard::strlcpy(req.AffectedSOPInstanceUID, instanceUIDs[size_t(i % cfg.objects)].c_str(), sizeof(req.AffectedSOPInstanceUID));
+        dataset->putAndInsertString(DCM_SOPInstanceUID, req.AffectedSOPInstanceUID);
+
+        timer.start();
+        cond = DIMSE_storeUser(assoc, presId, &req, NULL, dataset, NULL, NULL, DIMSE_BLOCKING, 0, &rsp, &statusDetail);
+        const qint64 ns = timer.nsecsElapsed();
+        delete statusDetail;
+
+        if (cond.good() && rsp.DimseStatus == STATUS_Success)
+        {
+            storeNs.append(ns);
+            ++stored;
+        }
+        else
+        {
+            ++failed;
+            if (cond.bad()) error = DimseCondition::dump(temp_str, cond);
+        }
+    }
+
+    if (cond.good())
+        ASC_releaseAssociation(assoc);
+    else
+        ASC_abortAssociation(assoc);
+    ASC_destroyAssociation(&assoc);
+    ASC_dropNetwork(&net);
+}
+
+/* user and system time of the whole process */
+static qint64 processCpuNs()
+{
+#ifdef _WIN32
+    FILETIME creation, exit, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user))
+        return 0;
+    const quint64 k = (quint64(kernel.dwHighDateTime) << 32) | kernel.dwLowDateTime;
+    const quint64 u = (quint64(user.dwHighDateTime) << 32) | user.dwLowDateTime;
+    return qint64(k + u) * 100;
+#else
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+    return (qint64(usage.ru_utime.tv_sec) + usage.ru_stime.tv_sec) * 1000000000
+         + (qint64(usage.ru_utime.tv_usec) + usage.ru_stime.tv_usec) * 1000;
+#endif
+}
+
+/* page faults of the process so far, minor and major */
+static qint64 processPageFaults()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return 0;
+    return counters.PageFaultCount;
+#else
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+    return qint64(usage.ru_minflt) + usage.ru_majflt;
+#endif
+}
+
+/* associations which are negotiated and then left alone until close() */
+class IdleAssociations
+{
+public:
+    ~IdleAssociations() { close(); }
+
+    int open(const LoadConfig& cfg)
+    {
+        if (ASC_initializeNetwork(NET_REQUESTOR, 0, 30, &net).bad())
+            return 0;
+        const char *transferSyntaxes[] = { UID_LittleEndianExplicitTransferSyntax };
+        for (int i = 0; i < cfg.idle; ++i)
+        {
+            T_ASC_Parameters *params = NULL;
+            T_ASC_Association *assoc = NULL;
+            OFCondition cond = ASC_createAssociationParameters(&params, ASC_DEFAULTMAXPDU);
+            if (cond.good()) cond = ASC_setAPTitles(params, "XRFBENCHIDLE", APPLICATIONTITLE, NULL);
+            if (cond.good()) cond = ASC_setPresentationAddresses(params, "localhost", QString("127.0.0.1:%1").arg(cfg.port).toLatin1().constData());
+            if (cond.good()) cond = ASC_addPresentationContext(params, 1, UID_VerificationSOPClass, transferSyntaxes, 1);
+            if (cond.good()) cond = ASC_requestAssociation(net, params, &assoc);
+            if (cond.good())
+                associations.push_back(assoc);
+            else if (assoc)
+                ASC_destroyAssociation(&assoc);
+            else if (params)
+                ASC_destroyAssociationParameters(&params);
+        }
+        return int(associations.size());
+    }
+
+    void close()
+    {
+        for (T_ASC_Association *assoc : associations)
+        {
+            ASC_releaseAssociation(assoc);
+            ASC_destroyAssociation(&assoc);
+        }
+        associations.clear();
+        if (net)
+            ASC_dropNetwork(&net);
+    }
+
+private:
+    T_ASC_Network *net = NULL;
+    std::vector<T_ASC_Association*> associations;
+};
+
+static QJsonObject latency(QVector<qint64> ns)
+{
+    std::sort(ns.begin(), ns.end());
+    const auto percentile = [&ns](double p) {
+        return ns.isEmpty() ? 0.0 : ns.at(qMin(ns.size() - 1, int(p * ns.size()))) / 1e6;
+    };
+    QJsonObject o;
+    o["count"] = ns.size();
+    o["p50_ms"] = percentile(0.50);
+    o["p90_ms"] = percentile(0.90);
+    o["p99_ms"] = percentile(0.99);
+    o["max_ms"] = ns.isEmpty() ? 0.0 : ns.last() / 1e6;
+    return o;
+}
+
+int receive(const QStringList &args)
+{
+    LoadConfig cfg;
+    cfg.port = option(args, "--port", QString::number(cfg.port)).toInt();
+    cfg.associations = qMax(1, option(args, "--associations", QString::number(cfg.associations)).toInt());
+    cfg.objects = qMax(1, option(args, "--objects", QString::number(cfg.objects)).toInt());
+    cfg.frames = qMax(1, option(args, "--frames", QString::number(cfg.frames)).toInt());
+    cfg.rows = qBound(1, option(args, "--rows", QString::number(cfg.rows)).toInt(), 65535);
+    cfg.columns = qBound(1, option(args, "--cols", QString::number(cfg.columns)).toInt(), 65535);
+    cfg.bits = qBound(1, option(args, "--bits", QString::number(cfg.bits)).toInt(), 16);
+    cfg.workers = qMax(1, option(args, "--workers", QString::number(cfg.workers)).toInt());
+    cfg.idle = qMax(0, option(args, "--idle", QString::number(cfg.idle)).toInt());
+    cfg.writeFiles = option(args, "--write-files", "1") != "0";
+    cfg.bitPreserving = args.contains("--bit-preserving");
+    cfg.mappedFiles = args.contains("--mapped");
+    cfg.writeBehind = args.contains("--write-behind");
+    cfg.compress = args.contains("--compress");
+    cfg.poolMb = qMax(0, option(args, "--pool", "0").toInt());
+    cfg.hugePages = args.contains("--hugepages");
+    cfg.projections = args.contains("--projections");
+    cfg.loopDelivery = args.contains("--loop-delivery") || cfg.poolMb > 0 || cfg.projections;
+    cfg.ring = qMax(0, option(args, "--ring", "0").toInt());
+    cfg.displayFps = qMax(1, option(args, "--display-fps", QString::number(cfg.displayFps)).toInt());
+    const QString ringPolicy = option(args, "--ring-policy", "oldest");
+    if (ringPolicy == "newest")
+        cfg.ringPolicy = RingPolicy::DropNewest;
+    else if (ringPolicy == "block")
+        cfg.ringPolicy = RingPolicy::Block;
+    else if (ringPolicy != "oldest")
+    {
+        QTextStream(stderr) << "receive: unknown ring policy " << ringPolicy << " (oldest, newest or block)\n";
+        return 1;
+    }
+    cfg.resend = qMax(0, option(args, "--resend", "0").toInt());
+    const QString duplicates = option(args, "--duplicates", QString());
+    cfg.instanceIndex = !duplicates.isEmpty();
+    if (duplicates == "overwrite")
+        cfg.duplicatePolicy = DuplicatePolicy::Overwrite;
+    else if (duplicates == "version")
+        cfg.duplicatePolicy = DuplicatePolicy::Version;
+    else if (cfg.instanceIndex && duplicates != "skip")
+    {
+        QTextStream(stderr) << "receive: unknown duplicate policy " << duplicates << " (skip, overwrite or version)\n";
+        return 1;
+    }
+    const QString digests = option(args, "--digests", QString());
+    cfg.digests = !digests.isEmpty();
+    if (cfg.digests && !digestAlgorithmFromName(digests.toLatin1(), cfg.digestAlgorithm))
+    {
+        QTextStream(stderr) << "receive: unknown digest algorithm " << digests << " (crc32c, xxh64 or best)\n";
+        return 1;
+    }
+    const QString xfer = option(args, "--xfer", "explicit");
+    if (xfer == "deflate")
+        cfg.xfer = EXS_DeflatedLittleEndianExplicit;
+    else if (xfer == "rle")
+        cfg.xfer = EXS_RLELossless;
+    else if (xfer != "explicit")
+    {
+        QTextStream(stderr) << "receive: unknown transfer syntax " << xfer << " (explicit, deflate or rle)\n";
+        return 1;
+    }
+    DcmRLEEncoderRegistration::registerCodecs();
+
+    QTemporaryDir outdir;
+    const QString directory = option(args, "--outdir", outdir.path());
+
+    // eostudy timeout of 1s, so that the study is reported while we measure the idle receiver
+    CineLoopRcv rcv(directory, ".dcm", unsigned(cfg.port), 1);
+    rcv.setMaxConcurrentAssociations(cfg.workers);
+    rcv.setWriteFiles(cfg.writeFiles);
+    rcv.setBitPreserving(cfg.bitPreserving);
+    rcv.setMappedFiles(cfg.mappedFiles);
+    if (cfg.writeBehind)
+        rcv.enableWriteBehind();
+    if (cfg.compress)
+        rcv.enableBackgroundCompression();
+    // nobody is connected to cineLoopAvailable(), every loop is released right after delivery
+    rcv.setLoopDelivery(cfg.loopDelivery);
+    rcv.setProjectionGeometry(cfg.projections);
+    if (cfg.poolMb > 0)
+        rcv.enablePixelBufferPool(qint64(cfg.poolMb) * 1024 * 1024, cfg.hugePages);
+    if (cfg.ring > 0)
+        rcv.enableFrameRing(cfg.ring, cfg.ringPolicy);
+    rcv.setFileDigests(cfg.digests, cfg.digestAlgorithm);
+    if (cfg.instanceIndex)
+        rcv.enableInstanceIndex(cfg.duplicatePolicy);
+    if (cfg.xfer != EXS_LittleEndianExplicit)
+        rcv.setTransferSyntaxes(std::vector<E_TransferSyntax>(1, cfg.xfer));
+    if (!rcv.init())
+    {
+        QTextStream(stderr) << "receive: cannot initialize the receiver on port " << cfg.port << "\n";
+        return 1;
+    }
+    rcv.start();
+
+    // a display thread pulling one frame per refresh
+    std::atomic<bool> displayDone(false);
+    std::thread display;
+    if (rcv.framering())
+    {
+        display = std::thread([&rcv, &displayDone, &cfg]() {
+            CineFrame frame;
+            while (!displayDone.load())
+            {
+                rcv.framering()->pop(frame);
+                frame = CineFrame();
+                QThread::usleep(1000000 / cfg.displayFps);
+            }
+        });
+    }
+
+    // idle associations sit in the receiver's reactor for the whole run
+    IdleAssociations idle;
+    const int idleOpened = idle.open(cfg);
+
+    char studyInstanceUID[100];
+    dcmGenerateUniqueIdentifier(studyInstanceUID, SITE_STUDY_UID_ROOT);
+    std::vector<std::unique_ptr<Sender>> senders;
+    for (int i = 0; i < cfg.associations; ++i)
+        senders.emplace_back(new Sender(cfg, i, studyInstanceUID));
+
+    const qint64 faults = processPageFaults();
+    QElapsedTimer wall;
+    wall.start();
+    for (auto& sender : senders)
+        sender->start();
+    for (auto& sender : senders)
+        sender->wait();
+    const qint64 wallNs = wall.nsecsElapsed();
+    const qint64 pageFaults = processPageFaults() - faults;
+    displayDone.store(true);
+    if (display.joinable())
+        display.join();
+
+    // the compression stage only starts once the last association is gone
+    qint64 compressNs = 0;
+    if (rcv.compressor())
+    {
+        QElapsedTimer drain;
+        drain.start();
+        rcv.compressor()->waitForIdle();
+        compressNs = drain.nsecsElapsed();
+    }
+
+    // what the receiver costs while nothing is sent: the idle associations are still open,
+    // the only expected wakeup is the end-of-study timer
+    QJsonObject idleResult;
+    if (cfg.idle > 0)
+    {
+        const quint64 wakeups = rcv.metricsSnapshot().counters[Metrics::LoopWakeups];
+        const qint64 cpu = processCpuNs();
+        QThread::msleep(2000);
+        idleResult["associations"] = idleOpened;
+        idleResult["open_associations"] = rcv.activeAssociations();
+        idleResult["cpu_ms_per_s"] = (processCpuNs() - cpu) / 1e6 / 2.0;
+        idleResult["loop_wakeups_per_s"] = double(rcv.metricsSnapshot().counters[Metrics::LoopWakeups] - wakeups) / 2.0;
+        idle.close();
+    }
+
+    QElapsedTimer stopping;
+    stopping.start();
+    rcv.stop();
+    rcv.wait();
+    const qint64 stopNs = stopping.nsecsElapsed();
+
+    QVector<qint64> setupNs, storeNs;
+    int stored = 0, failed = 0;
+    QJsonArray errors;
+    for (auto& sender : senders)
+    {
+        setupNs += sender->setupNs;
+        storeNs += sender->storeNs;
+        stored += sender->stored;
+        failed += sender->failed;
+        if (!sender->error.empty())
+            errors.append(QString(sender->error.c_str()));
+    }
+
+    QJsonObject config;
+    config["associations"] = cfg.associations;
+    config["objects_per_association"] = cfg.objects;
+    config["frames"] = cfg.frames;
+    config["rows"] = cfg.rows;
+    config["columns"] = cfg.columns;
+    config["bits"] = cfg.bits;
+    config["workers"] = cfg.workers;
+    config["idle_associations"] = cfg.idle;
+    config["write_files"] = cfg.writeFiles;
+    config["bit_preserving"] = cfg.bitPreserving;
+    config["mapped_files"] = cfg.mappedFiles;
+    config["write_behind"] = cfg.writeBehind;
+    config["xfer"] = xfer;
+    config["compress"] = cfg.compress;
+    config["loop_delivery"] = cfg.loopDelivery;
+    config["projections"] = cfg.projections;
+    config["pool_mb"] = cfg.poolMb;
+    config["huge_pages"] = cfg.hugePages;
+    config["resend"] = cfg.resend;
+    config["digests"] = cfg.digests ? QString(digestAlgorithmName(cfg.digestAlgorithm)) : QString("none");
+    config["duplicates"] = cfg.instanceIndex ? duplicates : QString("none");
+
+    const double seconds = wallNs / 1e9;
+    QJsonObject result;
+    result["mode"] = "receive";
+    result["config"] = config;
+    result["stored"] = stored;
+    result["failed"] = failed;
+    result["wall_s"] = seconds;
+    result["objects_per_s"] = seconds > 0 ? stored / seconds : 0.0;
+    result["mb_per_s"] = seconds > 0 ? (double(stored) * cfg.pixelBytes() / 1048576.0) / seconds : 0.0;
+    result["association_setup"] = latency(setupNs);
+    result["store_latency"] = latency(storeNs);
+    result["stop_ms"] = stopNs / 1e6;
+    result["page_faults_per_object"] = stored ? double(pageFaults) / stored : 0.0;
+    if (cfg.idle > 0)
+        result["idle"] = idleResult;
+    if (cfg.writeBehind)
+    {
+        const WriteBehindStats stats = rcv.writeBehindStats();
+        QJsonObject wb;
+        wb["written"] = double(stats.written);
+        wb["failed"] = double(stats.failed);
+        wb["batches"] = double(stats.batches);
+        wb["max_queue_depth"] = stats.maxQueueDepth;
+        wb["max_queued_mb"] = stats.maxQueuedBytes / 1048576.0;
+        wb["max_latency_ms"] = stats.maxLatencyNs / 1e6;
+        result["write_behind"] = wb;
+    }
+    if (rcv.pixelbufferpool())
+    {
+        const PixelBufferPoolStats stats = rcv.pixelbufferpool()->stats();
+        QJsonObject p;
+        p["hits"] = double(stats.hits);
+        p["misses"] = double(stats.misses);
+        p["evicted"] = double(stats.evicted);
+        p["pooled_mb"] = stats.pooledBytes / 1048576.0;
+        p["huge_page_buffers"] = stats.hugePageBuffers;
+        result["pixel_buffer_pool"] = p;
+    }
+    if (rcv.framering())
+    {
+        const FrameRingStats stats = rcv.framering()->stats();
+        QJsonObject r;
+        r["capacity"] = rcv.framering()->capacity();
+        r["policy"] = ringPolicy;
+        r["display_fps"] = cfg.displayFps;
+        r["pushed"] = double(stats.pushed);
+        r["popped"] = double(stats.popped);
+        r["dropped_oldest"] = double(stats.droppedOldest);
+        r["dropped_newest"] = double(stats.droppedNewest);
+        r["blocked_ms"] = stats.blockedNs / 1e6;
+        r["mean_latency_ms"] = stats.popped ? stats.latencyTotalNs / 1e6 / stats.popped : 0.0;
+        r["max_latency_ms"] = stats.latencyMaxNs / 1e6;
+        result["frame_ring"] = r;
+    }
+    if (rcv.compressor())
+    {
+        const CompressionStats stats = rcv.compressor()->stats();
+        QJsonObject c;
+        c["compressed"] = double(stats.compressed);
+        c["skipped"] = double(stats.skipped);
+        c["failed"] = double(stats.failed);
+        c["file_ratio"] = stats.bytesAfter > 0 ? double(stats.bytesBefore) / stats.bytesAfter : 0.0;
+        c["cpu_ms_per_loop"] = stats.compressed ? stats.cpuNs / 1e6 / stats.compressed : 0.0;
+        c["drain_s"] = compressNs / 1e9;
+        result["compression"] = c;
+    }
+
+    // where the receiver spent its time, as seen from the inside
+    const MetricsSnapshot metrics = rcv.metricsSnapshot();
+    static const char* stageNames[Metrics::StageCount] = { "network_receive", "dataset_build", "disk_write", "signal_dispatch", "projection_geometry" };
+    QJsonObject stages;
+    for (int i = 0; i < Metrics::StageCount; ++i)
+    {
+        const MetricsSnapshot::StageStats& stage = metrics.stages[i];
+        QJsonObject o;
+        o["mean_ms"] = stage.count ? double(stage.totalNs) / stage.count / 1e6 : 0.0;
+        o["max_ms"] = stage.maxNs / 1e6;
+        stages[stageNames[i]] = o;
+    }
+    result["receiver_stages"] = stages;
+    result["received_mb"] = metrics.counters[Metrics::BytesReceived] / 1048576.0;
+    if (cfg.instanceIndex)
+    {
+        QJsonObject d;
+        d["identical"] = double(metrics.counters[Metrics::DuplicatesIdentical]);
+        d["differing"] = double(metrics.counters[Metrics::DuplicatesDiffering]);
+        d["saved_mb"] = metrics.counters[Metrics::DuplicateBytesSaved] / 1048576.0;
+        result["duplicates"] = d;
+    }
+    if (cfg.digests)
+    {
+        // hashing time against the time the C-STOREs took, as the senders saw it
+        qint64 storeTotalNs = 0;
+        for (qint64 ns : storeNs)
+            storeTotalNs += ns;
+        const quint64 digestNs = metrics.counters[Metrics::DigestNanoseconds];
+        QJsonObject d;
+        d["ms_per_object"] = stored ? digestNs / 1e6 / stored : 0.0;
+        d["share_of_receive_pct"] = storeTotalNs > 0 ? 100.0 * digestNs / storeTotalNs : 0.0;
+        if (cfg.writeFiles)
+        {
+            const VerifyReport report = verifyDirectory(directory);
+            d["verified"] = report.verified;
+            d["not_verified"] = report.files - report.verified;
+            d["verify_gb_per_s"] = report.wallNs > 0 ? report.bytes / double(report.wallNs) : 0.0;
+        }
+        result["digests"] = d;
+    }
+    result["wire_ratio"] = stored ? double(metrics.counters[Metrics::BytesReceived]) / (double(stored) * cfg.pixelBytes()) : 0.0;
+    if (cfg.writeFiles)
+    {
+        // what the stored objects occupy on disk, they are written as received
+        qint64 diskBytes = 0;
+        QDirIterator it(directory, QStringList() << "*.dcm", QDir::Files, QDirIterator::Subdirectories);
+        while (it.hasNext())
+        {
+            it.next();
+            diskBytes += it.fileInfo().size();
+        }
+        result["disk_mb"] = diskBytes / 1048576.0;
+    }
+
+    if (!errors.isEmpty())
+        result["errors"] = errors;
+    printJson(result);
+    return failed ? 2 : 0;
+}
+
+}
+}
@@ -0,0 +1,110 @@
+#include "bench.h"
+#include "xrfwindowlevel.h"
+
+#include <QElapsedTimer>
+#include <QJsonArray>
+
+#include <string.h>
+#include <vector>
+
+namespace xrf {
+namespace bench {
+
+static const WindowKernel kernels[] = { WindowKernel::Scalar, WindowKernel::SSE2, WindowKernel::AVX2 };
+
+/* every raw bit pattern, so the self-check also sees the bits above the high bit set */
+static bool bitExact(const WindowLevel &window, WindowKernel kernel)
+{
+    const size_t count = (size_t(1) << window.bitsAllocated) + 15;
+    std::vector<Uint16> words(count);
+    std::vector<Uint8> bytes(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        words[i] = Uint16(i);
+        bytes[i] = Uint8(i);
+    }
+    const void *src = window.bitsAllocated > 8 ? OFstatic_cast(const void *, words.data()) : bytes.data();
+    std::vector<Uint8> reference(count), out(count);
+    applyWindow(window, src, reference.data(), count, WindowKernel::Scalar);
+    applyWindow(window, src, out.data(), count, kernel);
+    return memcmp(reference.data(), out.data(), count) == 0;
+}
+
+int window(const QStringList &args)
+{
+    const int rows = qMax(1, option(args, "--rows", "1024").toInt());
+    const int cols = qMax(1, option(args, "--cols", "1024").toInt());
+    const int frames = qMax(1, option(args, "--frames", "8").toInt());
+    const int repeat = qMax(1, option(args, "--repeat", "10").toInt());
+    const size_t pixels = size_t(rows) * cols * frames;
+
+    // the same noise for every depth, only the low bits of it for 8 bit data
+    std::vector<Uint16> words(pixels);
+    std::vector<Uint8> bytes(pixels);
+    Uint32 state = 2463534242u;
+    for (size_t i = 0; i < pixels; ++i)
+    {
+        state ^= state << 13; state ^= state >> 17; state ^= state << 5;
+        words[i] = Uint16(state);
+        bytes[i] = Uint8(state);
+    }
+    std::vector<Uint8> out(pixels);
+
+    QJsonArray results;
+    bool allExact = true;
+    QElapsedTimer timer;
+    for (int bits : { 8, 12, 16 })
+    {
+        for (int pixelRepresentation : { 0, 1 })
+        {
+            CineLoopInfo info;
+            info.photometricInterpretation = "MONOCHROME2";
+            info.bitsAllocated = quint16(bits > 8 ? 16 : 8);
+            info.bitsStored = quint16(bits);
+            info.highBit = quint16(bits - 1);
+            info.pixelRepresentation = quint16(pixelRepresentation);
+            // half the range, so values fall below, inside and above the window
+            const double width = double(1 << bits) / 2.0;
+            const WindowLevel window = WindowLevel::make(info, pixelRepresentation ? 0.0 : width, width);
+            const void *src = bits > 8 ? OFstatic_cast(const void *, words.data()) : bytes.data();
+
+            double scalarNs = 0.0;
+            for (WindowKernel kernel : kernels)
+            {
+                if (!isWindowKernelSupported(kernel))
+                    continue;
+                applyWindow(window, src, out.data(), pixels, kernel);
+                timer.start();
+                for (int r = 0; r < repeat; ++r)
+                    applyWindow(window, src, out.data(), pixels, kernel);
+                const double ns = double(timer.nsecsElapsed()) / repeat;
+                if (kernel == WindowKernel::Scalar)
+                    scalarNs = ns;
+                const bool exact = bitExact(window, kernel);
+                allExact = allExact && exact;
+
+                QJsonObject o;
+                o["bits_stored"] = bits;
+                o["signed"] = pixelRepresentation == 1;
+                o["kernel"] = windowKernelName(kernel);
+                o["ms_per_pass"] = ns / 1e6;
+                o["gpix_per_s"] = ns > 0.0 ? pixels / ns : 0.0;
+                o["speedup"] = ns > 0.0 ? scalarNs / ns : 0.0;
+                o["bit_exact"] = exact;
+                results.append(o);
+            }
+        }
+    }
+
+    QJsonObject result;
+    result["pixels"] = double(pixels);
+    result["repeat"] = repeat;
+    result["best_kernel"] = windowKernelName(WindowKernel::Best);
+    result["bit_exact"] = allExact;
+    result["results"] = results;
+    printJson(result);
+    return allExact ? 0 : 1;
+}
+
+}
+}
@@ -0,0 +1,88 @@
+#include "bench.h"
+
+#include <QCoreApplication>
+#include <QJsonDocument>
+#include <QTextStream>
+
+namespace xrf {
+namespace bench {
+
+QString option(const QStringList &args, const QString &name, const QString &fallback)
+{
+    const int i = args.indexOf(name);
+    return (i >= 0 && i + 1 < args.size()) ? args.at(i + 1) : fallback;
+}
+
+void printJson(const QJsonObject &result)
+{
+    QTextStream(stdout) << QJsonDocument(result).toJson(QJsonDocument::Indented);
+}
+
+}
+}
+
+static int usage()
+{
+    QTextStream(stderr)
+        << "usage: xrfbench <mode> [options]\n"
+        << "  header <directory> [--ext .dcm] [--tags important|default] [--repeat n]\n"
+        << "      metadata-only HeaderReader vs. DcmFileFormat::loadFile over the files of a directory\n"
+        << "  receive [--associations n] [--objects n] [--frames n] [--rows n] [--cols n] [--bits n]\n"
+        << "          [--workers n] [--port n] [--outdir dir] [--write-files 0|1] [--bit-preserving] [--mapped] [--write-behind]\n"
+        << "          [--xfer explicit|deflate|rle] [--compress] [--idle n] [--loop-delivery] [--pool mb] [--hugepages]\n"
+        << "          [--ring n] [--ring-policy oldest|newest|block] [--display-fps n] [--duplicates skip|overwrite|version] [--resend n]\n"
+        << "          [--digests crc32c|xxh64|best] [--projections]\n"
+        << "      in-process receiver driven over loopback by n concurrent SCU associations;\n"
+        << "      --idle keeps n more associations open without sending and measures the idle receiver,\n"
+        << "      --pool receives delivered loops into a pixel buffer pool of mb megabytes,\n"
+        << "      --ring feeds a frame ring of n frames which a display thread drains at --display-fps,\n"
+        << "      --resend sends every object n more times, --duplicates decides what the receiver does with them,\n"
+        << "      --digests keeps file digests and reports their share of the receive time,\n"
+        << "      --projections computes the projection matrices of every delivered loop (projection_geometry stage)\n"
+        << "  cine [file] [--frames n] [--rows n] [--cols n] [--bits n] [--fps n] [--seconds n] [--cache n] [--threads n]\n"
+        << "      plays a stored loop (or a synthetic one) through the cine player and measures the frame time jitter\n"
+        << "  window [--rows n] [--cols n] [--frames n] [--repeat n]\n"
+        << "      window/level kernels against the scalar reference, 8/12/16 bit signed and unsigned;\n"
+        << "      fails unless every kernel is bit exact over all stored values\n"
+        << "  associate [--associations n] [--requestors n] [--contexts n] [--promiscuous] [--legacy] [--port n]\n"
+        << "      association setup rate on loopback, every association proposing --contexts contexts;\n"
+        << "      --legacy negotiates with DCMTK's helpers instead of the compiled acceptance policy\n"
+        << "  verify [directory] [--threads n] [--mb n] [--repeat n]\n"
+        << "      CRC-32C and xxHash64 throughput over an mb megabyte buffer; with a directory, the files\n"
+        << "      below it against the digests the receiver kept (receive --digests); fails on a mismatch\n"
+        << "  rawcine [directory] [--ext .dcm] [--repeat n] [--frames n] [--rows n] [--cols n] [--bits n]\n"
+        << "      converts the loops of a directory (or a synthetic one) to raw cine files and measures the time\n"
+        << "      from a file name to a readable frame: dcmdata, mapped DICOM and mapped raw cine;\n"
+        << "      fails unless the raw files hold the same frames\n"
+        << "  projection [--frames n] [--repeat n] [--random n]\n"
+        << "      projection matrices of a rotational run of n frames per kernel; fails unless reference geometries,\n"
+        << "      n random ones checked by ray intersection, per-frame angles and the kernels all agree\n";
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QStringList args = app.arguments().mid(1);
+    if (args.isEmpty())
+        return usage();
+
+    const QString mode = args.takeFirst();
+    if (mode == "header")
+        return xrf::bench::header(args);
+    if (mode == "receive")
+        return xrf::bench::receive(args);
+    if (mode == "cine")
+        return xrf::bench::cine(args);
+    if (mode == "window")
+        return xrf::bench::window(args);
+    if (mode == "associate")
+        return xrf::bench::associate(args);
+    if (mode == "verify")
+        return xrf::bench::verify(args);
+    if (mode == "rawcine")
+        return xrf::bench::rawcine(args);
+    if (mode == "projection")
+        return xrf::bench::projection(args);
+    return usage();
+}
@@ -0,0 +1,97 @@
+#-------------------------------------------------
+#
+# Benchmarks of the receiver, see main.cpp for the modes
+#
+#-------------------------------------------------
+
+QT       += core
+QT       -= gui
+
+TARGET = xrfbench
+TEMPLATE = app
+CONFIG   += console
+CONFIG   -= app_bundle
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+INCLUDEPATH += ..
+
+win32 {
+INCLUDEPATH += \
+                C:/dev/dcmtk/install/include \
+                C:/dev/dcmtk/ext/libzlib/include \
+
+LIBS += -lwsock32 -ladvapi32 -lnetapi32 -lpsapi \
+        -LC:/dev/dcmtk/ext/support/zlib/lib -lzlib_d \
+        -LC:/dev/dcmtk/install/lib -lofstd -loflog -ldcmdata -ldcmimgle -ldcmnet \
+}
+
+unix {
+LIBS += -ldcmnet -ldcmimgle -ldcmdata -loflog -lofstd -lz -lpthread
+}
+
+SOURCES +=  main.cpp \
+            benchloop.cpp \
+            benchheader.cpp \
+            benchreceive.cpp \
+            benchcine.cpp \
+            benchwindow.cpp \
+            benchassociate.cpp \
+            benchverify.cpp \
+            benchrawcine.cpp \
+            benchprojection.cpp \
+            ../xrfcinelooprcv.cpp \
+            ../xrfassociation.cpp \
+            ../xrflazydataset.cpp \
+            ../xrfwritebehind.cpp \
+            ../xrfcineloop.cpp \
+            ../xrfdcmscan.cpp \
+            ../xrfstreamstore.cpp \
+            ../xrfframetap.cpp \
+            ../xrfloopindex.cpp \
+            ../xrfheaderreader.cpp \
+            ../xrfstudytracker.cpp \
+            ../xrfmetrics.cpp \
+            ../xrfcompressor.cpp \
+            ../xrfreactor.cpp \
+            ../xrfbufferpool.cpp \
+            ../xrfmappedfile.cpp \
+            ../xrfframering.cpp \
+            ../xrfcineplayer.cpp \
+            ../xrfwindowlevel.cpp \
+            ../xrfacceptance.cpp \
+            ../xrfhash.cpp \
+            ../xrfinstanceindex.cpp \
+            ../xrfrecordfile.cpp \
+            ../xrfdigest.cpp \
+            ../xrfrawcine.cpp \
+            ../xrfprojection.cpp
+
+HEADERS  += bench.h \
+            ../xrfcinelooprcv.h \
+            ../xrfassociation.h \
+            ../xrflazydataset.h \
+            ../xrfwritebehind.h \
+            ../xrferror.h \
+            ../xrfcineloop.h \
+            ../xrfdcmscan.h \
+            ../xrfstreamstore.h \
+            ../xrfframetap.h \
+            ../xrfloopindex.h \
+            ../xrfheaderreader.h \
+            ../xrfstudytracker.h \
+            ../xrfmetrics.h \
+            ../xrfcompressor.h \
+            ../xrfreactor.h \
+            ../xrfbufferpool.h \
+            ../xrfmappedfile.h \
+            ../xrfframering.h \
+            ../xrfcineplayer.h \
+            ../xrfwindowlevel.h \
+            ../xrfacceptance.h \
+            ../xrfhash.h \
+            ../xrfinstanceindex.h \
+            ../xrfrecordfile.h \
+            ../xrfdigest.h \
+            ../xrfrawcine.h \
+            ../xrfprojection.h
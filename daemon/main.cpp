@@ -0,0 +1,340 @@
+#include "signalwatcher.h"
+#include "xrfcinelooprcv.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSettings>
+#include <QTextStream>
+
+#ifdef Q_OS_LINUX
+#include <unistd.h>
+#endif
+
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+
+static OFLogger daemonLogger = OFLog::getLogger("dcmtk.apps.xrfrcvd");
+
+/* a thread which is joined when it goes out of scope, so that returning early (e.g.
+ * on a configuration error) never leaves it joinable, which would terminate */
+class JoiningThread
+{
+public:
+    template <class Function>
+    explicit JoiningThread(Function&& function) : mThread(std::forward<Function>(function)) {}
+    ~JoiningThread()                        { join(); }
+
+    void join()                             { if (mThread.joinable()) mThread.join(); }
+
+private:
+    std::thread mThread;
+};
+
+/* command line first, then the [receiver] group of the configuration file, then the default */
+static QString setting(const QCommandLineParser& parser, const QSettings* settings, const QString& name, const QString& fallback = QString())
+{
+    if (parser.isSet(name))
+        return parser.value(name);
+    if (settings)
+        return settings->value("receiver/" + name, fallback).toString();
+    return fallback;
+}
+
+static bool flag(const QCommandLineParser& parser, const QSettings* settings, const QString& name)
+{
+    if (parser.isSet(name))
+        return true;
+    return settings && settings->value("receiver/" + name, false).toBool();
+}
+
+static bool transferSyntaxes(const QString& names, std::vector<E_TransferSyntax>& syntaxes)
+{
+    for (const QString& name : names.split(',', QString::SkipEmptyParts))
+    {
+        const QString n = name.trimmed().toLower();
+        if (n == "jpeg-lossless")       syntaxes.push_back(EXS_JPEGProcess14SV1);
+        else if (n == "jpeg-ls")        syntaxes.push_back(EXS_JPEGLSLossless);
+        else if (n == "rle")            syntaxes.push_back(EXS_RLELossless);
+        else if (n == "deflate")        syntaxes.push_back(EXS_DeflatedLittleEndianExplicit);
+        else return false;
+    }
+    return true;
+}
+
+static bool duplicatePolicy(const QString& name, xrf::DuplicatePolicy& policy)
+{
+    const QString n = name.toLower();
+    if (n == "skip")           policy = xrf::DuplicatePolicy::Skip;
+    else if (n == "overwrite") policy = xrf::DuplicatePolicy::Overwrite;
+    else if (n == "version")   policy = xrf::DuplicatePolicy::Version;
+    else return false;
+    return true;
+}
+
+static bool rawCineExport(const QString& name, xrf::RawCineExport& mode)
+{
+    const QString n = name.toLower();
+    if (n == "alongside")    mode = xrf::RawCineExport::Alongside;
+    else if (n == "instead") mode = xrf::RawCineExport::Instead;
+    else if (n == "off")     mode = xrf::RawCineExport::Off;
+    else return false;
+    return true;
+}
+
+static bool logLevel(const QString& name, OFLogger::LogLevel& level)
+{
+    const QString n = name.toLower();
+    if (n == "trace")      level = OFLogger::TRACE_LOG_LEVEL;
+    else if (n == "debug") level = OFLogger::DEBUG_LOG_LEVEL;
+    else if (n == "info")  level = OFLogger::INFO_LOG_LEVEL;
+    else if (n == "warn")  level = OFLogger::WARN_LOG_LEVEL;
+    else if (n == "error") level = OFLogger::ERROR_LOG_LEVEL;
+    else return false;
+    return true;
+}
+
+/* time since the process was created, i.e. including exec and dynamic linking; -1 where unknown */
+static double processAgeMs()
+{
+#ifdef Q_OS_LINUX
+    QFile stat("/proc/self/stat");
+    QFile uptime("/proc/uptime");
+    if (!stat.open(QIODevice::ReadOnly) || !uptime.open(QIODevice::ReadOnly))
+        return -1;
+    const QByteArray line = stat.readAll();
+    // starttime is field 22 of stat(5), the 20th behind the command name in parentheses
+    const QList<QByteArray> fields = line.mid(line.lastIndexOf(')') + 2).split(' ');
+    if (fields.size() < 20)
+        return -1;
+    const double started = fields.at(19).toDouble() / sysconf(_SC_CLK_TCK);
+    const double now = uptime.readAll().split(' ').first().toDouble();
+    return (now - started) * 1000.0;
+#else
+    return -1;
+#endif
+}
+
+int main(int argc, char *argv[])
+{
+    QElapsedTimer startup;
+    startup.start();
+
+    // loading the data dictionary is the bulk of a cold start; it does not depend on
+    // anything below, so it runs while the application and the receiver are set up
+    qint64 dictionaryNs = 0;
+    JoiningThread dictionaryLoader([&dictionaryNs]() {
+        QElapsedTimer timer;
+        timer.start();
+        dcmDataDict.isDictionaryLoaded();
+        dictionaryNs = timer.nsecsElapsed();
+    });
+
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("xrfrcvd");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Headless DICOM receiver for X-ray cine loops. Options override the [receiver] "
+                                     "group of the configuration file, which uses the same names.");
+    parser.addHelpOption();
+    parser.addOptions({
+        { { "c", "config" }, "Configuration file (ini).", "file" },
+        { { "p", "port" }, "TCP port to listen on (default 11112).", "port" },
+        { { "o", "outdir" }, "Output directory (default: current directory).", "dir" },
+        { "ext", "File name extension of stored objects (default .dcm).", "ext" },
+        { "workers", "Associations served concurrently (default 4).", "n" },
+        { "eostudy", "End-of-study timeout in seconds (default 5).", "s" },
+        { "shutdown-deadline", "Time in ms the commands in flight get to complete on SIGTERM (default 5000).", "ms" },
+        { "xfer", "Compressed transfer syntaxes to accept, most preferred first: "
+                  "jpeg-lossless, jpeg-ls, rle, deflate (comma separated).", "list" },
+        { "write-behind", "Write received objects on a separate I/O thread." },
+        { "bit-preserving", "Write PDVs to disk as they arrive." },
+        { "mapped-files", "Write PDVs into preallocated, memory mapped files." },
+        { "study-subdirs", "Store each study in a subdirectory of its own." },
+        { "loop-index", "Keep a loop index in the output directory." },
+        { "duplicates", "Index stored SOP instances and treat ones sent again by policy: "
+                        "skip, overwrite or version.", "policy" },
+        { "digests", "Keep digests of every stored file next to it: crc32c, xxh64 or best.", "algorithm" },
+        { "verify", "Verify the digests of the files in the output directory, print the result as JSON "
+                    "and exit; exits with 2 if a file does not match." },
+        { "verify-threads", "Threads for --verify (default: one per core).", "n" },
+        { "raw-cine", "Write native loops as raw cine files (.xrfcine) for reconstruction: "
+                      "alongside or instead of the DICOM files.", "mode" },
+        { "convert-raw", "Write the raw cine file of every stored file in the output directory, "
+                         "print the result as JSON and exit; exits with 2 if a file cannot be converted." },
+        { "compress", "Compress stored loops to RLE lossless while idle." },
+        { "metrics", "Write Prometheus metrics to this file.", "file" },
+        { "metrics-interval", "Interval of the metrics file in ms (default 15000).", "ms" },
+        { "log-level", "trace, debug, info, warn or error (default info).", "level" },
+        { "check-startup", "Measure the time until the receiver listens, print it as JSON and exit; "
+                           "exits with 1 if it exceeds the budget." },
+        { "budget", "Startup budget in ms for --check-startup (default 100).", "ms" },
+    });
+    parser.process(app);
+
+    std::unique_ptr<QSettings> settings;
+    if (parser.isSet("config"))
+    {
+        if (!QFile::exists(parser.value("config")))
+        {
+            QTextStream(stderr) << "xrfrcvd: configuration file " << parser.value("config") << " does not exist\n";
+            return 1;
+        }
+        settings.reset(new QSettings(parser.value("config"), QSettings::IniFormat));
+    }
+    const QSettings *config = settings.get();
+
+    OFLogger::LogLevel level = OFLogger::INFO_LOG_LEVEL;
+    std::vector<E_TransferSyntax> syntaxes;
+    if (!logLevel(setting(parser, config, "log-level", "info"), level))
+    {
+        QTextStream(stderr) << "xrfrcvd: unknown log level " << setting(parser, config, "log-level") << "\n";
+        return 1;
+    }
+    if (!transferSyntaxes(setting(parser, config, "xfer"), syntaxes))
+    {
+        QTextStream(stderr) << "xrfrcvd: unknown transfer syntax in " << setting(parser, config, "xfer") << "\n";
+        return 1;
+    }
+    xrf::DuplicatePolicy duplicates = xrf::DuplicatePolicy::Skip;
+    if (!setting(parser, config, "duplicates").isEmpty() && !duplicatePolicy(setting(parser, config, "duplicates"), duplicates))
+    {
+        QTextStream(stderr) << "xrfrcvd: unknown duplicate policy " << setting(parser, config, "duplicates") << "\n";
+        return 1;
+    }
+    xrf::DigestAlgorithm digestAlgorithm = xrf::DigestAlgorithm::Best;
+    if (!setting(parser, config, "digests").isEmpty() && !xrf::digestAlgorithmFromName(setting(parser, config, "digests").toLatin1(), digestAlgorithm))
+    {
+        QTextStream(stderr) << "xrfrcvd: unknown digest algorithm " << setting(parser, config, "digests") << "\n";
+        return 1;
+    }
+    xrf::RawCineExport rawCine = xrf::RawCineExport::Off;
+    if (!setting(parser, config, "raw-cine").isEmpty() && !rawCineExport(setting(parser, config, "raw-cine"), rawCine))
+    {
+        QTextStream(stderr) << "xrfrcvd: unknown raw cine mode " << setting(parser, config, "raw-cine") << "\n";
+        return 1;
+    }
+    OFLog::configure(level);
+
+    // raw cine files of what was stored before, the receiver is not started
+    if (parser.isSet("convert-raw"))
+    {
+        dictionaryLoader.join();
+        const QString ext = setting(parser, config, "ext", ".dcm");
+        QElapsedTimer timer;
+        timer.start();
+        int files = 0;
+        qint64 bytes = 0;
+        QStringList failed;
+        QDirIterator it(setting(parser, config, "outdir", "."), QStringList() << "*" + ext, QDir::Files, QDirIterator::Subdirectories);
+        while (it.hasNext())
+        {
+            const QString name = it.next();
+            const QString rawFile = xrf::rawCineFileName(name);
+            ++files;
+            OFCondition cond = xrf::convertToRawCine(name, rawFile);
+            if (cond.good())
+                bytes += QFileInfo(rawFile).size();
+            else
+                failed << QString("%1: %2").arg(name, cond.text());
+        }
+        QJsonObject result;
+        result["files"] = files;
+        result["converted"] = files - failed.size();
+        result["bytes_written"] = double(bytes);
+        result["seconds"] = timer.nsecsElapsed() / 1e9;
+        result["not_converted"] = QJsonArray::fromStringList(failed);
+        QTextStream(stdout) << QJsonDocument(result).toJson(QJsonDocument::Indented);
+        return failed.isEmpty() ? 0 : 2;
+    }
+
+    // a check of what was stored, the receiver is not started
+    if (parser.isSet("verify"))
+    {
+        dictionaryLoader.join();
+        const xrf::VerifyReport report = xrf::verifyDirectory(setting(parser, config, "outdir", "."),
+                                                              setting(parser, config, "verify-threads", "0").toInt());
+        QJsonObject result;
+        result["files"] = report.files;
+        result["verified"] = report.verified;
+        result["mismatched"] = report.mismatched;
+        result["invalid"] = report.invalid;
+        result["failed"] = report.failed;
+        result["gb_per_s"] = report.wallNs > 0 ? report.bytes / double(report.wallNs) : 0.0;
+        result["not_verified"] = QJsonArray::fromStringList(report.mismatches);
+        QTextStream(stdout) << QJsonDocument(result).toJson(QJsonDocument::Indented);
+        return report.verified == report.files ? 0 : 2;
+    }
+
+    const unsigned int port = setting(parser, config, "port", "11112").toUInt();
+    xrf::CineLoopRcv rcv(setting(parser, config, "outdir", "."), setting(parser, config, "ext", ".dcm"), port,
+                         setting(parser, config, "eostudy", "5").toLong());
+    rcv.setMaxConcurrentAssociations(setting(parser, config, "workers", "4").toInt());
+    rcv.setShutdownDeadline(setting(parser, config, "shutdown-deadline", "5000").toLongLong());
+    rcv.setTransferSyntaxes(syntaxes);
+    rcv.setBitPreserving(flag(parser, config, "bit-preserving"));
+    rcv.setMappedFiles(flag(parser, config, "mapped-files"));
+    if (flag(parser, config, "write-behind"))
+        rcv.enableWriteBehind();
+    if (flag(parser, config, "study-subdirs"))
+        rcv.setStudySubdirectories(true);
+    if (flag(parser, config, "loop-index"))
+        rcv.enableLoopIndex();
+    if (!setting(parser, config, "duplicates").isEmpty())
+        rcv.enableInstanceIndex(duplicates);
+    if (!setting(parser, config, "digests").isEmpty())
+        rcv.setFileDigests(true, digestAlgorithm);
+    rcv.setRawCineExport(rawCine);
+    if (flag(parser, config, "compress"))
+        rcv.enableBackgroundCompression();
+    if (!setting(parser, config, "metrics").isEmpty())
+        rcv.enableMetricsFile(setting(parser, config, "metrics"), setting(parser, config, "metrics-interval", "15000").toInt());
+
+    dictionaryLoader.join();
+    QElapsedTimer network;
+    network.start();
+    if (!rcv.init())
+        return 1;
+    const qint64 networkNs = network.nsecsElapsed();
+    const qint64 listeningNs = startup.nsecsElapsed();
+
+    if (parser.isSet("check-startup"))
+    {
+        const double budget = setting(parser, config, "budget", "100").toDouble();
+        QJsonObject result;
+        result["dictionary_ms"] = dictionaryNs / 1e6;
+        result["network_ms"] = networkNs / 1e6;
+        result["listening_ms"] = listeningNs / 1e6;
+        result["process_ms"] = processAgeMs();
+        result["budget_ms"] = budget;
+        result["ok"] = listeningNs / 1e6 <= budget;
+        QTextStream(stdout) << QJsonDocument(result).toJson(QJsonDocument::Indented);
+        return listeningNs / 1e6 <= budget ? 0 : 1;
+    }
+
+    OFLOG_INFO(daemonLogger, "listening on port " << port << " after " << listeningNs / 1000000 << " ms (data dictionary "
+        << dictionaryNs / 1000000 << " ms)");
+
+    // a signal stops the listener; the commands in flight are drained (up to the shutdown
+    // deadline) and what they queued is written before run() returns
+    xrf::SignalWatcher watcher;
+    QObject::connect(&watcher, SIGNAL(terminate(int)), &rcv, SLOT(stop()));
+    QObject::connect(&rcv, SIGNAL(finished()), &app, SLOT(quit()));
+    rcv.start();
+
+    const int result = app.exec();
+    rcv.stop();
+    rcv.wait();
+    const xrf::ShutdownReport report = rcv.shutdownReport();
+    OFLOG_INFO(daemonLogger, "stopped after " << report.flushMs << " ms: " << report.interruptedAssociations
+        << " associations interrupted, " << report.idleAssociations + report.drainedAssociations << " ended");
+    return result;
+}
@@ -0,0 +1,90 @@
+#include "signalwatcher.h"
+
+#include <QSocketNotifier>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <signal.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace xrf {
+
+static SignalWatcher *instance = 0;
+
+#ifdef _WIN32
+static BOOL WINAPI consoleHandler(DWORD event)
+{
+    if (instance == 0)
+        return FALSE;
+    // called on a thread of its own, the queued call takes the event over to the event loop
+    QMetaObject::invokeMethod(instance, "terminate", Qt::QueuedConnection, Q_ARG(int, int(event)));
+    return TRUE;
+}
+#else
+static int signalFds[2] = { -1, -1 };
+
+static void signalHandler(int signal)
+{
+    const char number = char(signal);
+    ssize_t written = ::write(signalFds[0], &number, 1);
+    (void)written;
+}
+#endif
+
+SignalWatcher::SignalWatcher(QObject *parent)
+    : QObject(parent), notifier(0)
+{
+    instance = this;
+#ifdef _WIN32
+    SetConsoleCtrlHandler(consoleHandler, TRUE);
+#else
+    if (::socketpair(AF_UNIX, SOCK_STREAM, 0, signalFds) != 0)
+        return;
+    notifier = new QSocketNotifier(signalFds[1], QSocketNotifier::Read, this);
+    connect(notifier, SIGNAL(activated(int)), this, SLOT(readSignal()));
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = signalHandler;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGTERM, &action, 0);
+    sigaction(SIGINT, &action, 0);
+    sigaction(SIGHUP, &action, 0);
+#endif
+}
+
+SignalWatcher::~SignalWatcher()
+{
+#ifdef _WIN32
+    SetConsoleCtrlHandler(consoleHandler, FALSE);
+#else
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGHUP, SIG_DFL);
+    if (signalFds[0] >= 0)
+    {
+        ::close(signalFds[0]);
+        ::close(signalFds[1]);
+        signalFds[0] = signalFds[1] = -1;
+    }
+#endif
+    instance = 0;
+}
+
+void SignalWatcher::readSignal()
+{
+#ifndef _WIN32
+    notifier->setEnabled(false);
+    char number = 0;
+    if (::read(signalFds[1], &number, 1) == 1)
+        emit terminate(int(number));
+    notifier->setEnabled(true);
+#endif
+}
+
+}
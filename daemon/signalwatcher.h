@@ -0,0 +1,32 @@
+#pragma once
+
+#include <QObject>
+
+class QSocketNotifier;
+
+namespace xrf {
+
+/*
+ * Turns SIGTERM, SIGINT and SIGHUP (console control events on Windows) into the
+ * terminate() signal, delivered on the thread of the event loop. The handler itself
+ * only writes the signal number to a socket pair, which is all that is safe to do in
+ * a signal handler; the notifier on the other end picks it up. One instance at a time.
+ */
+class SignalWatcher : public QObject
+{
+    Q_OBJECT
+public:
+    explicit SignalWatcher(QObject *parent = 0);
+    ~SignalWatcher();
+
+signals:
+    void terminate(int signal);
+
+private slots:
+    void readSignal();
+
+private:
+    QSocketNotifier *notifier;
+};
+
+}
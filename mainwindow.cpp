@@ -1,6 +1,7 @@
 #include "mainwindow.h"
 #include "ui_mainwindow.h"
 #include "xrfcinelooprcv.h"
+#include "xrfcineviewer.h"
 
 #include <QDebug>
 
@@ -9,29 +10,54 @@ MainWindow::MainWindow(QWidget *parent) :
     ui(new Ui::MainWindow)
 {
     ui->setupUi(this);
+    // received loops play here, the widget only paints what the player's workers rendered
+    mViewer = new xrf::CineViewer(this);
+    setCentralWidget(mViewer);
+    // the display pulls at its own pace, the ring absorbs what comes in faster
+    mLiveTimer.setInterval(16);
+    connect(&mLiveTimer, SIGNAL(timeout()), this, SLOT(pullLiveFrame()));
 }
 
 MainWindow::~MainWindow()
 {
+    // bounded by the receiver's shutdown deadline plus writing what is still queued
+    mLiveTimer.stop();
     Stop();
-    Wait(10*1000); // 10 secs
+    Wait();
     mLoopRcv.reset();
     delete ui;
 }
 
-void MainWindow::Init(const QString &savedir, const QString& fileextension, const unsigned int port, const long eostudy_timeout) {
+void MainWindow::Init(const QString &savedir, const QString& fileextension, const unsigned int port, const long eostudy_timeout,
+                      bool compress) {
     mSaveDir = savedir;
 
     if(!mLoopRcv)
         mLoopRcv = std::make_unique<xrf::CineLoopRcv>(mSaveDir, fileextension, port, eostudy_timeout, true, this);
 
+    mLoopRcv->setLoopDelivery(true);
+    // loops are received into recycled buffers instead of a fresh data set each
+    mLoopRcv->enablePixelBufferPool();
+    // frames for live review as they come off the network; a display which falls
+    // behind loses the oldest frames, the network side never waits for it
+    mLoopRcv->enableFrameRing(16, xrf::RingPolicy::DropOldest);
+    mLoopRcv->setStudySubdirectories(true);
+    // the viewer plays loops as they arrive, so only syntaxes with native pixel data are
+    // offered; a deflated data set is inflated on the way in, it still cuts the wire time
+    mLoopRcv->setTransferSyntaxes({ EXS_DeflatedLittleEndianExplicit });
+    // if asked for, stored files are RLE compressed while the receiver is idle instead
+    // (CineLoop::fromFile() decodes them again)
+    if (compress)
+        mLoopRcv->enableBackgroundCompression();
     mLoopRcv->init();
-    connect(mLoopRcv.get(), SIGNAL(finished()), mLoopRcv.get(), SLOT(deleteLater()));
     connect(mLoopRcv.get(), SIGNAL(cineLoopReceived(const QString&)),this, SLOT(handleCineLoopReceived(const QString&)));
+    connect(mLoopRcv.get(), SIGNAL(cineLoopAvailable(const xrf::CineLoopPtr&)),this, SLOT(handleCineLoopAvailable(const xrf::CineLoopPtr&)));
+    connect(mLoopRcv.get(), SIGNAL(studyCompleted(const QString&, const QStringList&)),this, SLOT(handleStudyCompleted(const QString&, const QStringList&)));
 }
 
 void MainWindow::Start() {
     if(mLoopRcv) mLoopRcv->start();
+    mLiveTimer.start();
 }
 
 void MainWindow::Stop() {
@@ -44,5 +70,31 @@ void MainWindow::Wait(unsigned long time_in_milliseconds) {
 
 void MainWindow::handleCineLoopReceived(const QString &loopfilename) {
     qDebug() << "MainWindow::handleCineLoopReceived: " << loopfilename;
+    // without loop delivery the stored file is played, mapped rather than parsed
+    if(mLoopRcv && mLoopRcv->loopdelivery())
+        return;
+    xrf::CineLoopPtr loop = xrf::CineLoop::fromFile(loopfilename);
+    if(loop)
+        mViewer->setLoop(loop);
+}
+
+void MainWindow::handleCineLoopAvailable(const xrf::CineLoopPtr &loop) {
+    qDebug() << "MainWindow::handleCineLoopAvailable: " << loop->info().sopInstanceUID
+             << loop->info().columns << "x" << loop->info().rows << "x" << loop->frameCount();
+    mViewer->setLoop(loop);
+}
+
+void MainWindow::pullLiveFrame() {
+    xrf::FrameRing *ring = mLoopRcv ? mLoopRcv->framering() : nullptr;
+    xrf::CineFrame frame;
+    if(!ring || !ring->pop(frame))
+        return;
+    const xrf::FrameRingStats stats = ring->stats();
+    statusBar()->showMessage(QString("live: %1 frame %2/%3, ring latency %4 ms, %5 dropped")
+                             .arg(frame.info->sopInstanceUID).arg(frame.index + 1).arg(frame.info->numberOfFrames)
+                             .arg(stats.lastLatencyNs / 1e6, 0, 'f', 1).arg(stats.dropped()));
+}
 
+void MainWindow::handleStudyCompleted(const QString &studyuid, const QStringList &files) {
+    qDebug() << "MainWindow::handleStudyCompleted: " << studyuid << files.size() << "files";
 }
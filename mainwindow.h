@@ -2,14 +2,20 @@
 #define MAINWINDOW_H
 
 #include <QMainWindow>
+#include <QStringList>
+#include <QTimer>
+#include <climits>
 #include <memory>
 
+#include "xrfcineloop.h"
+
 namespace Ui {
 class MainWindow;
 }
 
 namespace xrf {
     class CineLoopRcv;
+    class CineViewer;
 }
 class MainWindow : public QMainWindow
 {
@@ -19,17 +25,26 @@ public:
     explicit MainWindow(QWidget *parent = 0);
     ~MainWindow();
 
-    void Init(const QString& savedir, const QString &fileextension, const unsigned int port, const long eostudy_timeout = -1);
+    /* compress: rewrite stored loops as RLE Lossless while the receiver is idle, off
+     * unless asked for, downstream tools may expect the syntax the modality sent */
+    void Init(const QString& savedir, const QString &fileextension, const unsigned int port, const long eostudy_timeout = -1,
+              bool compress = false);
     void Start();
     void Stop();
-    void Wait(unsigned long time_in_milliseconds);
+    void Wait(unsigned long time_in_milliseconds = ULONG_MAX);
 
 public slots:
     void handleCineLoopReceived(const QString& loopfilename);
+    void handleCineLoopAvailable(const xrf::CineLoopPtr& loop);
+    void handleStudyCompleted(const QString& studyuid, const QStringList& files);
+    /* takes the next live frame from the receiver's frame ring, on the display timer */
+    void pullLiveFrame();
 
 private:
     Ui::MainWindow *ui;
     QString mSaveDir;
+    QTimer mLiveTimer;
+    xrf::CineViewer *mViewer;
     std::unique_ptr<xrf::CineLoopRcv> mLoopRcv{nullptr};
 };
 
@@ -0,0 +1,132 @@
+#include "xrfacceptance.h"
+
+#include "dcmtk/dcmdata/dcuid.h"
+
+#include <string.h>
+
+namespace xrf {
+
+/* a peer which proposes ever new private SOP classes must not grow the cache without bound */
+static const int maxUnnamed = 4096;
+
+AcceptancePolicy::AcceptancePolicy()
+    : unknownRanking(-1)
+{
+    unknownEntry.role = ASC_SC_ROLE_DEFAULT;
+    unknownEntry.ranking = -1;
+}
+
+void AcceptancePolicy::setTransferSyntaxes(const char *const transferSyntaxes[], int count)
+{
+    Ranking ranking;
+    for (int i = 0; i < count; ++i)
+    {
+        const QByteArray uid(transferSyntaxes[i]);
+        // listed twice: the first, better rank counts
+        if (!ranking.ranks.contains(uid))
+        {
+            ranking.ranks.insert(uid, int(ranking.uids.size()));
+            ranking.uids.push_back(uid);
+        }
+    }
+    rankings.push_back(ranking);
+}
+
+void AcceptancePolicy::addAbstractSyntaxes(const char *const uids[], int count, T_ASC_SC_ROLE role)
+{
+    if (rankings.empty())
+        return;
+    Entry entry;
+    entry.role = role;
+    entry.ranking = int(rankings.size()) - 1;
+    for (int i = 0; i < count; ++i)
+        abstractSyntaxes.insert(QByteArray(uids[i]), entry);
+}
+
+void AcceptancePolicy::setAcceptUnknown(bool enable, T_ASC_SC_ROLE role)
+{
+    unknownRanking = (enable && !rankings.empty()) ? int(rankings.size()) - 1 : -1;
+    unknownEntry.role = role;
+    unknownEntry.ranking = unknownRanking;
+}
+
+void AcceptancePolicy::clear()
+{
+    rankings.clear();
+    abstractSyntaxes.clear();
+    unknownRanking = -1;
+    unknownEntry.ranking = -1;
+    unnamed.clear();
+}
+
+const AcceptancePolicy::Entry *AcceptancePolicy::find(const QByteArray &abstractSyntax)
+{
+    QHash<QByteArray, Entry>::const_iterator entry = abstractSyntaxes.constFind(abstractSyntax);
+    if (entry != abstractSyntaxes.constEnd())
+        return &entry.value();
+    if (unknownRanking < 0)
+        return NULL;
+
+    // dcmFindNameOfUID() searches the whole UID dictionary, ask once per abstract syntax
+    QHash<QByteArray, bool>::const_iterator known = unnamed.constFind(abstractSyntax);
+    if (known == unnamed.constEnd())
+    {
+        if (unnamed.size() >= maxUnnamed)
+            unnamed.clear();
+        // deep copy, the key points into the association parameters
+        known = unnamed.insert(QByteArray(abstractSyntax.constData(), abstractSyntax.size()),
+                               dcmFindNameOfUID(abstractSyntax.constData()) == NULL);
+    }
+    return known.value() ? &unknownEntry : NULL;
+}
+
+OFCondition AcceptancePolicy::apply(T_ASC_Parameters *params)
+{
+    // take the proposed contexts off the list first: accepting and refusing look the
+    // context up on the same list, which moves its cursor
+    std::vector<DUL_PRESENTATIONCONTEXT*> proposed;
+    LST_HEAD *requested = params->DULparams.requestedPresentationContext;
+    if (requested != NULL)
+    {
+        DUL_PRESENTATIONCONTEXT *pc = OFstatic_cast(DUL_PRESENTATIONCONTEXT *, LST_Head(&requested));
+        (void)LST_Position(&requested, OFstatic_cast(LST_NODE *, pc));
+        for (; pc != NULL; pc = OFstatic_cast(DUL_PRESENTATIONCONTEXT *, LST_Next(&requested)))
+            proposed.push_back(pc);
+    }
+
+    OFCondition result = EC_Normal;
+    for (DUL_PRESENTATIONCONTEXT *pc : proposed)
+    {
+        const Entry *entry = find(QByteArray::fromRawData(pc->abstractSyntax, int(strlen(pc->abstractSyntax))));
+        if (entry == NULL)
+        {
+            result = ASC_refusePresentationContext(params, pc->presentationContextID, ASC_P_ABSTRACTSYNTAXNOTSUPPORTED);
+            if (result.bad()) return result;
+            continue;
+        }
+
+        const Ranking &ranking = rankings[size_t(entry->ranking)];
+        int best = int(ranking.uids.size());
+        LST_HEAD *syntaxes = pc->proposedTransferSyntax;
+        if (syntaxes != NULL)
+        {
+            DUL_TRANSFERSYNTAX *ts = OFstatic_cast(DUL_TRANSFERSYNTAX *, LST_Head(&syntaxes));
+            (void)LST_Position(&syntaxes, OFstatic_cast(LST_NODE *, ts));
+            for (; ts != NULL; ts = OFstatic_cast(DUL_TRANSFERSYNTAX *, LST_Next(&syntaxes)))
+            {
+                const int rank = ranking.ranks.value(QByteArray::fromRawData(ts->transferSyntax, int(strlen(ts->transferSyntax))), best);
+                if (rank < best)
+                    best = rank;
+            }
+        }
+
+        if (best < int(ranking.uids.size()))
+            result = ASC_acceptPresentationContext(params, pc->presentationContextID, ranking.uids[size_t(best)].constData(), entry->role);
+        else
+            result = ASC_refusePresentationContext(params, pc->presentationContextID, ASC_P_TRANSFERSYNTAXESNOTSUPPORTED);
+        if (result.bad()) return result;
+    }
+    return result;
+}
+
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "dcmtk/config/osconfig.h"    /* make sure OS specific configuration is included first */
+
+#include "dcmtk/dcmnet/assoc.h"
+
+#include <QByteArray>
+#include <QHash>
+
+#include <vector>
+
+namespace xrf {
+
+/*
+ * The presentation contexts a receiver accepts, compiled once into hash tables:
+ * abstract syntax -> accepted role and ranking of transfer syntaxes, and per ranking
+ * transfer syntax -> rank. apply() then decides every context an association
+ * proposes in a single pass, with one lookup for its abstract syntax and one per
+ * proposed transfer syntax, where ASC_acceptContextsWithPreferredTransferSyntaxes()
+ * compares each of them against every listed SOP class and syntax again for every
+ * association. The outcome is the same: the most preferred of the proposed transfer
+ * syntaxes is accepted, anything else is refused.
+ * Built before the receiver starts; apply() is called by the thread which accepts
+ * associations only.
+ */
+class AcceptancePolicy
+{
+public:
+    AcceptancePolicy();
+
+    /* ranking for the abstract syntaxes added from now on, most preferred first */
+    void setTransferSyntaxes(const char* const transferSyntaxes[], int count);
+    /* abstract syntaxes accepted in role with the current ranking */
+    void addAbstractSyntaxes(const char* const uids[], int count, T_ASC_SC_ROLE role = ASC_SC_ROLE_DEFAULT);
+    /* accept abstract syntaxes which have no name in the UID dictionary, i.e. are not
+     * known not to be storage SOP classes (storescp --promiscuous), with the current ranking */
+    void setAcceptUnknown(bool enable, T_ASC_SC_ROLE role = ASC_SC_ROLE_DEFAULT);
+    void clear();
+    bool isEmpty() const                    { return abstractSyntaxes.isEmpty() && unknownRanking < 0; }
+
+    /* accepts or refuses every context proposed in params */
+    OFCondition apply(T_ASC_Parameters* params);
+
+private:
+    struct Entry
+    {
+        T_ASC_SC_ROLE role;
+        int ranking;
+    };
+    struct Ranking
+    {
+        QHash<QByteArray, int> ranks;
+        std::vector<QByteArray> uids;       // by rank
+    };
+
+    const Entry* find(const QByteArray& abstractSyntax);
+
+    std::vector<Ranking> rankings;
+    QHash<QByteArray, Entry> abstractSyntaxes;
+    int unknownRanking;                     // -1: unknown abstract syntaxes are refused
+    Entry unknownEntry;
+    QHash<QByteArray, bool> unnamed;        // abstract syntax -> not in the UID dictionary, as seen so far
+};
+
+}
@@ -0,0 +1,768 @@
+#include "xrfassociation.h"
+#include "xrfcineloop.h"
+#include "xrferror.h"
+#include "xrfframetap.h"
+#include "xrfprojection.h"
+#include "xrfrawcine.h"
+#include "xrfstreamstore.h"
+
+#include "dcmtk/dcmnet/dcmtrans.h"
+#include "dcmtk/dcmdata/dcxfer.h"
+
+
+namespace xrf {
+struct StoreCallbackData
+{
+  AssociationHandler* handler;
+  char* imageFileName;
+  std::shared_ptr<DcmFileFormat> dcmff;
+  T_ASC_Association* assoc;
+  bool streamed;
+  FrameTap* frames;
+  ScannerTap* scanner;
+  StageTimer* stages;
+  QByteArray sopInstanceUID;
+  const InstanceRecord* duplicate;      // as indexed, if the instance was stored before
+  HashTap* hash;
+  DigestTap* digests;
+  bool skipped;                         // duplicate which was not written, see DuplicatePolicy::Skip
+  OFString fileName;                    // where the object is on disk, empty if nowhere
+  bool filed;                           // indexed and reported, the file stays even if the C-STORE-RSP fails
+};
+
+/* name of the file in the directory of its study (see StudyTracker) */
+static OFString studyFileName(const QString& directory, const char* imageFileName)
+{
+  OFString name;
+  OFStandard::getFilenameFromPath(name, imageFileName);
+  OFString path = directory.toLocal8Bit().constData();
+  return path + PATH_SEPARATOR + name;
+}
+
+/* whether the object just received is the one the instance index knows */
+static bool isIdenticalDuplicate(const StoreCallbackData *cbdata)
+{
+  // a resend in another transfer syntax hashes differently and counts as other content
+  return cbdata->duplicate && cbdata->hash && cbdata->hash->isComplete()
+      && cbdata->hash->digest() == cbdata->duplicate->contentHash && qint64(cbdata->hash->bytes()) == cbdata->duplicate->bytes;
+}
+
+/* counts a duplicate by content, saved if it was never written; true if it was identical */
+static bool countDuplicate(CineLoopRcv *rcv, const StoreCallbackData *cbdata, bool saved)
+{
+  if (!isIdenticalDuplicate(cbdata))
+  {
+    rcv->metrics().add(Metrics::DuplicatesDiffering);
+    OFLOG_WARN(storescpLogger, "SOP instance " << cbdata->sopInstanceUID.constData() << " received again with other content than "
+      << cbdata->duplicate->file().toLocal8Bit().constData());
+    return false;
+  }
+  rcv->metrics().add(Metrics::DuplicatesIdentical);
+  if (saved)
+    rcv->metrics().add(Metrics::DuplicateBytesSaved, cbdata->hash->bytes());
+  return true;
+}
+
+/* the projection matrices of a loop, cached with it before the consumers get it (see
+ * CineLoopRcv::setProjectionGeometry()); what came before is booked to DatasetBuild */
+static void computeProjections(CineLoopRcv *rcv, const CineLoopPtr& loop, StageTimer& stages)
+{
+  if (!rcv->projectiongeometry())
+    return;
+  stages.lap(Metrics::DatasetBuild);
+  if (!loop->projections())
+    OFLOG_DEBUG(storescpLogger, "no projection matrices for " << loop->info().sopInstanceUID.toLocal8Bit().constData()
+      << ": acquisition geometry is incomplete");
+  stages.lap(Metrics::ProjectionGeometry);
+}
+
+/*
+ * Stores (or, on the streaming path, files) the object of a C-STORE after its data set
+ * was received completely and delivers it to the consumers of the receiver. The time
+ * spent is booked to the stages of the callback data's StageTimer.
+ */
+static void storeReceivedObject(StoreCallbackData *cbdata, DcmDataset **imageDataSet, T_DIMSE_C_StoreRSP *rsp)
+{
+  CineLoopRcv *rcv = cbdata->handler->receiver();
+  StageTimer& stages = *cbdata->stages;
+
+  // Concerning the following line: an appropriate status code is already set in the resp structure,
+  // it need not be success. For example, if the caller has already detected an out of resources problem
+  // then the status will reflect this.  The callback function is still called to allow cleanup.
+  //rsp->DimseStatus = STATUS_Success;
+
+  // on the streaming path the PDVs have already been written to the file (if any) as
+  // they arrived; there is no data set in memory, we only need to report the results.
+  if (cbdata->streamed)
+  {
+    if ((rsp->DimseStatus == STATUS_Success) && !rcv->ignore())
+    {
+      // the data set only went through the hash, the stored copy stays as it is
+      if (cbdata->skipped)
+      {
+        if (countDuplicate(rcv, cbdata, true))
+          OFLOG_INFO(storescpLogger, "discarded duplicate of " << cbdata->duplicate->file().toLocal8Bit().constData());
+        stages.lap(Metrics::DatasetBuild);
+        return;
+      }
+      if (rcv->loopdelivery() && cbdata->frames)
+      {
+        if (cbdata->frames->loop())
+        {
+          computeProjections(rcv, cbdata->frames->loop(), stages);
+          rcv->emitCineLoopAvailableSignal(cbdata->frames->loop());
+        }
+        else
+          OFLOG_WARN(storescpLogger, "cannot deliver received object as cine loop: " << cbdata->frames->status().text());
+        stages.lap(Metrics::SignalDispatch);
+      }
+      if (rcv->writefiles())
+      {
+        // an identical resend has been written by now, it saves no bytes, only a version
+        if (cbdata->duplicate && countDuplicate(rcv, cbdata, false)
+            && rcv->duplicatepolicy() == DuplicatePolicy::Version)
+        {
+          // no new version of what we have already
+          OFStandard::deleteFile(cbdata->imageFileName);
+          OFLOG_INFO(storescpLogger, "discarded duplicate of " << cbdata->duplicate->file().toLocal8Bit().constData());
+          stages.lap(Metrics::DiskWrite);
+          return;
+        }
+
+        const DatasetScanner& scanner = cbdata->scanner->scanner();
+        OFString studyInstanceUID;
+        scanner.getString(DCM_StudyInstanceUID, studyInstanceUID);
+
+        // the file was written to the output directory while receiving, move it to its study
+        OFString fileName = cbdata->imageFileName;
+        const OFString studyFile = studyFileName(rcv->studyObjectReceived(studyInstanceUID, cbdata->assoc->params->DULparams.callingAPTitle), cbdata->imageFileName);
+        const RawCineExport rawCine = rcv->rawcineexport();
+        const CineLoopPtr loop = cbdata->frames ? cbdata->frames->loop() : CineLoopPtr();
+        const OFCondition loopCond = cbdata->frames ? cbdata->frames->status() : OFCondition(EC_IllegalCall);
+        if (rawCine == RawCineExport::Instead)
+        {
+          // there is no DICOM file, the loop only goes to its raw cine file
+          const QString rawFile = rawCineFileName(QString::fromLocal8Bit(studyFile.c_str()));
+          OFCondition rawCond = loop ? writeRawCine(rawFile, *loop) : loopCond;
+          stages.lap(Metrics::DiskWrite);
+          if (rawCond.bad())
+          {
+            OFLOG_ERROR(storescpLogger, "cannot write raw cine file: " << rawFile.toLocal8Bit().constData() << ": " << rawCond.text());
+            rcv->metrics().error(rawCond);
+            rsp->DimseStatus = STATUS_STORE_Error_CannotUnderstand;
+            rcv->studyObjectStored(studyInstanceUID, OFString());
+            return;
+          }
+          fileName = rawFile.toLocal8Bit().constData();
+        }
+        else if (studyFile != fileName)
+        {
+          // the rename replaces an earlier copy atomically, there is always one of them
+          if (OFStandard::fileExists(studyFile))
+            OFLOG_WARN(storescpLogger, "DICOM file already exists, overwriting: " << studyFile);
+          if (!replaceFile(fileName, studyFile))
+          {
+            // the study counts the object already, it learns that it failed
+            OFLOG_ERROR(storescpLogger, "cannot move DICOM file to study directory: " << fileName);
+            rcv->metrics().error(XRF_ReplaceFailed);
+            rsp->DimseStatus = STATUS_STORE_Refused_OutOfResources;
+            OFStandard::deleteFile(fileName);
+            cbdata->fileName.clear();
+            stages.lap(Metrics::DiskWrite);
+            rcv->studyObjectStored(studyInstanceUID, OFString());
+            return;
+          }
+          cbdata->fileName = fileName = studyFile;
+        }
+        if (rawCine == RawCineExport::Alongside)
+        {
+          const QString rawFile = rawCineFileName(QString::fromLocal8Bit(fileName.c_str()));
+          OFCondition rawCond = loop ? writeRawCine(rawFile, *loop) : loopCond;
+          if (rawCond.bad())
+            OFLOG_WARN(storescpLogger, "cannot write raw cine file: " << rawFile.toLocal8Bit().constData() << ": " << rawCond.text());
+        }
+        if (cbdata->digests && cbdata->digests->isComplete())
+        {
+          OFCondition digestCond = cbdata->digests->digests().write(QString::fromLocal8Bit(fileName.c_str()));
+          if (digestCond.bad())
+            OFLOG_WARN(storescpLogger, "cannot write digests of " << fileName << ": " << digestCond.text());
+          rcv->metrics().add(Metrics::DigestNanoseconds, quint64(cbdata->digests->elapsedNs()));
+        }
+        stages.lap(Metrics::DiskWrite);
+
+        // from here on the indexes and the study know the file, it must not be removed
+        cbdata->fileName = fileName;
+        cbdata->filed = true;
+        LoopIndexRecord record;
+        if (rcv->loopindex() && record.read(scanner).good())
+          rcv->addToLoopIndex(record, fileName);
+        if (rcv->instanceindex() && cbdata->hash->isComplete())
+        {
+          InstanceRecord instance;
+          memset(&instance, 0, sizeof(instance));
+          instance.setSop(cbdata->sopInstanceUID);
+          instance.contentHash = cbdata->hash->digest();
+          instance.bytes = qint64(cbdata->hash->bytes());
+          instance.version = cbdata->duplicate ? cbdata->duplicate->version : 1;
+          if (cbdata->duplicate && rcv->duplicatepolicy() == DuplicatePolicy::Version)
+            ++instance.version;
+          rcv->addToInstanceIndex(instance, fileName);
+        }
+        rcv->studyObjectStored(studyInstanceUID, fileName);
+        stages.lap(Metrics::DatasetBuild);
+        OFLOG_INFO(storescpLogger, "stored DICOM file: " << fileName);
+        rcv->emitCineLoopReceivedSignal(QString(fileName.c_str()));
+        stages.lap(Metrics::SignalDispatch);
+      }
+    }
+  }
+  // we want to write the received information to a file only if this information
+  // is present and the option opt_ignore is not set.
+  else if ((imageDataSet != NULL) && (*imageDataSet != NULL) && !rcv->ignore())
+  {
+    // hand the loop to in-memory consumers first, they need not wait for the disk;
+    // the loop shares the pixel buffer of the data set we just received, unless
+    // writing the file swaps that buffer into the other byte order in place
+    if (rcv->loopdelivery() && (rsp->DimseStatus == STATUS_Success))
+    {
+      OFCondition loopCond;
+      CineLoopPtr loop = CineLoop::fromFileFormat(cbdata->dcmff, &loopCond);
+      E_TransferSyntax writeXfer = rcv->writetransfersyntax();
+      if (writeXfer == EXS_Unknown) writeXfer = (*imageDataSet)->getOriginalXfer();
+      if (loop && rcv->writefiles() && DcmXfer(writeXfer).getByteOrder() != gLocalByteOrder)
+      {
+        loop = CineLoop::copy(*loop);
+        if (!loop) loopCond = EC_MemoryExhausted;
+      }
+      stages.lap(Metrics::DatasetBuild);
+      if (loop)
+      {
+        computeProjections(rcv, loop, stages);
+        rcv->emitCineLoopAvailableSignal(loop);
+      }
+      else
+        OFLOG_WARN(storescpLogger, "cannot deliver received object as cine loop: " << loopCond.text());
+      stages.lap(Metrics::SignalDispatch);
+    }
+
+    if (!rcv->writefiles())
+      return;
+
+    LoopIndexRecord record;
+
+    // the file goes to the directory of its study, which may complete the sender's previous study
+    OFString studyInstanceUID;
+    (*imageDataSet)->findAndGetOFString(DCM_StudyInstanceUID, studyInstanceUID);
+    const OFString fileName = studyFileName(rcv->studyObjectReceived(studyInstanceUID, cbdata->assoc->params->DULparams.callingAPTitle), cbdata->imageFileName);
+
+    // determine the transfer syntax which shall be used to write the information to the file
+    E_TransferSyntax xfer =  rcv->writetransfersyntax();
+    if (xfer == EXS_Unknown) xfer = (*imageDataSet)->getOriginalXfer();
+    stages.lap(Metrics::DatasetBuild);
+
+    // store file either with meta header or as pure dataset
+    OFLOG_INFO(storescpLogger, "storing DICOM file: " << fileName);
+    if (OFStandard::fileExists(fileName))
+    {
+      OFLOG_WARN(storescpLogger, "DICOM file already exists, overwriting: " << fileName);
+    }
+    // with a write-behind stage the data set is handed over to the I/O thread, which
+    // also reports the file to its study and emits the signal once it is durable; depending on the policy we wait
+    // for that before the C-STORE-RSP goes out
+    if (rcv->writebehind())
+    {
+      WriteBehindQueue::Job job;
+      job.fileformat = cbdata->dcmff;
+      job.fileName = fileName;
+      job.xfer = xfer;
+      job.sequenceType = rcv->sequencetype();
+      job.groupLength = rcv->grouplength();
+      job.paddingType = rcv->paddingtype();
+      job.filepad = OFstatic_cast(Uint32, rcv->filepad());
+      job.itempad = OFstatic_cast(Uint32, rcv->itempad());
+      job.writeMode = (rcv->usemetaheader()) ? EWM_fileformat : EWM_dataset;
+      // the I/O thread reports the file, removing it here would only race the job
+      cbdata->fileName = fileName;
+      cbdata->filed = true;
+      // the I/O thread owns the data set once it is queued, the record is taken before;
+      // the loop is only indexed, and counted as stored for its study, once its file is durable
+      const bool indexed = rcv->loopindex() && record.read(**imageDataSet).good();
+      job.completed = [rcv, record, fileName, studyInstanceUID, indexed](const OFCondition& result) mutable {
+        if (indexed && result.good())
+          rcv->addToLoopIndex(record, fileName);
+        rcv->studyObjectStored(studyInstanceUID, result.good() ? fileName : OFString());
+      };
+
+      std::shared_ptr<WriteTicket> ticket = rcv->writebehind()->enqueue(job);
+      OFCondition cond = (rcv->writebehind()->ackPolicy() == AckPolicy::OnDurable) ? ticket->wait() : EC_Normal;
+      stages.lap(Metrics::DiskWrite);
+      if (cond.bad())
+      {
+        rcv->metrics().error(cond);
+        rsp->DimseStatus = STATUS_STORE_Refused_OutOfResources;
+      }
+      return;
+    }
+
+    cbdata->fileName = fileName;
+    OFCondition cond = cbdata->dcmff->saveFile(fileName.c_str(), xfer, rcv->sequencetype(), rcv->grouplength(),
+        rcv->paddingtype(), OFstatic_cast(Uint32, rcv->filepad()), OFstatic_cast(Uint32, rcv->itempad()),
+        (rcv->usemetaheader()) ? EWM_fileformat : EWM_dataset);
+    stages.lap(Metrics::DiskWrite);
+    if (cond.bad())
+    {
+      OFLOG_ERROR(storescpLogger, "cannot write DICOM file: " << fileName << ": " << cond.text());
+      rcv->metrics().error(cond);
+      rsp->DimseStatus = STATUS_STORE_Refused_OutOfResources;
+      rcv->studyObjectStored(studyInstanceUID, OFString());
+    }
+    else // file saved succesfully
+    {
+        cbdata->filed = true;
+        if (rcv->loopindex() && record.read(**imageDataSet).good())
+          rcv->addToLoopIndex(record, fileName);
+        rcv->studyObjectStored(studyInstanceUID, fileName);
+        stages.lap(Metrics::DatasetBuild);
+        rcv->emitCineLoopReceivedSignal(QString(fileName.c_str()));
+        stages.lap(Metrics::SignalDispatch);
+    }
+  }
+}
+
+/*
+ * This function.is used to indicate progress when storescp receives instance data over the
+ * network. On the final call to this function (identified by progress->state == DIMSE_StoreEnd)
+ * this function will store the data set which was received over the network to a file.
+ * Earlier calls to this function will simply cause some information to be dumped to stdout.
+ *
+ * Parameters:
+ *   callbackData  - [in] data for this callback function
+ *   progress      - [in] The state of progress. (identifies if this is the initial or final call
+ *                   to this function, or a call in between these two calls.
+ *   req           - [in] The original store request message.
+ *   imageFileName - [in] The path to and name of the file the information shall be written to.
+ *   imageDataSet  - [in] The data set which shall be stored in the image file
+ *   rsp           - [inout] the C-STORE-RSP message (will be sent after the call to this function)
+ *   statusDetail  - [inout] This variable can be used to capture detailed information with regard to
+ *                   the status information which is captured in the status element (0000,0900). Note
+ *                   that this function does specify any such information, the pointer will be set to NULL.
+ */
+static void storeSCPCallback(void *callbackData,
+                             T_DIMSE_StoreProgress *progress,
+                             T_DIMSE_C_StoreRQ * /*req*/,
+                             char * /*imageFileName*/,
+                             DcmDataset **imageDataSet,
+                             T_DIMSE_C_StoreRSP *rsp,
+                             DcmDataset **statusDetail)
+{
+  // dump some information if required (depending on the progress state)
+  // We can't use oflog for the pdu output, but we use a special logger for
+  // generating this output. If it is set to level "INFO" we generate the
+  // output, if it's set to "DEBUG" then we'll assume that there is debug output
+  // generated for each PDU elsewhere.
+  OFLogger progressLogger = OFLog::getLogger("dcmtk.apps." OFFIS_CONSOLE_APPLICATION ".progress");
+  if (progressLogger.getChainedLogLevel() == OFLogger::INFO_LOG_LEVEL)
+  {
+    switch (progress->state)
+    {
+      case DIMSE_StoreBegin:
+        COUT << "RECV: ";
+        break;
+      case DIMSE_StoreEnd:
+        COUT << OFendl;
+        break;
+      default:
+        COUT << '.';
+        break;
+    }
+    COUT.flush();
+  }
+
+  // the clock of the network stage starts with the first PDV
+  if (progress->state == DIMSE_StoreBegin)
+    OFstatic_cast(StoreCallbackData *, callbackData)->stages->restart();
+
+  // if this is the final call of this function, save the data which was received to a file
+  // (note that we could also save the image somewhere else, put it in database, etc.)
+  if (progress->state == DIMSE_StoreEnd)
+  {
+    // do not send status detail information
+    *statusDetail = NULL;
+
+    // remember callback data
+    StoreCallbackData *cbdata = OFstatic_cast(StoreCallbackData *, callbackData);
+    Metrics& metrics = cbdata->handler->receiver()->metrics();
+
+    // dcmdata decodes the data set while the PDVs come in, so building it in memory is part of receiving
+    cbdata->stages->lap(Metrics::NetworkReceive);
+    metrics.add(Metrics::BytesReceived, progress->progressBytes);
+
+    storeReceivedObject(cbdata, imageDataSet, rsp);
+
+    cbdata->stages->commit();
+    metrics.add(rsp->DimseStatus == STATUS_Success ? Metrics::ObjectsStored : Metrics::ObjectsFailed);
+  }
+}
+
+
+AssociationHandler::AssociationHandler(CineLoopRcv* rcv, T_ASC_Association* assoc)
+    : rcv(rcv), assoc(assoc), socketHandle(-1), cond(EC_Normal), presID(0)
+{
+    // the pool runs the handler once per burst of commands, it deletes itself at the end
+    setAutoDelete(false);
+    DcmTransportConnection *connection = DUL_getTransportConnection(assoc->DULassociation);
+    if (connection)
+        socketHandle = qintptr(connection->getSocket());
+}
+
+AssociationHandler::~AssociationHandler()
+{
+    // let the receiver know, no matter how the association ended
+    rcv->associationFinished();
+}
+
+static bool keepsAssociation(const OFCondition& cond)
+{
+  return cond == EC_Normal || cond == DIMSE_NODATAAVAILABLE || cond == DIMSE_OUTOFRESOURCES;
+}
+
+void AssociationHandler::run()
+{
+  OFString temp_str;
+
+  /* now do the real work, i.e. receive DIMSE commmands over the network connection */
+  /* which was established and handle these commands correspondingly. In case of */
+  /* storscp only C-ECHO-RQ and C-STORE-RQ commands can be processed. The worker */
+  /* keeps the association while the sender has more commands in flight; the check */
+  /* includes PDVs which DUL has already read from the socket. A receiver which is */
+  /* stopping only lets the command in flight complete. */
+  const bool idle = rcv->stopping();
+  cond = EC_Normal;
+  if (!idle)
+  {
+    do
+    {
+      cond = processCommand();
+    }
+    while (keepsAssociation(cond) && !rcv->stopping() && ASC_dataWaiting(assoc, 0));
+  }
+
+  // nothing is waiting, the reactor runs us again for the next command; this
+  // handler may be running on another worker as soon as the call returns
+  if (keepsAssociation(cond) && rcv->watchAssociation(this))
+    return;
+
+  if (keepsAssociation(cond))
+  {
+    OFLOG_INFO(storescpLogger, "Association Aborted (receiver is shutting down)");
+    rcv->metrics().add(Metrics::AssociationsAborted);
+    cond = ASC_abortAssociation(assoc);
+  }
+  else if (cond == DUL_PEERREQUESTEDRELEASE)
+  {
+    OFLOG_INFO(storescpLogger, "Association Release");
+    cond = ASC_acknowledgeRelease(assoc);
+  }
+  else if (cond == DUL_PEERABORTEDASSOCIATION)
+  {
+    OFLOG_INFO(storescpLogger, "Association Aborted");
+    rcv->metrics().add(Metrics::AssociationsAborted);
+  }
+  else
+  {
+    OFLOG_ERROR(storescpLogger, "DIMSE failure (aborting association): " << DimseCondition::dump(temp_str, cond));
+    rcv->metrics().add(Metrics::AssociationsAborted);
+    rcv->metrics().error(cond);
+    /* some kind of error so abort the association */
+    cond = ASC_abortAssociation(assoc);
+  }
+
+  if (rcv->stopping())
+    rcv->associationShutDown(this, idle);
+  // the socket is closed with the association, its number may be reused right away
+  rcv->unwatchAssociation(this);
+  cleanup();
+  delete this;
+}
+
+/*
+ * This function receives one DIMSE commmand over the network connection
+ * and handles it correspondingly. Note that in case of storscp only
+ * C-ECHO-RQ and C-STORE-RQ commands can be processed. The reactor only
+ * hands us the association once there is data, the end-of-study timeout
+ * is taken care of by the receiver.
+ *
+ * Parameters:
+ *   assoc - [in] The association (network connection to another DICOM application).
+ */
+OFCondition AssociationHandler::processCommand()
+{
+  DcmDataset *statusDetail = NULL;
+
+  // receive a DIMSE command over the network
+  cond = DIMSE_receiveCommand(assoc, rcv->blockmode(), rcv->dimsetimeout(), &presID, &msg, &statusDetail);
+
+  // if the command which was received has extra status
+  // detail information, dump this information
+  if (statusDetail != NULL)
+  {
+    OFLOG_WARN(storescpLogger, "Status Detail:" << OFendl << DcmObject::PrintHelper(*statusDetail));
+    delete statusDetail;
+    statusDetail = NULL;
+  }
+
+  // check if peer did release or abort, or if we have a valid message
+  if (cond == EC_Normal)
+  {
+    // in case we received a valid message, process this command
+    // note that storescp can only process a C-ECHO-RQ and a C-STORE-RQ
+    switch (msg.CommandField)
+    {
+      case DIMSE_C_ECHO_RQ:
+        // process C-ECHO-Request
+        cond = echoSCP();
+        break;
+      case DIMSE_C_STORE_RQ:
+        // process C-STORE-Request
+        cond = storeSCP();
+        break;
+      default:
+        // we cannot handle this kind of message
+        cond = DIMSE_BADCOMMANDTYPE;
+        OFLOG_ERROR(storescpLogger, "cannot handle command: 0x"
+             << STD_NAMESPACE hex << OFstatic_cast(unsigned, msg.CommandField));
+        break;
+    }
+  }
+  return cond;
+}
+
+
+OFCondition AssociationHandler::echoSCP()
+{
+  OFString temp_str;
+  OFLOG_INFO(storescpLogger, "Received Echo Request");
+  rcv->metrics().add(Metrics::EchoRequests);
+  OFLOG_DEBUG(storescpLogger, DIMSE_dumpMessage(temp_str, msg.msg.CEchoRQ, DIMSE_INCOMING, NULL, presID));
+
+  /* the echo succeeded !! */
+  cond = DIMSE_sendEchoResponse(assoc, presID, &msg.msg.CEchoRQ, STATUS_Success, NULL);
+  if (cond.bad())
+  {
+    OFLOG_ERROR(storescpLogger, "Echo SCP Failed: " << DimseCondition::dump(temp_str, cond));
+  }
+  return cond;
+}
+
+
+/*
+ * This function processes a DIMSE C-STORE-RQ commmand that was
+ * received over the network connection.
+ *
+ * Parameters:
+ *   assoc  - [in] The association (network connection to another DICOM application).
+ *   msg    - [in] The DIMSE C-STORE-RQ message that was received.
+ *   presID - [in] The ID of the presentation context which was specified in the PDV which contained
+ *                 the DIMSE command.
+ */
+OFCondition AssociationHandler::storeSCP()
+{
+  T_DIMSE_C_StoreRQ *req;
+  char imageFileName[2048];
+
+  // assign the actual information of the C-STORE-RQ command to a local variable
+  req = &msg.msg.CStoreRQ;
+
+
+  // don't create new UID, use the study instance UID as found in object
+  sprintf(imageFileName, "%s%c%s.%s%s", rcv->outputdirectory().c_str(), PATH_SEPARATOR, dcmSOPClassUIDToModality(req->AffectedSOPClassUID, "UNKNOWN"),
+          req->AffectedSOPInstanceUID, rcv->filenameextension().c_str());
+
+
+  // dump some information if required
+  OFString str;
+  OFLOG_INFO(storescpLogger, "Received Store Request: MsgID " << req->MessageID << ", ("
+    << dcmSOPClassUIDToModality(req->AffectedSOPClassUID, "OT") << ")");
+  OFLOG_DEBUG(storescpLogger, DIMSE_dumpMessage(str, *req, DIMSE_INCOMING, NULL, presID));
+  rcv->metrics().add(Metrics::StoreRequests);
+
+  // intialize some variables
+  StoreCallbackData callbackData;
+  callbackData.handler = this;
+  callbackData.assoc = assoc;
+  callbackData.imageFileName = imageFileName;
+  callbackData.sopInstanceUID = QByteArray(req->AffectedSOPInstanceUID);
+  callbackData.duplicate = NULL;
+  callbackData.hash = NULL;
+  callbackData.digests = NULL;
+  callbackData.skipped = false;
+  callbackData.filed = false;
+
+  // the command names the SOP instance, so one which was stored before is known
+  // before the first byte of its data set arrives
+  InstanceRecord duplicate;
+  if (rcv->instanceindex() && rcv->writefiles() && !rcv->ignore()
+      && rcv->instanceindex()->find(callbackData.sopInstanceUID, duplicate))
+  {
+    callbackData.duplicate = &duplicate;
+    callbackData.skipped = (rcv->duplicatepolicy() == DuplicatePolicy::Skip);
+    if (rcv->duplicatepolicy() == DuplicatePolicy::Version)
+      sprintf(imageFileName, "%s%c%s.%s.v%d%s", rcv->outputdirectory().c_str(), PATH_SEPARATOR, dcmSOPClassUIDToModality(req->AffectedSOPClassUID, "UNKNOWN"),
+              req->AffectedSOPInstanceUID, int(duplicate.version) + 1, rcv->filenameextension().c_str());
+  }
+
+  // objects in a compressed or deflated transfer syntax are stored exactly as they come
+  // in; building them in memory would only mean decoding and encoding them again
+  T_ASC_PresentationContext presentationContext;
+  OFBool compressed = OFFalse;
+  if (ASC_findAcceptedPresentationContext(assoc->params, presID, &presentationContext).good())
+  {
+    DcmXfer xfer(presentationContext.acceptedTransferSyntax);
+    compressed = xfer.isEncapsulated() || (xfer.getStreamCompression() == ESC_zlib);
+  }
+
+  // a loop for in-memory delivery is only received into a pooled buffer on the streaming path
+  const OFBool pooled = rcv->pixelbufferpool() && rcv->loopdelivery();
+  const RawCineExport rawCine = rcv->rawcineexport();
+  callbackData.streamed = rcv->bitpreserving() || rcv->mappedfiles() || rcv->progressiveframes() || compressed || pooled || rcv->instanceindex() || rcv->filedigests()
+      || rawCine != RawCineExport::Off;
+  callbackData.frames = NULL;
+  callbackData.scanner = NULL;
+  StageTimer stages(rcv->metrics());
+  callbackData.stages = &stages;
+
+  // on the streaming path each incoming PDV is written straight to the output file and
+  // handed to the taps, so the data set is never parsed or held in memory; peak memory
+  // per association is bounded by the PDU size (plus the pixel buffer of a loop which is
+  // assembled for progressive or in-memory delivery) rather than by the size of the object.
+  if (callbackData.streamed)
+  {
+    // the taps always see the plain data set, a deflated one is inflated for them
+    FrameTap frameTap;
+    frameTap.setBufferPool(rcv->pixelbufferpool());
+    InflateTap inflateTap;
+    std::vector<StreamTap*> taps(1, &inflateTap);
+    // the content hash is taken over the data set as it is sent, deflated or not
+    HashTap hashTap;
+    if (rcv->instanceindex())
+    {
+      taps.push_back(&hashTap);
+      callbackData.hash = &hashTap;
+    }
+    if (rcv->progressiveframes())
+    {
+      CineLoopRcv *receiver = rcv;
+      frameTap.setFrameHandler([receiver](const CineFrame& frame) { receiver->emitFrameReceivedSignal(frame); });
+    }
+    // the raw cine file is written from the loop the frame tap assembles
+    const OFBool rawCineFile = rawCine != RawCineExport::Off && rcv->writefiles() && !rcv->ignore();
+    if ((rcv->progressiveframes() || rcv->loopdelivery() || rawCineFile) && !callbackData.skipped)
+    {
+      inflateTap.addTap(&frameTap);
+      callbackData.frames = &frameTap;
+    }
+
+    // the header elements are needed to file the object with its study and in the loop index
+    ScannerTap scannerTap;
+    scannerTap.addCaptureTags(LoopIndex::captureTags());
+    const char *fileName = NULL;
+    DigestTap digestTap(rcv->digestalgorithm());
+    if (rcv->writefiles() && !rcv->ignore() && !callbackData.skipped)
+    {
+      fileName = (rawCine == RawCineExport::Instead) ? NULL : imageFileName;
+      inflateTap.addTap(&scannerTap);
+      callbackData.scanner = &scannerTap;
+      // the digests are taken of the file as it is written, it is never read back for them
+      if (rcv->filedigests() && fileName)
+        callbackData.digests = &digestTap;
+      if (fileName && OFStandard::fileExists(imageFileName))
+      {
+        OFLOG_WARN(storescpLogger, "DICOM file already exists, overwriting: " << imageFileName);
+      }
+    }
+    callbackData.dcmff.reset();
+    if (fileName)
+      callbackData.fileName = fileName;
+    cond = streamingStoreProvider(assoc, presID, req, fileName, rcv->usemetaheader(), taps,
+                                  storeSCPCallback, &callbackData, rcv->blockmode(), rcv->dimsetimeout(), rcv->mappedfiles(),
+                                  callbackData.digests);
+    if (cond.bad())
+    {
+      OFString temp_str;
+      OFLOG_ERROR(storescpLogger, "Store SCP Failed: " << DimseCondition::dump(temp_str, cond));
+      rcv->metrics().error(cond);
+      // the provider removes the file if the data set itself failed; a failure after the
+      // callback filed the object (e.g. sending the response) must not take it away again,
+      // the indexes and the study point at it and a resend may be skipped as a duplicate
+      if (!callbackData.filed && !callbackData.fileName.empty() && !rcv->ignore())
+        OFStandard::deleteFile(callbackData.fileName.c_str());
+    }
+    return cond;
+  }
+
+  // the file format lives on the heap, it may outlive this call in the write-behind queue
+  std::shared_ptr<DcmFileFormat> dcmff = std::make_shared<DcmFileFormat>();
+  callbackData.dcmff = dcmff;
+
+  // store SourceApplicationEntityTitle in metaheader
+  if (assoc && assoc->params)
+  {
+    const char *aet = assoc->params->DULparams.callingAPTitle;
+    if (aet) dcmff->getMetaInfo()->putAndInsertString(DCM_SourceApplicationEntityTitle, aet);
+  }
+
+  // define an address where the information which will be received over the network will be stored
+  DcmDataset *dset = dcmff->getDataset();
+
+  cond = DIMSE_storeProvider(assoc, presID, req, NULL, rcv->usemetaheader(), &dset,
+                              storeSCPCallback, &callbackData, rcv->blockmode(), rcv->dimsetimeout());
+
+  // if some error occured, dump corresponding information and remove the outfile if necessary
+  if (cond.bad())
+  {
+    OFString temp_str;
+    OFLOG_ERROR(storescpLogger, "Store SCP Failed: " << DimseCondition::dump(temp_str, cond));
+    rcv->metrics().error(cond);
+    // remove the file which was written (in the directory of its study, if that is
+    // where it went), unless the object was filed before the failure
+    if (!rcv->ignore() && !callbackData.filed && !callbackData.fileName.empty()
+        && strcmp(callbackData.fileName.c_str(), NULL_DEVICE_NAME) != 0)
+      OFStandard::deleteFile(callbackData.fileName.c_str());
+  }
+#ifdef _WIN32
+  else if (rcv->ignore())
+  {
+    if (strcmp(imageFileName, NULL_DEVICE_NAME) != 0)
+      OFStandard::deleteFile(imageFileName); // delete the temporary file
+  }
+#endif
+
+  // return return value
+  return cond;
+}
+
+// instead of exiting throw exception
+OFCondition& AssociationHandler::cleanup()
+{
+    OFString temp_str;
+
+    if (cond.code() == DULC_FORKEDCHILD)
+        return cond;
+
+    cond = ASC_dropSCPAssociation(assoc);
+    if (cond.bad())
+    {
+        OFLOG_FATAL(storescpLogger, DimseCondition::dump(temp_str, cond));
+        return cond;
+    }
+    cond = ASC_destroyAssociation(&assoc);
+    if (cond.bad())
+    {
+        OFLOG_FATAL(storescpLogger, DimseCondition::dump(temp_str, cond));
+        return cond;
+    }
+
+  return cond;
+}
+
+}
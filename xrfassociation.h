@@ -0,0 +1,47 @@
+#pragma once
+
+#include "xrfcinelooprcv.h"
+
+#include <QRunnable>
+
+namespace xrf {
+
+/*
+ * Per-association state of the receiver. The listener thread of CineLoopRcv
+ * negotiates an association and hands it over to an AssociationHandler, which the
+ * reactor runs on the receiver's worker pool whenever a command comes in, so that
+ * several senders can push their cine loops at the same time. A run handles what has
+ * arrived and hands the association back to the reactor; once the association ends
+ * the handler deletes itself. Everything that used to live in CineLoopRcv for the
+ * duration of one association (assoc, msg, presID, cond) lives here now.
+ */
+class AssociationHandler : public QRunnable
+{
+public:
+    AssociationHandler(CineLoopRcv* rcv, T_ASC_Association* assoc);
+    ~AssociationHandler();
+
+    void run() Q_DECL_OVERRIDE;
+
+    CineLoopRcv*       receiver()    { return rcv; }
+    T_ASC_Association* association() { return assoc; }
+    /* socket of the association, -1 if it is not known */
+    qintptr            socket() const { return socketHandle; }
+
+protected:
+    OFCondition processCommand();
+    OFCondition echoSCP();
+    OFCondition storeSCP();
+    OFCondition& cleanup();
+
+private:
+    CineLoopRcv* rcv;
+    T_ASC_Association* assoc;
+    qintptr socketHandle;
+    OFCondition cond;
+
+    T_DIMSE_Message msg;
+    T_ASC_PresentationContextID presID;
+};
+
+}
@@ -0,0 +1,250 @@
+#include "xrfbufferpool.h"
+
+#include <QList>
+#include <QMutex>
+
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace xrf {
+
+namespace {
+
+struct Block
+{
+    void*  address;
+    size_t size;
+    bool   huge;
+};
+
+const size_t hugePageSize = 2 * 1024 * 1024;
+
+size_t systemPageSize()
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwPageSize;
+#else
+    const long size = sysconf(_SC_PAGESIZE);
+    return size > 0 ? size_t(size) : 4096;
+#endif
+}
+
+size_t roundUp(size_t value, size_t granularity)
+{
+    return (value + granularity - 1) / granularity * granularity;
+}
+
+/* fresh anonymous memory, page aligned and zeroed; address NULL on failure */
+Block mapBuffer(size_t size, bool hugePages)
+{
+    Block block = { NULL, size, false };
+#ifdef _WIN32
+    // large pages need SeLockMemoryPrivilege, without it the first call fails
+    const SIZE_T largePage = GetLargePageMinimum();
+    if (hugePages && largePage > 0 && size % largePage == 0)
+    {
+        block.address = VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+        block.huge = (block.address != NULL);
+    }
+    if (block.address == NULL)
+        block.address = VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+    void *address = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    // only succeeds if huge pages have been reserved (vm.nr_hugepages)
+    if (hugePages)
+    {
+        address = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        block.huge = (address != MAP_FAILED);
+    }
+#endif
+    if (address == MAP_FAILED)
+    {
+        address = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (address == MAP_FAILED)
+            return block;
+#ifdef MADV_HUGEPAGE
+        // transparent huge pages, the kernel backs the buffer with them as far as it can
+        if (hugePages)
+            block.huge = (madvise(address, size, MADV_HUGEPAGE) == 0);
+#endif
+    }
+    block.address = address;
+#endif
+    return block;
+}
+
+void unmapBuffer(const Block& block)
+{
+#ifdef _WIN32
+    VirtualFree(block.address, 0, MEM_RELEASE);
+#else
+    munmap(block.address, block.size);
+#endif
+}
+
+}
+
+struct PixelBufferPool::State
+{
+    State(qint64 capacity, bool hugePages)
+        : capacity(capacity), hugePages(hugePages), granularity(systemPageSize())
+    {
+        if (hugePages)
+        {
+#ifdef _WIN32
+            const size_t largePage = GetLargePageMinimum();
+            granularity = largePage > 0 ? largePage : hugePageSize;
+#else
+            granularity = hugePageSize;
+#endif
+        }
+    }
+
+    ~State()
+    {
+        for (const Block& block : idle)
+            unmapBuffer(block);
+    }
+
+    void release(const Block& block);
+
+    QMutex mutex;
+    const qint64 capacity;
+    const bool hugePages;
+    size_t granularity;
+    QList<Block> idle;              // released longest ago first
+    PixelBufferPoolStats stats;
+};
+
+void PixelBufferPool::State::release(const Block &block)
+{
+    std::vector<Block> evict;
+    {
+        QMutexLocker locker(&mutex);
+        stats.outstandingBytes -= qint64(block.size);
+        if (qint64(block.size) > capacity)
+            evict.push_back(block);
+        else
+        {
+            while (stats.pooledBytes + qint64(block.size) > capacity && !idle.isEmpty())
+            {
+                evict.push_back(idle.takeFirst());
+                stats.pooledBytes -= qint64(evict.back().size);
+            }
+            idle.append(block);
+            stats.pooledBytes += qint64(block.size);
+        }
+        stats.pooledBuffers = idle.size();
+        stats.evicted += evict.size();
+        for (const Block& b : evict)
+            if (b.huge) --stats.hugePageBuffers;
+    }
+    // unmapping a large buffer takes a while, not under the mutex
+    for (const Block& b : evict)
+        unmapBuffer(b);
+}
+
+
+PixelBufferPool::PixelBufferPool(qint64 capacityBytes, bool hugePages)
+    : state(std::make_shared<State>(qMax(Q_INT64_C(0), capacityBytes), hugePages))
+{
+
+}
+
+PixelBufferPool::~PixelBufferPool()
+{
+    // buffers still handed out keep the state alive and are unmapped with it
+    trim();
+}
+
+size_t PixelBufferPool::bufferSize(size_t bytes) const
+{
+    const size_t size = roundUp(qMax(bytes, size_t(1)), state->granularity);
+    size_t top = 1;
+    while (top <= size / 2)
+        top <<= 1;
+    return roundUp(size, qMax(state->granularity, top / 8));
+}
+
+std::shared_ptr<Uint8> PixelBufferPool::acquire(size_t bytes)
+{
+    const size_t size = bufferSize(bytes);
+    Block block = { NULL, size, false };
+    {
+        QMutexLocker locker(&state->mutex);
+        // the most recently released buffer of the class is the most likely to be resident
+        for (int i = state->idle.size() - 1; i >= 0; --i)
+        {
+            if (state->idle.at(i).size == size)
+            {
+                block = state->idle.takeAt(i);
+                state->stats.pooledBytes -= qint64(size);
+                state->stats.pooledBuffers = state->idle.size();
+                state->stats.outstandingBytes += qint64(size);
+                ++state->stats.hits;
+                break;
+            }
+        }
+    }
+    if (block.address == NULL)
+    {
+        block = mapBuffer(size, state->hugePages);
+        if (block.address == NULL)
+            return std::shared_ptr<Uint8>();
+        QMutexLocker locker(&state->mutex);
+        state->stats.outstandingBytes += qint64(size);
+        ++state->stats.misses;
+        if (block.huge) ++state->stats.hugePageBuffers;
+    }
+
+    std::weak_ptr<State> pool = state;
+    return std::shared_ptr<Uint8>(static_cast<Uint8*>(block.address), [pool, block](Uint8 *) {
+        if (std::shared_ptr<State> owner = pool.lock())
+            owner->release(block);
+        else
+            unmapBuffer(block);
+    });
+}
+
+void PixelBufferPool::trim()
+{
+    QList<Block> idle;
+    {
+        QMutexLocker locker(&state->mutex);
+        idle.swap(state->idle);
+        for (const Block& block : idle)
+            if (block.huge) --state->stats.hugePageBuffers;
+        state->stats.evicted += idle.size();
+        state->stats.pooledBytes = 0;
+        state->stats.pooledBuffers = 0;
+    }
+    for (const Block& block : idle)
+        unmapBuffer(block);
+}
+
+qint64 PixelBufferPool::capacity() const
+{
+    return state->capacity;
+}
+
+bool PixelBufferPool::hugePages() const
+{
+    return state->hugePages;
+}
+
+PixelBufferPoolStats PixelBufferPool::stats() const
+{
+    QMutexLocker locker(&state->mutex);
+    return state->stats;
+}
+
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "dcmtk/config/osconfig.h"    /* make sure OS specific configuration is included first */
+
+#include "dcmtk/ofstd/oftypes.h"
+
+#include <QtGlobal>
+
+#include <memory>
+
+namespace xrf {
+
+/* counters of a PixelBufferPool, see PixelBufferPool::stats() */
+struct PixelBufferPoolStats
+{
+    quint64 hits = 0;                   // acquire() served from the pool
+    quint64 misses = 0;                 // acquire() had to map a new buffer
+    quint64 evicted = 0;                // buffers unmapped to stay within the capacity
+    int     pooledBuffers = 0;
+    qint64  pooledBytes = 0;            // idle, ready for reuse
+    qint64  outstandingBytes = 0;       // handed out and not released yet
+    int     hugePageBuffers = 0;        // of the buffers alive, pooled or not
+};
+
+/*
+ * Pool of large page aligned buffers for the pixel data of received loops. Back to
+ * back loops of the same geometry would otherwise allocate and free hundreds of MB a
+ * minute, and every fresh mapping is paid for again in page faults. A buffer comes
+ * back to the pool when the last reference to it is dropped, i.e. when the consumers
+ * have released the loop (and every frame) which was received into it; buffers which
+ * are released after the pool is gone are simply unmapped. Sizes are rounded up to a
+ * class (a page, then eight classes per power of two), so loops of similar size share
+ * buffers. At most capacity bytes are kept idle, the buffers released longest ago are
+ * unmapped first. With huge pages buffers are backed by 2 MB pages where the system
+ * provides them (MAP_HUGETLB, else transparent huge pages on Linux, MEM_LARGE_PAGES on
+ * Windows), falling back to normal pages otherwise. The pool may be used from several
+ * threads.
+ */
+class PixelBufferPool
+{
+public:
+    explicit PixelBufferPool(qint64 capacityBytes = Q_INT64_C(1024) * 1024 * 1024, bool hugePages = false);
+    ~PixelBufferPool();
+
+    /* a buffer of at least bytes bytes, NULL if no memory could be mapped */
+    std::shared_ptr<Uint8> acquire(size_t bytes);
+
+    /* size of the buffer acquire(bytes) hands out */
+    size_t bufferSize(size_t bytes) const;
+
+    /* unmaps every idle buffer */
+    void trim();
+
+    qint64 capacity() const;
+    bool hugePages() const;
+    PixelBufferPoolStats stats() const;
+
+private:
+    struct State;
+    std::shared_ptr<State> state;
+};
+
+}
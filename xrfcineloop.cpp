@@ -0,0 +1,468 @@
+#include "xrfcineloop.h"
+#include "xrfdcmscan.h"
+#include "xrfheaderreader.h"
+#include "xrfmappedfile.h"
+#include "xrfprojection.h"
+#include "xrfrawcine.h"
+
+#include "dcmtk/dcmdata/dcdatset.h"
+#include "dcmtk/dcmdata/dcdeftag.h"
+#include "dcmtk/dcmdata/dcfilefo.h"
+#include "dcmtk/dcmdata/dcistrmb.h"
+#include "dcmtk/dcmdata/dcrledrg.h"
+#include "dcmtk/dcmdata/dcsequen.h"
+#include "dcmtk/dcmdata/dcxfer.h"
+
+#include <QList>
+
+#include <cstring>
+#include <mutex>
+#include <new>
+
+namespace xrf {
+
+static QString getString(DcmItem& dataset, const DcmTagKey& tag)
+{
+    OFString value;
+    if (dataset.findAndGetOFString(tag, value).good())
+        return QString::fromLatin1(value.c_str()).trimmed();
+    return QString();
+}
+
+static double getDouble(DcmItem& dataset, const DcmTagKey& tag, double fallback = 0.0)
+{
+    Float64 value;
+    if (dataset.findAndGetFloat64(tag, value).good())
+        return value;
+    return fallback;
+}
+
+static qint32 getInteger(DcmItem& dataset, const DcmTagKey& tag, qint32 fallback = 0)
+{
+    Sint32 value;
+    if (dataset.findAndGetSint32(tag, value).good())
+        return value;
+    return fallback;
+}
+
+bool getNumber(DcmItem &dataset, const DcmTagKey &tag, double &value, unsigned long pos)
+{
+    DcmElement *elem = NULL;
+    if (dataset.findAndGetElement(tag, elem).bad() || elem->getLength() == 0)
+        return false;
+
+    QByteArray text;
+    const DcmEVR vr = elem->ident();
+    if (vr == EVR_UN || vr == EVR_OB)
+    {
+        Uint8 *raw = NULL;
+        if (elem->getLength() > 64 || elem->getUint8Array(raw).bad() || raw == NULL)
+            return false;
+        text = QByteArray(OFreinterpret_cast(const char *, raw), int(elem->getLength()));
+    }
+    else
+    {
+        Float64 number;
+        if (elem->getFloat64(number, pos).good())
+        {
+            value = number;
+            return true;
+        }
+        OFString str;
+        if (elem->getOFString(str, pos).bad())
+            return false;
+        text = QByteArray(str.c_str());
+    }
+
+    const QList<QByteArray> values = text.split('\\');
+    if (pos >= unsigned(values.size()))
+        return false;
+    bool ok = false;
+    value = values.at(int(pos)).trimmed().toDouble(&ok);
+    return ok;
+}
+
+/* the per-frame values of CineGeometry which the functional groups of an enhanced
+ * object carry; readFunctionalGroup() returns the fields it found */
+enum FrameValue { FramePrimaryAngle, FrameSecondaryAngle, FrameSourceToDetector, FrameSourceToIsocenter, FrameValueCount };
+
+static const CineGeometry::Field frameValueFields[FrameValueCount] = {
+    CineGeometry::HasPositionerPrimaryAngle, CineGeometry::HasPositionerSecondaryAngle,
+    CineGeometry::HasDistanceSourceToDetector, CineGeometry::HasSourceToIsocenter
+};
+
+static quint32 readFunctionalGroup(DcmItem &group, double values[FrameValueCount])
+{
+    quint32 found = 0;
+    DcmItem *item = NULL;
+    if (group.findAndGetSequenceItem(DCM_PositionerPositionSequence, item, 0).good())
+    {
+        if (getNumber(*item, DCM_PositionerPrimaryAngle, values[FramePrimaryAngle])) found |= CineGeometry::HasPositionerPrimaryAngle;
+        if (getNumber(*item, DCM_PositionerSecondaryAngle, values[FrameSecondaryAngle])) found |= CineGeometry::HasPositionerSecondaryAngle;
+    }
+    if (group.findAndGetSequenceItem(DCM_XRayGeometrySequence, item, 0).good())
+    {
+        if (getNumber(*item, DCM_DistanceSourceToDetector, values[FrameSourceToDetector])) found |= CineGeometry::HasDistanceSourceToDetector;
+        if (getNumber(*item, DCM_DistanceSourceToIsocenter, values[FrameSourceToIsocenter])) found |= CineGeometry::HasSourceToIsocenter;
+    }
+    return found;
+}
+
+/* enhanced objects: the shared functional groups stand in for what the top level
+ * lacks, the per-frame ones override them frame by frame */
+static void readFunctionalGroups(CineGeometry &geometry, DcmItem &dataset)
+{
+    double *const scalars[FrameValueCount] = {
+        &geometry.positionerPrimaryAngle, &geometry.positionerSecondaryAngle, &geometry.distanceSourceToDetector, &geometry.sourceToIsocenter
+    };
+    std::vector<double> *const perFrame[FrameValueCount] = {
+        &geometry.framePrimaryAngles, &geometry.frameSecondaryAngles, &geometry.frameSourceToDetector, &geometry.frameSourceToIsocenter
+    };
+    DcmItem *group = NULL;
+    if (dataset.findAndGetSequenceItem(DCM_SharedFunctionalGroupsSequence, group, 0).good())
+    {
+        double values[FrameValueCount];
+        const quint32 found = readFunctionalGroup(*group, values);
+        for (int k = 0; k < FrameValueCount; ++k)
+        {
+            if ((found & frameValueFields[k]) && !geometry.has(frameValueFields[k]))
+            {
+                *scalars[k] = values[k];
+                geometry.fields |= frameValueFields[k];
+            }
+        }
+        DcmItem *pixels = NULL;
+        if (!geometry.has(CineGeometry::HasImagerPixelSpacing) && group->findAndGetSequenceItem(DCM_FramePixelDataPropertiesSequence, pixels, 0).good()
+            && getNumber(*pixels, DCM_ImagerPixelSpacing, geometry.imagerPixelSpacing[0], 0)
+            && getNumber(*pixels, DCM_ImagerPixelSpacing, geometry.imagerPixelSpacing[1], 1))
+            geometry.fields |= CineGeometry::HasImagerPixelSpacing;
+    }
+
+    DcmSequenceOfItems *frames = NULL;
+    if (dataset.findAndGetSequence(DCM_PerFrameFunctionalGroupsSequence, frames).good() && frames->card() > 0)
+    {
+        const unsigned long count = frames->card();
+        std::vector<double> values[FrameValueCount];
+        quint32 anyFound = 0;
+        for (int k = 0; k < FrameValueCount; ++k)
+            values[k].resize(count);
+        for (unsigned long f = 0; f < count; ++f)
+        {
+            double frame[FrameValueCount];
+            const quint32 found = frames->getItem(f) ? readFunctionalGroup(*frames->getItem(f), frame) : 0;
+            for (int k = 0; k < FrameValueCount; ++k)
+            {
+                // a frame without the value has the one of the run
+                values[k][f] = (found & frameValueFields[k]) ? frame[k] : *scalars[k];
+                if ((found & frameValueFields[k]) && !geometry.has(frameValueFields[k]) && f == 0)
+                {
+                    *scalars[k] = frame[k];
+                    geometry.fields |= frameValueFields[k];
+                }
+            }
+            anyFound |= found;
+        }
+        for (int k = 0; k < FrameValueCount; ++k)
+            if (anyFound & frameValueFields[k])
+                perFrame[k]->swap(values[k]);
+    }
+}
+
+OFCondition CineGeometry::read(DcmItem &dataset)
+{
+    *this = CineGeometry();
+    if (getNumber(dataset, DCM_DistanceSourceToDetector, distanceSourceToDetector)) fields |= HasDistanceSourceToDetector;
+    if (getNumber(dataset, DCM_DistanceSourceToPatient, distanceSourceToPatient)) fields |= HasDistanceSourceToPatient;
+    if (getNumber(dataset, DCM_EstimatedRadiographicMagnificationFactor, magnificationFactor)) fields |= HasMagnificationFactor;
+    if (getNumber(dataset, DCM_PositionerPrimaryAngle, positionerPrimaryAngle)) fields |= HasPositionerPrimaryAngle;
+    if (getNumber(dataset, DCM_PositionerSecondaryAngle, positionerSecondaryAngle)) fields |= HasPositionerSecondaryAngle;
+    if (getNumber(dataset, XRF_SourceToIsocenter, sourceToIsocenter)) fields |= HasSourceToIsocenter;
+    if (getNumber(dataset, XRF_DetectorRotation, detectorRotation)) fields |= HasDetectorRotation;
+    if (getNumber(dataset, DCM_ImagerPixelSpacing, imagerPixelSpacing[0], 0)
+        && getNumber(dataset, DCM_ImagerPixelSpacing, imagerPixelSpacing[1], 1))
+        fields |= HasImagerPixelSpacing;
+
+    // rotational runs: one increment per frame, relative to the angles of the run
+    double value;
+    for (unsigned long pos = 0; getNumber(dataset, DCM_PositionerPrimaryAngleIncrement, value, pos); ++pos)
+        framePrimaryAngles.push_back(positionerPrimaryAngle + value);
+    for (unsigned long pos = 0; getNumber(dataset, DCM_PositionerSecondaryAngleIncrement, value, pos); ++pos)
+        frameSecondaryAngles.push_back(positionerSecondaryAngle + value);
+
+    readFunctionalGroups(*this, dataset);
+    return EC_Normal;
+}
+
+OFCondition CineGeometry::read(const DatasetScanner &scanner)
+{
+    *this = CineGeometry();
+    if (scanner.getFloat64(DCM_DistanceSourceToDetector, distanceSourceToDetector)) fields |= HasDistanceSourceToDetector;
+    if (scanner.getFloat64(DCM_DistanceSourceToPatient, distanceSourceToPatient)) fields |= HasDistanceSourceToPatient;
+    if (scanner.getFloat64(DCM_EstimatedRadiographicMagnificationFactor, magnificationFactor)) fields |= HasMagnificationFactor;
+    if (scanner.getFloat64(DCM_PositionerPrimaryAngle, positionerPrimaryAngle)) fields |= HasPositionerPrimaryAngle;
+    if (scanner.getFloat64(DCM_PositionerSecondaryAngle, positionerSecondaryAngle)) fields |= HasPositionerSecondaryAngle;
+    if (scanner.getFloat64(XRF_SourceToIsocenter, sourceToIsocenter)) fields |= HasSourceToIsocenter;
+    if (scanner.getFloat64(XRF_DetectorRotation, detectorRotation)) fields |= HasDetectorRotation;
+    if (scanner.getFloat64(DCM_ImagerPixelSpacing, imagerPixelSpacing[0], 0)
+        && scanner.getFloat64(DCM_ImagerPixelSpacing, imagerPixelSpacing[1], 1))
+        fields |= HasImagerPixelSpacing;
+
+    double value;
+    for (long pos = 0; scanner.getFloat64(DCM_PositionerPrimaryAngleIncrement, value, pos); ++pos)
+        framePrimaryAngles.push_back(positionerPrimaryAngle + value);
+    for (long pos = 0; scanner.getFloat64(DCM_PositionerSecondaryAngleIncrement, value, pos); ++pos)
+        frameSecondaryAngles.push_back(positionerSecondaryAngle + value);
+
+    // the scanner keeps the functional group sequences as they were encoded, they are
+    // parsed on their own; shared (5200,9229) comes before per-frame (5200,9230)
+    QByteArray encoded, sequence;
+    if (scanner.getSequence(DCM_SharedFunctionalGroupsSequence, sequence))
+        encoded += sequence;
+    if (scanner.getSequence(DCM_PerFrameFunctionalGroupsSequence, sequence))
+        encoded += sequence;
+    if (!encoded.isEmpty())
+    {
+        DcmDataset groups;
+        DcmInputBufferStream stream;
+        stream.setBuffer(encoded.constData(), offile_off_t(encoded.size()));
+        stream.setEos();
+        groups.transferInit();
+        const OFCondition cond = groups.read(stream, scanner.transferSyntax());
+        groups.transferEnd();
+        // without them the geometry is that of the top level, as for a legacy object
+        if (cond.good())
+            readFunctionalGroups(*this, groups);
+    }
+    return EC_Normal;
+}
+
+std::vector<DcmTagKey> CineGeometry::captureTags()
+{
+    return {
+        DCM_DistanceSourceToDetector, DCM_DistanceSourceToPatient, DCM_EstimatedRadiographicMagnificationFactor,
+        DCM_PositionerPrimaryAngle, DCM_PositionerSecondaryAngle, XRF_SourceToIsocenter, XRF_DetectorRotation,
+        DCM_ImagerPixelSpacing, DCM_PositionerPrimaryAngleIncrement, DCM_PositionerSecondaryAngleIncrement,
+        DCM_SharedFunctionalGroupsSequence, DCM_PerFrameFunctionalGroupsSequence
+    };
+}
+
+size_t CineLoopInfo::frameBytes() const
+{
+    return size_t(rows) * columns * samplesPerPixel * ((bitsAllocated + 7) / 8);
+}
+
+OFCondition CineLoopInfo::read(DcmItem &dataset)
+{
+    sopClassUID = getString(dataset, DCM_SOPClassUID);
+    sopInstanceUID = getString(dataset, DCM_SOPInstanceUID);
+    studyInstanceUID = getString(dataset, DCM_StudyInstanceUID);
+    seriesInstanceUID = getString(dataset, DCM_SeriesInstanceUID);
+    photometricInterpretation = getString(dataset, DCM_PhotometricInterpretation);
+
+    OFCondition cond = dataset.findAndGetUint16(DCM_Rows, rows);
+    if (cond.good()) cond = dataset.findAndGetUint16(DCM_Columns, columns);
+    if (cond.good()) cond = dataset.findAndGetUint16(DCM_BitsAllocated, bitsAllocated);
+    if (cond.bad())
+        return cond;
+    if (dataset.findAndGetUint16(DCM_SamplesPerPixel, samplesPerPixel).bad()) samplesPerPixel = 1;
+    if (dataset.findAndGetUint16(DCM_BitsStored, bitsStored).bad()) bitsStored = bitsAllocated;
+    if (dataset.findAndGetUint16(DCM_HighBit, highBit).bad()) highBit = bitsStored - 1;
+    if (dataset.findAndGetUint16(DCM_PixelRepresentation, pixelRepresentation).bad()) pixelRepresentation = 0;
+
+    numberOfFrames = qMax(1, getInteger(dataset, DCM_NumberOfFrames, 1));
+    frameTime = getDouble(dataset, DCM_FrameTime);
+    recommendedFrameRate = getDouble(dataset, DCM_RecommendedDisplayFrameRate);
+    cineRate = getDouble(dataset, DCM_CineRate);
+    startTrim = getInteger(dataset, DCM_StartTrim);
+    stopTrim = getInteger(dataset, DCM_StopTrim);
+    windowCenter = getDouble(dataset, DCM_WindowCenter);
+    windowWidth = getDouble(dataset, DCM_WindowWidth);
+    geometry.read(dataset);
+
+    return EC_Normal;
+}
+
+OFCondition CineLoopInfo::read(const DatasetScanner &scanner)
+{
+    OFString value;
+    Sint32 number;
+    double real;
+
+    if (!scanner.getUint16(DCM_Rows, rows) || !scanner.getUint16(DCM_Columns, columns) || !scanner.getUint16(DCM_BitsAllocated, bitsAllocated))
+        return EC_TagNotFound;
+
+    sopClassUID = scanner.getString(DCM_SOPClassUID, value) ? QString::fromLatin1(value.c_str()) : QString();
+    sopInstanceUID = scanner.getString(DCM_SOPInstanceUID, value) ? QString::fromLatin1(value.c_str()) : QString();
+    studyInstanceUID = scanner.getString(DCM_StudyInstanceUID, value) ? QString::fromLatin1(value.c_str()) : QString();
+    seriesInstanceUID = scanner.getString(DCM_SeriesInstanceUID, value) ? QString::fromLatin1(value.c_str()) : QString();
+    photometricInterpretation = scanner.getString(DCM_PhotometricInterpretation, value) ? QString::fromLatin1(value.c_str()) : QString();
+
+    if (!scanner.getUint16(DCM_SamplesPerPixel, samplesPerPixel)) samplesPerPixel = 1;
+    if (!scanner.getUint16(DCM_BitsStored, bitsStored)) bitsStored = bitsAllocated;
+    if (!scanner.getUint16(DCM_HighBit, highBit)) highBit = bitsStored - 1;
+    if (!scanner.getUint16(DCM_PixelRepresentation, pixelRepresentation)) pixelRepresentation = 0;
+
+    numberOfFrames = scanner.getSint32(DCM_NumberOfFrames, number) ? qMax(1, int(number)) : 1;
+    frameTime = scanner.getFloat64(DCM_FrameTime, real) ? real : 0.0;
+    recommendedFrameRate = scanner.getFloat64(DCM_RecommendedDisplayFrameRate, real) ? real : 0.0;
+    cineRate = scanner.getFloat64(DCM_CineRate, real) ? real : 0.0;
+    startTrim = scanner.getSint32(DCM_StartTrim, number) ? number : 0;
+    stopTrim = scanner.getSint32(DCM_StopTrim, number) ? number : 0;
+    windowCenter = scanner.getFloat64(DCM_WindowCenter, real) ? real : 0.0;
+    windowWidth = scanner.getFloat64(DCM_WindowWidth, real) ? real : 0.0;
+    geometry.read(scanner);
+
+    xfer = scanner.transferSyntax();
+    return EC_Normal;
+}
+
+
+CineLoop::CineLoop(const CineLoopInfo &info, std::shared_ptr<const void> owner, const Uint8 *pixels, size_t pixelBytes,
+                   size_t frameStride)
+    : mInfo(info), mOwner(std::move(owner)), mPixels(pixels), mPixelBytes(pixelBytes),
+      mStride(frameStride ? frameStride : info.frameBytes())
+{
+
+}
+
+CineLoopPtr CineLoop::fromFileFormat(const std::shared_ptr<DcmFileFormat> &fileformat, OFCondition *status)
+{
+    OFCondition cond = EC_Normal;
+    CineLoopPtr loop;
+    DcmDataset *dset = fileformat ? fileformat->getDataset() : NULL;
+
+    CineLoopInfo info;
+    if (dset == NULL)
+        cond = EC_IllegalCall;
+    if (cond.good())
+    {
+        info.xfer = dset->getOriginalXfer();
+        cond = info.read(*dset);
+    }
+    // compressed pixel data would have to be decoded, which is not our business here
+    if (cond.good() && DcmXfer(info.xfer).isEncapsulated())
+        cond = EC_UnsupportedEncoding;
+
+    DcmElement *elem = NULL;
+    if (cond.good())
+        cond = dset->findAndGetElement(DCM_PixelData, elem);
+
+    // hand out the element's own value buffer, dcmdata keeps it in the local byte order
+    Uint8 *pixels = NULL;
+    if (cond.good())
+    {
+        if (info.bitsAllocated > 8)
+        {
+            Uint16 *words = NULL;
+            cond = elem->getUint16Array(words);
+            pixels = OFreinterpret_cast(Uint8 *, words);
+        }
+        else
+            cond = elem->getUint8Array(pixels);
+    }
+
+    if (cond.good())
+    {
+        const size_t pixelBytes = elem->getLength();
+        if (pixels == NULL || pixelBytes < info.frameBytes() * size_t(info.numberOfFrames))
+            cond = EC_CorruptedData;
+        else
+            loop = std::make_shared<const CineLoop>(info, fileformat, pixels, pixelBytes);
+    }
+
+    if (status) *status = cond;
+    return loop;
+}
+
+/* loads a file the mapping cannot serve (compressed, or in the other byte order) and
+ * decodes its pixel data into memory; RLE is always available, other codecs (JPEG,
+ * JPEG-LS) if the application registered their decoders */
+static CineLoopPtr decodeFile(const QString &fileName, OFCondition *status)
+{
+    static std::once_flag rleDecoder;
+    std::call_once(rleDecoder, []() { DcmRLEDecoderRegistration::registerCodecs(); });
+
+    CineLoopPtr loop;
+    std::shared_ptr<DcmFileFormat> fileformat = std::make_shared<DcmFileFormat>();
+    OFCondition cond = fileformat->loadFile(fileName.toLocal8Bit().constData());
+    DcmDataset *dset = fileformat->getDataset();
+    if (cond.good() && DcmXfer(dset->getOriginalXfer()).isEncapsulated())
+    {
+        cond = dset->chooseRepresentation(EXS_LittleEndianExplicit, NULL);
+        if (cond.good() && !dset->canWriteXfer(EXS_LittleEndianExplicit))
+            cond = EC_UnsupportedEncoding;
+        // fromFileFormat() takes the encoding from the original transfer syntax
+        if (cond.good())
+            dset->updateOriginalXfer();
+    }
+    if (cond.good())
+        loop = CineLoop::fromFileFormat(fileformat, &cond);
+
+    if (status) *status = cond;
+    return loop;
+}
+
+CineLoopPtr CineLoop::fromFile(const QString &fileName, OFCondition *status)
+{
+    if (fileName.endsWith(RawCineExtension, Qt::CaseInsensitive))
+        return RawCineFile::loop(RawCineFile::open(fileName, status), status);
+
+    CineLoopPtr loop;
+    HeaderReader header(fileName);
+    OFCondition cond = header.read();
+
+    CineLoopInfo info;
+    if (cond.good() && (!header.pixelDataFound() || header.scanner().pixelDataEncapsulated()))
+        cond = EC_UnsupportedEncoding;
+    if (cond.good())
+        cond = info.read(header.scanner());
+    // the mapping is read-only, data in the other byte order would have to be swapped
+    if (cond.good() && info.bitsAllocated > 8 && DcmXfer(info.xfer).getByteOrder() != gLocalByteOrder)
+        cond = EC_UnsupportedEncoding;
+    info.xfer = EXS_LittleEndianExplicit;
+
+    if (cond == EC_UnsupportedEncoding && header.pixelDataFound())
+        return decodeFile(fileName, status);
+
+    std::shared_ptr<const MappedFile> file;
+    if (cond.good())
+        file = MappedFile::open(fileName, &cond);
+
+    if (cond.good())
+    {
+        const size_t pixelBytes = header.pixelDataLength();
+        const quint64 offset = quint64(header.pixelDataFileOffset());
+        if (offset + pixelBytes > file->size() || pixelBytes < info.frameBytes() * size_t(info.numberOfFrames))
+            cond = EC_CorruptedData;
+        else
+            loop = std::make_shared<const CineLoop>(info, file, file->data() + offset, pixelBytes);
+    }
+
+    if (status) *status = cond;
+    return loop;
+}
+
+const Uint8* CineLoop::frame(int index) const
+{
+    if (index < 0 || index >= mInfo.numberOfFrames)
+        return NULL;
+    return mPixels + size_t(index) * mStride;
+}
+
+CineLoopPtr CineLoop::copy(const CineLoop &loop)
+{
+    std::shared_ptr<Uint8> pixels(new (std::nothrow) Uint8[qMax(loop.mPixelBytes, size_t(1))], std::default_delete<Uint8[]>());
+    if (!pixels)
+        return CineLoopPtr();
+    memcpy(pixels.get(), loop.mPixels, loop.mPixelBytes);
+    return std::make_shared<const CineLoop>(loop.mInfo, pixels, pixels.get(), loop.mPixelBytes, loop.mStride);
+}
+
+std::shared_ptr<const ProjectionSet> CineLoop::projections() const
+{
+    // consumers on several threads may ask at once, the first one computes them
+    std::call_once(mProjectionsOnce, [this]() { mProjections = ProjectionSet::compute(mInfo); });
+    return mProjections;
+}
+
+}
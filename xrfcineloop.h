@@ -0,0 +1,184 @@
+#pragma once
+
+#include "dcmtk/config/osconfig.h"    /* make sure OS specific configuration is included first */
+
+#include "dcmtk/dcmdata/dcfilefo.h"
+
+#include <QMetaType>
+#include <QString>
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace xrf {
+
+class DatasetScanner;
+class ProjectionSet;
+
+/* private Siemens AX elements we need for the reconstruction, see docs/DICOM-TAG.txt */
+const DcmTagKey XRF_SourceToIsocenter(0x0021, 0x1017);
+const DcmTagKey XRF_DetectorRotation(0x0021, 0x1071);
+
+/* a numeric value from a data set; private elements the dictionary does not know are
+ * read as UN, in which case the value is parsed from the raw (string) bytes */
+bool getNumber(DcmItem& dataset, const DcmTagKey& tag, double& value, unsigned long pos = 0);
+
+/*
+ * Acquisition geometry of an X-ray loop, the IMPORTANT fields of docs/DICOM-TAG.txt.
+ * A value is only meaningful if its flag is set in fields.
+ */
+struct CineGeometry
+{
+    enum Field {
+        HasDistanceSourceToDetector = 0x001,
+        HasDistanceSourceToPatient  = 0x002,
+        HasMagnificationFactor      = 0x004,
+        HasPositionerPrimaryAngle   = 0x008,
+        HasPositionerSecondaryAngle = 0x010,
+        HasSourceToIsocenter        = 0x020,
+        HasDetectorRotation         = 0x040,
+        HasImagerPixelSpacing       = 0x080
+    };
+
+    quint32  fields = 0;
+    double   distanceSourceToDetector = 0.0;    // (0018,1110) mm
+    double   distanceSourceToPatient = 0.0;     // (0018,1111) mm
+    double   magnificationFactor = 0.0;         // (0018,1114)
+    double   positionerPrimaryAngle = 0.0;      // (0018,1510) deg, LAO +
+    double   positionerSecondaryAngle = 0.0;    // (0018,1511) deg, CRA +
+    double   sourceToIsocenter = 0.0;           // (0021,1017) mm
+    double   detectorRotation = 0.0;            // (0021,1071) deg
+    double   imagerPixelSpacing[2] = { 0.0, 0.0 };  // (0018,1164) mm, between rows \ columns
+
+    /* one value per frame where the geometry changes during the run (rotational
+     * acquisitions), empty where it does not: the positioner angles from the angle
+     * increments (0018,1520/1521), which are relative to the angles above, or the
+     * angles and distances of the per-frame functional groups of an enhanced object.
+     * read(scanner) parses the functional group sequences the scanner captured. */
+    std::vector<double> framePrimaryAngles;
+    std::vector<double> frameSecondaryAngles;
+    std::vector<double> frameSourceToDetector;
+    std::vector<double> frameSourceToIsocenter;
+
+    bool has(Field field) const             { return (fields & field) != 0; }
+
+    OFCondition read(DcmItem& dataset);
+    OFCondition read(const DatasetScanner& scanner);
+    /* the elements read(scanner) needs to have been captured */
+    static std::vector<DcmTagKey> captureTags();
+};
+
+/* the attributes of a received loop which consumers need without touching dcmdata */
+struct CineLoopInfo
+{
+    QString  sopClassUID;
+    QString  sopInstanceUID;
+    QString  studyInstanceUID;
+    QString  seriesInstanceUID;
+    QString  photometricInterpretation;
+
+    quint16  rows = 0;
+    quint16  columns = 0;
+    quint16  samplesPerPixel = 1;
+    quint16  bitsAllocated = 0;
+    quint16  bitsStored = 0;
+    quint16  highBit = 0;
+    quint16  pixelRepresentation = 0;       // 0 unsigned, 1 signed
+    qint32   numberOfFrames = 1;
+
+    double   frameTime = 0.0;               // (0018,1063) ms/frame, 0 if absent
+    double   recommendedFrameRate = 0.0;    // (0008,2144) frames/s, 0 if absent
+    double   cineRate = 0.0;                // (0018,0040) frames/s, 0 if absent
+    qint32   startTrim = 0;                 // (0008,2142), 1-based, 0 if absent
+    qint32   stopTrim = 0;                  // (0008,2143), 1-based, 0 if absent
+    double   windowCenter = 0.0;            // (0028,1050) first value
+    double   windowWidth = 0.0;             // (0028,1051) first value, 0 if absent
+
+    CineGeometry geometry;
+
+    E_TransferSyntax xfer = EXS_Unknown;
+
+    /* bytes of one frame of native (uncompressed) pixel data */
+    size_t frameBytes() const;
+
+    /* fills the attributes from a data set; fails if the image pixel module is incomplete */
+    OFCondition read(DcmItem& dataset);
+    /* same from the elements a DatasetScanner captured on the fly */
+    OFCondition read(const DatasetScanner& scanner);
+};
+
+/*
+ * Immutable, reference counted cine loop: metadata plus one contiguous buffer of
+ * native pixel data in the local byte order. The pixel buffer is not copied out of
+ * whatever received it; the loop keeps its owner (e.g. the DcmFileFormat the
+ * receiver built) alive instead, so handing a CineLoopPtr across threads costs a
+ * reference count increment.
+ */
+class CineLoop
+{
+public:
+    /* frameStride: bytes from one frame to the next if the frames are padded, 0 if they are not */
+    CineLoop(const CineLoopInfo& info, std::shared_ptr<const void> owner, const Uint8* pixels, size_t pixelBytes,
+             size_t frameStride = 0);
+
+    /* wraps the native pixel data of a received file format without copying it; the
+     * loop is only immutable as long as nobody writes fileformat in the other byte
+     * order, which dcmdata does by swapping the buffer in place (see copy()) */
+    static std::shared_ptr<const CineLoop> fromFileFormat(const std::shared_ptr<DcmFileFormat>& fileformat, OFCondition* status = nullptr);
+    /* maps a stored file and points into the mapping, the pixel data is not copied,
+     * for native pixel data in the local byte order (or with 8 bits allocated). Other
+     * files are loaded and decoded into memory: RLE always, JPEG and JPEG-LS if their
+     * decoders are registered. Raw cine files (see RawCineFile) are recognised by
+     * their extension. */
+    static std::shared_ptr<const CineLoop> fromFile(const QString& fileName, OFCondition* status = nullptr);
+    /* a loop with a copy of the pixel data of loop, for when the owner of its buffer is
+     * about to change it (e.g. dcmdata byte swapping it in place while writing a file);
+     * null if the memory cannot be had */
+    static std::shared_ptr<const CineLoop> copy(const CineLoop& loop);
+
+    const CineLoopInfo& info() const        { return mInfo; }
+    int           frameCount() const        { return mInfo.numberOfFrames; }
+    size_t        frameBytes() const        { return mInfo.frameBytes(); }
+    size_t        frameStride() const       { return mStride; }
+    const Uint8*  pixelData() const         { return mPixels; }
+    size_t        pixelDataBytes() const    { return mPixelBytes; }
+
+    /* start of frame index (0-based), NULL if out of range */
+    const Uint8*  frame(int index) const;
+
+    /* projection matrices of the frames (see ProjectionSet), computed on first use and
+     * kept with the loop; the receiver computes them before it hands the loop out if
+     * asked to (CineLoopRcv::setProjectionGeometry()). Null if the geometry is incomplete. */
+    std::shared_ptr<const ProjectionSet> projections() const;
+
+private:
+    CineLoopInfo mInfo;
+    std::shared_ptr<const void> mOwner;
+    const Uint8* mPixels;
+    size_t mPixelBytes;
+    size_t mStride;
+    mutable std::once_flag mProjectionsOnce;
+    mutable std::shared_ptr<const ProjectionSet> mProjections;
+};
+
+typedef std::shared_ptr<const CineLoop> CineLoopPtr;
+
+/*
+ * One frame of a loop which is still being received. pixels points into the buffer
+ * the loop is received into (native, local byte order) and stays valid as long as
+ * the frame (or a copy of it) is alive.
+ */
+struct CineFrame
+{
+    std::shared_ptr<const CineLoopInfo> info;
+    std::shared_ptr<const void> owner;
+    int          index = 0;                 // 0-based
+    const Uint8* pixels = nullptr;
+    size_t       bytes = 0;
+};
+
+}
+
+Q_DECLARE_METATYPE(xrf::CineLoopPtr)
+Q_DECLARE_METATYPE(xrf::CineFrame)
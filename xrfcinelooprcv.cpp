@@ -1,142 +1,94 @@
 #include "xrfcinelooprcv.h"
+#include "xrfassociation.h"
 
-namespace xrf {
-struct StoreCallbackData
-{
-  CineLoopRcv* rcv;
-  char* imageFileName;
-  DcmFileFormat* dcmff;
-  T_ASC_Association* assoc;
-};
-
-/*
- * This function.is used to indicate progress when storescp receives instance data over the
- * network. On the final call to this function (identified by progress->state == DIMSE_StoreEnd)
- * this function will store the data set which was received over the network to a file.
- * Earlier calls to this function will simply cause some information to be dumped to stdout.
- *
- * Parameters:
- *   callbackData  - [in] data for this callback function
- *   progress      - [in] The state of progress. (identifies if this is the initial or final call
- *                   to this function, or a call in between these two calls.
- *   req           - [in] The original store request message.
- *   imageFileName - [in] The path to and name of the file the information shall be written to.
- *   imageDataSet  - [in] The data set which shall be stored in the image file
- *   rsp           - [inout] the C-STORE-RSP message (will be sent after the call to this function)
- *   statusDetail  - [inout] This variable can be used to capture detailed information with regard to
- *                   the status information which is captured in the status element (0000,0900). Note
- *                   that this function does specify any such information, the pointer will be set to NULL.
- */
-static void storeSCPCallback(void *callbackData,
-                             T_DIMSE_StoreProgress *progress,
-                             T_DIMSE_C_StoreRQ * /*req*/,
-                             char * /*imageFileName*/,
-                             DcmDataset **imageDataSet,
-                             T_DIMSE_C_StoreRSP *rsp,
-                             DcmDataset **statusDetail)
-{
-  // dump some information if required (depending on the progress state)
-  // We can't use oflog for the pdu output, but we use a special logger for
-  // generating this output. If it is set to level "INFO" we generate the
-  // output, if it's set to "DEBUG" then we'll assume that there is debug output
-  // generated for each PDU elsewhere.
-  OFLogger progressLogger = OFLog::getLogger("dcmtk.apps." OFFIS_CONSOLE_APPLICATION ".progress");
-  if (progressLogger.getChainedLogLevel() == OFLogger::INFO_LOG_LEVEL)
-  {
-    switch (progress->state)
-    {
-      case DIMSE_StoreBegin:
-        COUT << "RECV: ";
-        break;
-      case DIMSE_StoreEnd:
-        COUT << OFendl;
-        break;
-      default:
-        COUT << '.';
-        break;
-    }
-    COUT.flush();
-  }
-
-  // if this is the final call of this function, save the data which was received to a file
-  // (note that we could also save the image somewhere else, put it in database, etc.)
-  if (progress->state == DIMSE_StoreEnd)
-  {
-    OFString tmpStr;
-
-    // do not send status detail information
-    *statusDetail = NULL;
-
-    // remember callback data
-    StoreCallbackData *cbdata = OFstatic_cast(StoreCallbackData *, callbackData);
-
-    // Concerning the following line: an appropriate status code is already set in the resp structure,
-    // it need not be success. For example, if the caller has already detected an out of resources problem
-    // then the status will reflect this.  The callback function is still called to allow cleanup.
-    //rsp->DimseStatus = STATUS_Success;
-
-    // we want to write the received information to a file only if this information
-    // is present and the options opt_bitPreserving and opt_ignore are not set.
-    if ((imageDataSet != NULL) && (*imageDataSet != NULL) && !cbdata->rcv->ignore())
-    {
-      OFString fileName;
+#include <QDateTime>
+#include <QRunnable>
 
-      fileName = cbdata->imageFileName;
+#include <functional>
 
-      // update global variables outputFileNameArray
-      // (might be used in executeOnReception() and renameOnEndOfStudy)
-      cbdata->rcv->outputfilenamearray().push_back(OFStandard::getFilenameFromPath(tmpStr, fileName));
-
-      // determine the transfer syntax which shall be used to write the information to the file
-      E_TransferSyntax xfer =  cbdata->rcv->writetransfersyntax();
-      if (xfer == EXS_Unknown) xfer = (*imageDataSet)->getOriginalXfer();
-
-      // store file either with meta header or as pure dataset
-      OFLOG_INFO(storescpLogger, "storing DICOM file: " << fileName);
-      if (OFStandard::fileExists(fileName))
-      {
-        OFLOG_WARN(storescpLogger, "DICOM file already exists, overwriting: " << fileName);
-      }
-      OFCondition cond = cbdata->dcmff->saveFile(fileName.c_str(), xfer, cbdata->rcv->sequencetype(), cbdata->rcv->grouplength(),
-          cbdata->rcv->paddingtype(), OFstatic_cast(Uint32, cbdata->rcv->filepad()), OFstatic_cast(Uint32, cbdata->rcv->itempad()),
-          (cbdata->rcv->usemetaheader()) ? EWM_fileformat : EWM_dataset);
-      if (cond.bad())
-      {
-        OFLOG_ERROR(storescpLogger, "cannot write DICOM file: " << fileName << ": " << cond.text());
-        rsp->DimseStatus = STATUS_STORE_Refused_OutOfResources;
-      }
-      else // file saved succesfully
-      {
-          cbdata->rcv->emitCineLoopReceivedSignal(QString(fileName.c_str()));
-      }
-    }
-  }
-}
+namespace xrf {
 
+/* configured plus the three uncompressed transfer syntaxes */
+static const int maxTransferSyntaxes = 28;
 
 CineLoopRcv::CineLoopRcv(const QString &outdir, const QString &fileextension, unsigned int port, long eostudy_timeout, bool promiscuous, QObject *parent)
-    : QThread(parent), stopRunning(false), net(NULL), assoc(NULL), cond(EC_Normal),
-      opt_outputDirectory(outdir.toStdString().c_str()), presID(0),
+    : QThread(parent), stopRunning(false), listenSocket(-1), listening(false), deadlineReached(false), studies(outdir), net(NULL), cond(EC_Normal),
+      opt_outputDirectory(outdir.toStdString().c_str()),
       opt_fileNameExtension(fileextension.toStdString().c_str()),
       opt_port(port), opt_maxPDU(ASC_DEFAULTMAXPDU), opt_useMetaheader(OFTrue),
       opt_networkTransferSyntax(EXS_Unknown), opt_writeTransferSyntax(EXS_Unknown),
       opt_groupLength(EGL_recalcGL), opt_sequenceType(EET_ExplicitLength),
       opt_paddingType(EPD_withoutPadding), opt_filepad(0),opt_itempad(0),
-      opt_ignore(OFFalse), opt_promiscuous(promiscuous),opt_respondingAETitle(APPLICATIONTITLE),
+      opt_ignore(OFFalse), opt_bitPreserving(OFFalse), opt_mappedFiles(OFFalse),
+      opt_loopDelivery(OFFalse), opt_writeFiles(OFTrue), opt_progressiveFrames(OFFalse), opt_promiscuous(promiscuous),opt_hashedAcceptance(OFTrue),opt_duplicatePolicy(DuplicatePolicy::Overwrite),opt_fileDigests(OFFalse),opt_digestAlgorithm(DigestAlgorithm::Best),opt_rawCineExport(RawCineExport::Off),opt_projectionGeometry(OFFalse),opt_respondingAETitle(APPLICATIONTITLE),
       opt_blockMode(DIMSE_BLOCKING), opt_dimse_timeout(0),
-      opt_endOfStudyTimeout(eostudy_timeout),opt_acse_timeout(30)
+      opt_endOfStudyTimeout(eostudy_timeout),opt_acse_timeout(30),
+      opt_maxAssociations(1), opt_shutdownDeadline(5000)
+{
+    studies.setTimeout(eostudy_timeout < 0 ? -1 : qint64(eostudy_timeout) * 1000);
+    qRegisterMetaType<xrf::CineLoopPtr>("xrf::CineLoopPtr");
+    qRegisterMetaType<xrf::CineFrame>("xrf::CineFrame");
+
+}
+
+/* most preferred first: the configured (compressed) transfer syntaxes in their order,
+ * then the uncompressed ones. Deflate needs zlib on our side, without it the syntax is
+ * not offered; with nativeOnly the encapsulated syntaxes are left out as well. Returns
+ * the number of entries used in transferSyntaxes.
+ */
+static int preferredTransferSyntaxes(const std::vector<E_TransferSyntax>& configured, OFBool nativeOnly, const char* transferSyntaxes[maxTransferSyntaxes])
 {
+  int numTransferSyntaxes = 0;
+  for (E_TransferSyntax xfer : configured)
+  {
+    DcmXfer xferSyntax(xfer);
+#ifndef WITH_ZLIB
+    if (xferSyntax.getStreamCompression() == ESC_zlib)
+      continue;
+#endif
+    if (nativeOnly && xferSyntax.isEncapsulated())
+      continue;
+    if (xfer != EXS_Unknown && numTransferSyntaxes < maxTransferSyntaxes - 3)
+      transferSyntaxes[numTransferSyntaxes++] = xferSyntax.getXferID();
+  }
 
+  /* Then we prefer explicit transfer syntaxes.
+   * If we are running on a Little Endian machine we prefer
+   * LittleEndianExplicitTransferSyntax to BigEndianTransferSyntax.
+   */
+  const char* uncompressedSyntaxes[3];
+  if (gLocalByteOrder == EBO_LittleEndian)  /* defined in dcxfer.h */
+  {
+    uncompressedSyntaxes[0] = UID_LittleEndianExplicitTransferSyntax;
+    uncompressedSyntaxes[1] = UID_BigEndianExplicitTransferSyntax;
+  }
+  else
+  {
+    uncompressedSyntaxes[0] = UID_BigEndianExplicitTransferSyntax;
+    uncompressedSyntaxes[1] = UID_LittleEndianExplicitTransferSyntax;
+  }
+  uncompressedSyntaxes[2] = UID_LittleEndianImplicitTransferSyntax;
+  for (int i = 0; i < 3; i++)
+  {
+    OFBool listed = OFFalse;
+    for (int k = 0; k < numTransferSyntaxes && !listed; k++)
+      listed = (strcmp(transferSyntaxes[k], uncompressedSyntaxes[i]) == 0);
+    if (!listed)
+      transferSyntaxes[numTransferSyntaxes++] = uncompressedSyntaxes[i];
+  }
+  return numTransferSyntaxes;
 }
 
 bool CineLoopRcv::init()
 {
     OFString temp_str;
 
+#ifdef _WIN32
     WSAData winSockData;
     /* we need at least version 1.1 */
     WORD winSockVersionNeeded = MAKEWORD( 1, 1 );
     WSAStartup(winSockVersionNeeded, &winSockData);
+#endif
 
     /* make sure data dictionary is loaded */
     if (!dcmDataDict.isDictionaryLoaded())
@@ -176,6 +128,23 @@ bool CineLoopRcv::init()
       return false;
     }
 
+    /* what associations may propose is fixed from here on; raw cine files are written
+     * from the loop the frame tap assembles, which needs native pixel data */
+    const OFBool nativeOnly = opt_rawCineExport != RawCineExport::Off;
+    for (E_TransferSyntax xfer : opt_transferSyntaxes)
+    {
+      if (nativeOnly && DcmXfer(xfer).isEncapsulated())
+        OFLOG_WARN(storescpLogger, "raw cine export is enabled, not offering " << DcmXfer(xfer).getXferName());
+    }
+    const char* transferSyntaxes[maxTransferSyntaxes];
+    const int numTransferSyntaxes = preferredTransferSyntaxes(opt_transferSyntaxes, nativeOnly, transferSyntaxes);
+    const char* knownAbstractSyntaxes[] = { UID_VerificationSOPClass };
+    acceptance.clear();
+    acceptance.setTransferSyntaxes(transferSyntaxes, numTransferSyntaxes);
+    acceptance.addAbstractSyntaxes(knownAbstractSyntaxes, DIM_OF(knownAbstractSyntaxes));
+    acceptance.addAbstractSyntaxes(dcmAllStorageSOPClassUIDs, numberOfAllDcmStorageSOPClassUIDs);
+    acceptance.setAcceptUnknown(opt_promiscuous);
+
     return true;
 }
 
@@ -192,109 +161,13 @@ CineLoopRcv::~CineLoopRcv()
 //      return 1;
     }
 
+#ifdef _WIN32
     WSACleanup();
+#endif
 
     OFLOG_INFO(storescpLogger, "CineLoopRcv - DESTRUCTOR");
 }
 
-/*
- * This function receives DIMSE commmands over the network connection
- * and handles these commands correspondingly. Note that in case of
- * storscp only C-ECHO-RQ and C-STORE-RQ commands can be processed.
- *
- * Parameters:
- *   assoc - [in] The association (network connection to another DICOM application).
- */
-OFCondition CineLoopRcv::processCommands()
-{
-  cond = EC_Normal;
-//  T_DIMSE_Message msg;
-//  T_ASC_PresentationContextID presID = 0;
-  DcmDataset *statusDetail = NULL;
-
-  // start a loop to be able to receive more than one DIMSE command
-  while( cond == EC_Normal || cond == DIMSE_NODATAAVAILABLE || cond == DIMSE_OUTOFRESOURCES )
-  {
-    // receive a DIMSE command over the network
-    cond = DIMSE_receiveCommand(assoc, DIMSE_NONBLOCKING, OFstatic_cast(int, opt_endOfStudyTimeout), &presID, &msg, &statusDetail);
-
-    // check what kind of error occurred. If no data was
-    // received, check if certain other conditions are met
-    if( cond == DIMSE_NODATAAVAILABLE )
-    {
-      // If in addition to the fact that no data was received also option --eostudy-timeout is set and
-      // if at the same time there is still a study which is considered to be open (i.e. we were actually
-      // expecting to receive more objects that belong to this study) (this is the case if lastStudyInstanceUID
-      // does not equal NULL), we have to consider that all objects for the current study have been received.
-      // In such an "end-of-study" case, we might have to execute certain optional functions which were specified
-      // by the user through command line options passed to storescp.
-      if( opt_endOfStudyTimeout != -1 && !lastStudyInstanceUID.empty() )
-      {
-        // before we actually execute those optional functions, we need to determine the path and name
-        // of the subdirectory into which the DICOM files for the last study were written.
-        lastStudySubdirectoryPathAndName = subdirectoryPathAndName;
-
-        // also, we need to clear lastStudyInstanceUID to indicate
-        // that the last study is not considered to be open any more.
-        lastStudyInstanceUID.clear();
-
-        // also, we need to clear subdirectoryPathAndName
-        subdirectoryPathAndName.clear();
-      }
-    }
-
-    // if the command which was received has extra status
-    // detail information, dump this information
-    if (statusDetail != NULL)
-    {
-      OFLOG_WARN(storescpLogger, "Status Detail:" << OFendl << DcmObject::PrintHelper(*statusDetail));
-      delete statusDetail;
-    }
-
-    // check if peer did release or abort, or if we have a valid message
-    if (cond == EC_Normal)
-    {
-      // in case we received a valid message, process this command
-      // note that storescp can only process a C-ECHO-RQ and a C-STORE-RQ
-      switch (msg.CommandField)
-      {
-        case DIMSE_C_ECHO_RQ:
-          // process C-ECHO-Request
-          cond = echoSCP();
-          break;
-        case DIMSE_C_STORE_RQ:
-          // process C-STORE-Request
-          cond = storeSCP();
-          break;
-        default:
-          // we cannot handle this kind of message
-          cond = DIMSE_BADCOMMANDTYPE;
-          OFLOG_ERROR(storescpLogger, "cannot handle command: 0x"
-               << STD_NAMESPACE hex << OFstatic_cast(unsigned, msg.CommandField));
-          break;
-      }
-    }
-  }
-  return cond;
-}
-
-
-OFCondition CineLoopRcv::echoSCP()
-{
-  OFString temp_str;
-  OFLOG_INFO(storescpLogger, "Received Echo Request");
-  OFLOG_DEBUG(storescpLogger, DIMSE_dumpMessage(temp_str, msg.msg.CEchoRQ, DIMSE_INCOMING, NULL, presID));
-
-  /* the echo succeeded !! */
-  cond = DIMSE_sendEchoResponse(assoc, presID, &msg.msg.CEchoRQ, STATUS_Success, NULL);
-  if (cond.bad())
-  {
-    OFLOG_ERROR(storescpLogger, "Echo SCP Failed: " << DimseCondition::dump(temp_str, cond));
-  }
-  return cond;
-}
-
-
 DUL_PRESENTATIONCONTEXT* CineLoopRcv::findPresentationContextID(LST_HEAD * head, T_ASC_PresentationContextID presentationContextID)
 {
   DUL_PRESENTATIONCONTEXT *pc;
@@ -322,81 +195,6 @@ DUL_PRESENTATIONCONTEXT* CineLoopRcv::findPresentationContextID(LST_HEAD * head,
 }
 
 
-/*
- * This function processes a DIMSE C-STORE-RQ commmand that was
- * received over the network connection.
- *
- * Parameters:
- *   assoc  - [in] The association (network connection to another DICOM application).
- *   msg    - [in] The DIMSE C-STORE-RQ message that was received.
- *   presID - [in] The ID of the presentation context which was specified in the PDV which contained
- *                 the DIMSE command.
- */
-OFCondition CineLoopRcv::storeSCP()
-{
-  T_DIMSE_C_StoreRQ *req;
-  char imageFileName[2048];
-
-  // assign the actual information of the C-STORE-RQ command to a local variable
-  req = &msg.msg.CStoreRQ;
-
-
-  // don't create new UID, use the study instance UID as found in object
-  sprintf(imageFileName, "%s%c%s.%s%s", opt_outputDirectory.c_str(), PATH_SEPARATOR, dcmSOPClassUIDToModality(req->AffectedSOPClassUID, "UNKNOWN"),
-          req->AffectedSOPInstanceUID, opt_fileNameExtension.c_str());
-
-
-  // dump some information if required
-  OFString str;
-  OFLOG_INFO(storescpLogger, "Received Store Request: MsgID " << req->MessageID << ", ("
-    << dcmSOPClassUIDToModality(req->AffectedSOPClassUID, "OT") << ")");
-  OFLOG_DEBUG(storescpLogger, DIMSE_dumpMessage(str, *req, DIMSE_INCOMING, NULL, presID));
-
-  // intialize some variables
-  StoreCallbackData callbackData;
-  callbackData.rcv = this;
-  callbackData.assoc = assoc;
-  callbackData.imageFileName = imageFileName;
-  DcmFileFormat dcmff;
-  callbackData.dcmff = &dcmff;
-
-  // store SourceApplicationEntityTitle in metaheader
-  if (assoc && assoc->params)
-  {
-    const char *aet = assoc->params->DULparams.callingAPTitle;
-    if (aet) dcmff.getMetaInfo()->putAndInsertString(DCM_SourceApplicationEntityTitle, aet);
-  }
-
-  // define an address where the information which will be received over the network will be stored
-  DcmDataset *dset = dcmff.getDataset();
-
-  cond = DIMSE_storeProvider(assoc, presID, req, NULL, opt_useMetaheader, &dset,
-                              storeSCPCallback, &callbackData, opt_blockMode, opt_dimse_timeout);
-
-  // if some error occured, dump corresponding information and remove the outfile if necessary
-  if (cond.bad())
-  {
-    OFString temp_str;
-    OFLOG_ERROR(storescpLogger, "Store SCP Failed: " << DimseCondition::dump(temp_str, cond));
-    // remove file
-    if (!opt_ignore)
-    {
-      if (strcmp(imageFileName, NULL_DEVICE_NAME) != 0)
-        OFStandard::deleteFile(imageFileName);
-    }
-  }
-#ifdef _WIN32
-  else if (opt_ignore)
-  {
-    if (strcmp(imageFileName, NULL_DEVICE_NAME) != 0)
-      OFStandard::deleteFile(imageFileName); // delete the temporary file
-  }
-#endif
-
-  // return return value
-  return cond;
-}
-
 /** accept all presenstation contexts for unknown SOP classes,
  *  i.e. UIDs appearing in the list of abstract syntaxes
  *  where no corresponding name is defined in the UID dictionary.
@@ -495,6 +293,18 @@ OFCondition CineLoopRcv::acceptUnknownContextsWithPreferredTransferSyntaxes(T_AS
   return cond;
 }
 
+/* runs a function on a thread pool */
+class FunctionTask : public QRunnable
+{
+public:
+    explicit FunctionTask(std::function<void()> function) : function(std::move(function)) { setAutoDelete(true); }
+
+    void run() Q_DECL_OVERRIDE { function(); }
+
+private:
+    std::function<void()> function;
+};
+
 OFCondition CineLoopRcv::acceptAssociation()
 {
   char buf[BUFSIZ];
@@ -505,77 +315,53 @@ OFCondition CineLoopRcv::acceptAssociation()
     UID_VerificationSOPClass
   };
 
-  const char* transferSyntaxes[] = { NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL };
-  int numTransferSyntaxes = 0;
 
-  // try to receive an association. Here we either want to use blocking or
-  // non-blocking, depending on if the option --eostudy-timeout is set.
-    cond = ASC_receiveAssociation(net, &assoc, opt_maxPDU, NULL, NULL, OFFalse, DUL_NOBLOCK, OFstatic_cast(int, opt_endOfStudyTimeout));
+  T_ASC_Association *assoc = NULL;
+
+  // the listening socket was readable, so there is a connection to accept; should the
+  // peer have given up in the meantime we must not block either. Reading the
+  // A-ASSOCIATE-RQ is bounded by the ACSE timeout, which is why we run on the acceptor.
+  cond = ASC_receiveAssociation(net, &assoc, opt_maxPDU, NULL, NULL, OFFalse, DUL_NOBLOCK, 0);
 
   // if some kind of error occured, take care of it
   if (cond.bad())
   {
-    // check what kind of error occurred. If no association was
-    // received, check if certain other conditions are met
-    if( cond == DUL_NOASSOCIATIONREQUEST )
-    {
-      // If in addition to the fact that no association was received also option --eostudy-timeout is set
-      // and if at the same time there is still a study which is considered to be open (i.e. we were actually
-      // expecting to receive more objects that belong to this study) (this is the case if lastStudyInstanceUID
-      // does not equal NULL), we have to consider that all objects for the current study have been received.
-      // In such an "end-of-study" case, we might have to execute certain optional functions which were specified
-      // by the user through command line options passed to storescp.
-      if( opt_endOfStudyTimeout != -1 && !lastStudyInstanceUID.empty() )
-      {
-        // before we actually execute those optional functions, we need to determine the path and name
-        // of the subdirectory into which the DICOM files for the last study were written.
-        lastStudySubdirectoryPathAndName = subdirectoryPathAndName;
-
-        // also, we need to clear lastStudyInstanceUID to indicate
-        // that the last study is not considered to be open any more.
-        lastStudyInstanceUID.clear();
-
-        // also, we need to clear subdirectoryPathAndName
-        subdirectoryPathAndName.clear();
-
-      }
-    }
-    // If something else was wrong we might have to dump an error message.
-    else
+    // check what kind of error occurred. If no association was received the
+    // peer gave up before we got to it; if something else was wrong we might
+    // have to dump an error message.
+    if( cond != DUL_NOASSOCIATIONREQUEST )
     {
       OFLOG_ERROR(storescpLogger, "Receiving Association failed: " << DimseCondition::dump(temp_str, cond));
+      counters.error(cond);
     }
 
     // no matter what kind of error occurred, we need to do a cleanup
-    return cleanup();
+    return cleanup(assoc);
   }
 
   OFLOG_INFO(storescpLogger, "Association Received");
 
-  /* We prefer explicit transfer syntaxes.
-   * If we are running on a Little Endian machine we prefer
-   * LittleEndianExplicitTransferSyntax to BigEndianTransferSyntax.
-   */
-  if (gLocalByteOrder == EBO_LittleEndian)  /* defined in dcxfer.h */
+  if (opt_hashedAcceptance)
   {
-    transferSyntaxes[0] = UID_LittleEndianExplicitTransferSyntax;
-    transferSyntaxes[1] = UID_BigEndianExplicitTransferSyntax;
+    /* Verification, the storage SOP classes and, in promiscuous mode, the unknown ones */
+    cond = acceptance.apply(assoc->params);
+    if (cond.bad())
+    {
+      OFLOG_DEBUG(storescpLogger, DimseCondition::dump(temp_str, cond));
+      return cleanup(assoc);
+    }
   }
   else
   {
-    transferSyntaxes[0] = UID_BigEndianExplicitTransferSyntax;
-    transferSyntaxes[1] = UID_LittleEndianExplicitTransferSyntax;
-  }
-  transferSyntaxes[2] = UID_LittleEndianImplicitTransferSyntax;
-  numTransferSyntaxes = 3;
-
+    const char* transferSyntaxes[maxTransferSyntaxes];
+    const int numTransferSyntaxes = preferredTransferSyntaxes(opt_transferSyntaxes, opt_rawCineExport != RawCineExport::Off, transferSyntaxes);
 
     /* accept the Verification SOP Class if presented */
     cond = ASC_acceptContextsWithPreferredTransferSyntaxes( assoc->params, knownAbstractSyntaxes, DIM_OF(knownAbstractSyntaxes), transferSyntaxes, numTransferSyntaxes);
     if (cond.bad())
     {
       OFLOG_DEBUG(storescpLogger, DimseCondition::dump(temp_str, cond));
-      return cleanup();
+      return cleanup(assoc);
     }
 
     /* the array of Storage SOP Class UIDs comes from dcuid.h */
@@ -583,7 +369,7 @@ OFCondition CineLoopRcv::acceptAssociation()
     if (cond.bad())
     {
       OFLOG_DEBUG(storescpLogger, DimseCondition::dump(temp_str, cond));
-      return cleanup();
+      return cleanup(assoc);
     }
 
     if (opt_promiscuous)
@@ -594,10 +380,10 @@ OFCondition CineLoopRcv::acceptAssociation()
       if (cond.bad())
       {
         OFLOG_DEBUG(storescpLogger, DimseCondition::dump(temp_str, cond));
-        return cleanup();
+        return cleanup(assoc);
       }
     }
-
+  }
 
   /* set our app title */
   ASC_setAPTitles(assoc->params, NULL, NULL, opt_respondingAETitle);
@@ -615,12 +401,13 @@ OFCondition CineLoopRcv::acceptAssociation()
     };
 
     OFLOG_INFO(storescpLogger, "Association Rejected: Bad Application Context Name: " << buf);
+    counters.add(Metrics::AssociationsRejected);
     cond = ASC_rejectAssociation(assoc, &rej);
     if (cond.bad())
     {
       OFLOG_DEBUG(storescpLogger, DimseCondition::dump(temp_str, cond));
     }
-    return cleanup();
+    return cleanup(assoc);
 
   }
   else
@@ -629,7 +416,8 @@ OFCondition CineLoopRcv::acceptAssociation()
     if (cond.bad())
     {
       OFLOG_ERROR(storescpLogger, DimseCondition::dump(temp_str, cond));
-      return cleanup();
+      counters.error(cond);
+      return cleanup(assoc);
     }
     OFLOG_INFO(storescpLogger, "Association Acknowledged (Max Send PDV: " << assoc->sendPDVLength << ")");
     if (ASC_countAcceptedPresentationContexts(assoc->params) == 0)
@@ -663,32 +451,26 @@ OFCondition CineLoopRcv::acceptAssociation()
   // store calling presentation address (i.e. remote hostname)
   callingPresentationAddress = OFSTRING_GUARD(assoc->params->DULparams.callingPresentationAddress);
 
-  /* now do the real work, i.e. receive DIMSE commmands over the network connection */
-  /* which was established and handle these commands correspondingly. In case of */
-  /* storscp only C-ECHO-RQ and C-STORE-RQ commands can be processed. */
-  cond = processCommands();
-
-  if (cond == DUL_PEERREQUESTEDRELEASE)
-  {
-    OFLOG_INFO(storescpLogger, "Association Release");
-    cond = ASC_acknowledgeRelease(assoc);
-  }
-  else if (cond == DUL_PEERABORTEDASSOCIATION)
-  {
-    OFLOG_INFO(storescpLogger, "Association Aborted");
-  }
-  else
+  /* now hand the association over to the reactor, which passes it on to the worker pool */
+  /* whenever a DIMSE command comes in, while this thread goes back to listening. */
+  if (backgroundCompressor) backgroundCompressor->pause();
+  openAssociations.ref();
+  counters.add(Metrics::AssociationsAccepted);
+  AssociationHandler *handler = new AssociationHandler(this, assoc);
   {
-    OFLOG_ERROR(storescpLogger, "DIMSE failure (aborting association): " << DimseCondition::dump(temp_str, cond));
-    /* some kind of error so abort the association */
-    cond = ASC_abortAssociation(assoc);
+    QMutexLocker locker(&mutex);
+    associations.insert(handler);
   }
+  // a receiver which is stopping lets the handler abort the association right away
+  if (!watchAssociation(handler))
+    workers.start(handler);
 
-  return cleanup();
+  return cond;
 }
 
 // instead of exiting throw exception
-OFCondition& CineLoopRcv::cleanup()
+// drops an association which was not handed over to a worker
+OFCondition& CineLoopRcv::cleanup(T_ASC_Association *&assoc)
 {
 
     OFString temp_str;
@@ -716,16 +498,367 @@ OFCondition& CineLoopRcv::cleanup()
 
 void CineLoopRcv::stop()
 {
-    QMutexLocker(&this->mutex);
-    stopRunning = true;
+    {
+        QMutexLocker locker(&mutex);
+        if (!stopRunning)
+            shutdownTimer.start();
+        stopRunning = true;
+    }
+    if (ring)
+        ring->close();
+    // the reactor takes it from here, see reactorTimer()
+    reactor.wakeup();
+}
+
+bool CineLoopRcv::stopping()
+{
+    QMutexLocker locker(&mutex);
+    return stopRunning;
+}
+
+ShutdownReport CineLoopRcv::shutdownReport()
+{
+    QMutexLocker locker(&mutex);
+    return shutdown;
+}
+
+void CineLoopRcv::setMaxConcurrentAssociations(int count)
+{
+    // only meaningful before start(), the pool is sized in run()
+    opt_maxAssociations = qMax(1, count);
+}
+
+int CineLoopRcv::activeAssociations() const
+{
+    return openAssociations.load();
+}
+
+void CineLoopRcv::enableWriteBehind(qint64 maxQueuedBytes, AckPolicy policy)
+{
+    writer = std::make_unique<WriteBehindQueue>(maxQueuedBytes, policy);
+    writer->setCompletionHandler([this](const OFString& fileName, const OFCondition& result) {
+        if (result.good())
+            emitCineLoopReceivedSignal(QString(fileName.c_str()));
+    });
+}
+
+void CineLoopRcv::enableBackgroundCompression(int threads)
+{
+    backgroundCompressor = std::make_unique<BackgroundCompressor>(threads);
+    backgroundCompressor->setCompletionHandler([](const CompressionResult& result) {
+        const QByteArray fileName = result.fileName.toLocal8Bit();
+        if (result.skipped)
+            OFLOG_DEBUG(storescpLogger, "not compressing " << fileName.constData());
+        else if (result.cond.bad())
+            OFLOG_WARN(storescpLogger, "cannot compress " << fileName.constData() << ": " << result.cond.text());
+        else
+            OFLOG_INFO(storescpLogger, "compressed " << fileName.constData() << ": " << result.frames << " frames, ratio "
+                << result.ratio() << ", " << result.fileBytesBefore << " -> " << result.fileBytesAfter << " bytes, cpu "
+                << result.cpuNs / 1000000 << " ms, wall " << result.wallNs / 1000000 << " ms");
+    });
+}
+
+void CineLoopRcv::enablePixelBufferPool(qint64 capacityBytes, bool hugePages)
+{
+    pool = std::make_unique<PixelBufferPool>(capacityBytes, hugePages);
+}
+
+void CineLoopRcv::enableFrameRing(int capacity, RingPolicy policy)
+{
+    ring = std::make_unique<FrameRing>(capacity, policy);
+    opt_progressiveFrames = OFTrue;
+}
+
+void CineLoopRcv::enableLoopIndex(const QString &fileName)
+{
+    index = std::make_unique<LoopIndex>();
+    indexFileName = fileName.isEmpty() ? QString("%1/loops.xrfidx").arg(QString(opt_outputDirectory.c_str())) : fileName;
+}
+
+void CineLoopRcv::addToLoopIndex(LoopIndexRecord &record, const OFString &filename)
+{
+    OFString name;
+    record.setFileName(QString(OFStandard::getFilenameFromPath(name, filename).c_str()));
+    OFCondition result = index->append(record);
+    if (result.bad())
+        OFLOG_WARN(storescpLogger, "cannot add " << filename << " to loop index: " << result.text());
+}
+
+void CineLoopRcv::enableInstanceIndex(DuplicatePolicy policy, const QString &fileName)
+{
+    instances = std::make_unique<InstanceIndex>();
+    instanceIndexFileName = fileName.isEmpty() ? QString("%1/instances.xrfsop").arg(QString(opt_outputDirectory.c_str())) : fileName;
+    opt_duplicatePolicy = policy;
+}
+
+void CineLoopRcv::addToInstanceIndex(InstanceRecord &record, const OFString &filename)
+{
+    OFString name;
+    record.setFileName(QString(OFStandard::getFilenameFromPath(name, filename).c_str()));
+    record.stored = QDateTime::currentMSecsSinceEpoch();
+    OFCondition result = instances->append(record);
+    if (result.bad())
+        OFLOG_WARN(storescpLogger, "cannot add " << filename << " to instance index: " << result.text());
+}
+
+void CineLoopRcv::enableMetricsFile(const QString &fileName, int intervalMs)
+{
+    exporter = std::make_unique<MetricsExporter>([this]() { return metricsSnapshot(); }, fileName, intervalMs);
+}
+
+MetricsSnapshot CineLoopRcv::metricsSnapshot()
+{
+    MetricsSnapshot snap = counters.snapshot();
+    snap.activeAssociations = activeAssociations();
+    snap.maxAssociations = opt_maxAssociations;
+    if (writer)
+    {
+        const WriteBehindStats stats = writer->stats();
+        snap.writeQueueDepth = stats.queueDepth;
+        snap.writeQueueBytes = stats.queuedBytes;
+    }
+    snap.openStudies = studies.openStudies();
+    if (ring)
+    {
+        const FrameRingStats stats = ring->stats();
+        snap.ringFramesPopped = stats.popped;
+        snap.ringFramesDroppedOldest = stats.droppedOldest;
+        snap.ringFramesDroppedNewest = stats.droppedNewest;
+        snap.ringLatencyTotalNs = stats.latencyTotalNs;
+        snap.ringLatencyMaxNs = stats.latencyMaxNs;
+        snap.ringDepth = stats.depth;
+    }
+    return snap;
+}
+
+WriteBehindStats CineLoopRcv::writeBehindStats()
+{
+    return writer ? writer->stats() : WriteBehindStats();
+}
+
+bool CineLoopRcv::watchAssociation(AssociationHandler *handler)
+{
+    // checked under the mutex, so an association is either watched before reactorTimer()
+    // dispatches the idle ones or learns here that the receiver is stopping
+    QMutexLocker locker(&mutex);
+    if (stopRunning)
+        return false;
+    // without a socket to watch (or if the reactor fails) the worker waits for the command itself
+    if (handler->socket() < 0 || reactor.watch(handler->socket(), [this, handler]() { workers.start(handler); }).bad())
+        workers.start(handler);
+    return true;
+}
+
+void CineLoopRcv::unwatchAssociation(AssociationHandler *handler)
+{
+    QMutexLocker locker(&mutex);
+    associations.remove(handler);
+    interrupted.remove(handler);
+    if (handler->socket() >= 0)
+        reactor.unwatch(handler->socket());
+}
+
+void CineLoopRcv::associationShutDown(AssociationHandler *handler, bool idle)
+{
+    QMutexLocker locker(&mutex);
+    if (idle)
+        shutdown.idleAssociations++;
+    else if (interrupted.contains(handler))
+        shutdown.interruptedAssociations++;
+    else
+        shutdown.drainedAssociations++;
+}
+
+void CineLoopRcv::associationFinished()
+{
+    if (backgroundCompressor) backgroundCompressor->resume();
+    openAssociations.deref();
+    // a stopping receiver waits for the last association
+    reactor.wakeup();
+}
+
+QString CineLoopRcv::studyObjectReceived(const OFString &studyInstanceUID, const OFString &callingAETitle)
+{
+    QList<CompletedStudy> completed;
+    const QString directory = studies.objectReceived(QString(studyInstanceUID.c_str()), QString(callingAETitle.c_str()), completed);
+    completeStudies(completed);
+    return directory;
+}
+
+void CineLoopRcv::studyObjectStored(const OFString &studyInstanceUID, const OFString &filename)
+{
+    QList<CompletedStudy> completed;
+    studies.objectStored(QString(studyInstanceUID.c_str()), QString(filename.c_str()), completed);
+    completeStudies(completed);
+    // the end-of-study timer of the study starts now
+    reactor.wakeup();
+}
+
+void CineLoopRcv::associationRequested()
+{
+    // a peer which connects and then takes its time with the A-ASSOCIATE-RQ would hold
+    // up every association the reactor serves, so the request is read and negotiated on
+    // the acceptor thread; the listening socket is watched again once it is done
+    acceptor.start(new FunctionTask([this]() {
+        acceptAssociation();
+        QMutexLocker locker(&mutex);
+        if (listening)
+            reactor.watch(listenSocket, [this]() { associationRequested(); });
+    }));
+}
+
+qint64 CineLoopRcv::reactorTimer()
+{
+    counters.add(Metrics::LoopWakeups);
+    endOfStudyTimeoutReached();
+    const qint64 delay = studies.msecsToNextExpiry();
+
+    QMutexLocker locker(&mutex);
+    if (!stopRunning)
+        return delay;
+
+    if (listening)
+    {
+        // no new associations; the ones waiting for their next command have nothing in
+        // flight, their handlers see that the receiver is stopping and abort them
+        reactor.unwatch(listenSocket);
+        listening = false;
+        reactor.dispatchAll();
+    }
+    if (openAssociations.load() == 0)
+    {
+        reactor.quit();
+        return -1;
+    }
+
+    const qint64 remaining = opt_shutdownDeadline - shutdownTimer.elapsed();
+    if (remaining > 0)
+        return delay < 0 ? remaining : qMin(delay, remaining);
+
+    // the deadline has passed: whoever is still receiving gets its socket shut down
+    // under them, which fails the DIMSE call the worker is blocked in
+    if (!deadlineReached)
+    {
+        deadlineReached = true;
+        for (AssociationHandler *handler : associations)
+        {
+            interrupted.insert(handler);
+            if (handler->socket() >= 0)
+                Reactor::interrupt(handler->socket());
+        }
+        OFLOG_WARN(storescpLogger, "shutdown deadline of " << opt_shutdownDeadline << " ms passed, interrupting "
+            << interrupted.size() << " associations");
+    }
+    return delay;
+}
+
+/*
+ * Called on the reactor whenever it wakes up: every study which has been idle for the
+ * end-of-study timeout is considered to be complete.
+ */
+void CineLoopRcv::endOfStudyTimeoutReached()
+{
+    QList<CompletedStudy> completed;
+    studies.expire(completed);
+    completeStudies(completed);
+}
+
+void CineLoopRcv::completeStudies(const QList<CompletedStudy> &completed)
+{
+    for (const CompletedStudy& study : completed)
+    {
+        OFLOG_INFO(storescpLogger, "study complete: " << study.studyInstanceUID.toLatin1().constData()
+            << " (" << study.files.size() << " files in " << study.directory.toLocal8Bit().constData() << ")");
+        emit studyCompleted(study.studyInstanceUID, study.files);
+    }
 }
 
 void CineLoopRcv::run()
 {
-     while ( acceptAssociation().good() )
+     workers.setMaxThreadCount(opt_maxAssociations);
+     acceptor.setMaxThreadCount(1);
+     if (writer) writer->start(QThread::HighPriority);
+     if (backgroundCompressor) backgroundCompressor->start(QThread::LowestPriority);
+     if (index)
      {
-         QMutexLocker(&this->mutex);
-         if(stopRunning) break;
+         OFCondition indexCond = index->open(indexFileName);
+         if (indexCond.good())
+         {
+             const int added = index->update(QString(opt_outputDirectory.c_str()), QString(opt_fileNameExtension.c_str()));
+             OFLOG_INFO(storescpLogger, "loop index: " << index->count() << " loops, " << added << " added");
+         }
+         else
+         {
+             OFLOG_ERROR(storescpLogger, "cannot open loop index " << indexFileName.toLocal8Bit().constData() << ": " << indexCond.text());
+             index.reset();
+         }
+     }
+     if (instances)
+     {
+         OFCondition instancesCond = instances->open(instanceIndexFileName);
+         if (instancesCond.good())
+             OFLOG_INFO(storescpLogger, "instance index: " << instances->count() << " instances");
+         else
+         {
+             OFLOG_ERROR(storescpLogger, "cannot open instance index " << instanceIndexFileName.toLocal8Bit().constData() << ": " << instancesCond.text());
+             instances.reset();
+         }
+     }
+     if (exporter) exporter->start(QThread::LowPriority);
+
+     OFCondition reactorCond = reactor.open();
+     if (reactorCond.good())
+     {
+         listenSocket = qintptr(DUL_networkSocket(net->network));
+         listening = true;
+         reactor.setTimerHandler([this]() { return reactorTimer(); });
+         reactorCond = reactor.watch(listenSocket, [this]() { associationRequested(); });
+         if (reactorCond.good())
+             reactorCond = reactor.exec();
+     }
+     if (reactorCond.bad())
+         OFLOG_FATAL(storescpLogger, "cannot wait for associations: " << reactorCond.text());
+
+     // unless it failed, the reactor only returns once every association has ended; one
+     // still being accepted is turned away by watchAssociation()
+     acceptor.waitForDone();
+     workers.waitForDone();
+     qint64 drainMs = 0;
+     {
+         QMutexLocker locker(&mutex);
+         drainMs = shutdownTimer.isValid() ? shutdownTimer.elapsed() : 0;
+     }
+     const int queuedWrites = writer ? writer->stats().queueDepth : 0;
+     // and everything they queued reach the disk
+     if (writer) writer->shutdown();
+     // loops which were not compressed yet stay as they are
+     if (backgroundCompressor) backgroundCompressor->shutdown();
+     // the writer's completions wake the reactor up (see studyObjectStored()), it is
+     // only closed once they have all run
+     reactor.close();
+     if (index) index->close();
+     if (instances) instances->close();
+
+     // whatever is still open is as complete as it is going to get
+     QList<CompletedStudy> completed;
+     studies.closeAll(completed);
+     completeStudies(completed);
+
+     if (exporter)
+     {
+         exporter->stop();
+         exporter->wait();
+     }
+
+     {
+         QMutexLocker locker(&mutex);
+         shutdown.drainMs = drainMs;
+         shutdown.flushMs = shutdownTimer.isValid() ? shutdownTimer.elapsed() : 0;
+         shutdown.flushedWrites = queuedWrites;
+         OFLOG_INFO(storescpLogger, "shutdown: " << shutdown.idleAssociations << " idle and "
+             << shutdown.drainedAssociations << " busy associations ended, " << shutdown.interruptedAssociations
+             << " interrupted at the deadline; drained in " << shutdown.drainMs << " ms, "
+             << shutdown.flushedWrites << " queued writes flushed after " << shutdown.flushMs << " ms");
      }
 
      OFLOG_INFO(storescpLogger, "CineLoopRcv run - finished");
@@ -733,6 +866,17 @@ void CineLoopRcv::run()
 
     void CineLoopRcv::emitCineLoopReceivedSignal(const QString& fullpath) {
         emit cineLoopReceived(fullpath);
+        // raw cine files are not DICOM, there is nothing to compress
+        if (backgroundCompressor && !fullpath.endsWith(RawCineExtension)) backgroundCompressor->enqueue(fullpath);
+    }
+
+    void CineLoopRcv::emitCineLoopAvailableSignal(const xrf::CineLoopPtr& loop) {
+        emit cineLoopAvailable(loop);
+    }
+
+    void CineLoopRcv::emitFrameReceivedSignal(const xrf::CineFrame& frame) {
+        if (ring) ring->push(frame);
+        emit frameReceived(frame);
     }
 
 }
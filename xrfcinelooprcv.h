@@ -26,8 +26,29 @@
 #include "dcmtk/dcmtls/tlslayer.h"
 //#endif
 
+#include "xrfacceptance.h"
+#include "xrfbufferpool.h"
+#include "xrfcineloop.h"
+#include "xrfcompressor.h"
+#include "xrfdigest.h"
+#include "xrfframering.h"
+#include "xrfinstanceindex.h"
+#include "xrfloopindex.h"
+#include "xrfmetrics.h"
+#include "xrfrawcine.h"
+#include "xrfreactor.h"
+#include "xrfstudytracker.h"
+#include "xrfwritebehind.h"
+
+#include <QAtomicInt>
+#include <QElapsedTimer>
 #include <QMutex>
+#include <QSet>
 #include <QThread>
+#include <QThreadPool>
+
+#include <memory>
+#include <vector>
 
 namespace xrf {
 #define OFFIS_CONSOLE_APPLICATION "xrfviewer"
@@ -44,7 +65,26 @@ static char rcsid[] = "$dcmtk: " OFFIS_CONSOLE_APPLICATION " v" OFFIS_DCMTK_VERS
 #define CALLED_AETITLE_PLACEHOLDER "#c"
 #define CALLING_PRESENTATION_ADDRESS_PLACEHOLDER "#r"
 
+class AssociationHandler;
 
+/* what stopping the receiver cost, see CineLoopRcv::shutdownReport() */
+struct ShutdownReport
+{
+    int    idleAssociations = 0;        // no command in flight, aborted right away
+    int    drainedAssociations = 0;     // finished the command in flight before the deadline
+    int    interruptedAssociations = 0; // still busy at the deadline, cut off
+    int    flushedWrites = 0;           // objects the write-behind stage still had queued
+    qint64 drainMs = 0;                 // stop() until the last association had ended
+    qint64 flushMs = 0;                 // and until everything queued was on disk
+};
+
+/*
+ * DICOM storage SCP for cine loops. The thread of the receiver runs a Reactor which
+ * waits for association requests on the listening socket and for the next command on
+ * every open association; an association only occupies a worker of the pool while it
+ * has something to receive, so idle associations cost neither a thread nor CPU time.
+ * The end-of-study timeout is a timer of the reactor.
+ */
 class CineLoopRcv : public QThread
 {
     Q_OBJECT
@@ -58,10 +98,162 @@ public:
     void run() Q_DECL_OVERRIDE;
 
     void emitCineLoopReceivedSignal(const QString& fullpath);
+    void emitCineLoopAvailableSignal(const xrf::CineLoopPtr& loop);
+    void emitFrameReceivedSignal(const xrf::CineFrame& frame);
 
     OFCondition acceptAssociation();
 
+    /* time the commands in flight get to complete after stop(); associations which are
+     * still busy then are cut off (default: 5000 ms). */
+    void setShutdownDeadline(qint64 msecs)  { opt_shutdownDeadline = msecs; }
+    /* valid once run() has returned after stop() */
+    ShutdownReport    shutdownReport();
+
+    /* maximum number of associations whose commands are served concurrently by the
+     * worker pool (default: 1). Any number of associations may be open, the ones which
+     * have received a command wait for a free worker. Call before start(). */
+    void setMaxConcurrentAssociations(int count);
+    int  maxConcurrentAssociations() const  { return opt_maxAssociations; }
+    int  activeAssociations() const;
+
+    /* write incoming PDVs straight to the output file instead of building the data set
+     * in memory first (like storescp --bit-preserving). Use LazyDataset to get at the
+     * metadata of a file received this way. Call before start(). */
+    void setBitPreserving(bool enable)      { opt_bitPreserving = enable; }
+
+    /* like bit preserving, but the output file is preallocated for the pixel data once
+     * its header has been received and written through a memory mapping; it appears
+     * under its name when complete and synced (see MappedFileWriter). Readers can map it
+     * again without copying, see CineLoop::fromFile(). Call before start(). */
+    void setMappedFiles(bool enable)        { opt_mappedFiles = enable; }
+
+    /* hand received data sets to an asynchronous write stage instead of writing them on
+     * the association's thread. At most maxQueuedBytes of data sets are held in memory;
+     * workers block while the queue is full. The policy decides whether the C-STORE-RSP
+     * is sent when the object is queued or when it is durable. Applies to the in-memory
+     * store path only, bit-preserving mode writes while receiving. Call before start(). */
+    void enableWriteBehind(qint64 maxQueuedBytes = Q_INT64_C(512) * 1024 * 1024, AckPolicy policy = AckPolicy::OnDurable);
+    WriteBehindQueue* writebehind()         { return writer.get(); }
+    WriteBehindStats  writeBehindStats();
+
+    /* transcode every file written to the output directory to RLE Lossless in the
+     * background, on a pool of low priority threads (0: ideal thread count).
+     * The stage is paused while any association is open. Call before start(). */
+    void enableBackgroundCompression(int threads = 0);
+    BackgroundCompressor* compressor()      { return backgroundCompressor.get(); }
+
+    /* emit cineLoopAvailable() with the received loop straight from memory, and
+     * optionally skip writing files altogether. */
+    void setLoopDelivery(bool enable)       { opt_loopDelivery = enable; }
+    void setWriteFiles(bool enable)         { opt_writeFiles = enable; }
+
+    /* receive the pixel data of loops for loop delivery or progressive frames into
+     * buffers of a PixelBufferPool, which keeps up to capacityBytes of released buffers
+     * for the next loops. dcmdata cannot parse into a buffer of ours, so with a pool
+     * loop delivery switches to the streaming store path (the file, if any, is written
+     * while receiving, as with bit preserving). Call before start(). */
+    void enablePixelBufferPool(qint64 capacityBytes = Q_INT64_C(1024) * 1024 * 1024, bool hugePages = false);
+    PixelBufferPool*  pixelbufferpool()     { return pool.get(); }
+
+    /* emit frameReceived() for every frame of a native multi-frame object as soon as it
+     * has come off the network, instead of waiting for the end of the C-STORE. Switches
+     * to the streaming store path (the file, if any, is written while receiving); the
+     * complete loop still goes to cineLoopAvailable() with loop delivery. Call before start(). */
+    void setProgressiveFrames(bool enable)  { opt_progressiveFrames = enable; }
+
+    /* push every frame which frameReceived() announces into a FrameRing as well, for
+     * live display threads which pull frames at their own rate; policy decides what
+     * happens while the ring is full. The frames are native, not decoded, and each
+     * keeps its loop's receive buffer alive (see FrameRing). Switches progressive
+     * frames on. stop() closes the ring, so a worker never waits for a display which
+     * is gone. Call before start(). */
+    void enableFrameRing(int capacity = 64, RingPolicy policy = RingPolicy::DropOldest);
+    FrameRing*        framering()           { return ring.get(); }
+
+    /* transfer syntaxes to accept for storage in addition to the uncompressed ones, most
+     * preferred first, e.g. EXS_JPEGProcess14SV1, EXS_JPEGLSLossless, EXS_RLELossless or
+     * EXS_DeflatedLittleEndianExplicit. The uncompressed syntaxes (local byte order
+     * first) follow them, so senders which cannot compress are still served. Objects in
+     * a compressed or deflated syntax go through the streaming store path and are
+     * written exactly as received, nothing is transcoded. Encapsulated (compressed)
+     * pixel data is not handed out as loops or frames (cineLoopAvailable(),
+     * frameReceived(), the frame ring); read such files back with CineLoop::fromFile(),
+     * which decodes RLE. Call before init(). */
+    void setTransferSyntaxes(const std::vector<E_TransferSyntax>& preferred) { opt_transferSyntaxes = preferred; }
+    const std::vector<E_TransferSyntax>& transfersyntaxes() const { return opt_transferSyntaxes; }
+
+    /* init() compiles what is accepted into an AcceptancePolicy, which decides the
+     * presentation contexts of every association in one pass; false negotiates each
+     * association with DCMTK's list based helpers instead (for comparison). */
+    void setHashedAcceptance(bool enable)   { opt_hashedAcceptance = enable; }
+
+    /* compute FileDigests of every file while it is written and keep them next to it
+     * (see verifyDirectory()); objects are received by the streaming store path while
+     * enabled. Call before start(). */
+    void setFileDigests(bool enable, DigestAlgorithm algorithm = DigestAlgorithm::Best) { opt_fileDigests = enable; opt_digestAlgorithm = algorithm; }
+
+    /* write every native loop as a raw cine file (see RawCineFile) as well as, or instead
+     * of, its DICOM file. The loop is assembled while receiving, so objects go through
+     * the streaming store path, and the encapsulated syntaxes of setTransferSyntaxes()
+     * are not offered while enabled; with RawCineExport::Instead objects which are not
+     * native cannot be stored and are refused. Call before init(). */
+    void setRawCineExport(RawCineExport mode) { opt_rawCineExport = mode; }
+
+    /* compute the projection matrices of every loop which goes to cineLoopAvailable()
+     * before it is emitted (see CineLoop::projections()), so consumers find them cached
+     * with the loop; needs loop delivery. */
+    void setProjectionGeometry(bool enable) { opt_projectionGeometry = enable; }
+
+    /* store the files of each study in a subdirectory prefix_StudyInstanceUID of the
+     * output directory. Call before start(). */
+    void setStudySubdirectories(bool enable, const QString& prefix = QString("ST")) { studies.setSubdirectories(enable, prefix); }
+
+    /* keep a LoopIndex of the geometry of every loop written to the output directory;
+     * the default index file is loops.xrfidx in the output directory. Files which are
+     * not indexed yet are added when the receiver starts. Call before start(). */
+    void enableLoopIndex(const QString& fileName = QString());
+    LoopIndex*        loopindex()           { return index.get(); }
+
+    /* keep an InstanceIndex of the SOP instances stored, so objects which are sent again
+     * are dealt with by policy as soon as their C-STORE-RQ arrives; the default index
+     * file is instances.xrfsop in the output directory. Objects are received by the
+     * streaming store path while the index is enabled. Call before start(). */
+    void enableInstanceIndex(DuplicatePolicy policy = DuplicatePolicy::Skip, const QString& fileName = QString());
+    InstanceIndex*    instanceindex()       { return instances.get(); }
+    DuplicatePolicy   duplicatepolicy()     { return opt_duplicatePolicy; }
+
+    /* counters and stage times of the receiver; metricsSnapshot() adds the current
+     * association, write queue and study gauges. With a metrics file the snapshot is
+     * written in the Prometheus text format every intervalMs. Call before start(). */
+    Metrics&          metrics()             { return counters; }
+    MetricsSnapshot   metricsSnapshot();
+    void enableMetricsFile(const QString& fileName, int intervalMs = 15000);
+
+    /* called by the association workers: watch the association's socket until its next
+     * command arrives (false once the receiver is stopping), stop watching before the
+     * association is dropped, and account for an association which has ended */
+    bool stopping();
+    bool watchAssociation(AssociationHandler* handler);
+    void unwatchAssociation(AssociationHandler* handler);
+    /* the association ended while the receiver was stopping; idle: no command was in flight */
+    void associationShutDown(AssociationHandler* handler, bool idle);
+    void associationFinished();
+    QString studyObjectReceived(const OFString& studyInstanceUID, const OFString& callingAETitle);
+    void studyObjectStored(const OFString& studyInstanceUID, const OFString& filename);
+    void endOfStudyTimeoutReached();
+    void addToLoopIndex(LoopIndexRecord& record, const OFString& filename);
+    void addToInstanceIndex(InstanceRecord& record, const OFString& filename);
+
     OFBool            ignore()              { return opt_ignore; }
+    OFBool            bitpreserving()       { return opt_bitPreserving; }
+    OFBool            mappedfiles()         { return opt_mappedFiles; }
+    OFBool            loopdelivery()        { return opt_loopDelivery; }
+    OFBool            writefiles()          { return opt_writeFiles; }
+    OFBool            progressiveframes()   { return opt_progressiveFrames; }
+    OFBool            filedigests()         { return opt_fileDigests; }
+    DigestAlgorithm   digestalgorithm()     { return opt_digestAlgorithm; }
+    RawCineExport     rawcineexport()       { return opt_rawCineExport; }
+    OFBool            projectiongeometry()  { return opt_projectionGeometry; }
     OFBool            usemetaheader()       { return opt_useMetaheader; }
     T_ASC_Network*    netobj()                 { return net; }
     E_GrpLenEncoding  grouplength()         { return opt_groupLength; }
@@ -69,20 +261,33 @@ public:
     E_PaddingEncoding paddingtype()         { return opt_paddingType; }
     OFCmdUnsignedInt  filepad()             { return opt_filepad; }
     OFCmdUnsignedInt  itempad()             { return opt_itempad; }
-    OFList<OFString>& outputfilenamearray() { return outputFileNameArray; }
     E_TransferSyntax& writetransfersyntax() { return opt_writeTransferSyntax; }
+    const OFString&   outputdirectory()     { return opt_outputDirectory; }
+    const OFString&   filenameextension()   { return opt_fileNameExtension; }
+    long              endofstudytimeout()   { return opt_endOfStudyTimeout; }
+    T_DIMSE_BlockingMode blockmode()        { return opt_blockMode; }
+    int               dimsetimeout()        { return opt_dimse_timeout; }
 
 signals:
     void cineLoopReceived(const QString& fullpath);
+    void cineLoopAvailable(const xrf::CineLoopPtr& loop);
+    void frameReceived(const xrf::CineFrame& frame);
+    /* all files of a study, once the study is considered complete (see StudyTracker) */
+    void studyCompleted(const QString& studyInstanceUID, const QStringList& files);
 
 public slots:
+    /* returns at once: the listener stops, idle associations are aborted and the ones
+     * busy with a command get until the shutdown deadline; run() returns once
+     * everything they queued has been written. */
     void stop();
 
 protected:
-    OFCondition& cleanup();
-    OFCondition processCommands();
-    OFCondition echoSCP();
-    OFCondition storeSCP();
+    OFCondition& cleanup(T_ASC_Association *&assoc);
+    /* run on the reactor: the listening socket is readable, and after every wakeup
+     * (returns the delay to the next call) */
+    void associationRequested();
+    qint64 reactorTimer();
+    void completeStudies(const QList<CompletedStudy>& completed);
     DUL_PRESENTATIONCONTEXT * findPresentationContextID(LST_HEAD * head, T_ASC_PresentationContextID presentationContextID);
     OFCondition acceptUnknownContextsWithTransferSyntax(T_ASC_Parameters * params, const char* transferSyntax, T_ASC_SC_ROLE acceptedRole);
     OFCondition acceptUnknownContextsWithPreferredTransferSyntaxes(T_ASC_Parameters * params,
@@ -93,11 +298,33 @@ private:
     QMutex mutex;
     bool stopRunning;
 
-    OFCondition cond;
+    QThreadPool workers;
+    QThreadPool acceptor;               // one thread, reads and negotiates association requests
+    Reactor reactor;
+    qintptr listenSocket;
+    bool listening;
+    QAtomicInt openAssociations;
+    QSet<AssociationHandler*> associations;         // open, guarded by mutex
+    QSet<AssociationHandler*> interrupted;          // cut off at the shutdown deadline
+    bool deadlineReached;
+    QElapsedTimer shutdownTimer;
+    ShutdownReport shutdown;
+    std::unique_ptr<WriteBehindQueue> writer{nullptr};
+    std::unique_ptr<BackgroundCompressor> backgroundCompressor{nullptr};
+    std::unique_ptr<LoopIndex> index{nullptr};
+    std::unique_ptr<PixelBufferPool> pool{nullptr};
+    std::unique_ptr<FrameRing> ring{nullptr};
+    QString indexFileName;
+    std::unique_ptr<InstanceIndex> instances{nullptr};
+    QString instanceIndexFileName;
+    StudyTracker studies;
+    Metrics counters;
+    std::unique_ptr<MetricsExporter> exporter{nullptr};
 
     T_ASC_Network *net;
+    OFCondition cond;
     DcmAssociationConfiguration asccfg;
-    T_ASC_Association *assoc;
+    AcceptancePolicy acceptance;
 
     OFString           opt_fileNameExtension;
     OFCmdUnsignedInt   opt_port;
@@ -111,7 +338,19 @@ private:
     OFCmdUnsignedInt   opt_filepad;
     OFCmdUnsignedInt   opt_itempad;
     OFBool             opt_ignore;
+    OFBool             opt_bitPreserving;
+    OFBool             opt_mappedFiles;
+    OFBool             opt_loopDelivery;
+    OFBool             opt_writeFiles;
+    OFBool             opt_progressiveFrames;
     OFBool             opt_promiscuous;
+    OFBool             opt_hashedAcceptance;
+    DuplicatePolicy    opt_duplicatePolicy;
+    OFBool             opt_fileDigests;
+    DigestAlgorithm    opt_digestAlgorithm;
+    RawCineExport      opt_rawCineExport;
+    OFBool             opt_projectionGeometry;
+    std::vector<E_TransferSyntax> opt_transferSyntaxes;
     OFString           callingAETitle;                    // calling application entity title will be stored here
     OFString           lastCallingAETitle;
     OFString           calledAETitle;                     // called application entity title will be stored here
@@ -120,17 +359,12 @@ private:
     OFString           lastCallingPresentationAddress;
     const char *       opt_respondingAETitle;
     OFString           opt_outputDirectory;         // default: output directory equals "."
-    OFString           lastStudyInstanceUID;
-    OFString           subdirectoryPathAndName;
-    OFList<OFString>   outputFileNameArray;
-    OFString           lastStudySubdirectoryPathAndName;
     long               opt_endOfStudyTimeout;        // default: no end of study timeout
     T_DIMSE_BlockingMode opt_blockMode;
     int                opt_dimse_timeout;
     int                opt_acse_timeout;
-
-    T_DIMSE_Message msg;
-    T_ASC_PresentationContextID presID;
+    int                opt_maxAssociations;
+    qint64             opt_shutdownDeadline;
 };
 
 }
@@ -0,0 +1,279 @@
+#include "xrfcineplayer.h"
+
+#include <QRunnable>
+#include <QThread>
+
+#include <algorithm>
+#include <cmath>
+
+namespace xrf {
+
+/* frames we keep presentation errors of for the percentiles */
+static const size_t maxErrorSamples = 100000;
+
+class RenderTask : public QRunnable
+{
+public:
+    RenderTask(CinePlayer *player, int generation, const CineLoopPtr& loop, int index, const WindowLevel& window)
+        : player(player), generation(generation), loop(loop), index(index), window(window) {}
+
+    void run() Q_DECL_OVERRIDE
+    {
+        const DisplayFrame frame = CinePlayer::render(*loop, index, window);
+        QMetaObject::invokeMethod(player, "frameRendered", Qt::QueuedConnection,
+                                  Q_ARG(int, generation), Q_ARG(xrf::DisplayFrame, frame));
+    }
+
+private:
+    CinePlayer *player;
+    int generation;
+    CineLoopPtr loop;
+    int index;
+    WindowLevel window;
+};
+
+
+CinePlayer::CinePlayer(int cacheFrames, int threads, QObject *parent)
+    : QObject(parent), mGeneration(0), mFirst(0), mLast(-1), mIntervalMs(0.0), mFrameRateOverride(0.0),
+      mPlaying(false), mSequence(0), mWaitingFor(-1), mCacheFrames(qMax(1, cacheFrames)),
+      mLastPresentNs(-1), mIntervalTotalNs(0), mIntervalMaxNs(0)
+{
+    qRegisterMetaType<xrf::DisplayFrame>("xrf::DisplayFrame");
+    // leave a core to the thread which plays, it must never wait for one
+    mWorkers.setMaxThreadCount(threads > 0 ? threads : qMax(1, QThread::idealThreadCount() - 1));
+    mTimer.setSingleShot(true);
+    mTimer.setTimerType(Qt::PreciseTimer);
+    connect(&mTimer, SIGNAL(timeout()), this, SLOT(tick()));
+}
+
+CinePlayer::~CinePlayer()
+{
+    stop();
+    mWorkers.clear();
+    mWorkers.waitForDone();
+}
+
+double CinePlayer::frameInterval(const CineLoopInfo &info)
+{
+    if (info.recommendedFrameRate > 0.0)
+        return 1000.0 / info.recommendedFrameRate;
+    if (info.frameTime > 0.0)
+        return info.frameTime;
+    if (info.cineRate > 0.0)
+        return 1000.0 / info.cineRate;
+    return 1000.0 / 15.0;
+}
+
+DisplayFrame CinePlayer::render(const CineLoop &loop, int index, const WindowLevel &window)
+{
+    DisplayFrame frame;
+    const CineLoopInfo& info = loop.info();
+    frame.pixels.resize(int(size_t(info.rows) * info.columns));
+    if (!applyWindow(window, loop, index, OFreinterpret_cast(Uint8 *, frame.pixels.data())))
+        return DisplayFrame();
+    frame.index = index;
+    frame.width = info.columns;
+    frame.height = info.rows;
+    return frame;
+}
+
+bool CinePlayer::setLoop(const CineLoopPtr &loop)
+{
+    stop();
+    ++mGeneration;
+    mWorkers.clear();
+    mCache.clear();
+    mPending.clear();
+    mLoop.reset();
+    if (!loop)
+        return false;
+
+    const CineLoopInfo& info = loop->info();
+    if (info.samplesPerPixel != 1 || !info.photometricInterpretation.startsWith("MONOCHROME")
+        || (info.bitsAllocated != 8 && info.bitsAllocated != 16) || loop->frameCount() < 1)
+        return false;
+
+    mLoop = loop;
+    mWindow = WindowLevel::fromInfo(info);
+    // trims are 1-based and inclusive; ignore ones which make no sense
+    mFirst = (info.startTrim > 0 && info.startTrim <= loop->frameCount()) ? info.startTrim - 1 : 0;
+    mLast = (info.stopTrim > 0 && info.stopTrim <= loop->frameCount()) ? info.stopTrim - 1 : loop->frameCount() - 1;
+    if (mLast < mFirst)
+    {
+        mFirst = 0;
+        mLast = loop->frameCount() - 1;
+    }
+    mIntervalMs = mFrameRateOverride > 0.0 ? 1000.0 / mFrameRateOverride : frameInterval(info);
+    mSequence = 0;
+    resetJitterStats();
+    prefetch();
+    return true;
+}
+
+void CinePlayer::setFrameRate(double fps)
+{
+    mFrameRateOverride = qMax(0.0, fps);
+    if (mLoop)
+        mIntervalMs = mFrameRateOverride > 0.0 ? 1000.0 / mFrameRateOverride : frameInterval(mLoop->info());
+}
+
+void CinePlayer::play()
+{
+    if (!mLoop)
+        return;
+    stop();
+    mPlaying = true;
+    mSequence = 0;
+    mWaitingFor = -1;
+    mLastPresentNs = -1;
+    mClock.start();
+    tick();
+}
+
+void CinePlayer::stop()
+{
+    mTimer.stop();
+    mPlaying = false;
+    mWaitingFor = -1;
+}
+
+int CinePlayer::frameAt(qint64 sequence) const
+{
+    return mFirst + int(sequence % (mLast - mFirst + 1));
+}
+
+void CinePlayer::tick()
+{
+    if (!mPlaying)
+        return;
+    const qint64 intervalNs = qint64(mIntervalMs * 1e6);
+    const qint64 now = mClock.nsecsElapsed();
+
+    // frames whose successor is due as well are not shown any more
+    const qint64 due = now / intervalNs;
+    if (due > mSequence)
+    {
+        mStats.skipped += quint64(due - mSequence);
+        mSequence = due;
+        mWaitingFor = -1;
+    }
+
+    if (mWaitingFor < 0)
+    {
+        QHash<int, DisplayFrame>::const_iterator cached = mCache.constFind(frameAt(mSequence));
+        if (cached != mCache.constEnd())
+        {
+            present(*cached, mSequence * intervalNs);
+            ++mSequence;
+        }
+        else
+        {
+            // frameRendered() shows it as soon as it is there
+            ++mStats.underruns;
+            mWaitingFor = mSequence;
+        }
+    }
+    prefetch();
+    scheduleNext();
+}
+
+void CinePlayer::scheduleNext()
+{
+    const qint64 intervalNs = qint64(mIntervalMs * 1e6);
+    const qint64 next = (mWaitingFor >= 0 ? mWaitingFor + 1 : mSequence) * intervalNs;
+    const qint64 remaining = next - mClock.nsecsElapsed();
+    // round up, a tick which comes early would find nothing to do
+    mTimer.start(int(qMax(qint64(0), (remaining + 999999) / 1000000)));
+}
+
+void CinePlayer::frameRendered(int generation, const DisplayFrame &frame)
+{
+    if (generation != mGeneration || frame.index < 0)
+        return;
+    mPending.remove(frame.index);
+    mCache.insert(frame.index, frame);
+    if (mPlaying && mWaitingFor >= 0 && frameAt(mWaitingFor) == frame.index)
+    {
+        present(frame, mWaitingFor * qint64(mIntervalMs * 1e6));
+        mSequence = mWaitingFor + 1;
+        mWaitingFor = -1;
+    }
+    prefetch();
+}
+
+void CinePlayer::prefetch()
+{
+    if (!mLoop)
+        return;
+    const int range = mLast - mFirst + 1;
+    const int ahead = qMin(mCacheFrames, range);
+    const qint64 start = mWaitingFor >= 0 ? mWaitingFor : mSequence;
+
+    // frames behind playback make room, unless the whole trim range fits into the cache
+    if (ahead < range)
+    {
+        QSet<int> window;
+        for (int k = 0; k < ahead; ++k)
+            window.insert(frameAt(start + k));
+        for (QHash<int, DisplayFrame>::iterator f = mCache.begin(); f != mCache.end(); )
+            f = window.contains(f.key()) ? f + 1 : mCache.erase(f);
+    }
+    // nearest first, the pool works through its queue in order
+    for (int k = 0; k < ahead; ++k)
+    {
+        const int index = frameAt(start + k);
+        if (mCache.contains(index) || mPending.contains(index))
+            continue;
+        mPending.insert(index);
+        mWorkers.start(new RenderTask(this, mGeneration, mLoop, index, mWindow));
+    }
+}
+
+void CinePlayer::present(const DisplayFrame &frame, qint64 dueNs)
+{
+    const qint64 now = mClock.nsecsElapsed();
+    if (mErrorsNs.size() >= maxErrorSamples)
+        mErrorsNs.erase(mErrorsNs.begin(), mErrorsNs.begin() + maxErrorSamples / 2);
+    mErrorsNs.push_back(std::abs(now - dueNs));
+    if (mLastPresentNs >= 0)
+    {
+        const qint64 interval = now - mLastPresentNs;
+        mIntervalTotalNs += interval;
+        mIntervalMaxNs = qMax(mIntervalMaxNs, interval);
+    }
+    mLastPresentNs = now;
+    ++mStats.presented;
+    emit frameReady(frame);
+}
+
+JitterStats CinePlayer::jitterStats() const
+{
+    JitterStats stats = mStats;
+    stats.intervalMs = mIntervalMs;
+    if (!mErrorsNs.empty())
+    {
+        std::vector<qint64> sorted(mErrorsNs);
+        std::sort(sorted.begin(), sorted.end());
+        qint64 total = 0;
+        for (qint64 e : sorted)
+            total += e;
+        stats.meanAbsErrorMs = total / 1e6 / sorted.size();
+        stats.p99AbsErrorMs = sorted[std::min(sorted.size() - 1, size_t(sorted.size() * 0.99))] / 1e6;
+        stats.maxAbsErrorMs = sorted.back() / 1e6;
+    }
+    if (stats.presented > 1)
+        stats.meanIntervalMs = mIntervalTotalNs / 1e6 / (stats.presented - 1);
+    stats.maxIntervalMs = mIntervalMaxNs / 1e6;
+    return stats;
+}
+
+void CinePlayer::resetJitterStats()
+{
+    mStats = JitterStats();
+    mErrorsNs.clear();
+    mLastPresentNs = -1;
+    mIntervalTotalNs = 0;
+    mIntervalMaxNs = 0;
+}
+
+}
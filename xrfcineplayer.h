@@ -0,0 +1,126 @@
+#pragma once
+
+#include "xrfcineloop.h"
+#include "xrfwindowlevel.h"
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMetaType>
+#include <QObject>
+#include <QSet>
+#include <QThreadPool>
+#include <QTimer>
+
+#include <memory>
+#include <vector>
+
+namespace xrf {
+
+/* one frame of a loop rendered for display: 8 bit grey levels, rows without padding */
+struct DisplayFrame
+{
+    int        index = -1;              // 0-based, in the loop
+    int        width = 0;
+    int        height = 0;
+    QByteArray pixels;
+};
+
+/* how closely frames were presented to the cine timing, see CinePlayer::jitterStats() */
+struct JitterStats
+{
+    quint64 presented = 0;
+    quint64 skipped = 0;                // due while an earlier one was still awaited, never shown
+    quint64 underruns = 0;              // ticks at which the frame was not rendered yet
+    double  intervalMs = 0.0;           // nominal
+    double  meanAbsErrorMs = 0.0;       // presentation time - schedule
+    double  p99AbsErrorMs = 0.0;
+    double  maxAbsErrorMs = 0.0;
+    double  meanIntervalMs = 0.0;       // between consecutive presentations
+    double  maxIntervalMs = 0.0;
+};
+
+/*
+ * Plays a cine loop at its own timing: the Recommended Display Frame Rate (0008,2144)
+ * if present, else the Frame Time (0018,1063), else the Cine Rate (0018,0040), else
+ * 15 frames/s; only the frames between Start Trim (0008,2142) and Stop Trim
+ * (0008,2143) are shown, in a loop. Frames are rendered (window/level to 8 bits by
+ * applyWindow()) on a pool of worker threads into a bounded cache which runs ahead of
+ * playback, so the thread the player lives on only hands out finished frames. The schedule is kept
+ * against a monotonic clock rather than by counting timer ticks, so late ticks do not
+ * add up; a frame which is not rendered when it is due is shown as soon as it is and
+ * counted as an underrun. Loops which are not monochrome are not played.
+ */
+class CinePlayer : public QObject
+{
+    Q_OBJECT
+public:
+    /* cacheFrames: how many frames are rendered ahead; threads: 0 = ideal thread count - 1 */
+    explicit CinePlayer(int cacheFrames = 32, int threads = 0, QObject *parent = 0);
+    ~CinePlayer();
+
+    /* stops playback and drops the frames of the previous loop; returns false if the
+     * loop cannot be played */
+    bool setLoop(const CineLoopPtr& loop);
+    CineLoopPtr loop() const                { return mLoop; }
+
+    /* overrides the timing of the loop, from the next play() on; 0 goes back to it */
+    void setFrameRate(double fps);
+    double frameIntervalMs() const          { return mIntervalMs; }
+    int firstFrame() const                  { return mFirst; }
+    int lastFrame() const                   { return mLast; }
+
+    bool isPlaying() const                  { return mPlaying; }
+    JitterStats jitterStats() const;
+    void resetJitterStats();
+
+    /* the cine timing of a loop in ms/frame, see above */
+    static double frameInterval(const CineLoopInfo& info);
+    /* renders frame index of loop; also called on the worker threads */
+    static DisplayFrame render(const CineLoop& loop, int index, const WindowLevel& window);
+
+signals:
+    void frameReady(const xrf::DisplayFrame& frame);
+
+public slots:
+    void play();
+    void stop();
+
+private slots:
+    void tick();
+    void frameRendered(int generation, const xrf::DisplayFrame& frame);
+
+private:
+    int frameAt(qint64 sequence) const;
+    void prefetch();
+    void present(const DisplayFrame& frame, qint64 dueNs);
+    void scheduleNext();
+
+    CineLoopPtr mLoop;
+    WindowLevel mWindow;
+    int mGeneration;                        // of the loop, frames of an older one are dropped
+    int mFirst;
+    int mLast;
+    double mIntervalMs;
+    double mFrameRateOverride;
+
+    QThreadPool mWorkers;
+    QTimer mTimer;
+    QElapsedTimer mClock;
+    bool mPlaying;
+    qint64 mSequence;                       // of the next frame due, counts through the trim range
+    qint64 mWaitingFor;                     // sequence which was due but not rendered, -1 if none
+    int mCacheFrames;
+    QHash<int, DisplayFrame> mCache;        // by frame index
+    QSet<int> mPending;                     // being rendered
+
+    std::vector<qint64> mErrorsNs;          // |presentation - schedule| of the frames presented
+    qint64 mLastPresentNs;
+    qint64 mIntervalTotalNs;
+    qint64 mIntervalMaxNs;
+    JitterStats mStats;
+};
+
+}
+
+Q_DECLARE_METATYPE(xrf::DisplayFrame)
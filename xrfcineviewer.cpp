@@ -0,0 +1,52 @@
+#include "xrfcineviewer.h"
+
+#include <QPainter>
+
+namespace xrf {
+
+CineViewer::CineViewer(QWidget *parent)
+    : QWidget(parent), mPlayer(32, 0)
+{
+    setAttribute(Qt::WA_OpaquePaintEvent);
+    setMinimumSize(256, 256);
+    connect(&mPlayer, SIGNAL(frameReady(const xrf::DisplayFrame&)), this, SLOT(showFrame(const xrf::DisplayFrame&)));
+}
+
+void CineViewer::setLoop(const CineLoopPtr &loop)
+{
+    mFrame = DisplayFrame();
+    mImage = QImage();
+    if (mPlayer.setLoop(loop))
+        mPlayer.play();
+    update();
+}
+
+void CineViewer::showFrame(const DisplayFrame &frame)
+{
+    // the image only points into the frame, which is kept until the next one arrives
+    mFrame = frame;
+    mImage = QImage(OFreinterpret_cast(const uchar *, mFrame.pixels.constData()),
+                    mFrame.width, mFrame.height, mFrame.width, QImage::Format_Grayscale8);
+    update();
+}
+
+void CineViewer::paintEvent(QPaintEvent *)
+{
+    QPainter painter(this);
+    painter.fillRect(rect(), Qt::black);
+    if (mImage.isNull())
+        return;
+
+    QSize size = mImage.size();
+    size.scale(this->size(), Qt::KeepAspectRatio);
+    const QRect target(QPoint((width() - size.width()) / 2, (height() - size.height()) / 2), size);
+    painter.setRenderHint(QPainter::SmoothPixmapTransform, size != mImage.size());
+    painter.drawImage(target, mImage);
+
+    painter.setPen(Qt::yellow);
+    painter.drawText(rect().adjusted(8, 8, -8, -8), Qt::AlignLeft | Qt::AlignTop,
+                     QString("%1 / %2  %3 fps").arg(mFrame.index + 1).arg(mPlayer.loop() ? mPlayer.loop()->frameCount() : 0)
+                     .arg(1000.0 / mPlayer.frameIntervalMs(), 0, 'f', 1));
+}
+
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "xrfcineplayer.h"
+
+#include <QImage>
+#include <QWidget>
+
+namespace xrf {
+
+/*
+ * Shows the loop a CinePlayer plays, scaled to the widget with its aspect ratio kept.
+ * Only paints: every frame arrives rendered, so the UI thread never waits for pixel
+ * data or a decoder.
+ */
+class CineViewer : public QWidget
+{
+    Q_OBJECT
+public:
+    explicit CineViewer(QWidget *parent = 0);
+
+    CinePlayer* player()                    { return &mPlayer; }
+
+public slots:
+    /* plays loop from its first frame; a loop which cannot be played leaves the view empty */
+    void setLoop(const xrf::CineLoopPtr& loop);
+
+protected:
+    void paintEvent(QPaintEvent *event) Q_DECL_OVERRIDE;
+
+private slots:
+    void showFrame(const xrf::DisplayFrame& frame);
+
+private:
+    CinePlayer mPlayer;
+    DisplayFrame mFrame;
+    QImage mImage;
+};
+
+}
@@ -0,0 +1,445 @@
+#include "xrfcompressor.h"
+#include "xrfcineloop.h"
+#include "xrfdigest.h"
+#include "xrferror.h"
+#include "xrfheaderreader.h"
+#include "xrfwritebehind.h"
+
+#include "dcmtk/dcmdata/dcdeftag.h"
+#include "dcmtk/dcmdata/dcpixel.h"
+#include "dcmtk/dcmdata/dcpixseq.h"
+#include "dcmtk/dcmdata/dcpxitem.h"
+
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QRunnable>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <stdio.h>
+#include <sys/stat.h>
+#include <time.h>
+#endif
+
+#include <atomic>
+#include <vector>
+
+namespace xrf {
+
+/* CPU time the calling thread has used so far */
+static qint64 threadCpuNs()
+{
+#ifdef _WIN32
+    FILETIME creation, exit, kernel, user;
+    if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user))
+        return 0;
+    const quint64 k = (quint64(kernel.dwHighDateTime) << 32) | kernel.dwLowDateTime;
+    const quint64 u = (quint64(user.dwHighDateTime) << 32) | user.dwLowDateTime;
+    return qint64(k + u) * 100;
+#else
+    timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+        return 0;
+    return qint64(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+/* enough of a file's identity to notice that it was rewritten (size, time of
+ * modification) or replaced by another one (inode) while we were working on it */
+struct FileStamp
+{
+    qint64    size = -1;
+    QDateTime modified;
+    quint64   inode = 0;
+
+    static FileStamp of(const QString& fileName)
+    {
+        FileStamp stamp;
+        const QFileInfo info(fileName);
+        if (!info.exists())
+            return stamp;
+        stamp.size = info.size();
+        stamp.modified = info.lastModified();
+#ifndef _WIN32
+        struct stat st;
+        if (stat(QFile::encodeName(fileName).constData(), &st) == 0)
+            stamp.inode = quint64(st.st_ino);
+#endif
+        return stamp;
+    }
+
+    bool operator==(const FileStamp& other) const
+    {
+        return size == other.size && modified == other.modified && inode == other.inode;
+    }
+};
+
+static void write32LE(Uint8* p, Uint32 value)
+{
+    p[0] = Uint8(value);
+    p[1] = Uint8(value >> 8);
+    p[2] = Uint8(value >> 16);
+    p[3] = Uint8(value >> 24);
+}
+
+/* PackBits (PS3.5 G.3.1): replicate runs of two or more bytes, copy the rest literally */
+static void packBits(const Uint8* data, size_t count, std::vector<Uint8>& out)
+{
+    size_t i = 0;
+    while (i < count)
+    {
+        size_t run = 1;
+        while (i + run < count && run < 128 && data[i + run] == data[i])
+            ++run;
+        if (run > 1)
+        {
+            out.push_back(Uint8(257 - run));    // -(run - 1)
+            out.push_back(data[i]);
+            i += run;
+            continue;
+        }
+        size_t literal = 1;
+        while (i + literal < count && literal < 128 && !(i + literal + 1 < count && data[i + literal] == data[i + literal + 1]))
+            ++literal;
+        out.push_back(Uint8(literal - 1));
+        out.insert(out.end(), data + i, data + i + literal);
+        i += literal;
+    }
+}
+
+/*
+ * One frame as an RLE Lossless fragment (PS3.5 Annex G): a 64 byte header, then one
+ * segment per byte of a sample, most significant byte first. Every row is encoded on
+ * its own and every segment is padded to an even length.
+ */
+static void encodeRLEFrame(const Uint8* frame, int rows, int columns, int bytesPerSample, std::vector<Uint8>& out)
+{
+    out.assign(64, 0);
+    write32LE(&out[0], Uint32(bytesPerSample));
+    std::vector<Uint8> row(columns);
+    for (int segment = 0; segment < bytesPerSample; ++segment)
+    {
+        write32LE(&out[4 + 4 * segment], Uint32(out.size()));
+        const int byteIndex = (gLocalByteOrder == EBO_LittleEndian) ? bytesPerSample - 1 - segment : segment;
+        for (int y = 0; y < rows; ++y)
+        {
+            const Uint8* src = frame + size_t(y) * columns * bytesPerSample + byteIndex;
+            for (int x = 0; x < columns; ++x)
+                row[x] = src[size_t(x) * bytesPerSample];
+            packBits(row.data(), row.size(), out);
+        }
+        if (out.size() & 1)
+            out.push_back(0);
+    }
+}
+
+/* the frames of one loop, shared by the encoders which work on it */
+struct EncodeJob
+{
+    const Uint8* pixels;
+    size_t frameBytes;
+    int frames;
+    int rows;
+    int columns;
+    int bytesPerSample;
+    std::vector<std::vector<Uint8>> fragments;
+    std::function<bool()> mayRun;
+
+    std::atomic<int> next{0};
+    std::atomic<qint64> cpuNs{0};
+    std::atomic<bool> cancelled{false};
+};
+
+/* takes frames off the job until there are none left; several of them run on the pool */
+class FrameEncoder : public QRunnable
+{
+public:
+    explicit FrameEncoder(EncodeJob& job) : job(job) { setAutoDelete(true); }
+
+    void run() Q_DECL_OVERRIDE
+    {
+        QThread::currentThread()->setPriority(QThread::LowestPriority);
+        const qint64 start = threadCpuNs();
+        forever
+        {
+            if (!job.mayRun())
+            {
+                job.cancelled = true;
+                break;
+            }
+            const int frame = job.next.fetch_add(1);
+            if (frame >= job.frames || job.cancelled)
+                break;
+            encodeRLEFrame(job.pixels + size_t(frame) * job.frameBytes, job.rows, job.columns, job.bytesPerSample, job.fragments[frame]);
+        }
+        job.cpuNs += threadCpuNs() - start;
+    }
+
+private:
+    EncodeJob& job;
+};
+
+
+BackgroundCompressor::BackgroundCompressor(int threads, QObject *parent)
+    : QThread(parent), paused(0), busy(false), stopping(false)
+{
+    pool.setMaxThreadCount(threads > 0 ? threads : QThread::idealThreadCount());
+}
+
+BackgroundCompressor::~BackgroundCompressor()
+{
+    shutdown();
+}
+
+void BackgroundCompressor::enqueue(const QString &fileName)
+{
+    QMutexLocker locker(&mutex);
+    if (stopping)
+        return;
+    queue.append(fileName);
+    changed.wakeAll();
+}
+
+void BackgroundCompressor::pause()
+{
+    QMutexLocker locker(&mutex);
+    paused++;
+}
+
+void BackgroundCompressor::resume()
+{
+    QMutexLocker locker(&mutex);
+    paused = qMax(0, paused - 1);
+    if (paused == 0)
+        changed.wakeAll();
+}
+
+bool BackgroundCompressor::waitWhilePaused()
+{
+    QMutexLocker locker(&mutex);
+    while (paused > 0 && !stopping)
+        changed.wait(&mutex);
+    return !stopping;
+}
+
+void BackgroundCompressor::waitForIdle()
+{
+    QMutexLocker locker(&mutex);
+    while ((!queue.isEmpty() || busy) && !stopping)
+        changed.wait(&mutex);
+}
+
+void BackgroundCompressor::shutdown()
+{
+    {
+        QMutexLocker locker(&mutex);
+        stopping = true;
+        queue.clear();
+        changed.wakeAll();
+    }
+    wait();
+    pool.waitForDone();
+}
+
+CompressionStats BackgroundCompressor::stats()
+{
+    QMutexLocker locker(&mutex);
+    CompressionStats stats = counters;
+    stats.queueDepth = queue.size() + (busy ? 1 : 0);
+    return stats;
+}
+
+void BackgroundCompressor::run()
+{
+    forever
+    {
+        QString fileName;
+        {
+            QMutexLocker locker(&mutex);
+            while ((queue.isEmpty() || paused > 0) && !stopping)
+                changed.wait(&mutex);
+            if (stopping)
+                break;
+            fileName = queue.takeFirst();
+            busy = true;
+        }
+
+        const CompressionResult result = compress(fileName);
+
+        {
+            QMutexLocker locker(&mutex);
+            busy = false;
+            if (result.skipped)
+                counters.skipped++;
+            else if (result.cond.bad())
+                counters.failed++;
+            else
+            {
+                counters.compressed++;
+                counters.bytesBefore += result.fileBytesBefore;
+                counters.bytesAfter += result.fileBytesAfter;
+            }
+            counters.cpuNs += result.cpuNs;
+            changed.wakeAll();
+        }
+        if (onCompleted)
+            onCompleted(result);
+    }
+}
+
+CompressionResult BackgroundCompressor::compress(const QString &fileName)
+{
+    CompressionResult result;
+    result.fileName = fileName;
+    QElapsedTimer wall;
+    wall.start();
+    const qint64 cpuStart = threadCpuNs();
+
+    // a look at the header tells most files which are not for us without loading them
+    // a resend of the object may replace the file while we compress it, the result is
+    // only put in its place if the file is still the one we read
+    const FileStamp stamp = FileStamp::of(fileName);
+    HeaderReader header(fileName);
+    OFCondition cond = header.read();
+    CineLoopInfo info;
+    if (cond.good())
+        cond = info.read(header.scanner());
+    DcmXfer xfer(header.transferSyntax());
+    if (xfer.isEncapsulated() || (xfer.getStreamCompression() == ESC_zlib) || (cond.good() &&
+        (!header.pixelDataFound() || info.samplesPerPixel != 1 || (info.bitsAllocated != 8 && info.bitsAllocated != 16))))
+    {
+        result.skipped = true;
+        return result;
+    }
+    if (cond.bad())
+    {
+        result.cond = cond;
+        return result;
+    }
+
+    const OFString path = fileName.toLocal8Bit().constData();
+    const OFString tempPath = path + ".xrfz";
+    result.fileBytesBefore = stamp.size;
+    result.frames = info.numberOfFrames;
+    {
+        DcmFileFormat fileformat;
+        cond = fileformat.loadFile(path.c_str());
+
+        DcmElement *elem = NULL;
+        if (cond.good())
+            cond = fileformat.getDataset()->findAndGetElement(DCM_PixelData, elem);
+        if (cond.good() && elem->ident() != EVR_PixelData)
+            cond = EC_CorruptedData;
+
+        const Uint8 *pixels = NULL;
+        if (cond.good())
+        {
+            if (info.bitsAllocated > 8)
+            {
+                Uint16 *words = NULL;
+                cond = elem->getUint16Array(words);
+                pixels = OFreinterpret_cast(const Uint8 *, words);
+            }
+            else
+            {
+                Uint8 *bytes = NULL;
+                cond = elem->getUint8Array(bytes);
+                pixels = bytes;
+            }
+        }
+
+        EncodeJob job;
+        job.frameBytes = info.frameBytes();
+        job.frames = info.numberOfFrames;
+        if (cond.good() && (pixels == NULL || elem->getLength() < job.frameBytes * size_t(job.frames)))
+            cond = EC_CorruptedData;
+
+        // the frames are independent, encode them in parallel; the encoders stop as soon
+        // as an association comes in and carry on when it is gone
+        if (cond.good())
+        {
+            job.pixels = pixels;
+            job.rows = info.rows;
+            job.columns = info.columns;
+            job.bytesPerSample = info.bitsAllocated / 8;
+            job.fragments.resize(size_t(job.frames));
+            job.mayRun = [this]() { return waitWhilePaused(); };
+            const int encoders = qMin(pool.maxThreadCount(), job.frames);
+            for (int i = 0; i < encoders; ++i)
+                pool.start(new FrameEncoder(job));
+            pool.waitForDone();
+            result.cpuNs += job.cpuNs;
+            result.pixelBytes = qint64(job.frameBytes) * job.frames;
+            if (job.cancelled)
+                cond = XRF_Cancelled;
+        }
+
+        if (cond.good())
+        {
+            // the offset table points at the item header of each frame's fragment
+            DcmPixelSequence *sequence = new DcmPixelSequence(DcmTag(DCM_PixelData, EVR_OB));
+            DcmPixelItem *offsetTable = new DcmPixelItem(DcmTag(DCM_Item, EVR_OB));
+            std::vector<Uint8> offsets(job.fragments.size() * 4);
+            Uint32 offset = 0;
+            sequence->insert(offsetTable);
+            for (size_t i = 0; i < job.fragments.size(); ++i)
+            {
+                const std::vector<Uint8>& fragment = job.fragments[i];
+                DcmPixelItem *item = new DcmPixelItem(DcmTag(DCM_Item, EVR_OB));
+                item->putUint8Array(fragment.data(), OFstatic_cast(unsigned long, fragment.size()));
+                sequence->insert(item);
+                write32LE(&offsets[i * 4], offset);
+                offset += Uint32(fragment.size()) + 8;
+                result.compressedBytes += qint64(fragment.size());
+            }
+            offsetTable->putUint8Array(offsets.data(), OFstatic_cast(unsigned long, offsets.size()));
+
+            // replaces the native pixel data, pixels is gone from here on
+            OFstatic_cast(DcmPixelData *, elem)->putOriginalRepresentation(EXS_RLELossless, NULL, sequence);
+            cond = fileformat.saveFile(tempPath.c_str(), EXS_RLELossless, EET_ExplicitLength, EGL_recalcGL,
+                                       EPD_noChange, 0, 0, EWM_fileformat);
+        }
+    }
+
+    if (cond.good() && !syncToDisk(tempPath, false))
+        cond = XRF_SyncFailed;
+    if (cond.good() && !(FileStamp::of(fileName) == stamp))
+    {
+        // the new file is queued for compression on its own
+        cond = XRF_FileChanged;
+        result.skipped = true;
+    }
+    if (cond.good())
+    {
+        if (replaceFile(tempPath, path))
+        {
+            OFString dirName;
+            syncToDisk(OFStandard::getDirNameFromPath(dirName, path), true);
+            result.fileBytesAfter = QFileInfo(fileName).size();
+            // the digests the receiver kept are of the native file, they follow it
+            FileDigests digests;
+            if (digests.read(fileName).good())
+            {
+                OFCondition digestCond = FileDigests::compute(fileName, digests.algorithm, digests);
+                if (digestCond.good())
+                    digestCond = digests.write(fileName);
+                if (digestCond.bad())
+                    QFile::remove(FileDigests::sidecarName(fileName));
+            }
+        }
+        else
+            cond = XRF_ReplaceFailed;
+    }
+    if (cond.bad() && OFStandard::fileExists(tempPath))
+        OFStandard::deleteFile(tempPath);
+
+    result.cond = cond;
+    result.cpuNs += threadCpuNs() - cpuStart;
+    result.wallNs = wall.nsecsElapsed();
+    return result;
+}
+
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include "dcmtk/config/osconfig.h"    /* make sure OS specific configuration is included first */
+
+#include "dcmtk/ofstd/ofcond.h"
+
+#include <QList>
+#include <QMutex>
+#include <QString>
+#include <QThread>
+#include <QThreadPool>
+#include <QWaitCondition>
+
+#include <functional>
+
+namespace xrf {
+
+/* outcome of compressing one stored loop, see BackgroundCompressor */
+struct CompressionResult
+{
+    QString fileName;
+    OFCondition cond = EC_Normal;
+    bool    skipped = false;            // already compressed, not a native image, or changed meanwhile (cond XRF_FileChanged)
+    int     frames = 0;
+    qint64  fileBytesBefore = 0;
+    qint64  fileBytesAfter = 0;
+    qint64  pixelBytes = 0;             // native pixel data
+    qint64  compressedBytes = 0;        // all fragments, without item headers
+    qint64  cpuNs = 0;                  // summed over the threads which encoded frames
+    qint64  wallNs = 0;
+
+    double ratio() const { return compressedBytes > 0 ? double(pixelBytes) / compressedBytes : 0.0; }
+};
+
+/* counters of the compression stage, see BackgroundCompressor::stats() */
+struct CompressionStats
+{
+    quint64 compressed = 0;
+    quint64 skipped = 0;
+    quint64 failed = 0;
+    int     queueDepth = 0;
+    qint64  bytesBefore = 0;            // files, of the loops which were compressed
+    qint64  bytesAfter = 0;
+    qint64  cpuNs = 0;
+};
+
+/*
+ * Background tier which transcodes stored loops to RLE Lossless. Files are queued
+ * after they have been written and handled one after the other by this thread; the
+ * frames of a loop are encoded in parallel on a pool of low priority threads. The
+ * compressed file is written next to the original, synced and renamed over it, so a
+ * reader sees either the old or the new file. While the receiver has an association
+ * open the stage is paused (see pause()), it must never take CPU away from the
+ * network. Files which are not native single-sample images with 8 or 16 bits
+ * allocated are left alone.
+ */
+class BackgroundCompressor : public QThread
+{
+    Q_OBJECT
+public:
+    typedef std::function<void(const CompressionResult& result)> CompletionHandler;
+
+    /* threads: size of the frame encoding pool (0: ideal thread count) */
+    explicit BackgroundCompressor(int threads = 0, QObject *parent = 0);
+    ~BackgroundCompressor();
+
+    /* called on this thread for every file which was taken from the queue */
+    void setCompletionHandler(const CompletionHandler& handler) { onCompleted = handler; }
+
+    void enqueue(const QString& fileName);
+
+    /* nested: the stage runs again once every pause() has been matched by a resume().
+     * A loop which is being encoded stops after the frames in flight. */
+    void pause();
+    void resume();
+
+    /* blocks until the queue is empty and nothing is being compressed */
+    void waitForIdle();
+    /* drops what is still queued and stops the thread; files stay as they are */
+    void shutdown();
+
+    CompressionStats stats();
+
+    void run() Q_DECL_OVERRIDE;
+
+    /* compresses one file on the calling thread and the pool */
+    CompressionResult compress(const QString& fileName);
+
+private:
+    /* false if the stage is stopping */
+    bool waitWhilePaused();
+
+    QMutex mutex;
+    QWaitCondition changed;
+    QList<QString> queue;
+    int paused;
+    bool busy;
+    bool stopping;
+
+    QThreadPool pool;
+    CompletionHandler onCompleted;
+    CompressionStats counters;
+};
+
+}
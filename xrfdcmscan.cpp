@@ -0,0 +1,405 @@
+#include "xrfdcmscan.h"
+#include "xrfcineloop.h"
+
+#include "dcmtk/dcmdata/dcdeftag.h"
+#include "dcmtk/dcmdata/dctag.h"
+
+#include <QList>
+
+#include <cstdlib>
+#include <cstring>
+
+namespace xrf {
+
+/* values larger than this are never kept, even if their tag is in the capture set */
+static const Uint32 MaxCaptureLength = 64 * 1024;
+/* nor are sequences which are longer than this, all items together (the per-frame
+ * functional groups of a long run take a few hundred bytes per frame) */
+static const int MaxSequenceLength = 16 * 1024 * 1024;
+
+static bool isLongFormVR(const Uint8* vr)
+{
+    static const char* longForm[] = { "OB", "OD", "OF", "OL", "OV", "OW", "SQ", "SV", "UC", "UN", "UR", "UT", "UV" };
+    for (const char* name : longForm)
+        if (vr[0] == name[0] && vr[1] == name[1])
+            return true;
+    return false;
+}
+
+static bool isVR(const char* vr, const char* name)
+{
+    return vr[0] == name[0] && vr[1] == name[1];
+}
+
+static bool isBinaryVR(const char* vr)
+{
+    return isVR(vr, "US") || isVR(vr, "SS") || isVR(vr, "UL") || isVR(vr, "SL") || isVR(vr, "FL") || isVR(vr, "FD")
+        || isVR(vr, "OB") || isVR(vr, "OW") || isVR(vr, "OF") || isVR(vr, "OD") || isVR(vr, "OL") || isVR(vr, "AT");
+}
+
+/* pos-th backslash separated component of a string value, without padding */
+static bool stringComponent(const QByteArray& value, long pos, OFString& result)
+{
+    QList<QByteArray> parts = value.split('\\');
+    if (pos < 0 || pos >= parts.size())
+        return false;
+    QByteArray part = parts[int(pos)];
+    while (!part.isEmpty() && (part.endsWith(' ') || part.endsWith('\0')))
+        part.chop(1);
+    int start = 0;
+    while (start < part.size() && part[start] == ' ')
+        ++start;
+    result = OFString(part.constData() + start, OFstatic_cast(size_t, part.size() - start));
+    return true;
+}
+
+
+DatasetScanner::DatasetScanner(E_TransferSyntax xfer)
+    : mXfer(xfer), mExplicitVR(true), mBigEndian(false), mState(Header), mOffset(0), mDepth(0),
+      mHeaderBytes(0), mRemaining(0), mInSequence(false), mCaptureTags(defaultCaptureTags()),
+      mPixelDataFound(false), mPixelDataOffset(0), mPixelDataLength(0)
+{
+    DcmXfer xferSyntax(xfer);
+    mExplicitVR = xferSyntax.isExplicitVR();
+    mBigEndian = xferSyntax.getByteOrder() == EBO_BigEndian;
+    // a deflated data set would have to be inflated first
+    if (xfer == EXS_Unknown || xferSyntax.getStreamCompression() != ESC_none)
+        mState = Failed;
+}
+
+std::vector<DcmTagKey> DatasetScanner::defaultCaptureTags()
+{
+    return {
+        DCM_SOPClassUID, DCM_SOPInstanceUID, DCM_StudyInstanceUID, DCM_SeriesInstanceUID,
+        DCM_RecommendedDisplayFrameRate, DCM_StartTrim, DCM_StopTrim, DCM_CineRate, DCM_FrameTime,
+        DCM_SamplesPerPixel, DCM_PhotometricInterpretation, DCM_NumberOfFrames, DCM_Rows, DCM_Columns,
+        DCM_BitsAllocated, DCM_BitsStored, DCM_HighBit, DCM_PixelRepresentation,
+        DCM_WindowCenter, DCM_WindowWidth,
+        DCM_DistanceSourceToDetector, DCM_DistanceSourceToPatient, DCM_EstimatedRadiographicMagnificationFactor,
+        DCM_PositionerPrimaryAngle, DCM_PositionerSecondaryAngle, DCM_ImagerPixelSpacing,
+        DCM_PositionerPrimaryAngleIncrement, DCM_PositionerSecondaryAngleIncrement,
+        XRF_SourceToIsocenter, XRF_DetectorRotation,
+        DCM_SharedFunctionalGroupsSequence, DCM_PerFrameFunctionalGroupsSequence
+    };
+}
+
+void DatasetScanner::setCaptureTags(const std::vector<DcmTagKey> &tags)
+{
+    mCaptureTags = tags;
+}
+
+void DatasetScanner::addCaptureTag(const DcmTagKey &tag)
+{
+    if (!isCaptured(tag))
+        mCaptureTags.push_back(tag);
+}
+
+bool DatasetScanner::isCaptured(const DcmTagKey &tag) const
+{
+    for (const DcmTagKey& key : mCaptureTags)
+        if (key == tag)
+            return true;
+    return false;
+}
+
+Uint16 DatasetScanner::read16(const Uint8 *p) const
+{
+    return mBigEndian ? Uint16((p[0] << 8) | p[1]) : Uint16(p[0] | (p[1] << 8));
+}
+
+Uint32 DatasetScanner::read32(const Uint8 *p) const
+{
+    return mBigEndian ? (Uint32(p[0]) << 24) | (Uint32(p[1]) << 16) | (Uint32(p[2]) << 8) | Uint32(p[3])
+                      : Uint32(p[0]) | (Uint32(p[1]) << 8) | (Uint32(p[2]) << 16) | (Uint32(p[3]) << 24);
+}
+
+/* size of the element header in mHeader, once its first 8 bytes are there */
+size_t DatasetScanner::headerSize() const
+{
+    // items and delimiters never have a VR
+    if (read16(mHeader) == 0xFFFE || !mExplicitVR)
+        return 8;
+    return isLongFormVR(mHeader + 4) ? 12 : 8;
+}
+
+void DatasetScanner::feed(const Uint8 *data, size_t length)
+{
+    while (length > 0 && mState != Done && mState != Failed)
+    {
+        // the header of a sequence which starts now is taken by processHeader()
+        const bool inSequence = mInSequence;
+        size_t n = 0;
+        switch (mState)
+        {
+        case Header:
+            {
+                const size_t need = (mHeaderBytes < 8) ? 8 : headerSize();
+                n = qMin(length, need - mHeaderBytes);
+                memcpy(mHeader + mHeaderBytes, data, n);
+                mHeaderBytes += n;
+                mOffset += n;
+                if (mHeaderBytes >= 8 && mHeaderBytes == headerSize())
+                {
+                    processHeader();
+                    mHeaderBytes = 0;
+                }
+            }
+            break;
+        case Capture:
+            {
+                n = size_t(qMin<quint64>(length, mRemaining));
+                mElements.back().value.append(OFreinterpret_cast(const char *, data), int(n));
+                mRemaining -= n;
+                mOffset += n;
+                if (mRemaining == 0)
+                    mState = Header;
+            }
+            break;
+        case Skip:
+            {
+                n = size_t(qMin<quint64>(length, mRemaining));
+                mRemaining -= n;
+                mOffset += n;
+                if (mRemaining == 0)
+                    mState = Header;
+            }
+            break;
+        default:
+            break;
+        }
+        if (inSequence)
+            captureSequence(data, n);
+        // the sequence is complete once we are back at the top level between two elements
+        if (mInSequence && mState == Header && mHeaderBytes == 0 && mDepth == 0)
+        {
+            mInSequence = false;
+            mElements.back().length = Uint32(mElements.back().value.size());
+        }
+        data += n;
+        length -= n;
+    }
+    // once done, the rest is only counted
+    mOffset += length;
+}
+
+void DatasetScanner::processHeader()
+{
+    const DcmTagKey tag(read16(mHeader), read16(mHeader + 2));
+    Uint32 length;
+    char vr[3] = { 0, 0, 0 };
+
+    if (tag.getGroup() == 0xFFFE || !mExplicitVR)
+        length = read32(mHeader + 4);
+    else
+    {
+        vr[0] = char(mHeader[4]);
+        vr[1] = char(mHeader[5]);
+        length = isLongFormVR(mHeader + 4) ? read32(mHeader + 8) : read16(mHeader + 6);
+    }
+
+    if (mDepth > 0)
+    {
+        // inside an undefined length sequence or item: only keep track of the nesting
+        if (tag == DCM_ItemDelimitationItem || tag == DCM_SequenceDelimitationItem)
+            --mDepth;
+        else if (length == DCM_UndefinedLength)
+            ++mDepth;
+        else if (length > 0)
+        {
+            mRemaining = length;
+            mState = Skip;
+        }
+        return;
+    }
+
+    if (tag == DCM_PixelData)
+    {
+        mPixelDataFound = true;
+        mPixelDataOffset = mOffset;
+        mPixelDataLength = length;
+        mState = Done;
+        return;
+    }
+
+    // a sequence is recognised by its VR, with implicit VR by the data dictionary
+    const bool sequence = mExplicitVR ? isVR(vr, "SQ") : (DcmTag(tag).getEVR() == EVR_SQ);
+    if (sequence && isCaptured(tag) && (length == DCM_UndefinedLength || length <= Uint32(MaxSequenceLength)))
+    {
+        // kept as it is encoded, header included; feed() adds the rest as it goes by
+        Element element;
+        element.tag = tag;
+        memcpy(element.vr, "SQ", 3);
+        element.offset = mOffset - headerSize();
+        element.length = DCM_UndefinedLength;   // until it is complete
+        element.value = QByteArray(OFreinterpret_cast(const char *, mHeader), int(headerSize()));
+        mElements.push_back(element);
+        mInSequence = true;
+        if (length == DCM_UndefinedLength)
+            mDepth = 1;
+        else if (length > 0)
+        {
+            mRemaining = length;
+            mState = Skip;
+        }
+        return;
+    }
+
+    if (length == DCM_UndefinedLength)
+    {
+        // a sequence (or UN encoded like one), step over its items
+        mDepth = 1;
+        return;
+    }
+
+    if (tag.getGroup() != 0xFFFE && isCaptured(tag) && length <= MaxCaptureLength)
+    {
+        Element element;
+        element.tag = tag;
+        if (!mExplicitVR)
+        {
+            // implicit VR: take the VR from the data dictionary
+            const char *name = DcmTag(tag).getVRName();
+            vr[0] = name ? name[0] : 'U';
+            vr[1] = name ? name[1] : 'N';
+        }
+        memcpy(element.vr, vr, 3);
+        element.offset = mOffset;
+        element.length = length;
+        mElements.push_back(element);
+        if (length > 0)
+        {
+            mRemaining = length;
+            mState = Capture;
+        }
+        return;
+    }
+
+    if (length > 0)
+    {
+        mRemaining = length;
+        mState = Skip;
+    }
+}
+
+void DatasetScanner::captureSequence(const Uint8 *data, size_t length)
+{
+    QByteArray& value = mElements.back().value;
+    if (value.size() + qint64(length) > MaxSequenceLength)
+    {
+        // too long to keep, it stays incomplete and is stepped over like any other
+        value = QByteArray();
+        mInSequence = false;
+        return;
+    }
+    value.append(OFreinterpret_cast(const char *, data), int(length));
+}
+
+void DatasetScanner::finish()
+{
+    // the end of the data set is a regular end only between two elements
+    if (mState == Header && mHeaderBytes == 0 && mDepth == 0)
+        mState = Done;
+    else if (mState != Done)
+        mState = Failed;
+}
+
+const DatasetScanner::Element* DatasetScanner::find(const DcmTagKey &tag) const
+{
+    for (const Element& element : mElements)
+        if (element.tag == tag)
+            return (element.value.size() == int(element.length)) ? &element : NULL;
+    return NULL;
+}
+
+bool DatasetScanner::getString(const DcmTagKey &tag, OFString &value, long pos) const
+{
+    const Element *element = find(tag);
+    if (element == NULL || isBinaryVR(element->vr) || isVR(element->vr, "SQ"))
+        return false;
+    return stringComponent(element->value, pos, value);
+}
+
+bool DatasetScanner::getUint16(const DcmTagKey &tag, Uint16 &value) const
+{
+    Sint32 number;
+    if (!getSint32(tag, number, 0) || number < 0 || number > 0xFFFF)
+        return false;
+    value = Uint16(number);
+    return true;
+}
+
+bool DatasetScanner::getSint32(const DcmTagKey &tag, Sint32 &value, long pos) const
+{
+    double number;
+    if (!getFloat64(tag, number, pos))
+        return false;
+    value = Sint32(number);
+    return true;
+}
+
+bool DatasetScanner::getSequence(const DcmTagKey &tag, QByteArray &encoded) const
+{
+    const Element *element = find(tag);
+    if (element == NULL || !isVR(element->vr, "SQ"))
+        return false;
+    encoded = element->value;
+    return true;
+}
+
+bool DatasetScanner::getFloat64(const DcmTagKey &tag, double &value, long pos) const
+{
+    const Element *element = find(tag);
+    if (element == NULL)
+        return false;
+
+    const char *vr = element->vr;
+    const Uint8 *p = OFreinterpret_cast(const Uint8 *, element->value.constData());
+    const size_t size = size_t(element->value.size());
+
+    if (isVR(vr, "US") || isVR(vr, "SS"))
+    {
+        if (pos < 0 || size < size_t(pos + 1) * 2) return false;
+        const Uint16 raw = read16(p + pos * 2);
+        value = isVR(vr, "SS") ? double(Sint16(raw)) : double(raw);
+        return true;
+    }
+    if (isVR(vr, "UL") || isVR(vr, "SL"))
+    {
+        if (pos < 0 || size < size_t(pos + 1) * 4) return false;
+        const Uint32 raw = read32(p + pos * 4);
+        value = isVR(vr, "SL") ? double(Sint32(raw)) : double(raw);
+        return true;
+    }
+    if (isVR(vr, "FL"))
+    {
+        if (pos < 0 || size < size_t(pos + 1) * 4) return false;
+        const Uint32 raw = read32(p + pos * 4);
+        Float32 f;
+        memcpy(&f, &raw, 4);
+        value = f;
+        return true;
+    }
+    if (isVR(vr, "FD"))
+    {
+        if (pos < 0 || size < size_t(pos + 1) * 8) return false;
+        const quint64 hi = read32(p + pos * 8 + (mBigEndian ? 0 : 4));
+        const quint64 lo = read32(p + pos * 8 + (mBigEndian ? 4 : 0));
+        const quint64 raw = (hi << 32) | lo;
+        Float64 d;
+        memcpy(&d, &raw, 8);
+        value = d;
+        return true;
+    }
+    if (isBinaryVR(vr) || isVR(vr, "SQ"))
+        return false;
+
+    // DS, IS and private elements of unknown VR which are encoded as strings
+    OFString text;
+    if (!stringComponent(element->value, pos, text) || text.empty())
+        return false;
+    char *end = NULL;
+    value = strtod(text.c_str(), &end);
+    return end != text.c_str();
+}
+
+}
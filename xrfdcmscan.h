@@ -0,0 +1,104 @@
+#pragma once
+
+#include "dcmtk/config/osconfig.h"    /* make sure OS specific configuration is included first */
+
+#include "dcmtk/dcmdata/dctagkey.h"
+#include "dcmtk/dcmdata/dctypes.h"
+#include "dcmtk/dcmdata/dcxfer.h"
+
+#include <QByteArray>
+
+#include <vector>
+
+namespace xrf {
+
+/*
+ * Incremental scanner for the top level of an encoded DICOM data set. Bytes are fed
+ * in arbitrary chunks as they come in (from the network or from a file); the scanner
+ * keeps the values of a configurable set of top level elements and stops at
+ * (7FE0,0010), recording where the pixel data starts and how long it is. Sequences
+ * are stepped over without being parsed, so nothing is built in memory; one in the
+ * capture set is kept as it is encoded, for the caller to parse (see getSequence()).
+ * Deflated transfer syntaxes cannot be scanned and put the scanner into the failed state.
+ */
+class DatasetScanner
+{
+public:
+    struct Element
+    {
+        DcmTagKey tag;
+        char      vr[3];
+        quint64   offset;          // of the value, relative to the start of the data set
+        Uint32    length;
+        QByteArray value;          // complete once the scanner has moved past it
+        // a sequence (vr "SQ") is kept with its element header and delimiters, offset
+        // is that of the header and length the size of the whole encoding
+    };
+
+    explicit DatasetScanner(E_TransferSyntax xfer = EXS_LittleEndianExplicit);
+
+    /* the top level elements whose values are kept; the default set covers the
+     * image pixel module, the UIDs, cine timing, the default window and the
+     * acquisition geometry (see CineGeometry), functional groups included */
+    void setCaptureTags(const std::vector<DcmTagKey>& tags);
+    void addCaptureTag(const DcmTagKey& tag);
+    static std::vector<DcmTagKey> defaultCaptureTags();
+
+    void feed(const Uint8* data, size_t length);
+
+    E_TransferSyntax transferSyntax() const  { return mXfer; }
+    bool    failed() const                   { return mState == Failed; }
+    /* the scanner has seen the header of (7FE0,0010) or the end of the data set */
+    bool    done() const                     { return mState == Done; }
+    bool    pixelDataFound() const           { return mPixelDataFound; }
+    bool    pixelDataEncapsulated() const    { return mPixelDataLength == DCM_UndefinedLength; }
+    quint64 pixelDataOffset() const          { return mPixelDataOffset; }
+    Uint32  pixelDataLength() const          { return mPixelDataLength; }
+    quint64 bytesScanned() const             { return mOffset; }
+
+    /* tell the scanner that there are no more bytes (e.g. a file without pixel data) */
+    void    finish();
+
+    const std::vector<Element>& elements() const { return mElements; }
+    const Element* find(const DcmTagKey& tag) const;
+
+    /* value accessors, interpreting the captured bytes according to the VR */
+    bool getString(const DcmTagKey& tag, OFString& value, long pos = 0) const;
+    bool getUint16(const DcmTagKey& tag, Uint16& value) const;
+    bool getFloat64(const DcmTagKey& tag, double& value, long pos = 0) const;
+    bool getSint32(const DcmTagKey& tag, Sint32& value, long pos = 0) const;
+    /* a captured sequence as encoded in transferSyntax(), from its element header to
+     * the end of its last item (or its delimitation item) */
+    bool getSequence(const DcmTagKey& tag, QByteArray& encoded) const;
+
+private:
+    enum State { Header, Capture, Skip, Done, Failed };
+
+    Uint16 read16(const Uint8* p) const;
+    Uint32 read32(const Uint8* p) const;
+    size_t headerSize() const;
+    void   processHeader();
+    bool   isCaptured(const DcmTagKey& tag) const;
+    void   captureSequence(const Uint8* data, size_t length);
+
+    E_TransferSyntax mXfer;
+    bool mExplicitVR;
+    bool mBigEndian;
+
+    State   mState;
+    quint64 mOffset;
+    int     mDepth;                 // nesting level of undefined length sequences and items
+    Uint8   mHeader[12];
+    size_t  mHeaderBytes;
+    quint64 mRemaining;             // of the value being captured or skipped
+    bool    mInSequence;            // capturing the encoding of mElements.back()
+
+    std::vector<DcmTagKey> mCaptureTags;
+    std::vector<Element> mElements;
+
+    bool    mPixelDataFound;
+    quint64 mPixelDataOffset;
+    Uint32  mPixelDataLength;
+};
+
+}
@@ -0,0 +1,210 @@
+#include "xrfdigest.h"
+#include "xrferror.h"
+#include "xrfheaderreader.h"
+
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QList>
+#include <QThread>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace xrf {
+
+/* format of the sidecar, the first line */
+static const char SidecarMagic[] = "xrfsum 1";
+
+/* digests over the given range of the file; the file is mapped, not read */
+static OFCondition digestFile(const QString &fileName, FileDigests &digests)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return EC_InvalidFilename;
+    digests.fileSize = file.size();
+    if (digests.hasPixelData && (digests.pixelDataOffset < 0 || digests.pixelDataLength < 0
+                                 || digests.pixelDataOffset + digests.pixelDataLength > digests.fileSize))
+        return XRF_DigestMismatch;
+
+    Digest whole(digests.algorithm);
+    Digest pixels(digests.algorithm);
+    if (digests.fileSize > 0)
+    {
+        const uchar *data = file.map(0, digests.fileSize);
+        if (data == NULL)
+            return XRF_MapFailed;
+        whole.update(data, size_t(digests.fileSize));
+        if (digests.hasPixelData)
+            pixels.update(data + digests.pixelDataOffset, size_t(digests.pixelDataLength));
+        file.unmap(const_cast<uchar *>(data));
+    }
+    digests.fileDigest = whole.value();
+    digests.pixelDataDigest = digests.hasPixelData ? pixels.value() : 0;
+    return EC_Normal;
+}
+
+QString FileDigests::sidecarName(const QString &fileName)
+{
+    return fileName + ".xrfsum";
+}
+
+OFCondition FileDigests::write(const QString &fileName) const
+{
+    QByteArray text(SidecarMagic);
+    text += "\nalgorithm ";
+    text += digestAlgorithmName(algorithm);
+    text += "\nfile " + QByteArray::number(fileSize) + ' ' + QByteArray::number(fileDigest, 16);
+    if (hasPixelData)
+        text += "\npixeldata " + QByteArray::number(pixelDataOffset) + ' ' + QByteArray::number(pixelDataLength)
+              + ' ' + QByteArray::number(pixelDataDigest, 16);
+    text += '\n';
+
+    QFile sidecar(sidecarName(fileName));
+    if (!sidecar.open(QIODevice::WriteOnly | QIODevice::Truncate) || sidecar.write(text) != text.size())
+        return XRF_WriteFailed;
+    return EC_Normal;
+}
+
+OFCondition FileDigests::read(const QString &fileName)
+{
+    QFile sidecar(sidecarName(fileName));
+    if (!sidecar.open(QIODevice::ReadOnly))
+        return XRF_DigestInvalid;
+    const QList<QByteArray> lines = sidecar.readAll().split('\n');
+    if (lines.isEmpty() || lines.first() != SidecarMagic)
+        return XRF_DigestInvalid;
+
+    *this = FileDigests();
+    bool haveAlgorithm = false, haveFile = false;
+    for (const QByteArray& line : lines.mid(1))
+    {
+        const QList<QByteArray> fields = line.split(' ');
+        bool ok = true;
+        if (fields.first() == "algorithm" && fields.size() == 2)
+            ok = haveAlgorithm = digestAlgorithmFromName(fields.at(1), algorithm) && algorithm != DigestAlgorithm::Best;
+        else if (fields.first() == "file" && fields.size() == 3)
+        {
+            bool sizeOk = false;
+            fileSize = fields.at(1).toLongLong(&sizeOk);
+            fileDigest = fields.at(2).toULongLong(&ok, 16);
+            ok = haveFile = ok && sizeOk;
+        }
+        else if (fields.first() == "pixeldata" && fields.size() == 4)
+        {
+            bool offsetOk = false, lengthOk = false;
+            pixelDataOffset = fields.at(1).toLongLong(&offsetOk);
+            pixelDataLength = fields.at(2).toLongLong(&lengthOk);
+            pixelDataDigest = fields.at(3).toULongLong(&ok, 16);
+            ok = hasPixelData = ok && offsetOk && lengthOk;
+        }
+        else if (!line.isEmpty())
+            ok = false;
+        if (!ok)
+            return XRF_DigestInvalid;
+    }
+    return (haveAlgorithm && haveFile) ? EC_Normal : XRF_DigestInvalid;
+}
+
+OFCondition FileDigests::compute(const QString &fileName, DigestAlgorithm algorithm, FileDigests &digests)
+{
+    HeaderReader header(fileName);
+    header.setCaptureTags(std::vector<DcmTagKey>());
+    OFCondition cond = header.read();
+    if (cond.bad())
+        return cond;
+
+    digests = FileDigests();
+    digests.algorithm = (algorithm == DigestAlgorithm::Best) ? bestDigestAlgorithm() : algorithm;
+    digests.hasPixelData = header.pixelDataFound();
+    if (digests.hasPixelData)
+    {
+        digests.pixelDataOffset = header.pixelDataFileOffset();
+        digests.pixelDataLength = header.pixelDataLength() == DCM_UndefinedLength
+            ? QFile(fileName).size() - digests.pixelDataOffset : qint64(header.pixelDataLength());
+    }
+    return digestFile(fileName, digests);
+}
+
+bool FileDigests::operator==(const FileDigests &other) const
+{
+    return algorithm == other.algorithm && fileSize == other.fileSize && fileDigest == other.fileDigest
+        && hasPixelData == other.hasPixelData && (!hasPixelData || (pixelDataOffset == other.pixelDataOffset
+        && pixelDataLength == other.pixelDataLength && pixelDataDigest == other.pixelDataDigest));
+}
+
+OFCondition verifyFileDigests(const QString &fileName, FileDigests *actual)
+{
+    FileDigests expected;
+    OFCondition cond = expected.read(fileName);
+    if (cond.bad())
+        return cond;
+
+    // the same ranges, recomputed
+    FileDigests computed = expected;
+    cond = digestFile(fileName, computed);
+    if (actual)
+        *actual = computed;
+    if (cond.bad())
+        return cond;
+    return computed == expected ? EC_Normal : XRF_DigestMismatch;
+}
+
+VerifyReport verifyDirectory(const QString &directory, int threads)
+{
+    VerifyReport report;
+    QElapsedTimer wall;
+    wall.start();
+
+    const QString suffix = FileDigests::sidecarName(QString());
+    QStringList files;
+    QDirIterator it(directory, QStringList() << "*" + suffix, QDir::Files, QDirIterator::Subdirectories);
+    while (it.hasNext())
+    {
+        const QString sidecar = it.next();
+        files.append(sidecar.left(sidecar.size() - suffix.size()));
+    }
+
+    // files are handed out one at a time, they differ a lot in size
+    std::vector<OFCondition> results(size_t(files.size()), EC_Normal);
+    std::vector<qint64> sizes(size_t(files.size()), 0);
+    std::atomic<int> next(0);
+    const auto worker = [&]() {
+        for (int i = next++; i < files.size(); i = next++)
+        {
+            FileDigests actual;
+            results[size_t(i)] = verifyFileDigests(files.at(i), &actual);
+            sizes[size_t(i)] = actual.fileSize;
+        }
+    };
+    std::vector<std::thread> workers;
+    const int count = qBound(1, threads > 0 ? threads : QThread::idealThreadCount(), qMax(1, files.size()));
+    for (int t = 0; t < count; ++t)
+        workers.emplace_back(worker);
+    for (std::thread& t : workers)
+        t.join();
+
+    report.files = files.size();
+    for (int i = 0; i < files.size(); ++i)
+    {
+        const OFCondition& cond = results[size_t(i)];
+        report.bytes += sizes[size_t(i)];
+        if (cond.good())
+            ++report.verified;
+        else
+        {
+            if (cond == XRF_DigestMismatch)
+                ++report.mismatched;
+            else if (cond == XRF_DigestInvalid)
+                ++report.invalid;
+            else
+                ++report.failed;
+            report.mismatches.append(files.at(i));
+        }
+    }
+    report.wallNs = wall.nsecsElapsed();
+    return report;
+}
+
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "dcmtk/config/osconfig.h"    /* make sure OS specific configuration is included first */
+
+#include "dcmtk/ofstd/ofcond.h"
+
+#include "xrfhash.h"
+
+#include <QString>
+#include <QStringList>
+
+namespace xrf {
+
+/*
+ * Integrity digests of a stored file: one over the file as a whole and one over the
+ * value of its pixel data (encapsulated pixel data: from the start of the value to
+ * the end of the file). The receiver computes them while the file is written (see
+ * CineLoopRcv::enableDigests()) and keeps them in a small text file next to it, the
+ * file name plus .xrfsum. The ranges are recorded with the digests, so verifying a
+ * file needs no DICOM parsing, only one read of it.
+ */
+struct FileDigests
+{
+    DigestAlgorithm algorithm = DigestAlgorithm::Crc32c;
+    qint64  fileSize = 0;
+    quint64 fileDigest = 0;
+    bool    hasPixelData = false;
+    qint64  pixelDataOffset = 0;        // in the file
+    qint64  pixelDataLength = 0;
+    quint64 pixelDataDigest = 0;
+
+    static QString sidecarName(const QString& fileName);
+
+    /* the sidecar of fileName */
+    OFCondition write(const QString& fileName) const;
+    OFCondition read(const QString& fileName);
+
+    /* reads fileName to compute its digests; the pixel data is located by a HeaderReader */
+    static OFCondition compute(const QString& fileName, DigestAlgorithm algorithm, FileDigests& digests);
+
+    bool operator==(const FileDigests& other) const;
+    bool operator!=(const FileDigests& other) const   { return !(*this == other); }
+};
+
+/* reads fileName and compares it to its sidecar: XRF_DigestMismatch, XRF_DigestInvalid
+ * or the error of reading it; actual takes what was computed */
+OFCondition verifyFileDigests(const QString& fileName, FileDigests* actual = NULL);
+
+/* outcome of verifyDirectory() */
+struct VerifyReport
+{
+    int     files = 0;                  // with a sidecar
+    int     verified = 0;
+    int     mismatched = 0;
+    int     invalid = 0;                // sidecar unreadable
+    int     failed = 0;                 // file unreadable
+    qint64  bytes = 0;                  // read
+    qint64  wallNs = 0;
+    QStringList mismatches;             // file names, also of the invalid and failed ones
+};
+
+/* verifies every file below directory which has a sidecar, spread over threads threads
+ * (0: the ideal thread count); each file is read once */
+VerifyReport verifyDirectory(const QString& directory, int threads = 0);
+
+}
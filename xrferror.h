@@ -0,0 +1,27 @@
+#pragma once
+
+#include "dcmtk/config/osconfig.h"    /* make sure OS specific configuration is included first */
+
+#include "dcmtk/ofstd/ofcond.h"
+
+namespace xrf {
+
+/* module number of the conditions raised by the receiver itself; DCMTK
+ * keeps the lower module numbers for its own libraries */
+const unsigned short XRF_MODULE = 1024;
+
+makeOFConditionConst(XRF_SyncFailed,          XRF_MODULE, 1, OF_error, "Cannot sync file to disk");
+makeOFConditionConst(XRF_WriteFailed,         XRF_MODULE, 2, OF_error, "Cannot write to file");
+makeOFConditionConst(XRF_IndexOpenFailed,     XRF_MODULE, 3, OF_error, "Cannot open loop index");
+makeOFConditionConst(XRF_IndexInvalid,        XRF_MODULE, 4, OF_error, "Loop index is corrupt or of another version");
+makeOFConditionConst(XRF_Cancelled,           XRF_MODULE, 5, OF_error, "Operation cancelled");
+makeOFConditionConst(XRF_ReplaceFailed,       XRF_MODULE, 6, OF_error, "Cannot replace file");
+makeOFConditionConst(XRF_ReactorFailed,       XRF_MODULE, 7, OF_error, "Cannot wait for socket readiness");
+makeOFConditionConst(XRF_MapFailed,           XRF_MODULE, 8, OF_error, "Cannot map file into memory");
+makeOFConditionConst(XRF_DigestMismatch,      XRF_MODULE, 9, OF_error, "File does not match its digest");
+makeOFConditionConst(XRF_DigestInvalid,       XRF_MODULE, 10, OF_error, "Digest file is missing or corrupt");
+makeOFConditionConst(XRF_RawCineInvalid,      XRF_MODULE, 11, OF_error, "Raw cine file is corrupt or of another version");
+makeOFConditionConst(XRF_GeometryIncomplete,  XRF_MODULE, 12, OF_error, "Acquisition geometry is incomplete");
+makeOFConditionConst(XRF_FileChanged,         XRF_MODULE, 13, OF_error, "File changed while it was processed");
+
+}
@@ -0,0 +1,170 @@
+#include "xrfframering.h"
+
+#include <QThread>
+
+namespace xrf {
+
+static quint64 ringSize(int capacity)
+{
+    quint64 size = 2;
+    while (size < quint64(qMax(capacity, 2)))
+        size <<= 1;
+    return size;
+}
+
+FrameRing::FrameRing(int capacity, RingPolicy policy)
+    : mask(ringSize(capacity) - 1), ringPolicy(policy), slots(new Slot[mask + 1]),
+      enqueuePos(0), dequeuePos(0), closed(false),
+      pushed(0), popped(0), droppedOldest(0), droppedNewest(0), blockedNs(0),
+      latencyTotalNs(0), latencyMaxNs(0), lastLatencyNs(0)
+{
+    for (quint64 i = 0; i <= mask; ++i)
+    {
+        slots[i].sequence.store(i, std::memory_order_relaxed);
+        slots[i].pushedNs = 0;
+    }
+    clock.start();
+}
+
+FrameRing::~FrameRing()
+{
+
+}
+
+bool FrameRing::push(const CineFrame &frame)
+{
+    QElapsedTimer blocked;
+    int spins = 0;
+    quint64 pos = enqueuePos.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        if (closed.load(std::memory_order_acquire))
+            break;
+
+        Slot& slot = slots[pos & mask];
+        const qint64 diff = qint64(slot.sequence.load(std::memory_order_acquire)) - qint64(pos);
+        if (diff == 0)
+        {
+            // the slot is free, claim the position
+            if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                slot.frame = frame;
+                slot.pushedNs = clock.nsecsElapsed();
+                slot.sequence.store(pos + 1, std::memory_order_release);
+                pushed.fetch_add(1, std::memory_order_relaxed);
+                if (blocked.isValid())
+                    blockedNs.fetch_add(blocked.nsecsElapsed(), std::memory_order_relaxed);
+                return true;
+            }
+            continue;
+        }
+        if (diff > 0)
+        {
+            // another producer took the position
+            pos = enqueuePos.load(std::memory_order_relaxed);
+            continue;
+        }
+
+        // full: the slot still holds the frame of the previous lap
+        if (ringPolicy == RingPolicy::DropNewest)
+        {
+            droppedNewest.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        if (ringPolicy == RingPolicy::DropOldest)
+        {
+            CineFrame oldest;
+            qint64 pushedNs;
+            if (take(oldest, pushedNs))
+                droppedOldest.fetch_add(1, std::memory_order_relaxed);
+        }
+        else
+        {
+            if (!blocked.isValid())
+                blocked.start();
+            // a consumer is usually only a few frames away, don't go to sleep right away
+            if (++spins < 64)
+                QThread::yieldCurrentThread();
+            else
+                QThread::usleep(200);
+        }
+        // if take() found nothing, a consumer is just moving the oldest frame out
+        pos = enqueuePos.load(std::memory_order_relaxed);
+    }
+    if (blocked.isValid())
+        blockedNs.fetch_add(blocked.nsecsElapsed(), std::memory_order_relaxed);
+    return false;
+}
+
+bool FrameRing::take(CineFrame &frame, qint64 &pushedNs)
+{
+    quint64 pos = dequeuePos.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        Slot& slot = slots[pos & mask];
+        const qint64 diff = qint64(slot.sequence.load(std::memory_order_acquire)) - qint64(pos + 1);
+        if (diff == 0)
+        {
+            if (dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                frame = std::move(slot.frame);
+                // the ring must not keep the loop's buffer alive
+                slot.frame = CineFrame();
+                pushedNs = slot.pushedNs;
+                slot.sequence.store(pos + mask + 1, std::memory_order_release);
+                return true;
+            }
+        }
+        else if (diff < 0)
+            return false;
+        else
+            pos = dequeuePos.load(std::memory_order_relaxed);
+    }
+}
+
+bool FrameRing::pop(CineFrame &frame)
+{
+    qint64 pushedNs;
+    if (!take(frame, pushedNs))
+        return false;
+    const qint64 latency = clock.nsecsElapsed() - pushedNs;
+    popped.fetch_add(1, std::memory_order_relaxed);
+    latencyTotalNs.fetch_add(latency, std::memory_order_relaxed);
+    lastLatencyNs.store(latency, std::memory_order_relaxed);
+    updateMax(latencyMaxNs, latency);
+    return true;
+}
+
+void FrameRing::updateMax(std::atomic<qint64> &max, qint64 value)
+{
+    qint64 current = max.load(std::memory_order_relaxed);
+    while (value > current && !max.compare_exchange_weak(current, value, std::memory_order_relaxed)) {}
+}
+
+void FrameRing::close()
+{
+    closed.store(true, std::memory_order_release);
+}
+
+int FrameRing::size() const
+{
+    const qint64 count = qint64(enqueuePos.load(std::memory_order_relaxed)) - qint64(dequeuePos.load(std::memory_order_relaxed));
+    return int(qBound(qint64(0), count, qint64(mask + 1)));
+}
+
+FrameRingStats FrameRing::stats() const
+{
+    FrameRingStats s;
+    s.pushed = pushed.load(std::memory_order_relaxed);
+    s.popped = popped.load(std::memory_order_relaxed);
+    s.droppedOldest = droppedOldest.load(std::memory_order_relaxed);
+    s.droppedNewest = droppedNewest.load(std::memory_order_relaxed);
+    s.blockedNs = blockedNs.load(std::memory_order_relaxed);
+    s.latencyTotalNs = latencyTotalNs.load(std::memory_order_relaxed);
+    s.latencyMaxNs = latencyMaxNs.load(std::memory_order_relaxed);
+    s.lastLatencyNs = lastLatencyNs.load(std::memory_order_relaxed);
+    s.depth = size();
+    return s;
+}
+
+}
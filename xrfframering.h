@@ -0,0 +1,108 @@
+#pragma once
+
+#include "xrfcineloop.h"
+
+#include <QElapsedTimer>
+
+#include <atomic>
+#include <memory>
+
+namespace xrf {
+
+/* what FrameRing::push() does while the ring is full */
+enum class RingPolicy {
+    DropOldest,     // the oldest frame in the ring makes room, push never waits
+    DropNewest,     // the frame being pushed is dropped, push never waits
+    Block           // push waits until a consumer has made room (or the ring is closed)
+};
+
+/* counters of a FrameRing, see FrameRing::stats() */
+struct FrameRingStats
+{
+    quint64 pushed = 0;                 // frames which went into the ring
+    quint64 popped = 0;                 // frames taken by consumers
+    quint64 droppedOldest = 0;
+    quint64 droppedNewest = 0;
+    qint64  blockedNs = 0;              // producers waiting under RingPolicy::Block
+    qint64  latencyTotalNs = 0;         // push -> pop, of the popped frames
+    qint64  latencyMaxNs = 0;
+    qint64  lastLatencyNs = 0;
+    int     depth = 0;
+
+    quint64 dropped() const { return droppedOldest + droppedNewest; }
+};
+
+/*
+ * Bounded lock-free ring of received frames between the receiver and live display
+ * consumers. The association workers push every frame as soon as it has come off the
+ * network; display threads pull at their own rate, each frame is taken by exactly one
+ * consumer. Every slot carries a sequence number (Vyukov's bounded queue), so
+ * producers and consumers only ever compete for a position counter with a
+ * compare-and-swap and never wait for each other, except under RingPolicy::Block.
+ * A popped frame holds a reference to the buffer its loop is received into (see
+ * CineFrame), the ring itself drops its reference as soon as the frame leaves it.
+ * The capacity is rounded up to a power of two.
+ *
+ * The frames are not decoded for display: they carry the stored values as received
+ * (native, local byte order), consumers window them themselves (see applyWindow()).
+ * Nor are they copied, so each frame keeps the buffer of its whole loop alive; a ring
+ * whose consumers fall behind by several loops holds up to capacity() loop buffers.
+ * A consumer which keeps frames beyond displaying them should copy or window them and
+ * drop the CineFrame.
+ */
+class FrameRing
+{
+public:
+    explicit FrameRing(int capacity = 64, RingPolicy policy = RingPolicy::DropOldest);
+    ~FrameRing();
+
+    /* false if the frame was dropped or the ring is closed */
+    bool push(const CineFrame& frame);
+    /* false if the ring is empty; never waits */
+    bool pop(CineFrame& frame);
+
+    /* wakes producers waiting under RingPolicy::Block, every push() fails from now on */
+    void close();
+    bool isClosed() const               { return closed.load(std::memory_order_acquire); }
+
+    int capacity() const                { return int(mask + 1); }
+    RingPolicy policy() const           { return ringPolicy; }
+    /* approximate while producers or consumers are busy */
+    int size() const;
+    FrameRingStats stats() const;
+
+private:
+    struct Slot
+    {
+        std::atomic<quint64> sequence;
+        CineFrame frame;
+        qint64 pushedNs;
+    };
+
+    bool take(CineFrame& frame, qint64& pushedNs);
+    static void updateMax(std::atomic<qint64>& max, qint64 value);
+
+    const quint64 mask;
+    const RingPolicy ringPolicy;
+    std::unique_ptr<Slot[]> slots;
+    QElapsedTimer clock;
+
+    // producers and consumers each on a cache line of their own
+    char pad0[64];
+    std::atomic<quint64> enqueuePos;
+    char pad1[64 - sizeof(std::atomic<quint64>)];
+    std::atomic<quint64> dequeuePos;
+    char pad2[64 - sizeof(std::atomic<quint64>)];
+    std::atomic<bool> closed;
+
+    std::atomic<quint64> pushed;
+    std::atomic<quint64> popped;
+    std::atomic<quint64> droppedOldest;
+    std::atomic<quint64> droppedNewest;
+    std::atomic<qint64> blockedNs;
+    std::atomic<qint64> latencyTotalNs;
+    std::atomic<qint64> latencyMaxNs;
+    std::atomic<qint64> lastLatencyNs;
+};
+
+}
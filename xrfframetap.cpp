@@ -0,0 +1,154 @@
+#include "xrfframetap.h"
+
+#include "dcmtk/dcmdata/dcswap.h"
+
+#include <cstring>
+#include <new>
+
+namespace xrf {
+
+FrameTap::FrameTap()
+    : mPool(NULL), mBigEndian(false), mOffset(0), mPixelBytes(0), mReceived(0), mFrameBytes(0),
+      mFramesReceived(0), mActive(false), mStatus(EC_Normal)
+{
+
+}
+
+void FrameTap::begin(E_TransferSyntax xfer)
+{
+    mScanner = DatasetScanner(xfer);
+    mBigEndian = (DcmXfer(xfer).getByteOrder() == EBO_BigEndian);
+    mOffset = 0;
+    mInfo.reset();
+    mPixels.reset();
+    mPixelBytes = mReceived = mFrameBytes = 0;
+    mFramesReceived = 0;
+    mActive = false;
+    mLoop.reset();
+    mStatus = mScanner.failed() ? EC_UnsupportedEncoding : EC_Normal;
+}
+
+void FrameTap::startPixelData()
+{
+    if (!mScanner.pixelDataFound() || mScanner.pixelDataEncapsulated())
+    {
+        mStatus = EC_UnsupportedEncoding;
+        return;
+    }
+
+    std::shared_ptr<CineLoopInfo> info = std::make_shared<CineLoopInfo>();
+    mStatus = info->read(mScanner);
+    if (mStatus.bad())
+        return;
+    // the data set is still in the transfer syntax of the network, the buffer is not
+    info->xfer = EXS_LittleEndianExplicit;
+
+    mFrameBytes = info->frameBytes();
+    mPixelBytes = mScanner.pixelDataLength();
+    if (mFrameBytes == 0 || mPixelBytes < mFrameBytes * size_t(info->numberOfFrames))
+    {
+        mStatus = EC_CorruptedData;
+        return;
+    }
+
+    if (mPool)
+    {
+        mPixels = mPool->acquire(mPixelBytes);
+        if (!mPixels)
+        {
+            mStatus = EC_MemoryExhausted;
+            return;
+        }
+    }
+    else
+    {
+        // the length comes from the peer, a failed allocation fails the tap, not the worker
+        mPixels.reset(new (std::nothrow) Uint8[mPixelBytes], std::default_delete<Uint8[]>());
+        if (!mPixels)
+        {
+            mStatus = EC_MemoryExhausted;
+            return;
+        }
+    }
+    mInfo = info;
+    mActive = true;
+}
+
+void FrameTap::write(const Uint8 *data, size_t length)
+{
+    if (mStatus.bad())
+        return;
+
+    const quint64 chunkOffset = mOffset;
+    mOffset += length;
+
+    if (!mActive)
+    {
+        // everything up to and including the pixel data header goes to the scanner,
+        // it stops by itself and ignores whatever follows in this chunk
+        mScanner.feed(data, length);
+        if (mScanner.failed())
+            mStatus = EC_UnsupportedEncoding;
+        else if (mScanner.done())
+            startPixelData();
+        if (!mActive)
+            return;
+    }
+
+    // copy the part of the chunk which overlaps the pixel data value
+    const quint64 valueStart = mScanner.pixelDataOffset() + mReceived;
+    const quint64 valueEnd = mScanner.pixelDataOffset() + mPixelBytes;
+    const quint64 begin = qMax(chunkOffset, valueStart);
+    const quint64 end = qMin(mOffset, valueEnd);
+    if (begin < end)
+    {
+        const size_t count = size_t(end - begin);
+        memcpy(mPixels.get() + mReceived, data + (begin - chunkOffset), count);
+        mReceived += count;
+        announceFrames();
+    }
+}
+
+void FrameTap::announceFrames()
+{
+    const int complete = qMin(int(mReceived / mFrameBytes), mInfo->numberOfFrames);
+    while (mFramesReceived < complete)
+    {
+        Uint8 *pixels = mPixels.get() + size_t(mFramesReceived) * mFrameBytes;
+        if (mBigEndian && mInfo->bitsAllocated > 8)
+            swapIfNecessary(gLocalByteOrder, EBO_BigEndian, pixels, OFstatic_cast(Uint32, mFrameBytes), mInfo->bitsAllocated / 8);
+
+        if (mFrameHandler)
+        {
+            CineFrame frame;
+            frame.info = mInfo;
+            frame.owner = mPixels;
+            frame.index = mFramesReceived;
+            frame.pixels = pixels;
+            frame.bytes = mFrameBytes;
+            mFrameHandler(frame);
+        }
+        ++mFramesReceived;
+    }
+}
+
+void FrameTap::finish(const OFCondition &result)
+{
+    if (result.bad())
+    {
+        mStatus = result;
+        return;
+    }
+    if (mStatus.good() && !mActive)
+    {
+        // the data set ended without (native) pixel data
+        mScanner.finish();
+        mStatus = EC_TagNotFound;
+    }
+    if (mStatus.good() && mFramesReceived < mInfo->numberOfFrames)
+        mStatus = EC_CorruptedData;
+    if (mStatus.good())
+        mLoop = std::make_shared<const CineLoop>(*mInfo, mPixels, mPixels.get(), size_t(mFramesReceived) * mFrameBytes);
+}
+
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "xrfstreamstore.h"
+#include "xrfdcmscan.h"
+#include "xrfcineloop.h"
+#include "xrfbufferpool.h"
+
+#include <functional>
+#include <memory>
+
+namespace xrf {
+
+/*
+ * Stream tap which assembles a native (uncompressed) cine loop while the C-STORE is
+ * still coming in. The scanner picks up the image pixel module from the data set
+ * header; once the header of (7FE0,0010) has gone by, a buffer for the whole pixel
+ * data is allocated and every frame is announced through the frame handler as soon
+ * as its last byte has arrived. Frames are converted to the local byte order before
+ * they are announced and are never copied again: the frames and the final loop all
+ * share the one buffer. With a PixelBufferPool the buffer is taken from the pool,
+ * sized from the image pixel module, and goes back to it once the loop and its
+ * frames have been released. Encapsulated pixel data is not assembled, the tap stays
+ * silent in that case.
+ */
+class FrameTap : public StreamTap
+{
+public:
+    typedef std::function<void(const CineFrame&)> FrameHandler;
+
+    FrameTap();
+
+    void setFrameHandler(FrameHandler handler)  { mFrameHandler = std::move(handler); }
+    /* pool to receive the pixel data into; NULL: a buffer on the heap */
+    void setBufferPool(PixelBufferPool* pool)   { mPool = pool; }
+
+    void begin(E_TransferSyntax xfer) Q_DECL_OVERRIDE;
+    void write(const Uint8* data, size_t length) Q_DECL_OVERRIDE;
+    void finish(const OFCondition& result) Q_DECL_OVERRIDE;
+    bool needsData() const Q_DECL_OVERRIDE  { return mStatus.good(); }
+
+    int framesReceived() const          { return mFramesReceived; }
+    /* the complete loop; only set after finish() with a good result */
+    CineLoopPtr loop() const            { return mLoop; }
+    OFCondition status() const          { return mStatus; }
+
+private:
+    void startPixelData();
+    void announceFrames();
+
+    DatasetScanner mScanner;
+    FrameHandler mFrameHandler;
+    PixelBufferPool* mPool;
+    bool mBigEndian;
+
+    quint64 mOffset;                        // of the next byte written, relative to the data set
+    std::shared_ptr<const CineLoopInfo> mInfo;
+    std::shared_ptr<Uint8> mPixels;
+    size_t mPixelBytes;                     // size of the pixel data value
+    size_t mReceived;                       // pixel data bytes received so far
+    size_t mFrameBytes;
+    int mFramesReceived;
+    bool mActive;
+
+    CineLoopPtr mLoop;
+    OFCondition mStatus;
+};
+
+}
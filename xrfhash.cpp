@@ -0,0 +1,309 @@
+#include "xrfhash.h"
+
+#include <QtEndian>
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define XRF_HASH_X86
+#include <nmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// GCC and Clang only emit the CRC32 instruction in functions which ask for it
+#if defined(XRF_HASH_X86) && defined(__GNUC__)
+#define XRF_TARGET_SSE42 __attribute__((target("sse4.2")))
+#else
+#define XRF_TARGET_SSE42
+#endif
+
+namespace xrf {
+
+static const quint64 Prime1 = Q_UINT64_C(0x9E3779B185EBCA87);
+static const quint64 Prime2 = Q_UINT64_C(0xC2B2AE3D27D4EB4F);
+static const quint64 Prime3 = Q_UINT64_C(0x165667B19E3779F9);
+static const quint64 Prime4 = Q_UINT64_C(0x85EBCA77C2B2AE63);
+static const quint64 Prime5 = Q_UINT64_C(0x27D4EB2F165667C5);
+
+static inline quint64 rotl(quint64 x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline quint64 read64(const unsigned char *p)
+{
+    return qFromLittleEndian<quint64>(p);
+}
+
+static inline quint32 read32(const unsigned char *p)
+{
+    return qFromLittleEndian<quint32>(p);
+}
+
+static inline quint64 mixRound(quint64 acc, quint64 input)
+{
+    acc += input * Prime2;
+    return rotl(acc, 31) * Prime1;
+}
+
+static inline quint64 mergeRound(quint64 acc, quint64 value)
+{
+    acc ^= mixRound(0, value);
+    return acc * Prime1 + Prime4;
+}
+
+XxHash64::XxHash64(quint64 seed)
+{
+    reset(seed);
+}
+
+void XxHash64::reset(quint64 seed)
+{
+    this->seed = seed;
+    acc[0] = seed + Prime1 + Prime2;
+    acc[1] = seed + Prime2;
+    acc[2] = seed;
+    acc[3] = seed - Prime1;
+    total = 0;
+    buffered = 0;
+}
+
+void XxHash64::update(const void *data, size_t length)
+{
+    const unsigned char *p = static_cast<const unsigned char *>(data);
+    const unsigned char *end = p + length;
+    total += length;
+
+    if (buffered + length < sizeof(buffer))
+    {
+        memcpy(buffer + buffered, p, length);
+        buffered += length;
+        return;
+    }
+    if (buffered > 0)
+    {
+        const size_t fill = sizeof(buffer) - buffered;
+        memcpy(buffer + buffered, p, fill);
+        p += fill;
+        for (int i = 0; i < 4; ++i)
+            acc[i] = mixRound(acc[i], read64(buffer + 8 * i));
+        buffered = 0;
+    }
+    // stripes of 32 bytes straight from the input
+    for (; p + 32 <= end; p += 32)
+    {
+        acc[0] = mixRound(acc[0], read64(p));
+        acc[1] = mixRound(acc[1], read64(p + 8));
+        acc[2] = mixRound(acc[2], read64(p + 16));
+        acc[3] = mixRound(acc[3], read64(p + 24));
+    }
+    buffered = size_t(end - p);
+    memcpy(buffer, p, buffered);
+}
+
+quint64 XxHash64::digest() const
+{
+    quint64 h;
+    if (total >= 32)
+    {
+        h = rotl(acc[0], 1) + rotl(acc[1], 7) + rotl(acc[2], 12) + rotl(acc[3], 18);
+        for (int i = 0; i < 4; ++i)
+            h = mergeRound(h, acc[i]);
+    }
+    else
+        h = seed + Prime5;
+    h += total;
+
+    const unsigned char *p = buffer;
+    const unsigned char *end = buffer + buffered;
+    for (; p + 8 <= end; p += 8)
+        h = rotl(h ^ mixRound(0, read64(p)), 27) * Prime1 + Prime4;
+    if (p + 4 <= end)
+    {
+        h = rotl(h ^ (quint64(read32(p)) * Prime1), 23) * Prime2 + Prime3;
+        p += 4;
+    }
+    for (; p < end; ++p)
+        h = rotl(h ^ (*p * Prime5), 11) * Prime1;
+
+    h ^= h >> 33;
+    h *= Prime2;
+    h ^= h >> 29;
+    h *= Prime3;
+    h ^= h >> 32;
+    return h;
+}
+
+quint64 XxHash64::hash(const void *data, size_t length, quint64 seed)
+{
+    XxHash64 state(seed);
+    state.update(data, length);
+    return state.digest();
+}
+
+
+/* reflected Castagnoli polynomial; table[k][b] is the CRC of byte b followed by k zero bytes */
+struct Crc32cTables
+{
+    quint32 table[8][256];
+
+    Crc32cTables()
+    {
+        for (quint32 b = 0; b < 256; ++b)
+        {
+            quint32 crc = b;
+            for (int i = 0; i < 8; ++i)
+                crc = (crc >> 1) ^ ((crc & 1) ? 0x82F63B78u : 0u);
+            table[0][b] = crc;
+        }
+        for (quint32 b = 0; b < 256; ++b)
+            for (int k = 1; k < 8; ++k)
+                table[k][b] = (table[k - 1][b] >> 8) ^ table[0][table[k - 1][b] & 0xFF];
+    }
+};
+
+static quint32 crc32cSoftware(quint32 crc, const unsigned char *p, size_t length)
+{
+    static const Crc32cTables tables;
+    const quint32 (*t)[256] = tables.table;
+    for (; length >= 8; p += 8, length -= 8)
+    {
+        const quint32 low = crc ^ read32(p);
+        const quint32 high = read32(p + 4);
+        crc = t[7][low & 0xFF] ^ t[6][(low >> 8) & 0xFF] ^ t[5][(low >> 16) & 0xFF] ^ t[4][low >> 24]
+            ^ t[3][high & 0xFF] ^ t[2][(high >> 8) & 0xFF] ^ t[1][(high >> 16) & 0xFF] ^ t[0][high >> 24];
+    }
+    for (; length > 0; ++p, --length)
+        crc = (crc >> 8) ^ t[0][(crc ^ *p) & 0xFF];
+    return crc;
+}
+
+#ifdef XRF_HASH_X86
+
+XRF_TARGET_SSE42 static quint32 crc32cHardware(quint32 crc, const unsigned char *p, size_t length)
+{
+#if defined(__x86_64__) || defined(_M_X64)
+    quint64 crc64 = crc;
+    for (; length >= 8; p += 8, length -= 8)
+    {
+        quint64 value;
+        memcpy(&value, p, 8);
+        crc64 = _mm_crc32_u64(crc64, value);
+    }
+    crc = quint32(crc64);
+#endif
+    for (; length >= 4; p += 4, length -= 4)
+    {
+        quint32 value;
+        memcpy(&value, p, 4);
+        crc = _mm_crc32_u32(crc, value);
+    }
+    for (; length > 0; ++p, --length)
+        crc = _mm_crc32_u8(crc, *p);
+    return crc;
+}
+
+#endif
+
+static bool detectCrc32cHardware()
+{
+#ifdef XRF_HASH_X86
+#ifdef _MSC_VER
+    int regs[4];
+    __cpuid(regs, 1);
+    return (regs[2] & (1 << 20)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2");
+#endif
+#else
+    return false;
+#endif
+}
+
+bool Crc32c::isHardwareAccelerated()
+{
+    static const bool hardware = detectCrc32cHardware();
+    return hardware;
+}
+
+void Crc32c::update(const void *data, size_t length)
+{
+    const unsigned char *p = static_cast<const unsigned char *>(data);
+    total += length;
+#ifdef XRF_HASH_X86
+    if (isHardwareAccelerated())
+    {
+        state = crc32cHardware(state, p, length);
+        return;
+    }
+#endif
+    state = crc32cSoftware(state, p, length);
+}
+
+quint32 Crc32c::hash(const void *data, size_t length)
+{
+    Crc32c state;
+    state.update(data, length);
+    return state.digest();
+}
+
+
+DigestAlgorithm bestDigestAlgorithm()
+{
+    return Crc32c::isHardwareAccelerated() ? DigestAlgorithm::Crc32c : DigestAlgorithm::XxHash64;
+}
+
+const char *digestAlgorithmName(DigestAlgorithm algorithm)
+{
+    switch (algorithm)
+    {
+    case DigestAlgorithm::Crc32c:   return "crc32c";
+    case DigestAlgorithm::XxHash64: return "xxh64";
+    case DigestAlgorithm::Best:     return digestAlgorithmName(bestDigestAlgorithm());
+    }
+    return "unknown";
+}
+
+bool digestAlgorithmFromName(const QByteArray &name, DigestAlgorithm &algorithm)
+{
+    if (name == "crc32c")       algorithm = DigestAlgorithm::Crc32c;
+    else if (name == "xxh64")   algorithm = DigestAlgorithm::XxHash64;
+    else if (name == "best")    algorithm = DigestAlgorithm::Best;
+    else return false;
+    return true;
+}
+
+Digest::Digest(DigestAlgorithm algorithm)
+    : mAlgorithm(algorithm == DigestAlgorithm::Best ? bestDigestAlgorithm() : algorithm)
+{
+
+}
+
+void Digest::reset()
+{
+    mCrc.reset();
+    mXxHash.reset();
+}
+
+void Digest::update(const void *data, size_t length)
+{
+    if (mAlgorithm == DigestAlgorithm::Crc32c)
+        mCrc.update(data, length);
+    else
+        mXxHash.update(data, length);
+}
+
+quint64 Digest::value() const
+{
+    return mAlgorithm == DigestAlgorithm::Crc32c ? mCrc.digest() : mXxHash.digest();
+}
+
+quint64 Digest::length() const
+{
+    return mAlgorithm == DigestAlgorithm::Crc32c ? mCrc.length() : mXxHash.length();
+}
+
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <QByteArray>
+#include <QtGlobal>
+
+#include <stddef.h>
+
+namespace xrf {
+
+/*
+ * Incremental xxHash64 (XXH64 of the reference implementation, same digests), for
+ * content hashes of data which arrives in chunks of any size.
+ */
+class XxHash64
+{
+public:
+    explicit XxHash64(quint64 seed = 0);
+
+    void reset(quint64 seed = 0);
+    void update(const void* data, size_t length);
+    quint64 digest() const;
+    quint64 length() const                  { return total; }
+
+    static quint64 hash(const void* data, size_t length, quint64 seed = 0);
+
+private:
+    quint64 acc[4];
+    quint64 seed;
+    quint64 total;
+    unsigned char buffer[32];
+    size_t buffered;
+};
+
+/*
+ * Incremental CRC-32C (Castagnoli, as in iSCSI and ext4). Uses the CRC32 instruction
+ * of SSE 4.2 where the CPU has it, else tables eight bytes at a time; both give the
+ * same values.
+ */
+class Crc32c
+{
+public:
+    Crc32c()                                { reset(); }
+
+    void reset()                            { state = 0xFFFFFFFFu; total = 0; }
+    void update(const void* data, size_t length);
+    quint32 digest() const                  { return state ^ 0xFFFFFFFFu; }
+    quint64 length() const                  { return total; }
+
+    static quint32 hash(const void* data, size_t length);
+    /* decided once, on first use */
+    static bool isHardwareAccelerated();
+
+private:
+    quint32 state;
+    quint64 total;
+};
+
+/* digests a Digest can compute */
+enum class DigestAlgorithm {
+    Crc32c,
+    XxHash64,
+    Best            // CRC-32C if the CPU computes it, else xxHash64
+};
+
+DigestAlgorithm bestDigestAlgorithm();
+const char* digestAlgorithmName(DigestAlgorithm algorithm);
+/* the inverse of digestAlgorithmName(); false for a name it does not know */
+bool digestAlgorithmFromName(const QByteArray& name, DigestAlgorithm& algorithm);
+
+/* either of the above behind one interface; a CRC-32C value is zero extended */
+class Digest
+{
+public:
+    explicit Digest(DigestAlgorithm algorithm = DigestAlgorithm::Best);
+
+    DigestAlgorithm algorithm() const       { return mAlgorithm; }
+    void reset();
+    void update(const void* data, size_t length);
+    quint64 value() const;
+    quint64 length() const;
+
+private:
+    DigestAlgorithm mAlgorithm;
+    Crc32c mCrc;
+    XxHash64 mXxHash;
+};
+
+}
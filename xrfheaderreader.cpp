@@ -0,0 +1,119 @@
+#include "xrfheaderreader.h"
+
+#include "dcmtk/dcmdata/dcerror.h"
+
+#include <QFile>
+
+#include <cstring>
+
+namespace xrf {
+
+/* large enough for the preamble, the meta header and the header of a typical XA data set */
+static const qint64 ChunkSize = 16384;
+
+static Uint16 readLE16(const char* p)
+{
+    return Uint16(Uint8(p[0]) | (Uint8(p[1]) << 8));
+}
+
+static Uint32 readLE32(const char* p)
+{
+    return Uint32(Uint8(p[0])) | (Uint32(Uint8(p[1])) << 8) | (Uint32(Uint8(p[2])) << 16) | (Uint32(Uint8(p[3])) << 24);
+}
+
+HeaderReader::HeaderReader(const QString &fileName)
+    : mFileName(fileName), mCaptureTags(DatasetScanner::defaultCaptureTags()), mDefaultXfer(EXS_LittleEndianImplicit),
+      mMetaHeader(false), mDatasetOffset(0), mBytesRead(0)
+{
+
+}
+
+/*
+ * Parses the meta header (always explicit VR little endian) which starts behind the
+ * preamble, sets mDatasetOffset to the first byte behind it.
+ */
+OFCondition HeaderReader::readMetaHeader(const QByteArray &head, E_TransferSyntax &xfer)
+{
+    const char *data = head.constData();
+    qint64 pos = 132;
+    OFString xferUID;
+
+    while (pos + 8 <= head.size() && readLE16(data + pos) == 0x0002)
+    {
+        const Uint16 element = readLE16(data + pos + 2);
+        const char vr[3] = { data[pos + 4], data[pos + 5], '\0' };
+        Uint32 length;
+        qint64 header;
+        if (!strcmp(vr, "OB") || !strcmp(vr, "OW") || !strcmp(vr, "OF") || !strcmp(vr, "SQ") || !strcmp(vr, "UT") || !strcmp(vr, "UN"))
+        {
+            if (pos + 12 > head.size())
+                return EC_CorruptedData;
+            length = readLE32(data + pos + 8);
+            header = 12;
+        }
+        else
+        {
+            length = readLE16(data + pos + 6);
+            header = 8;
+        }
+        if (length == DCM_UndefinedLength || pos + header + length > head.size())
+            return EC_CorruptedData;
+        if (element == 0x0010)
+            xferUID = OFString(data + pos + header, length);
+        pos += header + length;
+    }
+
+    // strip the padding of the UID
+    while (!xferUID.empty() && (xferUID[xferUID.size() - 1] == '\0' || xferUID[xferUID.size() - 1] == ' '))
+        xferUID.erase(xferUID.size() - 1);
+    xfer = DcmXfer(xferUID.c_str()).getXfer();
+    if (xfer == EXS_Unknown)
+        return EC_UnsupportedEncoding;
+
+    mDatasetOffset = pos;
+    return EC_Normal;
+}
+
+OFCondition HeaderReader::read()
+{
+    QFile file(mFileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return EC_InvalidFilename;
+
+    QByteArray head = file.read(ChunkSize);
+    mBytesRead = head.size();
+
+    E_TransferSyntax xfer = mDefaultXfer;
+    mMetaHeader = head.size() >= 132 && head.mid(128, 4) == "DICM";
+    mDatasetOffset = 0;
+    if (mMetaHeader)
+    {
+        // the meta header has to fit into the first chunk
+        OFCondition cond = readMetaHeader(head, xfer);
+        if (cond.bad())
+            return cond;
+    }
+
+    mScanner = DatasetScanner(xfer);
+    mScanner.setCaptureTags(mCaptureTags);
+    if (mScanner.failed())
+        return EC_UnsupportedEncoding;
+
+    mScanner.feed(OFreinterpret_cast(const Uint8 *, head.constData() + mDatasetOffset), size_t(head.size() - mDatasetOffset));
+    QByteArray chunk;
+    while (!mScanner.done() && !mScanner.failed())
+    {
+        chunk = file.read(ChunkSize);
+        if (chunk.isEmpty())
+        {
+            mScanner.finish();
+            break;
+        }
+        mBytesRead += chunk.size();
+        mScanner.feed(OFreinterpret_cast(const Uint8 *, chunk.constData()), size_t(chunk.size()));
+    }
+
+    return mScanner.failed() ? EC_CorruptedData : EC_Normal;
+}
+
+}
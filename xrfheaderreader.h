@@ -0,0 +1,57 @@
+#pragma once
+
+#include "dcmtk/config/osconfig.h"    /* make sure OS specific configuration is included first */
+
+#include "dcmtk/ofstd/ofcond.h"
+
+#include "xrfdcmscan.h"
+
+#include <QString>
+
+#include <vector>
+
+namespace xrf {
+
+/*
+ * Metadata-only reader for DICOM files, e.g. the ones the receiver wrote. The file is
+ * read in small chunks up to the header of (7FE0,0010) and never further, so the cost
+ * does not depend on the size of the pixel data. The values of a caller supplied set
+ * of top level elements are kept (see DatasetScanner), and the position of the pixel
+ * data in the file is recorded so that it can be read or mapped directly later on.
+ * Files with and without meta header are supported; deflated files are not.
+ */
+class HeaderReader
+{
+public:
+    explicit HeaderReader(const QString& fileName);
+
+    void setCaptureTags(const std::vector<DcmTagKey>& tags)  { mCaptureTags = tags; }
+    /* transfer syntax of a file without meta header (default: implicit VR little endian) */
+    void setDefaultTransferSyntax(E_TransferSyntax xfer)     { mDefaultXfer = xfer; }
+
+    OFCondition read();
+
+    const QString& fileName() const         { return mFileName; }
+    const DatasetScanner& scanner() const   { return mScanner; }
+    E_TransferSyntax transferSyntax() const { return mScanner.transferSyntax(); }
+    bool    hasMetaHeader() const           { return mMetaHeader; }
+    qint64  datasetOffset() const           { return mDatasetOffset; }
+    bool    pixelDataFound() const          { return mScanner.pixelDataFound(); }
+    /* absolute position of the pixel data value in the file */
+    qint64  pixelDataFileOffset() const     { return mDatasetOffset + qint64(mScanner.pixelDataOffset()); }
+    Uint32  pixelDataLength() const         { return mScanner.pixelDataLength(); }
+    qint64  bytesRead() const               { return mBytesRead; }
+
+private:
+    OFCondition readMetaHeader(const QByteArray& head, E_TransferSyntax& xfer);
+
+    QString mFileName;
+    std::vector<DcmTagKey> mCaptureTags;
+    E_TransferSyntax mDefaultXfer;
+    DatasetScanner mScanner;
+    bool mMetaHeader;
+    qint64 mDatasetOffset;
+    qint64 mBytesRead;
+};
+
+}
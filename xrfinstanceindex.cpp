@@ -0,0 +1,99 @@
+#include "xrfinstanceindex.h"
+#include "xrferror.h"
+
+namespace xrf {
+
+// the record is written as is, keep its layout stable
+Q_STATIC_ASSERT(sizeof(InstanceRecord) == 224);
+
+static const char IndexMagic[8] = { 'X', 'R', 'F', 'S', 'O', 'P', 'I', 'X' };
+
+QByteArray InstanceRecord::sop() const        { return fixedString(sopInstanceUID, sizeof(sopInstanceUID)); }
+QString InstanceRecord::file() const          { return QString::fromUtf8(fixedString(fileName, sizeof(fileName))); }
+
+void InstanceRecord::setSop(const QByteArray &uid)
+{
+    setFixedString(sopInstanceUID, sizeof(sopInstanceUID), uid);
+}
+
+void InstanceRecord::setFileName(const QString &name)
+{
+    setFixedString(fileName, sizeof(fileName), name.toUtf8());
+}
+
+
+InstanceIndex::InstanceIndex()
+    : mFile(IndexMagic, Version, sizeof(InstanceRecord))
+{
+
+}
+
+InstanceIndex::~InstanceIndex()
+{
+    close();
+}
+
+bool InstanceIndex::isOpen() const
+{
+    QMutexLocker locker(&mLock);
+    return mFile.isOpen();
+}
+
+void InstanceIndex::close()
+{
+    QMutexLocker locker(&mLock);
+    mFile.close();
+    mBySop.clear();
+}
+
+OFCondition InstanceIndex::open(const QString &fileName)
+{
+    close();
+
+    QMutexLocker locker(&mLock);
+    qint64 count = 0;
+    OFCondition cond = mFile.open(fileName, count);
+    if (cond.bad())
+        return cond;
+
+    const qint64 bytes = count * qint64(sizeof(InstanceRecord));
+    const QByteArray records = mFile.file().read(bytes);
+    if (records.size() != bytes)
+    {
+        mFile.close();
+        return XRF_IndexOpenFailed;
+    }
+    mBySop.reserve(int(count));
+    const InstanceRecord *rec = OFreinterpret_cast(const InstanceRecord *, records.constData());
+    for (qint64 i = 0; i < count; ++i)
+        mBySop.insert(rec[i].sop(), rec[i]);
+    return EC_Normal;
+}
+
+OFCondition InstanceIndex::append(const InstanceRecord &rec)
+{
+    QMutexLocker locker(&mLock);
+    OFCondition cond = mFile.append(&rec);
+    if (cond.bad())
+        return cond;
+    mBySop.insert(rec.sop(), rec);
+    return EC_Normal;
+}
+
+bool InstanceIndex::find(const QByteArray &sopInstanceUID, InstanceRecord &rec) const
+{
+    QMutexLocker locker(&mLock);
+    QHash<QByteArray, InstanceRecord>::const_iterator it = mBySop.constFind(sopInstanceUID);
+    if (it == mBySop.constEnd())
+        return false;
+    rec = it.value();
+    return true;
+}
+
+int InstanceIndex::count() const
+{
+    QMutexLocker locker(&mLock);
+    return mBySop.size();
+}
+
+}
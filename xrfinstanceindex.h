@@ -0,0 +1,75 @@
+#pragma once
+
+#include "dcmtk/config/osconfig.h"    /* make sure OS specific configuration is included first */
+
+#include "dcmtk/ofstd/ofcond.h"
+
+#include "xrfrecordfile.h"
+
+#include <QByteArray>
+#include <QHash>
+#include <QMutex>
+#include <QString>
+
+namespace xrf {
+
+/* what the receiver does with a SOP instance it has stored before */
+enum class DuplicatePolicy {
+    Overwrite,      // store it again under the same name, as storescp does
+    Skip,           // drain the data set without writing it anywhere; the stored copy stays
+    Version         // store it under name.vN.ext next to the earlier copies, unless it is identical
+};
+
+/*
+ * One entry of the instance index, in its on-disk layout (host byte order); change
+ * InstanceIndex::Version when touching it. UIDs and names are NUL padded and not
+ * terminated if they use the whole field.
+ */
+struct InstanceRecord
+{
+    char    sopInstanceUID[64];
+    char    fileName[128];                  // without directory
+    quint64 contentHash;                    // xxHash64 of the data set as received
+    qint64  bytes;                          // of the data set as received
+    qint64  stored;                         // ms since epoch
+    qint32  version;                        // 1 for the first copy, see DuplicatePolicy::Version
+    quint32 reserved;
+
+    QByteArray sop() const;
+    QString file() const;
+    void setSop(const QByteArray& uid);
+    void setFileName(const QString& name);
+};
+
+/*
+ * Append-only index of the SOP instances the receiver has stored, with a hash of
+ * their content, kept next to the loops in the output directory. A C-STORE-RQ names
+ * its SOP Instance UID up front, so a resent object is known as a duplicate before
+ * its first byte arrives and can be dealt with by the DuplicatePolicy; the content
+ * hash tells identical resends from objects which were changed in between. The
+ * records are read into a hash when the index is opened, a later record of the same
+ * SOP instance supersedes the earlier ones. The index may be used from several threads.
+ */
+class InstanceIndex
+{
+public:
+    static const quint32 Version = 1;
+
+    InstanceIndex();
+    ~InstanceIndex();
+
+    OFCondition open(const QString& fileName);
+    void close();
+    bool isOpen() const;
+
+    OFCondition append(const InstanceRecord& record);
+    bool find(const QByteArray& sopInstanceUID, InstanceRecord& record) const;
+    int count() const;
+
+private:
+    mutable QMutex mLock;
+    RecordFile mFile;
+    QHash<QByteArray, InstanceRecord> mBySop;
+};
+
+}
@@ -0,0 +1,47 @@
+#include "xrflazydataset.h"
+
+namespace xrf {
+
+LazyDataset::LazyDataset(const QString &filename, Uint32 maxReadLength)
+    : mFileName(filename), mMaxReadLength(maxReadLength), mStatus(EC_Normal)
+{
+
+}
+
+bool LazyDataset::isLoaded()
+{
+    QMutexLocker locker(&mMutex);
+    return mFileFormat != nullptr;
+}
+
+OFCondition LazyDataset::load()
+{
+    if (mFileFormat || mStatus.bad())
+        return mStatus;
+
+    std::unique_ptr<DcmFileFormat> fileformat = std::make_unique<DcmFileFormat>();
+    mStatus = fileformat->loadFile(mFileName.toLocal8Bit().constData(), EXS_Unknown, EGL_noChange, mMaxReadLength);
+    if (mStatus.good())
+        mFileFormat = std::move(fileformat);
+    return mStatus;
+}
+
+DcmDataset* LazyDataset::dataset()
+{
+    QMutexLocker locker(&mMutex);
+    return load().good() ? mFileFormat->getDataset() : NULL;
+}
+
+DcmMetaInfo* LazyDataset::metaInfo()
+{
+    QMutexLocker locker(&mMutex);
+    return load().good() ? mFileFormat->getMetaInfo() : NULL;
+}
+
+OFCondition LazyDataset::status()
+{
+    QMutexLocker locker(&mMutex);
+    return load();
+}
+
+}
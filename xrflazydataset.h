@@ -0,0 +1,44 @@
+#pragma once
+
+#include "dcmtk/config/osconfig.h"    /* make sure OS specific configuration is included first */
+
+#include "dcmtk/dcmdata/dcfilefo.h"
+
+#include <QMutex>
+#include <QString>
+
+#include <memory>
+
+namespace xrf {
+
+/*
+ * Metadata view of a received DICOM file which is only parsed when somebody asks for it.
+ * Files written by the bit-preserving store path are never parsed by the receiver; a
+ * consumer which needs tags wraps the path in a LazyDataset and calls dataset(). Elements
+ * larger than maxReadLength (i.e. the pixel data) stay on disk and are only loaded by
+ * dcmdata if they are actually accessed. The view may be shared between threads.
+ */
+class LazyDataset
+{
+public:
+    explicit LazyDataset(const QString& filename, Uint32 maxReadLength = 4096);
+
+    const QString& fileName() const { return mFileName; }
+    bool isLoaded();
+
+    /* parses the file on first call, returns NULL if it cannot be read (see status()) */
+    DcmDataset* dataset();
+    DcmMetaInfo* metaInfo();
+    OFCondition status();
+
+private:
+    OFCondition load();
+
+    QMutex mMutex;
+    QString mFileName;
+    Uint32 mMaxReadLength;
+    std::unique_ptr<DcmFileFormat> mFileFormat{nullptr};
+    OFCondition mStatus;
+};
+
+}
@@ -0,0 +1,321 @@
+#include "xrfloopindex.h"
+#include "xrferror.h"
+#include "xrfheaderreader.h"
+
+#include "dcmtk/dcmdata/dcdeftag.h"
+
+#include <QDateTime>
+#include <QDirIterator>
+
+#include <algorithm>
+#include <cstring>
+
+namespace xrf {
+
+// the record is written as is, keep its layout stable
+Q_STATIC_ASSERT(sizeof(LoopIndexRecord) == 384);
+
+static const char IndexMagic[8] = { 'X', 'R', 'F', 'L', 'I', 'D', 'X', '\0' };
+
+QByteArray LoopIndexRecord::study() const     { return fixedString(studyInstanceUID, sizeof(studyInstanceUID)); }
+QByteArray LoopIndexRecord::series() const    { return fixedString(seriesInstanceUID, sizeof(seriesInstanceUID)); }
+QByteArray LoopIndexRecord::sop() const       { return fixedString(sopInstanceUID, sizeof(sopInstanceUID)); }
+QString LoopIndexRecord::file() const         { return QString::fromUtf8(fixedString(fileName, sizeof(fileName))); }
+
+void LoopIndexRecord::setFileName(const QString &name)
+{
+    setFixedString(fileName, sizeof(fileName), name.toUtf8());
+}
+
+OFCondition LoopIndexRecord::read(DcmItem &dataset)
+{
+    memset(this, 0, sizeof(*this));
+
+    OFString value;
+    if (dataset.findAndGetOFString(DCM_SOPInstanceUID, value).bad() || value.empty())
+        return EC_TagNotFound;
+    setFixedString(sopInstanceUID, sizeof(sopInstanceUID), QByteArray(value.c_str()).trimmed());
+    if (dataset.findAndGetOFString(DCM_StudyInstanceUID, value).good())
+        setFixedString(studyInstanceUID, sizeof(studyInstanceUID), QByteArray(value.c_str()).trimmed());
+    if (dataset.findAndGetOFString(DCM_SeriesInstanceUID, value).good())
+        setFixedString(seriesInstanceUID, sizeof(seriesInstanceUID), QByteArray(value.c_str()).trimmed());
+
+    if (getNumber(dataset, DCM_DistanceSourceToDetector, distanceSourceToDetector)) fields |= HasDistanceSourceToDetector;
+    if (getNumber(dataset, DCM_DistanceSourceToPatient, distanceSourceToPatient)) fields |= HasDistanceSourceToPatient;
+    if (getNumber(dataset, DCM_PositionerPrimaryAngle, positionerPrimaryAngle)) fields |= HasPositionerPrimaryAngle;
+    if (getNumber(dataset, XRF_SourceToIsocenter, sourceToIsocenter)) fields |= HasSourceToIsocenter;
+    if (getNumber(dataset, XRF_DetectorRotation, detectorRotation)) fields |= HasDetectorRotation;
+    if (getNumber(dataset, DCM_FrameTime, frameTime)) fields |= HasFrameTime;
+
+    double frames = 1;
+    getNumber(dataset, DCM_NumberOfFrames, frames);
+    numberOfFrames = qMax(1, int(frames));
+
+    indexed = QDateTime::currentMSecsSinceEpoch();
+    return EC_Normal;
+}
+
+OFCondition LoopIndexRecord::read(const DatasetScanner &scanner)
+{
+    memset(this, 0, sizeof(*this));
+
+    OFString value;
+    if (!scanner.getString(DCM_SOPInstanceUID, value) || value.empty())
+        return EC_TagNotFound;
+    setFixedString(sopInstanceUID, sizeof(sopInstanceUID), QByteArray(value.c_str()));
+    if (scanner.getString(DCM_StudyInstanceUID, value))
+        setFixedString(studyInstanceUID, sizeof(studyInstanceUID), QByteArray(value.c_str()));
+    if (scanner.getString(DCM_SeriesInstanceUID, value))
+        setFixedString(seriesInstanceUID, sizeof(seriesInstanceUID), QByteArray(value.c_str()));
+
+    if (scanner.getFloat64(DCM_DistanceSourceToDetector, distanceSourceToDetector)) fields |= HasDistanceSourceToDetector;
+    if (scanner.getFloat64(DCM_DistanceSourceToPatient, distanceSourceToPatient)) fields |= HasDistanceSourceToPatient;
+    if (scanner.getFloat64(DCM_PositionerPrimaryAngle, positionerPrimaryAngle)) fields |= HasPositionerPrimaryAngle;
+    if (scanner.getFloat64(XRF_SourceToIsocenter, sourceToIsocenter)) fields |= HasSourceToIsocenter;
+    if (scanner.getFloat64(XRF_DetectorRotation, detectorRotation)) fields |= HasDetectorRotation;
+    if (scanner.getFloat64(DCM_FrameTime, frameTime)) fields |= HasFrameTime;
+
+    Sint32 frames = 1;
+    scanner.getSint32(DCM_NumberOfFrames, frames);
+    numberOfFrames = qMax(1, int(frames));
+
+    indexed = QDateTime::currentMSecsSinceEpoch();
+    return EC_Normal;
+}
+
+
+/* key order of the index: study, series, SOP instance */
+static bool lessKey(const LoopIndexRecord& a, const LoopIndexRecord& b)
+{
+    int c = strncmp(a.studyInstanceUID, b.studyInstanceUID, sizeof(a.studyInstanceUID));
+    if (c == 0) c = strncmp(a.seriesInstanceUID, b.seriesInstanceUID, sizeof(a.seriesInstanceUID));
+    if (c == 0) c = strncmp(a.sopInstanceUID, b.sopInstanceUID, sizeof(a.sopInstanceUID));
+    return c < 0;
+}
+
+static bool lessStudy(const LoopIndexRecord& a, const LoopIndexRecord& b)
+{
+    return strncmp(a.studyInstanceUID, b.studyInstanceUID, sizeof(a.studyInstanceUID)) < 0;
+}
+
+static bool lessSeries(const LoopIndexRecord& a, const LoopIndexRecord& b)
+{
+    int c = strncmp(a.studyInstanceUID, b.studyInstanceUID, sizeof(a.studyInstanceUID));
+    if (c == 0) c = strncmp(a.seriesInstanceUID, b.seriesInstanceUID, sizeof(a.seriesInstanceUID));
+    return c < 0;
+}
+
+
+LoopIndex::LoopIndex()
+    : mFile(IndexMagic, Version, sizeof(LoopIndexRecord)), mMap(NULL), mMapped(NULL), mMappedCount(0)
+{
+
+}
+
+LoopIndex::~LoopIndex()
+{
+    close();
+}
+
+bool LoopIndex::isOpen() const
+{
+    QReadLocker locker(&mLock);
+    return mFile.isOpen();
+}
+
+void LoopIndex::close()
+{
+    QWriteLocker locker(&mLock);
+    if (mMap)
+        mFile.file().unmap(mMap);
+    mFile.close();
+    mMap = NULL;
+    mMapped = NULL;
+    mMappedCount = 0;
+    mAppended.clear();
+    mBySop.clear();
+    mByFile.clear();
+    mOrder.clear();
+}
+
+OFCondition LoopIndex::open(const QString &fileName)
+{
+    close();
+
+    QWriteLocker locker(&mLock);
+    qint64 count = 0;
+    OFCondition cond = mFile.open(fileName, count);
+    if (cond.bad())
+        return cond;
+
+    if (count > 0)
+    {
+        mMap = mFile.file().map(0, RecordFile::headerSize() + count * qint64(sizeof(LoopIndexRecord)));
+        if (mMap == NULL)
+        {
+            mFile.close();
+            return XRF_IndexOpenFailed;
+        }
+        mMapped = OFreinterpret_cast(const LoopIndexRecord *, mMap + RecordFile::headerSize());
+        mMappedCount = int(count);
+    }
+
+    // the lookups follow the records in the order they were appended, the key order is
+    // sorted once from the records which were not superseded; inserting them one by one
+    // would move the order along for every record
+    for (int i = 0; i < mMappedCount; ++i)
+        replaceLookups(i);
+    mOrder.reserve(mBySop.size());
+    for (int i = 0; i < mMappedCount; ++i)
+    {
+        if (mBySop.value(record(i).sop()) == i)
+            mOrder.push_back(i);
+    }
+    // stable, so records with equal keys stay in the order in which they were appended
+    std::stable_sort(mOrder.begin(), mOrder.end(),
+        [this](int a, int b) { return lessKey(record(a), record(b)); });
+    return EC_Normal;
+}
+
+const LoopIndexRecord& LoopIndex::record(int i) const
+{
+    return (i < mMappedCount) ? mMapped[i] : mAppended[size_t(i - mMappedCount)];
+}
+
+int LoopIndex::replaceLookups(int i)
+{
+    const LoopIndexRecord& rec = record(i);
+    const QByteArray sop = rec.sop();
+
+    int old = -1;
+    QHash<QByteArray, int>::iterator previous = mBySop.find(sop);
+    if (previous != mBySop.end())
+    {
+        old = previous.value();
+        mByFile.remove(record(old).file());
+        previous.value() = i;
+    }
+    else
+        mBySop.insert(sop, i);
+
+    mByFile.insert(rec.file(), i);
+    return old;
+}
+
+void LoopIndex::insert(int i)
+{
+    // a SOP instance received again replaces its earlier record in the key order
+    const int old = replaceLookups(i);
+    if (old >= 0)
+    {
+        std::vector<int>::iterator pos = std::lower_bound(mOrder.begin(), mOrder.end(), old,
+            [this](int a, int b) { return lessKey(record(a), record(b)); });
+        if (pos != mOrder.end() && *pos == old)
+            mOrder.erase(pos);
+    }
+
+    std::vector<int>::iterator pos = std::upper_bound(mOrder.begin(), mOrder.end(), i,
+        [this](int a, int b) { return lessKey(record(a), record(b)); });
+    mOrder.insert(pos, i);
+}
+
+OFCondition LoopIndex::append(const LoopIndexRecord &rec)
+{
+    QWriteLocker locker(&mLock);
+    OFCondition cond = mFile.append(&rec);
+    if (cond.bad())
+        return cond;
+
+    mAppended.push_back(rec);
+    insert(mMappedCount + int(mAppended.size()) - 1);
+    return EC_Normal;
+}
+
+int LoopIndex::count() const
+{
+    QReadLocker locker(&mLock);
+    return int(mOrder.size());
+}
+
+bool LoopIndex::find(const QByteArray &sopInstanceUID, LoopIndexRecord &rec) const
+{
+    QReadLocker locker(&mLock);
+    QHash<QByteArray, int>::const_iterator it = mBySop.constFind(sopInstanceUID);
+    if (it == mBySop.constEnd())
+        return false;
+    rec = record(it.value());
+    return true;
+}
+
+template<typename Less>
+QVector<LoopIndexRecord> LoopIndex::range(const LoopIndexRecord &key, Less less) const
+{
+    QReadLocker locker(&mLock);
+    std::pair<std::vector<int>::const_iterator, std::vector<int>::const_iterator> found =
+        std::equal_range(mOrder.begin(), mOrder.end(), -1, [this, &key, less](int a, int b) {
+            return less(a < 0 ? key : record(a), b < 0 ? key : record(b));
+        });
+
+    QVector<LoopIndexRecord> result;
+    result.reserve(int(found.second - found.first));
+    for (std::vector<int>::const_iterator it = found.first; it != found.second; ++it)
+        result.append(record(*it));
+    return result;
+}
+
+QVector<LoopIndexRecord> LoopIndex::study(const QByteArray &studyInstanceUID) const
+{
+    LoopIndexRecord key;
+    memset(&key, 0, sizeof(key));
+    setFixedString(key.studyInstanceUID, sizeof(key.studyInstanceUID), studyInstanceUID);
+    return range(key, lessStudy);
+}
+
+QVector<LoopIndexRecord> LoopIndex::series(const QByteArray &studyInstanceUID, const QByteArray &seriesInstanceUID) const
+{
+    LoopIndexRecord key;
+    memset(&key, 0, sizeof(key));
+    setFixedString(key.studyInstanceUID, sizeof(key.studyInstanceUID), studyInstanceUID);
+    setFixedString(key.seriesInstanceUID, sizeof(key.seriesInstanceUID), seriesInstanceUID);
+    return range(key, lessSeries);
+}
+
+int LoopIndex::update(const QString &directory, const QString &fileExtension)
+{
+    // the files of a study may live in a subdirectory of their own
+    QDirIterator files(directory, QStringList() << QString("*%1").arg(fileExtension), QDir::Files, QDirIterator::Subdirectories);
+
+    int added = 0;
+    while (files.hasNext())
+    {
+        const QString path = files.next();
+        const QString name = files.fileName();
+        {
+            QReadLocker locker(&mLock);
+            if (mByFile.contains(name))
+                continue;
+        }
+
+        // only the header is of interest, the file is not read past (7FE0,0010)
+        HeaderReader reader(path);
+        reader.setCaptureTags(captureTags());
+        LoopIndexRecord rec;
+        if (reader.read().bad() || rec.read(reader.scanner()).bad())
+            continue;
+        rec.setFileName(name);
+        if (append(rec).good())
+            ++added;
+    }
+    return added;
+}
+
+std::vector<DcmTagKey> LoopIndex::captureTags()
+{
+    return {
+        DCM_StudyInstanceUID, DCM_SeriesInstanceUID, DCM_SOPInstanceUID,
+        DCM_DistanceSourceToDetector, DCM_DistanceSourceToPatient, DCM_PositionerPrimaryAngle,
+        XRF_SourceToIsocenter, XRF_DetectorRotation, DCM_NumberOfFrames, DCM_FrameTime
+    };
+}
+
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include "dcmtk/config/osconfig.h"    /* make sure OS specific configuration is included first */
+
+#include "dcmtk/dcmdata/dcitem.h"
+
+#include "xrfcineloop.h"
+#include "xrfdcmscan.h"
+#include "xrfrecordfile.h"
+
+#include <QByteArray>
+#include <QHash>
+#include <QReadWriteLock>
+#include <QString>
+#include <QVector>
+
+#include <deque>
+#include <vector>
+
+namespace xrf {
+
+/*
+ * One entry of the loop index. The layout is the on-disk layout (host byte order),
+ * so the record must stay a fixed size POD; change LoopIndex::Version when touching it.
+ * UIDs are NUL padded and not terminated if they use all 64 characters.
+ */
+struct LoopIndexRecord
+{
+    enum Field {
+        HasDistanceSourceToDetector = 0x01,
+        HasDistanceSourceToPatient  = 0x02,
+        HasPositionerPrimaryAngle   = 0x04,
+        HasSourceToIsocenter        = 0x08,
+        HasDetectorRotation         = 0x10,
+        HasFrameTime                = 0x20
+    };
+
+    char    studyInstanceUID[64];
+    char    seriesInstanceUID[64];
+    char    sopInstanceUID[64];
+    char    fileName[128];                  // without directory
+    qint64  indexed;                        // ms since epoch
+    double  distanceSourceToDetector;       // (0018,1110) mm
+    double  distanceSourceToPatient;        // (0018,1111) mm
+    double  positionerPrimaryAngle;         // (0018,1510) deg
+    double  sourceToIsocenter;              // (0021,1017) mm
+    double  detectorRotation;               // (0021,1071) deg
+    double  frameTime;                      // (0018,1063) ms
+    qint32  numberOfFrames;                 // (0028,0008)
+    quint32 fields;                         // Field flags of the values present
+
+    QByteArray study() const;
+    QByteArray series() const;
+    QByteArray sop() const;
+    QString file() const;
+
+    /* fills the record from a data set or from what a scanner captured; fails without SOP Instance UID */
+    OFCondition read(DcmItem& dataset);
+    OFCondition read(const DatasetScanner& scanner);
+    void setFileName(const QString& name);
+};
+
+/*
+ * Compact, append-only index of the received loops and their geometry, kept next to
+ * the loops in the output directory. The index file is memory mapped when it is
+ * opened; records appended afterwards are written through to the file and kept in
+ * memory until the next open. Lookups by SOP Instance UID go through a hash, range
+ * lookups by study (and series) through a key order which is maintained on append,
+ * so both take microseconds for tens of thousands of loops. A record for a SOP
+ * Instance UID which is already indexed supersedes the earlier one. The index may be
+ * used from several threads.
+ */
+class LoopIndex
+{
+public:
+    static const quint32 Version = 1;
+
+    LoopIndex();
+    ~LoopIndex();
+
+    OFCondition open(const QString& fileName);
+    void close();
+    bool isOpen() const;
+
+    OFCondition append(const LoopIndexRecord& record);
+
+    /* indexes the files below directory which are not indexed yet (by file name) */
+    int update(const QString& directory, const QString& fileExtension);
+
+    int  count() const;
+    bool find(const QByteArray& sopInstanceUID, LoopIndexRecord& record) const;
+    QVector<LoopIndexRecord> study(const QByteArray& studyInstanceUID) const;
+    QVector<LoopIndexRecord> series(const QByteArray& studyInstanceUID, const QByteArray& seriesInstanceUID) const;
+
+    /* the elements the index is built from, to be added to a DatasetScanner */
+    static std::vector<DcmTagKey> captureTags();
+
+private:
+    const LoopIndexRecord& record(int i) const;
+    /* points the lookups by SOP and by file at record i; returns the record it
+     * supersedes, or -1 */
+    int  replaceLookups(int i);
+    /* replaceLookups() and keeps the key order, for records appended while open */
+    void insert(int i);
+    template<typename Less> QVector<LoopIndexRecord> range(const LoopIndexRecord& key, Less less) const;
+
+    mutable QReadWriteLock mLock;
+    RecordFile mFile;
+    uchar* mMap;
+    const LoopIndexRecord* mMapped;
+    int mMappedCount;
+    std::deque<LoopIndexRecord> mAppended;  // stable addresses
+    QHash<QByteArray, int> mBySop;
+    QHash<QString, int> mByFile;
+    std::vector<int> mOrder;                // current records by study, series, SOP
+};
+
+}
@@ -0,0 +1,264 @@
+#include "xrfmappedfile.h"
+#include "xrferror.h"
+#include "xrfwritebehind.h"
+
+#include "dcmtk/ofstd/ofstd.h"
+
+#include <string.h>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace xrf {
+
+/* the mapping grows at least by this much, and is never smaller */
+static const quint64 minimumMapping = 1024 * 1024;
+
+MappedFileWriter::MappedFileWriter()
+    : mOpen(false),
+#ifdef _WIN32
+      mFile(INVALID_HANDLE_VALUE), mMapping(NULL),
+#else
+      mFd(-1),
+#endif
+      mBase(NULL), mMapped(0), mWritten(0)
+{
+
+}
+
+MappedFileWriter::~MappedFileWriter()
+{
+    discard();
+}
+
+OFCondition MappedFileWriter::open(const OFString &fileName, quint64 sizeHint)
+{
+    discard();
+    mFileName = fileName;
+    mTempName = fileName + ".part";
+#ifdef _WIN32
+    mFile = CreateFileA(mTempName.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL,
+                        CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (mFile == INVALID_HANDLE_VALUE)
+        return XRF_WriteFailed;
+#else
+    mFd = ::open(mTempName.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (mFd < 0)
+        return XRF_WriteFailed;
+#endif
+    mOpen = true;
+    mWritten = 0;
+    OFCondition cond = reserve(qMax(sizeHint, minimumMapping));
+    if (cond.bad())
+        discard();
+    return cond;
+}
+
+OFCondition MappedFileWriter::reserve(quint64 size)
+{
+    if (!mOpen)
+        return EC_IllegalCall;
+    if (size <= mMapped)
+        return EC_Normal;
+#ifdef Q_OS_LINUX
+    // allocate the blocks now: the file gets contiguous extents, and a full disk is an
+    // error here instead of a SIGBUS when the mapping is written to
+    if (fallocate(mFd, 0, 0, off_t(size)) != 0)
+    {
+        if (errno != EOPNOTSUPP || ftruncate(mFd, off_t(size)) != 0)
+            return XRF_WriteFailed;
+    }
+#elif !defined(_WIN32)
+    if (ftruncate(mFd, off_t(size)) != 0)
+        return XRF_WriteFailed;
+#endif
+    // on Windows mapping beyond the end extends the file
+    return remap(size);
+}
+
+OFCondition MappedFileWriter::remap(quint64 size)
+{
+#ifdef _WIN32
+    unmap();
+    mMapping = CreateFileMappingA(mFile, NULL, PAGE_READWRITE, DWORD(size >> 32), DWORD(size), NULL);
+    if (mMapping == NULL)
+        return XRF_MapFailed;
+    mBase = static_cast<Uint8*>(MapViewOfFile(mMapping, FILE_MAP_WRITE, 0, 0, SIZE_T(size)));
+    if (mBase == NULL)
+    {
+        CloseHandle(mMapping);
+        mMapping = NULL;
+        return XRF_MapFailed;
+    }
+#else
+    void *base = MAP_FAILED;
+#ifdef Q_OS_LINUX
+    // the old mapping stays valid if it cannot be moved
+    if (mBase != NULL)
+        base = mremap(mBase, size_t(mMapped), size_t(size), MREMAP_MAYMOVE);
+    else
+#endif
+    {
+        unmap();
+        base = mmap(NULL, size_t(size), PROT_READ | PROT_WRITE, MAP_SHARED, mFd, 0);
+    }
+    if (base == MAP_FAILED)
+        return XRF_MapFailed;
+    mBase = static_cast<Uint8*>(base);
+#endif
+    mMapped = size;
+    return EC_Normal;
+}
+
+void MappedFileWriter::unmap()
+{
+#ifdef _WIN32
+    if (mBase != NULL) UnmapViewOfFile(mBase);
+    if (mMapping != NULL) CloseHandle(mMapping);
+    mMapping = NULL;
+#else
+    if (mBase != NULL) munmap(mBase, size_t(mMapped));
+#endif
+    mBase = NULL;
+    mMapped = 0;
+}
+
+OFCondition MappedFileWriter::write(const void *data, size_t length)
+{
+    if (!mOpen)
+        return EC_IllegalCall;
+    if (mWritten + length > mMapped)
+    {
+        // only reached without a reservation, or if the data set is longer than announced
+        OFCondition cond = reserve(qMax(mWritten + length, 2 * mMapped));
+        if (cond.bad())
+            return cond;
+    }
+    memcpy(mBase + mWritten, data, length);
+    mWritten += length;
+    return EC_Normal;
+}
+
+OFCondition MappedFileWriter::commit()
+{
+    if (!mOpen)
+        return EC_IllegalCall;
+    OFCondition cond = EC_Normal;
+#ifdef _WIN32
+    if (!FlushViewOfFile(mBase, SIZE_T(mWritten)))
+        cond = XRF_SyncFailed;
+    unmap();
+    LARGE_INTEGER end;
+    end.QuadPart = LONGLONG(mWritten);
+    if (cond.good() && (!SetFilePointerEx(mFile, end, NULL, FILE_BEGIN) || !SetEndOfFile(mFile)))
+        cond = XRF_WriteFailed;
+    if (cond.good() && !FlushFileBuffers(mFile))
+        cond = XRF_SyncFailed;
+    CloseHandle(mFile);
+    mFile = INVALID_HANDLE_VALUE;
+#else
+    // the pages beyond the new end are never touched again, the mapping may stay
+    if (ftruncate(mFd, off_t(mWritten)) != 0)
+        cond = XRF_WriteFailed;
+    if (cond.good() && mWritten > 0 && msync(mBase, size_t(mWritten), MS_SYNC) != 0)
+        cond = XRF_SyncFailed;
+    unmap();
+    ::close(mFd);
+    mFd = -1;
+#endif
+    mOpen = false;
+    if (cond.good() && !replaceFile(mTempName, mFileName))
+        cond = XRF_ReplaceFailed;
+    // the rename is only durable once the directory is
+    if (cond.good())
+    {
+        OFString dirName;
+        syncToDisk(OFStandard::getDirNameFromPath(dirName, mFileName), true);
+    }
+    if (cond.bad())
+        OFStandard::deleteFile(mTempName);
+    return cond;
+}
+
+void MappedFileWriter::discard()
+{
+    if (!mOpen)
+        return;
+    unmap();
+#ifdef _WIN32
+    CloseHandle(mFile);
+    mFile = INVALID_HANDLE_VALUE;
+#else
+    ::close(mFd);
+    mFd = -1;
+#endif
+    mOpen = false;
+    OFStandard::deleteFile(mTempName);
+}
+
+
+MappedFile::~MappedFile()
+{
+#ifdef _WIN32
+    if (mData != NULL) UnmapViewOfFile(mData);
+#else
+    if (mData != NULL) munmap(const_cast<Uint8*>(mData), size_t(mSize));
+#endif
+}
+
+std::shared_ptr<const MappedFile> MappedFile::open(const QString &fileName, OFCondition *status)
+{
+    std::shared_ptr<MappedFile> file(new MappedFile);
+    const QByteArray path = fileName.toLocal8Bit();
+    OFCondition cond = EC_Normal;
+#ifdef _WIN32
+    HANDLE h = CreateFileA(path.constData(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL,
+                           OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    LARGE_INTEGER size;
+    if (h == INVALID_HANDLE_VALUE || !GetFileSizeEx(h, &size))
+        cond = EC_InvalidFilename;
+    else if (size.QuadPart > 0)
+    {
+        // the view keeps the mapping object alive, the handles can go right away
+        HANDLE mapping = CreateFileMappingA(h, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping != NULL)
+        {
+            file->mData = static_cast<const Uint8*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+            CloseHandle(mapping);
+        }
+        if (file->mData == NULL)
+            cond = XRF_MapFailed;
+        else
+            file->mSize = quint64(size.QuadPart);
+    }
+    if (h != INVALID_HANDLE_VALUE)
+        CloseHandle(h);
+#else
+    int fd = ::open(path.constData(), O_RDONLY | O_CLOEXEC);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0)
+        cond = EC_InvalidFilename;
+    else if (info.st_size > 0)
+    {
+        void *data = mmap(NULL, size_t(info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED)
+            cond = XRF_MapFailed;
+        else
+        {
+            file->mData = static_cast<const Uint8*>(data);
+            file->mSize = quint64(info.st_size);
+        }
+    }
+    if (fd >= 0)
+        ::close(fd);
+#endif
+    if (status) *status = cond;
+    return cond.good() ? file : std::shared_ptr<const MappedFile>();
+}
+
+}
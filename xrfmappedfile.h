@@ -0,0 +1,86 @@
+#pragma once
+
+#include "dcmtk/config/osconfig.h"    /* make sure OS specific configuration is included first */
+
+#include "dcmtk/ofstd/ofcond.h"
+#include "dcmtk/ofstd/ofstring.h"
+
+#include <QString>
+#include <QtGlobal>
+
+#include <memory>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+namespace xrf {
+
+/*
+ * Output file which is written through a shared memory mapping instead of buffered
+ * stream writes. The file is created under a temporary name (fileName.part) and
+ * preallocated (fallocate on Linux) as soon as its final size is known, see
+ * reserve(); without a reservation it grows in steps which double its size. Bytes
+ * are copied straight into the page cache by write(). commit() cuts the file to what
+ * was written, flushes it with a single msync and renames it to its final name, so a
+ * reader only ever sees a complete file. A writer which is neither committed nor
+ * discarded removes its temporary file when it is destroyed.
+ */
+class MappedFileWriter
+{
+public:
+    MappedFileWriter();
+    ~MappedFileWriter();
+
+    OFCondition open(const OFString& fileName, quint64 sizeHint = 0);
+    bool isOpen() const                 { return mOpen; }
+
+    /* preallocates and maps the file up to size bytes */
+    OFCondition reserve(quint64 size);
+    OFCondition write(const void* data, size_t length);
+    quint64 size() const                { return mWritten; }
+
+    OFCondition commit();
+    void discard();
+
+private:
+    OFCondition remap(quint64 size);
+    void unmap();
+
+    OFString mFileName;
+    OFString mTempName;
+    bool mOpen;
+#ifdef _WIN32
+    HANDLE mFile;
+    HANDLE mMapping;
+#else
+    int mFd;
+#endif
+    Uint8* mBase;
+    quint64 mMapped;
+    quint64 mWritten;
+};
+
+/*
+ * Read-only mapping of a whole file. Loops which are read from a file the receiver
+ * wrote point into the mapping (see CineLoop::fromFile()) and keep it alive, so the
+ * pixel data is never copied out of the page cache.
+ */
+class MappedFile
+{
+public:
+    ~MappedFile();
+
+    static std::shared_ptr<const MappedFile> open(const QString& fileName, OFCondition* status = nullptr);
+
+    const Uint8* data() const           { return mData; }
+    quint64 size() const                { return mSize; }
+
+private:
+    MappedFile() : mData(NULL), mSize(0) {}
+
+    const Uint8* mData;
+    quint64 mSize;
+};
+
+}
@@ -0,0 +1,302 @@
+#include "xrfmetrics.h"
+
+#include <QSaveFile>
+
+namespace xrf {
+
+/* counters of one thread; written by that thread only, read by snapshot() */
+struct Metrics::Shard
+{
+    std::atomic<quint64> counters[CounterCount];
+    std::atomic<quint64> count[StageCount];
+    std::atomic<quint64> totalNs[StageCount];
+    std::atomic<quint64> maxNs[StageCount];
+
+    Shard()
+    {
+        for (auto& c : counters) c.store(0, std::memory_order_relaxed);
+        for (int i = 0; i < StageCount; ++i)
+        {
+            count[i].store(0, std::memory_order_relaxed);
+            totalNs[i].store(0, std::memory_order_relaxed);
+            maxNs[i].store(0, std::memory_order_relaxed);
+        }
+    }
+};
+
+// distinguishes Metrics objects in the per-thread cache, even one constructed at the address of a deleted one
+static std::atomic<quint64> nextMetricsId(1);
+
+Metrics::Metrics()
+    : mId(nextMetricsId.fetch_add(1))
+{
+
+}
+
+Metrics::~Metrics()
+{
+
+}
+
+Metrics::Shard* Metrics::shard()
+{
+    // the last shard this thread used; the lookup below is only taken once per thread and Metrics
+    thread_local quint64 cachedId = 0;
+    thread_local Shard* cachedShard = nullptr;
+    if (cachedId == mId)
+        return cachedShard;
+
+    QMutexLocker locker(&mMutex);
+    const Qt::HANDLE thread = QThread::currentThreadId();
+    Shard* s = mThreadShards.value(thread, nullptr);
+    if (s == nullptr)
+    {
+        mShards.push_back(std::make_unique<Shard>());
+        s = mShards.back().get();
+        mThreadShards.insert(thread, s);
+    }
+    cachedId = mId;
+    cachedShard = s;
+    return s;
+}
+
+void Metrics::add(Counter counter, quint64 value)
+{
+    shard()->counters[counter].fetch_add(value, std::memory_order_relaxed);
+}
+
+void Metrics::time(Stage stage, qint64 nsecs)
+{
+    Shard* s = shard();
+    const quint64 ns = quint64(qMax(Q_INT64_C(0), nsecs));
+    s->count[stage].fetch_add(1, std::memory_order_relaxed);
+    s->totalNs[stage].fetch_add(ns, std::memory_order_relaxed);
+    // only this thread writes the shard, a plain compare is enough
+    if (ns > s->maxNs[stage].load(std::memory_order_relaxed))
+        s->maxNs[stage].store(ns, std::memory_order_relaxed);
+}
+
+void Metrics::error(const OFCondition &cond)
+{
+    if (cond.good())
+        return;
+    const quint32 key = (quint32(cond.module()) << 16) | cond.code();
+    QMutexLocker locker(&mMutex);
+    auto it = mErrors.find(key);
+    if (it == mErrors.end())
+    {
+        ErrorCount error = { cond.module(), cond.code(), QString::fromLatin1(cond.text()), 0 };
+        it = mErrors.insert(key, error);
+    }
+    it->count++;
+}
+
+MetricsSnapshot Metrics::snapshot() const
+{
+    MetricsSnapshot snap;
+    QMutexLocker locker(&mMutex);
+    for (const auto& s : mShards)
+    {
+        for (int i = 0; i < CounterCount; ++i)
+            snap.counters[i] += s->counters[i].load(std::memory_order_relaxed);
+        for (int i = 0; i < StageCount; ++i)
+        {
+            snap.stages[i].count += s->count[i].load(std::memory_order_relaxed);
+            snap.stages[i].totalNs += s->totalNs[i].load(std::memory_order_relaxed);
+            snap.stages[i].maxNs = qMax(snap.stages[i].maxNs, s->maxNs[i].load(std::memory_order_relaxed));
+        }
+    }
+    for (const ErrorCount& error : mErrors)
+        snap.errors.append({ error.module, error.code, error.text, error.count });
+    return snap;
+}
+
+
+static QByteArray escapeLabel(const QString& value)
+{
+    QByteArray escaped;
+    for (char c : value.toUtf8())
+    {
+        if (c == '\\' || c == '"')
+            escaped += '\\';
+        if (c == '\n')
+        {
+            escaped += "\\n";
+            continue;
+        }
+        escaped += c;
+    }
+    return escaped;
+}
+
+static void header(QByteArray& out, const char* name, const char* type, const char* help)
+{
+    out += "# HELP "; out += name; out += ' '; out += help; out += '\n';
+    out += "# TYPE "; out += name; out += ' '; out += type; out += '\n';
+}
+
+static void sample(QByteArray& out, const char* name, const QByteArray& labels, const QByteArray& value)
+{
+    out += name;
+    if (!labels.isEmpty())
+    {
+        out += '{'; out += labels; out += '}';
+    }
+    out += ' '; out += value; out += '\n';
+}
+
+static QByteArray seconds(quint64 ns)
+{
+    return QByteArray::number(double(ns) / 1e9, 'g', 12);
+}
+
+QByteArray MetricsSnapshot::toPrometheus() const
+{
+    static const char* stageNames[Metrics::StageCount] = { "network_receive", "dataset_build", "disk_write", "signal_dispatch", "projection_geometry" };
+    QByteArray out;
+
+    header(out, "xrfrcv_associations_total", "counter", "Associations by outcome.");
+    sample(out, "xrfrcv_associations_total", "result=\"accepted\"", QByteArray::number(counters[Metrics::AssociationsAccepted]));
+    sample(out, "xrfrcv_associations_total", "result=\"rejected\"", QByteArray::number(counters[Metrics::AssociationsRejected]));
+    sample(out, "xrfrcv_associations_total", "result=\"aborted\"", QByteArray::number(counters[Metrics::AssociationsAborted]));
+
+    header(out, "xrfrcv_requests_total", "counter", "DIMSE requests received.");
+    sample(out, "xrfrcv_requests_total", "command=\"C-ECHO\"", QByteArray::number(counters[Metrics::EchoRequests]));
+    sample(out, "xrfrcv_requests_total", "command=\"C-STORE\"", QByteArray::number(counters[Metrics::StoreRequests]));
+
+    header(out, "xrfrcv_objects_total", "counter", "Received objects by outcome.");
+    sample(out, "xrfrcv_objects_total", "result=\"stored\"", QByteArray::number(counters[Metrics::ObjectsStored]));
+    sample(out, "xrfrcv_objects_total", "result=\"failed\"", QByteArray::number(counters[Metrics::ObjectsFailed]));
+
+    header(out, "xrfrcv_received_bytes_total", "counter", "Bytes of data sets received.");
+    sample(out, "xrfrcv_received_bytes_total", QByteArray(), QByteArray::number(counters[Metrics::BytesReceived]));
+
+    header(out, "xrfrcv_loop_wakeups_total", "counter", "Wakeups of the socket readiness loop.");
+    sample(out, "xrfrcv_loop_wakeups_total", QByteArray(), QByteArray::number(counters[Metrics::LoopWakeups]));
+
+    header(out, "xrfrcv_duplicates_total", "counter", "SOP instances received again, by content.");
+    sample(out, "xrfrcv_duplicates_total", "content=\"identical\"", QByteArray::number(counters[Metrics::DuplicatesIdentical]));
+    sample(out, "xrfrcv_duplicates_total", "content=\"differing\"", QByteArray::number(counters[Metrics::DuplicatesDiffering]));
+
+    header(out, "xrfrcv_duplicate_bytes_saved_total", "counter", "Bytes of identical duplicates which were skipped rather than written to disk.");
+    sample(out, "xrfrcv_duplicate_bytes_saved_total", QByteArray(), QByteArray::number(counters[Metrics::DuplicateBytesSaved]));
+
+    header(out, "xrfrcv_digest_seconds_total", "counter", "Time spent computing file digests while receiving.");
+    sample(out, "xrfrcv_digest_seconds_total", QByteArray(), seconds(counters[Metrics::DigestNanoseconds]));
+
+    header(out, "xrfrcv_stage_seconds", "summary", "Time spent per object in each stage of the store path.");
+    for (int i = 0; i < Metrics::StageCount; ++i)
+    {
+        const QByteArray labels = QByteArray("stage=\"") + stageNames[i] + '"';
+        sample(out, "xrfrcv_stage_seconds_sum", labels, seconds(stages[i].totalNs));
+        sample(out, "xrfrcv_stage_seconds_count", labels, QByteArray::number(stages[i].count));
+    }
+    header(out, "xrfrcv_stage_max_seconds", "gauge", "Longest time one object spent in each stage.");
+    for (int i = 0; i < Metrics::StageCount; ++i)
+        sample(out, "xrfrcv_stage_max_seconds", QByteArray("stage=\"") + stageNames[i] + '"', seconds(stages[i].maxNs));
+
+    header(out, "xrfrcv_errors_total", "counter", "Failures by OFCondition module and code.");
+    for (const Error& error : errors)
+    {
+        const QByteArray labels = "module=\"" + QByteArray::number(error.module) + "\",code=\"" + QByteArray::number(error.code)
+                                + "\",text=\"" + escapeLabel(error.text) + '"';
+        sample(out, "xrfrcv_errors_total", labels, QByteArray::number(error.count));
+    }
+
+    header(out, "xrfrcv_active_associations", "gauge", "Associations which are open.");
+    sample(out, "xrfrcv_active_associations", QByteArray(), QByteArray::number(activeAssociations));
+    header(out, "xrfrcv_max_associations", "gauge", "Associations whose commands may be served concurrently.");
+    sample(out, "xrfrcv_max_associations", QByteArray(), QByteArray::number(maxAssociations));
+    header(out, "xrfrcv_write_queue_depth", "gauge", "Objects waiting in the write-behind stage.");
+    sample(out, "xrfrcv_write_queue_depth", QByteArray(), QByteArray::number(writeQueueDepth));
+    header(out, "xrfrcv_write_queue_bytes", "gauge", "Bytes waiting in the write-behind stage.");
+    sample(out, "xrfrcv_write_queue_bytes", QByteArray(), QByteArray::number(writeQueueBytes));
+    header(out, "xrfrcv_open_studies", "gauge", "Studies which are not complete yet.");
+    sample(out, "xrfrcv_open_studies", QByteArray(), QByteArray::number(openStudies));
+
+    header(out, "xrfrcv_frame_ring_frames_total", "counter", "Frames which left the live display ring, by how.");
+    sample(out, "xrfrcv_frame_ring_frames_total", "result=\"delivered\"", QByteArray::number(ringFramesPopped));
+    sample(out, "xrfrcv_frame_ring_frames_total", "result=\"dropped_oldest\"", QByteArray::number(ringFramesDroppedOldest));
+    sample(out, "xrfrcv_frame_ring_frames_total", "result=\"dropped_newest\"", QByteArray::number(ringFramesDroppedNewest));
+    header(out, "xrfrcv_frame_ring_latency_seconds", "summary", "Time delivered frames spent in the live display ring.");
+    sample(out, "xrfrcv_frame_ring_latency_seconds_sum", QByteArray(), seconds(ringLatencyTotalNs));
+    sample(out, "xrfrcv_frame_ring_latency_seconds_count", QByteArray(), QByteArray::number(ringFramesPopped));
+    header(out, "xrfrcv_frame_ring_latency_max_seconds", "gauge", "Longest time a delivered frame spent in the live display ring.");
+    sample(out, "xrfrcv_frame_ring_latency_max_seconds", QByteArray(), seconds(ringLatencyMaxNs));
+    header(out, "xrfrcv_frame_ring_depth", "gauge", "Frames waiting in the live display ring.");
+    sample(out, "xrfrcv_frame_ring_depth", QByteArray(), QByteArray::number(ringDepth));
+
+    return out;
+}
+
+
+StageTimer::StageTimer(Metrics &metrics)
+    : metrics(metrics)
+{
+    for (int i = 0; i < Metrics::StageCount; ++i)
+    {
+        ns[i] = 0;
+        used[i] = false;
+    }
+    timer.start();
+}
+
+void StageTimer::lap(Metrics::Stage stage)
+{
+    ns[stage] += timer.nsecsElapsed();
+    used[stage] = true;
+    timer.start();
+}
+
+void StageTimer::commit()
+{
+    for (int i = 0; i < Metrics::StageCount; ++i)
+    {
+        if (used[i])
+            metrics.time(Metrics::Stage(i), ns[i]);
+        ns[i] = 0;
+        used[i] = false;
+    }
+    timer.start();
+}
+
+
+MetricsExporter::MetricsExporter(std::function<MetricsSnapshot()> source, const QString &fileName, int intervalMs)
+    : source(std::move(source)), fileName(fileName), intervalMs(qMax(100, intervalMs)), stopping(false)
+{
+
+}
+
+void MetricsExporter::stop()
+{
+    QMutexLocker locker(&mutex);
+    stopping = true;
+    wakeup.wakeAll();
+}
+
+bool MetricsExporter::write()
+{
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+    file.write(source().toPrometheus());
+    return file.commit();
+}
+
+void MetricsExporter::run()
+{
+    QMutexLocker locker(&mutex);
+    while (!stopping)
+    {
+        locker.unlock();
+        write();
+        locker.relock();
+        if (!stopping)
+            wakeup.wait(&mutex, intervalMs);
+    }
+    // the final numbers, after the receiver has shut down
+    locker.unlock();
+    write();
+}
+
+}
@@ -0,0 +1,169 @@
+#pragma once
+
+#include "dcmtk/config/osconfig.h"    /* make sure OS specific configuration is included first */
+
+#include "dcmtk/ofstd/ofcond.h"
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QList>
+#include <QMap>
+#include <QMutex>
+#include <QString>
+#include <QThread>
+#include <QWaitCondition>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace xrf {
+
+struct MetricsSnapshot;
+
+/*
+ * Counters of the receiver. Every thread which records something gets a shard of its
+ * own, so the hot path is a relaxed atomic add on memory no other thread writes to;
+ * the shards are only summed up when a snapshot is taken. Errors are rare and keyed
+ * by OFCondition module and code, they are counted under a mutex.
+ */
+class Metrics
+{
+public:
+    enum Counter {
+        AssociationsAccepted,
+        AssociationsRejected,
+        AssociationsAborted,
+        EchoRequests,
+        StoreRequests,
+        ObjectsStored,
+        ObjectsFailed,
+        BytesReceived,
+        LoopWakeups,            // of the receiver's readiness loop, see Reactor
+        DuplicatesIdentical,    // SOP instances received again with the same content, see InstanceIndex
+        DuplicatesDiffering,    // SOP instances received again with other content
+        DuplicateBytesSaved,    // of identical duplicates which were not written (DuplicatePolicy::Skip)
+        DigestNanoseconds,      // spent computing file digests while receiving, see DigestTap
+        CounterCount
+    };
+
+    /* where the time of one C-STORE goes */
+    enum Stage {
+        NetworkReceive,         // C-STORE-RQ data set off the network (dcmdata decodes on the fly)
+        DatasetBuild,           // cine loop, study and index records from what was received
+        DiskWrite,              // file written, queued for the write-behind stage or moved
+        SignalDispatch,         // Qt signals to the consumers
+        ProjectionGeometry,     // projection matrices of a delivered loop, see CineLoop::projections()
+        StageCount
+    };
+
+    Metrics();
+    ~Metrics();
+
+    void add(Counter counter, quint64 value = 1);
+    void time(Stage stage, qint64 nsecs);
+    void error(const OFCondition& cond);
+
+    MetricsSnapshot snapshot() const;
+
+private:
+    struct Shard;
+    Shard* shard();
+
+    mutable QMutex mMutex;
+    const quint64 mId;
+    std::vector<std::unique_ptr<Shard>> mShards;
+    QHash<Qt::HANDLE, Shard*> mThreadShards;
+    struct ErrorCount
+    {
+        unsigned short module;
+        unsigned short code;
+        QString text;
+        quint64 count;
+    };
+    QMap<quint32, ErrorCount> mErrors;
+
+    friend struct MetricsSnapshot;
+};
+
+struct MetricsSnapshot
+{
+    struct StageStats
+    {
+        quint64 count = 0;
+        quint64 totalNs = 0;
+        quint64 maxNs = 0;
+    };
+    struct Error
+    {
+        unsigned short module;
+        unsigned short code;
+        QString text;
+        quint64 count;
+    };
+
+    quint64 counters[Metrics::CounterCount] = {};
+    StageStats stages[Metrics::StageCount];
+    QList<Error> errors;
+
+    // gauges, filled in by the receiver
+    int activeAssociations = 0;
+    int maxAssociations = 0;
+    int writeQueueDepth = 0;
+    qint64 writeQueueBytes = 0;
+    int openStudies = 0;
+    quint64 ringFramesPopped = 0;           // FrameRing, if the receiver has one
+    quint64 ringFramesDroppedOldest = 0;
+    quint64 ringFramesDroppedNewest = 0;
+    qint64 ringLatencyTotalNs = 0;
+    qint64 ringLatencyMaxNs = 0;
+    int ringDepth = 0;
+
+    /* Prometheus text exposition format */
+    QByteArray toPrometheus() const;
+};
+
+/* accumulates the stage times of one object and records them once it is done */
+class StageTimer
+{
+public:
+    explicit StageTimer(Metrics& metrics);
+
+    void restart()                  { timer.start(); }
+    void lap(Metrics::Stage stage);
+    void commit();
+
+private:
+    Metrics& metrics;
+    QElapsedTimer timer;
+    qint64 ns[Metrics::StageCount];
+    bool used[Metrics::StageCount];
+};
+
+/*
+ * Writes a snapshot to a Prometheus text file every intervalMs, e.g. for the textfile
+ * collector of node_exporter. The file is replaced atomically, a scraper never sees a
+ * partially written one.
+ */
+class MetricsExporter : public QThread
+{
+public:
+    MetricsExporter(std::function<MetricsSnapshot()> source, const QString& fileName, int intervalMs);
+
+    void stop();
+    void run() Q_DECL_OVERRIDE;
+
+private:
+    bool write();
+
+    std::function<MetricsSnapshot()> source;
+    QString fileName;
+    int intervalMs;
+    QMutex mutex;
+    QWaitCondition wakeup;
+    bool stopping;
+};
+
+}
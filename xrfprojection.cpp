@@ -0,0 +1,303 @@
+#include "xrfprojection.h"
+#include "xrferror.h"
+
+#include <cmath>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define XRF_PROJECTION_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// GCC and Clang only emit AVX2 in functions which ask for it; MSVC takes the intrinsics anywhere
+#if defined(XRF_PROJECTION_X86) && defined(__GNUC__)
+#define XRF_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define XRF_TARGET_AVX2
+#endif
+
+namespace xrf {
+
+static const double degrees = 3.14159265358979323846 / 180.0;
+
+/* what is the same for all frames of a loop */
+struct ProjectionParams
+{
+    double cosG;                            // detector rotation
+    double sinG;
+    double columnScale;                     // 1 / spacing between columns
+    double rowScale;                        // 1 / spacing between rows
+    double cx;                              // where the central ray hits the image
+    double cy;
+};
+
+/* what changes from frame to frame, one array each */
+struct FrameInputs
+{
+    const double *cosA;                     // primary angle
+    const double *sinA;
+    const double *cosB;                     // secondary angle
+    const double *sinB;
+    const double *sid;                      // source to detector
+    const double *dsi;                      // source to isocenter
+};
+
+/*
+ * d = (sinA cosB, -cosA cosB, sinB) is the beam direction, u' = (cosA, sinA, 0) and
+ * v' = (sinA sinB, -cosA sinB, -cosB) the column and row directions before the
+ * detector rotation, u = cosG u' + sinG v' and v = cosG v' - sinG u' after it.
+ * Rows of the matrix: fx u + cx d | cx D, fy v + cy d | cy D, d | D.
+ */
+static void projectScalar(const ProjectionParams &p, const FrameInputs &in, double *const out[12], size_t begin, size_t count)
+{
+    for (size_t f = begin; f < count; ++f)
+    {
+        const double cA = in.cosA[f], sA = in.sinA[f], cB = in.cosB[f], sB = in.sinB[f];
+        const double sAsB = sA * sB, cAsB = cA * sB;
+        const double dx = sA * cB, dy = -(cA * cB), dz = sB;
+        const double ux = p.cosG * cA + p.sinG * sAsB;
+        const double uy = p.cosG * sA - p.sinG * cAsB;
+        const double uz = -(p.sinG * cB);
+        const double vx = p.cosG * sAsB - p.sinG * cA;
+        const double vy = -(p.sinG * sA) - p.cosG * cAsB;
+        const double vz = -(p.cosG * cB);
+        const double fx = in.sid[f] * p.columnScale, fy = in.sid[f] * p.rowScale, D = in.dsi[f];
+
+        out[0][f] = fx * ux + p.cx * dx;
+        out[1][f] = fx * uy + p.cx * dy;
+        out[2][f] = fx * uz + p.cx * dz;
+        out[3][f] = p.cx * D;
+        out[4][f] = fy * vx + p.cy * dx;
+        out[5][f] = fy * vy + p.cy * dy;
+        out[6][f] = fy * vz + p.cy * dz;
+        out[7][f] = p.cy * D;
+        out[8][f] = dx;
+        out[9][f] = dy;
+        out[10][f] = dz;
+        out[11][f] = D;
+    }
+}
+
+#ifdef XRF_PROJECTION_X86
+
+/* 4 frames per step, the output arrays are 32 byte aligned */
+XRF_TARGET_AVX2
+static void projectAvx2(const ProjectionParams &p, const FrameInputs &in, double *const out[12], size_t count)
+{
+    const __m256d sign = _mm256_set1_pd(-0.0);
+    const __m256d cosG = _mm256_set1_pd(p.cosG), sinG = _mm256_set1_pd(p.sinG);
+    const __m256d columnScale = _mm256_set1_pd(p.columnScale), rowScale = _mm256_set1_pd(p.rowScale);
+    const __m256d cx = _mm256_set1_pd(p.cx), cy = _mm256_set1_pd(p.cy);
+    size_t f = 0;
+    for (; f + 4 <= count; f += 4)
+    {
+        const __m256d cA = _mm256_loadu_pd(in.cosA + f), sA = _mm256_loadu_pd(in.sinA + f);
+        const __m256d cB = _mm256_loadu_pd(in.cosB + f), sB = _mm256_loadu_pd(in.sinB + f);
+        const __m256d sAsB = _mm256_mul_pd(sA, sB), cAsB = _mm256_mul_pd(cA, sB);
+        const __m256d dx = _mm256_mul_pd(sA, cB);
+        const __m256d dy = _mm256_xor_pd(_mm256_mul_pd(cA, cB), sign);
+        const __m256d dz = sB;
+        const __m256d ux = _mm256_add_pd(_mm256_mul_pd(cosG, cA), _mm256_mul_pd(sinG, sAsB));
+        const __m256d uy = _mm256_sub_pd(_mm256_mul_pd(cosG, sA), _mm256_mul_pd(sinG, cAsB));
+        const __m256d uz = _mm256_xor_pd(_mm256_mul_pd(sinG, cB), sign);
+        const __m256d vx = _mm256_sub_pd(_mm256_mul_pd(cosG, sAsB), _mm256_mul_pd(sinG, cA));
+        const __m256d vy = _mm256_sub_pd(_mm256_xor_pd(_mm256_mul_pd(sinG, sA), sign), _mm256_mul_pd(cosG, cAsB));
+        const __m256d vz = _mm256_xor_pd(_mm256_mul_pd(cosG, cB), sign);
+        const __m256d sid = _mm256_loadu_pd(in.sid + f), D = _mm256_loadu_pd(in.dsi + f);
+        const __m256d fx = _mm256_mul_pd(sid, columnScale), fy = _mm256_mul_pd(sid, rowScale);
+
+        _mm256_store_pd(out[0] + f, _mm256_add_pd(_mm256_mul_pd(fx, ux), _mm256_mul_pd(cx, dx)));
+        _mm256_store_pd(out[1] + f, _mm256_add_pd(_mm256_mul_pd(fx, uy), _mm256_mul_pd(cx, dy)));
+        _mm256_store_pd(out[2] + f, _mm256_add_pd(_mm256_mul_pd(fx, uz), _mm256_mul_pd(cx, dz)));
+        _mm256_store_pd(out[3] + f, _mm256_mul_pd(cx, D));
+        _mm256_store_pd(out[4] + f, _mm256_add_pd(_mm256_mul_pd(fy, vx), _mm256_mul_pd(cy, dx)));
+        _mm256_store_pd(out[5] + f, _mm256_add_pd(_mm256_mul_pd(fy, vy), _mm256_mul_pd(cy, dy)));
+        _mm256_store_pd(out[6] + f, _mm256_add_pd(_mm256_mul_pd(fy, vz), _mm256_mul_pd(cy, dz)));
+        _mm256_store_pd(out[7] + f, _mm256_mul_pd(cy, D));
+        _mm256_store_pd(out[8] + f, dx);
+        _mm256_store_pd(out[9] + f, dy);
+        _mm256_store_pd(out[10] + f, dz);
+        _mm256_store_pd(out[11] + f, D);
+    }
+    projectScalar(p, in, out, f, count);
+}
+
+#endif
+
+static ProjectionKernel detectKernel()
+{
+#ifdef XRF_PROJECTION_X86
+#ifdef _MSC_VER
+    int regs[4];
+    __cpuid(regs, 0);
+    const int maxLeaf = regs[0];
+    __cpuid(regs, 1);
+    // AVX2 also needs the OS to save the YMM registers
+    const bool osAvx = (regs[2] & (1 << 27)) != 0 && (regs[2] & (1 << 28)) != 0 && (_xgetbv(0) & 6) == 6;
+    if (osAvx && maxLeaf >= 7)
+    {
+        __cpuidex(regs, 7, 0);
+        if (regs[1] & (1 << 5))
+            return ProjectionKernel::AVX2;
+    }
+#else
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return ProjectionKernel::AVX2;
+#endif
+#endif
+    return ProjectionKernel::Scalar;
+}
+
+ProjectionKernel bestProjectionKernel()
+{
+    static const ProjectionKernel best = detectKernel();
+    return best;
+}
+
+bool isProjectionKernelSupported(ProjectionKernel kernel)
+{
+    switch (kernel)
+    {
+    case ProjectionKernel::Scalar:
+    case ProjectionKernel::Best:
+        return true;
+    case ProjectionKernel::AVX2:
+        return bestProjectionKernel() == ProjectionKernel::AVX2;
+    }
+    return false;
+}
+
+const char *projectionKernelName(ProjectionKernel kernel)
+{
+    switch (kernel)
+    {
+    case ProjectionKernel::Scalar: return "scalar";
+    case ProjectionKernel::AVX2:   return "avx2";
+    case ProjectionKernel::Best:   return projectionKernelName(bestProjectionKernel());
+    }
+    return "unknown";
+}
+
+
+ProjectionSet::ProjectionSet(int frames)
+    : mFrames(frames), mStride((size_t(frames) + 3) & ~size_t(3))
+{
+    // 4 doubles of slack to align the start to 32 bytes
+    mStorage.resize(12 * mStride + 4);
+    mElements = OFreinterpret_cast(double *, (quintptr(mStorage.data()) + 31) & ~quintptr(31));
+}
+
+/* a per-frame value if there is one for every frame, else the one of the run */
+static double frameValue(const std::vector<double> &values, size_t frame, double run)
+{
+    return frame < values.size() ? values[frame] : run;
+}
+
+std::shared_ptr<const ProjectionSet> ProjectionSet::compute(const CineLoopInfo &info, ProjectionKernel kernel, OFCondition *status)
+{
+    const CineGeometry& g = info.geometry;
+    const int frames = info.numberOfFrames;
+    OFCondition cond = frames > 0 ? EC_Normal : EC_IllegalParameter;
+
+    // the distances of the run; each one stands in for what the others lack
+    double dsi = 0.0, sid = 0.0;
+    const bool hasMagnification = g.has(CineGeometry::HasMagnificationFactor) && g.magnificationFactor > 0.0;
+    if (g.has(CineGeometry::HasSourceToIsocenter)) dsi = g.sourceToIsocenter;
+    else if (g.has(CineGeometry::HasDistanceSourceToPatient)) dsi = g.distanceSourceToPatient;
+    else if (g.has(CineGeometry::HasDistanceSourceToDetector) && hasMagnification) dsi = g.distanceSourceToDetector / g.magnificationFactor;
+    if (g.has(CineGeometry::HasDistanceSourceToDetector)) sid = g.distanceSourceToDetector;
+    else if (hasMagnification) sid = g.magnificationFactor * dsi;
+    if (cond.good() && (!g.has(CineGeometry::HasImagerPixelSpacing) || g.imagerPixelSpacing[0] <= 0.0 || g.imagerPixelSpacing[1] <= 0.0))
+        cond = XRF_GeometryIncomplete;
+
+    // per-frame values which do not cover the loop are of no use
+    const size_t count = size_t(qMax(frames, 0));
+    const std::vector<double> none;
+    const std::vector<double>& primary = g.framePrimaryAngles.size() >= count ? g.framePrimaryAngles : none;
+    const std::vector<double>& secondary = g.frameSecondaryAngles.size() >= count ? g.frameSecondaryAngles : none;
+    const std::vector<double>& sids = g.frameSourceToDetector.size() >= count ? g.frameSourceToDetector : none;
+    const std::vector<double>& dsis = g.frameSourceToIsocenter.size() >= count ? g.frameSourceToIsocenter : none;
+
+    std::shared_ptr<ProjectionSet> set;
+    if (cond.good())
+    {
+        set.reset(new ProjectionSet(frames));
+
+        // the trigonometry per frame, into one array per input; the padding repeats the last frame
+        const size_t stride = set->mStride;
+        std::vector<double> inputs(6 * stride);
+        double *cosA = inputs.data(), *sinA = cosA + stride, *cosB = sinA + stride, *sinB = cosB + stride;
+        double *sidF = sinB + stride, *dsiF = sidF + stride;
+        for (size_t f = 0; f < stride && cond.good(); ++f)
+        {
+            const size_t frame = qMin(f, count - 1);
+            const double a = frameValue(primary, frame, g.positionerPrimaryAngle) * degrees;
+            const double b = frameValue(secondary, frame, g.positionerSecondaryAngle) * degrees;
+            cosA[f] = std::cos(a);
+            sinA[f] = std::sin(a);
+            cosB[f] = std::cos(b);
+            sinB[f] = std::sin(b);
+            sidF[f] = frameValue(sids, frame, sid);
+            dsiF[f] = frameValue(dsis, frame, dsi);
+            if (!(sidF[f] > 0.0 && dsiF[f] > 0.0))
+                cond = XRF_GeometryIncomplete;
+        }
+
+        if (cond.good())
+        {
+            const double rotation = g.has(CineGeometry::HasDetectorRotation) ? g.detectorRotation * degrees : 0.0;
+            ProjectionParams p;
+            p.cosG = std::cos(rotation);
+            p.sinG = std::sin(rotation);
+            p.columnScale = 1.0 / g.imagerPixelSpacing[1];
+            p.rowScale = 1.0 / g.imagerPixelSpacing[0];
+            p.cx = (info.columns - 1) / 2.0;
+            p.cy = (info.rows - 1) / 2.0;
+            const FrameInputs in = { cosA, sinA, cosB, sinB, sidF, dsiF };
+            double *out[12];
+            for (int k = 0; k < 12; ++k)
+                out[k] = set->mElements + size_t(k) * stride;
+
+            if (kernel == ProjectionKernel::Best || !isProjectionKernelSupported(kernel))
+                kernel = bestProjectionKernel();
+#ifdef XRF_PROJECTION_X86
+            if (kernel == ProjectionKernel::AVX2)
+                projectAvx2(p, in, out, stride);
+            else
+#endif
+                projectScalar(p, in, out, 0, stride);
+        }
+        else
+            set.reset();
+    }
+
+    if (status) *status = cond;
+    return set;
+}
+
+bool ProjectionSet::matrix(int frame, double m[12]) const
+{
+    if (frame < 0 || frame >= mFrames)
+        return false;
+    for (int k = 0; k < 12; ++k)
+        m[k] = mElements[size_t(k) * mStride + size_t(frame)];
+    return true;
+}
+
+bool ProjectionSet::project(int frame, const double point[3], double &column, double &row) const
+{
+    double m[12];
+    if (!matrix(frame, m))
+        return false;
+    const double w = m[8] * point[0] + m[9] * point[1] + m[10] * point[2] + m[11];
+    if (w <= 0.0)
+        return false;
+    column = (m[0] * point[0] + m[1] * point[1] + m[2] * point[2] + m[3]) / w;
+    row = (m[4] * point[0] + m[5] * point[1] + m[6] * point[2] + m[7]) / w;
+    return true;
+}
+
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "dcmtk/config/osconfig.h"    /* make sure OS specific configuration is included first */
+
+#include "dcmtk/ofstd/ofcond.h"
+
+#include "xrfcineloop.h"
+
+#include <memory>
+#include <vector>
+
+namespace xrf {
+
+/* instruction sets ProjectionSet::compute() can run on */
+enum class ProjectionKernel {
+    Scalar,         // reference, every platform
+    AVX2,           // 4 frames per step
+    Best            // the widest one the CPU supports, see bestProjectionKernel()
+};
+
+/*
+ * The 3x4 projection matrices of the frames of a loop, from patient coordinates (mm,
+ * LPS, origin at the isocenter) to pixel positions: (column, row) = (x / w, y / w) for
+ * (x, y, w) = P * (X, Y, Z, 1), with w the distance from the source along the central
+ * ray. Pixel (0, 0) is the centre of the first pixel of the image as displayed.
+ *
+ * At primary = secondary = 0 the beam runs from posterior to anterior, columns run
+ * to the patient's left and rows to the feet. The primary angle turns the C-arm
+ * about the head-feet axis towards the patient's left (LAO +), the secondary angle
+ * towards the head (CRA +), PS3.3 C.8.7.5; a positive detector rotation (0021,1071)
+ * turns the column direction towards the row direction about the central ray, which
+ * hits the middle of the image. The source is
+ * (0021,1017) away from the isocenter (else Distance Source to Patient), the detector
+ * Distance Source to Detector (else magnification * source to isocenter); pixels are
+ * Imager Pixel Spacing apart. The per-frame values of CineGeometry override these
+ * frame by frame.
+ *
+ * The matrices are kept as structure of arrays: element(row, column) points to that
+ * element of every frame, element(row, column)[frame], each array padded to a multiple
+ * of 4 frames and 32 byte aligned. Every kernel evaluates the same expressions in the
+ * same order in double precision; `xrfbench projection` checks them against the
+ * scalar reference and against reference geometries.
+ */
+class ProjectionSet
+{
+public:
+    /* null if the geometry of info lacks a distance or the pixel spacing (status
+     * XRF_GeometryIncomplete) or if info has no frames */
+    static std::shared_ptr<const ProjectionSet> compute(const CineLoopInfo& info, ProjectionKernel kernel = ProjectionKernel::Best,
+                                                        OFCondition* status = nullptr);
+
+    int           frameCount() const        { return mFrames; }
+    /* element (row 0..2, column 0..3) of the matrices of all frames */
+    const double* element(int row, int column) const { return mElements + size_t(row * 4 + column) * mStride; }
+
+    /* the matrix of frame (0-based), row major; false if index is out of range */
+    bool matrix(int frame, double m[12]) const;
+    /* pixel position of point (patient coordinates, mm) in frame; false if frame is out
+     * of range or the point is not in front of the source */
+    bool project(int frame, const double point[3], double& column, double& row) const;
+
+private:
+    explicit ProjectionSet(int frames);
+
+    int mFrames;
+    size_t mStride;                         // frames per element array, padded
+    std::vector<double> mStorage;
+    double* mElements;                      // 32 byte aligned, into mStorage
+};
+
+typedef std::shared_ptr<const ProjectionSet> ProjectionSetPtr;
+
+/* decided once, on first use */
+ProjectionKernel bestProjectionKernel();
+bool isProjectionKernelSupported(ProjectionKernel kernel);
+const char* projectionKernelName(ProjectionKernel kernel);
+
+}
@@ -0,0 +1,257 @@
+#include "xrfrawcine.h"
+#include "xrferror.h"
+#include "xrfrecordfile.h"
+
+#include "dcmtk/dcmdata/dcxfer.h"
+
+#include <QFileInfo>
+
+#include <cstring>
+#include <vector>
+
+namespace xrf {
+
+// the header is written as is, keep its layout stable
+Q_STATIC_ASSERT(sizeof(RawCineHeader) == 512);
+
+static const char RawCineMagic[8] = { 'X', 'R', 'F', 'C', 'I', 'N', 'E', '\0' };
+
+static quint64 aligned(quint64 offset)
+{
+    return (offset + RawCineHeader::Alignment - 1) & ~(RawCineHeader::Alignment - 1);
+}
+
+
+RawCineHeader RawCineHeader::make(const CineLoopInfo &info)
+{
+    RawCineHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, RawCineMagic, sizeof(header.magic));
+    header.version = Version;
+    header.headerSize = sizeof(RawCineHeader);
+    header.byteOrder = ByteOrderMark;
+
+    setFixedString(header.sopClassUID, sizeof(header.sopClassUID), info.sopClassUID.toLatin1());
+    setFixedString(header.sopInstanceUID, sizeof(header.sopInstanceUID), info.sopInstanceUID.toLatin1());
+    setFixedString(header.studyInstanceUID, sizeof(header.studyInstanceUID), info.studyInstanceUID.toLatin1());
+    setFixedString(header.seriesInstanceUID, sizeof(header.seriesInstanceUID), info.seriesInstanceUID.toLatin1());
+    setFixedString(header.photometricInterpretation, sizeof(header.photometricInterpretation), info.photometricInterpretation.toLatin1());
+
+    header.rows = info.rows;
+    header.columns = info.columns;
+    header.samplesPerPixel = info.samplesPerPixel;
+    header.bitsAllocated = info.bitsAllocated;
+    header.bitsStored = info.bitsStored;
+    header.highBit = info.highBit;
+    header.pixelRepresentation = info.pixelRepresentation;
+
+    header.numberOfFrames = info.numberOfFrames;
+    header.startTrim = info.startTrim;
+    header.stopTrim = info.stopTrim;
+    header.frameTime = info.frameTime;
+    header.recommendedFrameRate = info.recommendedFrameRate;
+    header.cineRate = info.cineRate;
+    header.windowCenter = info.windowCenter;
+    header.windowWidth = info.windowWidth;
+
+    const CineGeometry& geometry = info.geometry;
+    header.geometryFields = geometry.fields;
+    header.distanceSourceToDetector = geometry.distanceSourceToDetector;
+    header.distanceSourceToPatient = geometry.distanceSourceToPatient;
+    header.magnificationFactor = geometry.magnificationFactor;
+    header.positionerPrimaryAngle = geometry.positionerPrimaryAngle;
+    header.positionerSecondaryAngle = geometry.positionerSecondaryAngle;
+    header.sourceToIsocenter = geometry.sourceToIsocenter;
+    header.detectorRotation = geometry.detectorRotation;
+    header.imagerPixelSpacing[0] = geometry.imagerPixelSpacing[0];
+    header.imagerPixelSpacing[1] = geometry.imagerPixelSpacing[1];
+
+    header.frameBytes = info.frameBytes();
+    header.frameStride = aligned(header.frameBytes);
+    header.offsetTable = sizeof(RawCineHeader);
+    header.firstFrame = aligned(header.offsetTable + quint64(qMax(0, info.numberOfFrames)) * sizeof(quint64));
+    header.fileSize = header.firstFrame + quint64(qMax(0, info.numberOfFrames)) * header.frameStride;
+    return header;
+}
+
+CineLoopInfo RawCineHeader::info() const
+{
+    CineLoopInfo info;
+    info.sopClassUID = QString::fromLatin1(fixedString(sopClassUID, sizeof(sopClassUID)));
+    info.sopInstanceUID = QString::fromLatin1(fixedString(sopInstanceUID, sizeof(sopInstanceUID)));
+    info.studyInstanceUID = QString::fromLatin1(fixedString(studyInstanceUID, sizeof(studyInstanceUID)));
+    info.seriesInstanceUID = QString::fromLatin1(fixedString(seriesInstanceUID, sizeof(seriesInstanceUID)));
+    info.photometricInterpretation = QString::fromLatin1(fixedString(photometricInterpretation, sizeof(photometricInterpretation)));
+
+    info.rows = rows;
+    info.columns = columns;
+    info.samplesPerPixel = samplesPerPixel;
+    info.bitsAllocated = bitsAllocated;
+    info.bitsStored = bitsStored;
+    info.highBit = highBit;
+    info.pixelRepresentation = pixelRepresentation;
+
+    info.numberOfFrames = numberOfFrames;
+    info.startTrim = startTrim;
+    info.stopTrim = stopTrim;
+    info.frameTime = frameTime;
+    info.recommendedFrameRate = recommendedFrameRate;
+    info.cineRate = cineRate;
+    info.windowCenter = windowCenter;
+    info.windowWidth = windowWidth;
+
+    CineGeometry& geometry = info.geometry;
+    geometry.fields = geometryFields;
+    geometry.distanceSourceToDetector = distanceSourceToDetector;
+    geometry.distanceSourceToPatient = distanceSourceToPatient;
+    geometry.magnificationFactor = magnificationFactor;
+    geometry.positionerPrimaryAngle = positionerPrimaryAngle;
+    geometry.positionerSecondaryAngle = positionerSecondaryAngle;
+    geometry.sourceToIsocenter = sourceToIsocenter;
+    geometry.detectorRotation = detectorRotation;
+    geometry.imagerPixelSpacing[0] = imagerPixelSpacing[0];
+    geometry.imagerPixelSpacing[1] = imagerPixelSpacing[1];
+
+    info.xfer = gLocalByteOrder == EBO_BigEndian ? EXS_BigEndianExplicit : EXS_LittleEndianExplicit;
+    return info;
+}
+
+QString rawCineFileName(const QString &fileName)
+{
+    // without an extension the name ends in the SOP Instance UID, whose last component stays
+    const QString suffix = QFileInfo(fileName).suffix();
+    bool numeric = false;
+    suffix.toULongLong(&numeric);
+    const QString base = (suffix.isEmpty() || numeric) ? fileName : fileName.left(fileName.size() - suffix.size() - 1);
+    return base + RawCineExtension;
+}
+
+OFCondition writeRawCine(const QString &fileName, const CineLoop &loop)
+{
+    const CineLoopInfo& info = loop.info();
+    if (DcmXfer(info.xfer).isEncapsulated() || info.frameBytes() == 0 || loop.frameCount() < 1)
+        return EC_UnsupportedEncoding;
+
+    const RawCineHeader header = RawCineHeader::make(info);
+    MappedFileWriter file;
+    OFCondition cond = file.open(fileName.toLocal8Bit().constData(), header.fileSize);
+    // the size is known up front, the file is written through a single mapping
+    if (cond.good()) cond = file.reserve(header.fileSize);
+    if (cond.good()) cond = file.write(&header, sizeof(header));
+
+    std::vector<quint64> offsets(size_t(header.numberOfFrames));
+    for (size_t i = 0; i < offsets.size(); ++i)
+        offsets[i] = header.firstFrame + i * header.frameStride;
+    if (cond.good()) cond = file.write(offsets.data(), offsets.size() * sizeof(quint64));
+
+    static const Uint8 zeros[RawCineHeader::Alignment] = {};
+    if (cond.good() && header.firstFrame > file.size())
+        cond = file.write(zeros, size_t(header.firstFrame - file.size()));
+    const size_t padding = size_t(header.frameStride - header.frameBytes);
+    for (int i = 0; i < header.numberOfFrames && cond.good(); ++i)
+    {
+        cond = file.write(loop.frame(i), size_t(header.frameBytes));
+        if (cond.good() && padding > 0)
+            cond = file.write(zeros, padding);
+    }
+
+    if (cond.good())
+        cond = file.commit();
+    else
+        file.discard();
+    return cond;
+}
+
+OFCondition convertToRawCine(const QString &dicomFile, const QString &rawFile)
+{
+    OFCondition cond;
+    CineLoopPtr loop = CineLoop::fromFile(dicomFile, &cond);
+    if (cond == EC_UnsupportedEncoding)
+    {
+        // pixel data in the other byte order cannot be mapped; dcmdata swaps it into ours
+        std::shared_ptr<DcmFileFormat> fileformat = std::make_shared<DcmFileFormat>();
+        cond = fileformat->loadFile(dicomFile.toLocal8Bit().constData());
+        if (cond.good())
+            loop = CineLoop::fromFileFormat(fileformat, &cond);
+    }
+    if (cond.good())
+        cond = writeRawCine(rawFile, *loop);
+    return cond;
+}
+
+
+std::shared_ptr<const RawCineFile> RawCineFile::open(const QString &fileName, OFCondition *status)
+{
+    OFCondition cond;
+    std::shared_ptr<const MappedFile> mapped = MappedFile::open(fileName, &cond);
+    std::shared_ptr<RawCineFile> file;
+
+    const RawCineHeader *header = NULL;
+    if (cond.good())
+    {
+        header = OFreinterpret_cast(const RawCineHeader *, mapped->data());
+        if (mapped->size() < sizeof(RawCineHeader) || memcmp(header->magic, RawCineMagic, sizeof(RawCineMagic)) != 0
+            || header->version != RawCineHeader::Version || header->headerSize != sizeof(RawCineHeader)
+            || header->byteOrder != RawCineHeader::ByteOrderMark)
+            cond = XRF_RawCineInvalid;
+    }
+
+    // everything a frame lookup relies on is checked here, once
+    if (cond.good())
+    {
+        const quint64 frames = quint64(qMax(0, header->numberOfFrames));
+        const CineLoopInfo info = header->info();
+        if (frames < 1 || header->frameBytes == 0 || header->frameBytes != info.frameBytes()
+            || header->frameStride < header->frameBytes || header->frameStride % RawCineHeader::Alignment != 0
+            || header->offsetTable % sizeof(quint64) != 0 || header->offsetTable < sizeof(RawCineHeader)
+            || header->fileSize > mapped->size() || header->offsetTable + frames * sizeof(quint64) > header->fileSize)
+            cond = XRF_RawCineInvalid;
+    }
+    if (cond.good())
+    {
+        const quint64 *offsets = OFreinterpret_cast(const quint64 *, mapped->data() + header->offsetTable);
+        for (int i = 0; i < header->numberOfFrames && cond.good(); ++i)
+            if (offsets[i] % RawCineHeader::Alignment != 0 || offsets[i] + header->frameBytes > header->fileSize)
+                cond = XRF_RawCineInvalid;
+        if (cond.good())
+        {
+            file.reset(new RawCineFile());
+            file->mFile = mapped;
+            file->mHeader = header;
+            file->mOffsets = offsets;
+        }
+    }
+
+    if (status) *status = cond;
+    return file;
+}
+
+const Uint8* RawCineFile::frame(int index) const
+{
+    if (index < 0 || index >= mHeader->numberOfFrames)
+        return NULL;
+    return mFile->data() + mOffsets[index];
+}
+
+CineLoopPtr RawCineFile::loop(const std::shared_ptr<const RawCineFile> &file, OFCondition *status)
+{
+    if (!file)
+        return CineLoopPtr();
+
+    // a CineLoop steps through its frames at a fixed stride, as the writer lays them out
+    const RawCineHeader& header = file->header();
+    for (int i = 0; i < header.numberOfFrames; ++i)
+    {
+        if (file->mOffsets[i] != file->mOffsets[0] + quint64(i) * header.frameStride)
+        {
+            if (status) *status = EC_UnsupportedEncoding;
+            return CineLoopPtr();
+        }
+    }
+
+    if (status) *status = EC_Normal;
+    const size_t pixelBytes = size_t(header.frameStride) * size_t(header.numberOfFrames - 1) + size_t(header.frameBytes);
+    return std::make_shared<const CineLoop>(header.info(), file, file->frame(0), pixelBytes, size_t(header.frameStride));
+}
+
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include "dcmtk/config/osconfig.h"    /* make sure OS specific configuration is included first */
+
+#include "dcmtk/ofstd/ofcond.h"
+
+#include "xrfcineloop.h"
+#include "xrfmappedfile.h"
+
+#include <QString>
+
+#include <memory>
+
+namespace xrf {
+
+/* extension of raw cine files, next to or instead of the .dcm of a loop */
+const char RawCineExtension[] = ".xrfcine";
+
+/* whether the receiver writes raw cine files, see CineLoopRcv::setRawCineExport() */
+enum class RawCineExport {
+    Off,
+    Alongside,      // next to the DICOM file
+    Instead         // no DICOM file at all
+};
+
+/*
+ * Header at the start of a raw cine file, in its on-disk layout (host byte order,
+ * byteOrder tells a reader on the other kind of host); change Version when touching
+ * it. UIDs and strings are NUL padded and not terminated if they use the whole field.
+ * The geometry values are only meaningful if their CineGeometry flag is set in
+ * geometryFields; the timing values are 0 if absent, as in CineLoopInfo.
+ *
+ * The header is followed, at offsetTable, by one quint64 file offset per frame. The
+ * frames themselves start at firstFrame, every frameStride bytes: native pixel data
+ * in the local byte order, each frame 64 byte aligned and padded with zeros.
+ */
+struct RawCineHeader
+{
+    static const quint32 Version = 1;
+    static const quint32 ByteOrderMark = 0x01020304;
+    static const quint64 Alignment = 64;
+
+    char    magic[8];
+    quint32 version;
+    quint32 headerSize;                     // sizeof(RawCineHeader)
+    quint32 byteOrder;                      // ByteOrderMark as written
+    quint32 geometryFields;                 // CineGeometry::Field flags
+
+    char    sopClassUID[64];
+    char    sopInstanceUID[64];
+    char    studyInstanceUID[64];
+    char    seriesInstanceUID[64];
+    char    photometricInterpretation[16];
+
+    quint16 rows;
+    quint16 columns;
+    quint16 samplesPerPixel;
+    quint16 bitsAllocated;
+    quint16 bitsStored;
+    quint16 highBit;
+    quint16 pixelRepresentation;
+    quint16 reserved0;
+
+    qint32  numberOfFrames;
+    qint32  startTrim;                      // (0008,2142)
+    qint32  stopTrim;                       // (0008,2143)
+    qint32  reserved1;
+
+    double  frameTime;                      // (0018,1063) ms
+    double  recommendedFrameRate;           // (0008,2144) frames/s
+    double  cineRate;                       // (0018,0040) frames/s
+    double  windowCenter;                   // (0028,1050)
+    double  windowWidth;                    // (0028,1051)
+
+    double  distanceSourceToDetector;       // (0018,1110) mm
+    double  distanceSourceToPatient;        // (0018,1111) mm
+    double  magnificationFactor;            // (0018,1114)
+    double  positionerPrimaryAngle;         // (0018,1510) deg
+    double  positionerSecondaryAngle;       // (0018,1511) deg
+    double  sourceToIsocenter;              // (0021,1017) mm
+    double  detectorRotation;               // (0021,1071) deg
+    double  imagerPixelSpacing[2];          // (0018,1164) mm
+
+    quint64 frameBytes;                     // of the pixel data of one frame
+    quint64 frameStride;                    // from one frame to the next, a multiple of Alignment
+    quint64 offsetTable;
+    quint64 firstFrame;
+    quint64 fileSize;
+
+    Uint8   reserved[32];
+
+    /* header of a file for a loop of info, with the layout filled in */
+    static RawCineHeader make(const CineLoopInfo& info);
+    /* the loop the file holds; xfer is the native one of this host */
+    CineLoopInfo info() const;
+};
+
+/* writes loop as a raw cine file; only native pixel data can be written */
+OFCondition writeRawCine(const QString& fileName, const CineLoop& loop);
+/* writes the raw cine file of a stored DICOM file; pixel data in the other byte order
+ * is swapped, encapsulated pixel data is refused */
+OFCondition convertToRawCine(const QString& dicomFile, const QString& rawFile);
+/* fileName with its extension (if any) replaced by RawCineExtension */
+QString rawCineFileName(const QString& fileName);
+
+/*
+ * Read-only view of a mapped raw cine file. open() checks the header and the offset
+ * table once, after that a frame is a table lookup away and nothing is parsed or
+ * copied; loop() hands the mapping out as a CineLoop pointing into it.
+ */
+class RawCineFile
+{
+public:
+    static std::shared_ptr<const RawCineFile> open(const QString& fileName, OFCondition* status = nullptr);
+    /* the loop in file, which it keeps alive */
+    static CineLoopPtr loop(const std::shared_ptr<const RawCineFile>& file, OFCondition* status = nullptr);
+
+    const RawCineHeader& header() const     { return *mHeader; }
+    int     frameCount() const              { return mHeader->numberOfFrames; }
+    size_t  frameBytes() const              { return size_t(mHeader->frameBytes); }
+    /* start of frame index (0-based), NULL if out of range */
+    const Uint8* frame(int index) const;
+
+private:
+    RawCineFile() : mHeader(NULL), mOffsets(NULL) {}
+
+    std::shared_ptr<const MappedFile> mFile;
+    const RawCineHeader* mHeader;
+    const quint64* mOffsets;
+};
+
+}
@@ -22,6 +22,7 @@ DEFINES += QT_DEPRECATED_WARNINGS
 # You can also select to disable deprecated APIs only up to a certain version of Qt.
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
+win32 {
 INCLUDEPATH += \
                 C:/dev/dcmtk/install/include \
                 C:/dev/dcmtk/ext/libzlib/include \
@@ -29,12 +30,70 @@ INCLUDEPATH += \
 LIBS += -lwsock32 -ladvapi32 -lnetapi32 \
         -LC:/dev/dcmtk/ext/support/zlib/lib -lzlib_d \
         -LC:/dev/dcmtk/install/lib -lofstd -loflog -ldcmdata -ldcmimgle -ldcmnet \
+}
+
+unix {
+LIBS += -ldcmnet -ldcmimgle -ldcmdata -loflog -lofstd -lz -lpthread
+}
 
 SOURCES +=  main.cpp\
             mainwindow.cpp \
-            xrfcinelooprcv.cpp
+            xrfcinelooprcv.cpp \
+            xrfassociation.cpp \
+            xrflazydataset.cpp \
+            xrfwritebehind.cpp \
+            xrfcineloop.cpp \
+            xrfdcmscan.cpp \
+            xrfstreamstore.cpp \
+            xrfframetap.cpp \
+            xrfloopindex.cpp \
+            xrfheaderreader.cpp \
+            xrfstudytracker.cpp \
+            xrfmetrics.cpp \
+            xrfcompressor.cpp \
+            xrfreactor.cpp \
+            xrfbufferpool.cpp \
+            xrfmappedfile.cpp \
+            xrfframering.cpp \
+            xrfcineplayer.cpp \
+            xrfcineviewer.cpp \
+            xrfwindowlevel.cpp \
+            xrfacceptance.cpp \
+            xrfhash.cpp \
+            xrfinstanceindex.cpp \
+            xrfrecordfile.cpp \
+            xrfdigest.cpp \
+            xrfrawcine.cpp \
+            xrfprojection.cpp
 
 HEADERS  += mainwindow.h \
-            xrfcinelooprcv.h
+            xrfcinelooprcv.h \
+            xrfassociation.h \
+            xrflazydataset.h \
+            xrfwritebehind.h \
+            xrferror.h \
+            xrfcineloop.h \
+            xrfdcmscan.h \
+            xrfstreamstore.h \
+            xrfframetap.h \
+            xrfloopindex.h \
+            xrfheaderreader.h \
+            xrfstudytracker.h \
+            xrfmetrics.h \
+            xrfcompressor.h \
+            xrfreactor.h \
+            xrfbufferpool.h \
+            xrfmappedfile.h \
+            xrfframering.h \
+            xrfcineplayer.h \
+            xrfcineviewer.h \
+            xrfwindowlevel.h \
+            xrfacceptance.h \
+            xrfhash.h \
+            xrfinstanceindex.h \
+            xrfrecordfile.h \
+            xrfdigest.h \
+            xrfrawcine.h \
+            xrfprojection.h
 
 FORMS    += mainwindow.ui
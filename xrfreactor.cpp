@@ -0,0 +1,297 @@
+#include "xrfreactor.h"
+#include "xrferror.h"
+
+#include <climits>
+#include <string.h>
+#include <vector>
+
+#ifdef Q_OS_LINUX
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#elif defined(_WIN32)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace xrf {
+
+#if !defined(Q_OS_LINUX)
+#ifdef _WIN32
+static void closeSocket(qintptr s)          { closesocket(SOCKET(s)); }
+static int pollSockets(pollfd *fds, size_t count, int timeoutMs) { return WSAPoll(fds, ULONG(count), timeoutMs); }
+static bool interrupted()                   { return false; }
+#else
+static void closeSocket(qintptr s)          { ::close(int(s)); }
+static int pollSockets(pollfd *fds, size_t count, int timeoutMs) { return ::poll(fds, nfds_t(count), timeoutMs); }
+static bool interrupted()                   { return errno == EINTR; }
+#endif
+
+/* a datagram socket which sends to itself; wakeup() writes a byte, the loop polls for it */
+static qintptr openWakeupSocket()
+{
+    qintptr s = qintptr(::socket(AF_INET, SOCK_DGRAM, 0));
+    if (s < 0)
+        return -1;
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = 0;
+    socklen_t length = sizeof(address);
+    if (::bind(s, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0
+        || ::getsockname(s, reinterpret_cast<sockaddr*>(&address), &length) != 0
+        || ::connect(s, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+    {
+        closeSocket(s);
+        return -1;
+    }
+#ifdef _WIN32
+    u_long nonBlocking = 1;
+    ioctlsocket(SOCKET(s), FIONBIO, &nonBlocking);
+#else
+    fcntl(int(s), F_SETFL, fcntl(int(s), F_GETFL) | O_NONBLOCK);
+#endif
+    return s;
+}
+#endif
+
+Reactor::Reactor()
+#ifdef Q_OS_LINUX
+    : epollFd(-1), eventFd(-1)
+#else
+    : wakeupSocket(-1)
+#endif
+{
+
+}
+
+Reactor::~Reactor()
+{
+    close();
+}
+
+OFCondition Reactor::open()
+{
+    close();
+    stopping.store(0);
+#ifdef Q_OS_LINUX
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = eventFd;
+    if (epollFd < 0 || eventFd < 0 || epoll_ctl(epollFd, EPOLL_CTL_ADD, eventFd, &event) != 0)
+    {
+        close();
+        return XRF_ReactorFailed;
+    }
+#else
+    wakeupSocket = openWakeupSocket();
+    if (wakeupSocket < 0)
+        return XRF_ReactorFailed;
+#endif
+    return EC_Normal;
+}
+
+void Reactor::close()
+{
+    QMutexLocker locker(&mutex);
+    watches.clear();
+#ifdef Q_OS_LINUX
+    if (eventFd >= 0) ::close(eventFd);
+    if (epollFd >= 0) ::close(epollFd);
+    eventFd = epollFd = -1;
+#else
+    if (wakeupSocket >= 0) closeSocket(wakeupSocket);
+    wakeupSocket = -1;
+#endif
+}
+
+OFCondition Reactor::watch(qintptr socket, const Handler &handler)
+{
+    QMutexLocker locker(&mutex);
+    const bool known = watches.contains(socket);
+    Watch& w = watches[socket];
+    w.handler = handler;
+    w.armed = true;
+#ifdef Q_OS_LINUX
+    // the kernel disarms the socket with its first event, like we do in take()
+    epoll_event event;
+    event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+    event.data.fd = int(socket);
+    int result = epoll_ctl(epollFd, known ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, int(socket), &event);
+    // a socket which was closed without unwatch() has left the epoll set on its own
+    if (result != 0 && known && errno == ENOENT)
+        result = epoll_ctl(epollFd, EPOLL_CTL_ADD, int(socket), &event);
+    if (result != 0)
+    {
+        watches.remove(socket);
+        return XRF_ReactorFailed;
+    }
+#else
+    // poll() only learns about the socket when the loop builds its next set
+    Q_UNUSED(known);
+    locker.unlock();
+    wakeup();
+#endif
+    return EC_Normal;
+}
+
+void Reactor::unwatch(qintptr socket)
+{
+    QMutexLocker locker(&mutex);
+    if (watches.remove(socket) == 0)
+        return;
+#ifdef Q_OS_LINUX
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, int(socket), NULL);
+#endif
+}
+
+int Reactor::watchCount()
+{
+    QMutexLocker locker(&mutex);
+    return watches.size();
+}
+
+void Reactor::dispatchAll()
+{
+    std::vector<Handler> handlers;
+    {
+        QMutexLocker locker(&mutex);
+        for (QHash<qintptr, Watch>::iterator w = watches.begin(); w != watches.end(); ++w)
+        {
+            if (!w->armed)
+                continue;
+            // an event epoll still has for the socket finds it disarmed in take()
+            w->armed = false;
+            handlers.push_back(w->handler);
+        }
+    }
+    for (const Handler& handler : handlers)
+        handler();
+}
+
+void Reactor::interrupt(qintptr socket)
+{
+#ifdef _WIN32
+    ::shutdown(SOCKET(socket), SD_BOTH);
+#else
+    ::shutdown(int(socket), SHUT_RDWR);
+#endif
+}
+
+OFCondition Reactor::exec()
+{
+    qint64 delay = onTimer ? onTimer() : -1;
+    while (!stopping.load())
+    {
+        OFCondition cond = waitAndDispatch(delay < 0 ? -1 : int(qMin(delay, qint64(INT_MAX))));
+        if (cond.bad())
+            return cond;
+        delay = onTimer ? onTimer() : -1;
+    }
+    return EC_Normal;
+}
+
+void Reactor::wakeup()
+{
+    // under the mutex, so a wakeup never writes to a descriptor close() has given back
+    QMutexLocker locker(&mutex);
+#ifdef Q_OS_LINUX
+    if (eventFd < 0)
+        return;
+    const quint64 one = 1;
+    ssize_t written = ::write(eventFd, &one, sizeof(one));
+    (void)written;
+#else
+    if (wakeupSocket < 0)
+        return;
+    const char byte = 0;
+    ::send(wakeupSocket, &byte, 1, 0);
+#endif
+}
+
+void Reactor::quit()
+{
+    stopping.store(1);
+    wakeup();
+}
+
+bool Reactor::take(qintptr socket, Handler &handler)
+{
+    QMutexLocker locker(&mutex);
+    QHash<qintptr, Watch>::iterator w = watches.find(socket);
+    if (w == watches.end() || !w->armed)
+        return false;
+    w->armed = false;
+    handler = w->handler;
+    return true;
+}
+
+OFCondition Reactor::waitAndDispatch(int timeoutMs)
+{
+    Handler handler;
+#ifdef Q_OS_LINUX
+    epoll_event events[64];
+    const int count = epoll_wait(epollFd, events, 64, timeoutMs);
+    if (count < 0)
+        return errno == EINTR ? EC_Normal : XRF_ReactorFailed;
+    for (int i = 0; i < count; ++i)
+    {
+        if (events[i].data.fd == eventFd)
+        {
+            quint64 value;
+            ssize_t read = ::read(eventFd, &value, sizeof(value));
+            (void)read;
+        }
+        else if (take(events[i].data.fd, handler))
+            handler();
+    }
+#else
+    std::vector<pollfd> fds;
+    {
+        QMutexLocker locker(&mutex);
+        fds.reserve(watches.size() + 1);
+        pollfd wakeupFd = {};
+        wakeupFd.fd = decltype(wakeupFd.fd)(wakeupSocket);
+        wakeupFd.events = POLLIN;
+        fds.push_back(wakeupFd);
+        for (QHash<qintptr, Watch>::const_iterator w = watches.constBegin(); w != watches.constEnd(); ++w)
+        {
+            if (!w->armed)
+                continue;
+            pollfd fd = {};
+            fd.fd = decltype(fd.fd)(w.key());
+            fd.events = POLLIN;
+            fds.push_back(fd);
+        }
+    }
+    const int count = pollSockets(fds.data(), fds.size(), timeoutMs);
+    if (count < 0)
+        return interrupted() ? EC_Normal : XRF_ReactorFailed;
+    if (fds[0].revents)
+    {
+        char bytes[64];
+        while (::recv(wakeupSocket, bytes, sizeof(bytes), 0) > 0) {}
+    }
+    for (size_t i = 1; i < fds.size(); ++i)
+    {
+        if (fds[i].revents && take(qintptr(fds[i].fd), handler))
+            handler();
+    }
+#endif
+    return EC_Normal;
+}
+
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "dcmtk/config/osconfig.h"    /* make sure OS specific configuration is included first */
+
+#include "dcmtk/ofstd/ofcond.h"
+
+#include <QAtomicInt>
+#include <QHash>
+#include <QMutex>
+#include <QtGlobal>
+
+#include <functional>
+
+namespace xrf {
+
+/*
+ * Readiness loop of the receiver. One thread waits until any of a set of sockets
+ * becomes readable and calls the handler registered for it, so an idle connection
+ * neither holds a thread nor costs a wakeup. Linux uses epoll, other platforms poll()
+ * (WSAPoll() on Windows). Notifications are one-shot: a socket is disarmed before its
+ * handler runs and is not reported again until watch() is called for it once more,
+ * typically by the worker which handled what arrived. The timer handler runs on the
+ * loop thread after every wakeup of the loop, whatever caused it, and returns the
+ * delay after which it wants to run again. watch(), unwatch(), wakeup() and quit()
+ * may be called from any thread.
+ */
+class Reactor
+{
+public:
+    typedef std::function<void()> Handler;
+    /* returns the delay until the next call in ms, negative: none */
+    typedef std::function<qint64()> TimerHandler;
+
+    Reactor();
+    ~Reactor();
+
+    OFCondition open();
+    void close();
+
+    /* arms socket; handler replaces the one registered before */
+    OFCondition watch(qintptr socket, const Handler& handler);
+    /* call before the socket is closed */
+    void unwatch(qintptr socket);
+    int watchCount();
+    /* disarms every armed socket and calls its handler as if it had become readable */
+    void dispatchAll();
+
+    /* shuts socket down in both directions, so that a thread blocked on it returns */
+    static void interrupt(qintptr socket);
+
+    /* call before exec() */
+    void setTimerHandler(const TimerHandler& handler) { onTimer = handler; }
+
+    /* runs the loop on the calling thread until quit() */
+    OFCondition exec();
+    /* does nothing once the reactor is closed */
+    void wakeup();
+    void quit();
+
+private:
+    struct Watch
+    {
+        Handler handler;
+        bool armed;
+    };
+
+    OFCondition waitAndDispatch(int timeoutMs);
+    /* handler of an armed socket, which is disarmed; false if there is none */
+    bool take(qintptr socket, Handler& handler);
+
+    QMutex mutex;
+    QHash<qintptr, Watch> watches;
+    TimerHandler onTimer;
+    QAtomicInt stopping;
+#ifdef Q_OS_LINUX
+    int epollFd;
+    int eventFd;
+#else
+    qintptr wakeupSocket;           // UDP socket on the loopback, connected to itself
+#endif
+};
+
+}
@@ -0,0 +1,111 @@
+#include "xrfrecordfile.h"
+#include "xrferror.h"
+
+#include <string.h>
+
+namespace xrf {
+
+/* on-disk header of a record file, followed by the records */
+struct RecordFileHeader
+{
+    char    magic[8];
+    quint32 version;
+    quint32 recordSize;
+};
+
+QByteArray fixedString(const char* value, int size)
+{
+    return QByteArray(value, int(qstrnlen(value, uint(size))));
+}
+
+void setFixedString(char* target, int size, const QByteArray& value)
+{
+    memset(target, 0, size_t(size));
+    memcpy(target, value.constData(), size_t(qMin(size, value.size())));
+}
+
+
+RecordFile::RecordFile(const char magic[8], quint32 version, quint32 recordSize)
+    : mVersion(version), mRecordSize(recordSize)
+{
+    memcpy(mMagic, magic, sizeof(mMagic));
+}
+
+OFCondition RecordFile::open(const QString &fileName, qint64 &count)
+{
+    mFile.close();
+    count = 0;
+
+    mFile.setFileName(fileName);
+    if (!mFile.open(QIODevice::ReadWrite))
+        return XRF_IndexOpenFailed;
+
+    RecordFileHeader header;
+    if (mFile.size() < headerSize())
+    {
+        // new (or truncated) file
+        memcpy(header.magic, mMagic, sizeof(header.magic));
+        header.version = mVersion;
+        header.recordSize = mRecordSize;
+        mFile.resize(0);
+        if (mFile.write(OFreinterpret_cast(const char *, &header), sizeof(header)) != qint64(sizeof(header)) || !mFile.flush())
+        {
+            mFile.close();
+            return XRF_WriteFailed;
+        }
+        return EC_Normal;
+    }
+
+    if (mFile.read(OFreinterpret_cast(char *, &header), sizeof(header)) != qint64(sizeof(header))
+        || memcmp(header.magic, mMagic, sizeof(header.magic)) != 0
+        || header.version != mVersion || header.recordSize != mRecordSize)
+    {
+        mFile.close();
+        return XRF_IndexInvalid;
+    }
+
+    // a record which was only partially written when we went down is dropped
+    count = (mFile.size() - headerSize()) / qint64(mRecordSize);
+    const qint64 size = headerSize() + count * qint64(mRecordSize);
+    if (mFile.size() != size && !mFile.resize(size))
+    {
+        mFile.close();
+        count = 0;
+        return XRF_WriteFailed;
+    }
+    mFile.seek(headerSize());
+    return EC_Normal;
+}
+
+void RecordFile::close()
+{
+    mFile.close();
+}
+
+bool RecordFile::isOpen() const
+{
+    return mFile.isOpen();
+}
+
+OFCondition RecordFile::append(const void *record)
+{
+    if (!mFile.isOpen())
+        return EC_IllegalCall;
+
+    mFile.seek(mFile.size());
+    if (mFile.write(OFstatic_cast(const char *, record), mRecordSize) != qint64(mRecordSize) || !mFile.flush())
+        return XRF_WriteFailed;
+    return EC_Normal;
+}
+
+qint64 RecordFile::headerSize()
+{
+    return qint64(sizeof(RecordFileHeader));
+}
+
+QFile& RecordFile::file()
+{
+    return mFile;
+}
+
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "dcmtk/config/osconfig.h"    /* make sure OS specific configuration is included first */
+
+#include "dcmtk/ofstd/ofcond.h"
+
+#include <QByteArray>
+#include <QFile>
+#include <QString>
+
+namespace xrf {
+
+/* the contents of a NUL padded field, which is not terminated if it is full */
+QByteArray fixedString(const char* value, int size);
+/* stores value NUL padded, cut to size */
+void setFixedString(char* target, int size, const QByteArray& value);
+
+/*
+ * File of fixed size records behind a small header (magic, version, record size),
+ * the on-disk format of the receiver's indexes. open() creates the header of a new
+ * file, rejects a file of another kind, version or record layout and drops a record
+ * which was only partially written when we went down. Records are appended and
+ * flushed one at a time. Not thread safe, the owning index serializes the calls.
+ */
+class RecordFile
+{
+public:
+    RecordFile(const char magic[8], quint32 version, quint32 recordSize);
+
+    /* count is set to the number of complete records in the file */
+    OFCondition open(const QString& fileName, qint64& count);
+    void close();
+    bool isOpen() const;
+
+    OFCondition append(const void* record);
+
+    /* offset of the first record */
+    static qint64 headerSize();
+    /* the underlying file, positioned at the first record after open() */
+    QFile& file();
+
+private:
+    char mMagic[8];
+    quint32 mVersion;
+    quint32 mRecordSize;
+    QFile mFile;
+};
+
+}
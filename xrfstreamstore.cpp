@@ -0,0 +1,509 @@
+#include "xrfstreamstore.h"
+#include "xrferror.h"
+
+#include "dcmtk/dcmdata/dcdeftag.h"
+#include "dcmtk/dcmdata/dcmetinf.h"
+#include "dcmtk/dcmdata/dcuid.h"
+#include "dcmtk/dcmdata/dcxfer.h"
+#include "dcmtk/dcmnet/cond.h"
+
+#include <QElapsedTimer>
+
+#ifdef WITH_ZLIB
+#include <zlib.h>
+#endif
+
+namespace xrf {
+
+void ScannerTap::begin(E_TransferSyntax xfer)
+{
+    datasetScanner = DatasetScanner(xfer);
+    datasetScanner.setCaptureTags(captureTags);
+}
+
+void ScannerTap::write(const Uint8 *data, size_t length)
+{
+    if (!datasetScanner.done() && !datasetScanner.failed())
+        datasetScanner.feed(data, length);
+}
+
+
+#ifdef WITH_ZLIB
+struct InflateTap::Inflater
+{
+    z_stream zs;
+    bool open = false;
+    bool end = false;
+    Uint8 out[65536];
+
+    Inflater()             { memset(&zs, 0, sizeof(zs)); }
+    ~Inflater()            { close(); }
+    void close()           { if (open) inflateEnd(&zs); open = false; }
+};
+#else
+struct InflateTap::Inflater {};
+#endif
+
+InflateTap::InflateTap()
+    : deflated(false), cond(EC_Normal)
+{
+
+}
+
+InflateTap::~InflateTap()
+{
+
+}
+
+void InflateTap::begin(E_TransferSyntax xfer)
+{
+    deflated = (DcmXfer(xfer).getStreamCompression() == ESC_zlib);
+    cond = EC_Normal;
+    inflater.reset();
+    if (deflated)
+    {
+#ifdef WITH_ZLIB
+        inflater.reset(new Inflater);
+        // raw deflate, without zlib header (PS3.5 A.5)
+        if (inflateInit2(&inflater->zs, -MAX_WBITS) == Z_OK)
+            inflater->open = true;
+        else
+            cond = EC_MemoryExhausted;
+#else
+        cond = EC_UnsupportedEncoding;
+#endif
+    }
+    for (StreamTap* tap : taps)
+        tap->begin(deflated ? EXS_LittleEndianExplicit : xfer);
+}
+
+bool InflateTap::needsData() const
+{
+    if (cond.bad())
+        return false;
+    for (StreamTap* tap : taps)
+        if (tap->needsData())
+            return true;
+    return false;
+}
+
+void InflateTap::forward(const Uint8 *data, size_t length)
+{
+    for (StreamTap* tap : taps)
+        if (tap->needsData())
+            tap->write(data, length);
+}
+
+void InflateTap::write(const Uint8 *data, size_t length)
+{
+    if (!deflated)
+    {
+        forward(data, length);
+        return;
+    }
+#ifdef WITH_ZLIB
+    if (!needsData() || inflater->end)
+        return;
+    z_stream &zs = inflater->zs;
+    zs.next_in = OFconst_cast(Bytef *, data);
+    zs.avail_in = OFstatic_cast(uInt, length);
+    while (zs.avail_in > 0 && !inflater->end && needsData())
+    {
+        zs.next_out = inflater->out;
+        zs.avail_out = sizeof(inflater->out);
+        const int result = inflate(&zs, Z_NO_FLUSH);
+        if (result != Z_OK && result != Z_STREAM_END && result != Z_BUF_ERROR)
+        {
+            cond = EC_CorruptedData;
+            break;
+        }
+        const size_t produced = sizeof(inflater->out) - zs.avail_out;
+        if (produced > 0)
+            forward(inflater->out, produced);
+        else if (result == Z_BUF_ERROR)
+            break;
+        inflater->end = (result == Z_STREAM_END);
+    }
+#endif
+}
+
+void InflateTap::finish(const OFCondition &result)
+{
+    inflater.reset();
+    for (StreamTap* tap : taps)
+        tap->finish(result.good() ? cond : result);
+}
+
+
+DigestTap::DigestTap(DigestAlgorithm algorithm)
+    : mFile(algorithm), mPixels(algorithm), mDatasetOffset(0), mOffset(0), mComplete(false), mElapsedNs(0)
+{
+
+}
+
+void DigestTap::begin(E_TransferSyntax xfer)
+{
+    // the meta header has gone to the file already
+    mDatasetOffset = mFile.length();
+    mScanner = DatasetScanner(xfer);
+    mPixels.reset();
+    mOffset = 0;
+    mComplete = false;
+}
+
+void DigestTap::write(const Uint8 *data, size_t length)
+{
+    QElapsedTimer timer;
+    timer.start();
+    const quint64 chunkOffset = mOffset;
+    mOffset += length;
+    if (!mScanner.done() && !mScanner.failed())
+        mScanner.feed(data, length);
+
+    // encapsulated pixel data counts up to the end of the data set
+    if (mScanner.pixelDataFound())
+    {
+        const quint64 start = mScanner.pixelDataOffset();
+        const quint64 end = mScanner.pixelDataEncapsulated() ? mOffset : start + mScanner.pixelDataLength();
+        const quint64 from = qMax(chunkOffset, start);
+        const quint64 to = qMin(mOffset, end);
+        if (from < to)
+            mPixels.update(data + (from - chunkOffset), size_t(to - from));
+    }
+    mElapsedNs += timer.nsecsElapsed();
+}
+
+void DigestTap::writeFile(const Uint8 *data, size_t length)
+{
+    QElapsedTimer timer;
+    timer.start();
+    mFile.update(data, length);
+    mElapsedNs += timer.nsecsElapsed();
+}
+
+void DigestTap::finish(const OFCondition &result)
+{
+    mComplete = result.good();
+}
+
+FileDigests DigestTap::digests() const
+{
+    FileDigests digests;
+    digests.algorithm = mFile.algorithm();
+    digests.fileSize = qint64(mFile.length());
+    digests.fileDigest = mFile.value();
+    digests.hasPixelData = mScanner.pixelDataFound() && mOffset > mScanner.pixelDataOffset();
+    if (digests.hasPixelData)
+    {
+        digests.pixelDataOffset = qint64(mDatasetOffset + mScanner.pixelDataOffset());
+        digests.pixelDataLength = qint64(mScanner.pixelDataEncapsulated() ? mOffset - mScanner.pixelDataOffset()
+                                                                          : quint64(mScanner.pixelDataLength()));
+        digests.pixelDataDigest = mPixels.value();
+    }
+    return digests;
+}
+
+
+TeeConsumer::TeeConsumer()
+    : fileOpen(false), datasetStart(0), sized(false), tapsEnabled(false), digestTap(NULL), cond(EC_Normal)
+{
+
+}
+
+TeeConsumer::~TeeConsumer()
+{
+    closeFile(false);
+}
+
+OFCondition TeeConsumer::openFile(const OFString &fileName, bool mapped, E_TransferSyntax xfer)
+{
+    if (mapped)
+    {
+        // a deflated data set cannot be scanned, its file just grows as needed
+        sizeScanner = DatasetScanner(xfer);
+        sized = false;
+        if (mappedFile.open(fileName).bad())
+            return makeDcmnetCondition(DIMSEC_OUTOFRESOURCES, OF_error, "DIMSE createFilestream: cannot create file");
+        return EC_Normal;
+    }
+    if (!file.fopen(fileName.c_str(), "wb"))
+        return makeDcmnetCondition(DIMSEC_OUTOFRESOURCES, OF_error, "DIMSE createFilestream: cannot create file");
+    fileOpen = true;
+    return EC_Normal;
+}
+
+void TeeConsumer::closeFile(bool keep)
+{
+    if (mappedFile.isOpen())
+    {
+        if (keep && cond.good())
+        {
+            OFCondition result = mappedFile.commit();
+            if (result.bad())
+                cond = result;
+        }
+        else
+            mappedFile.discard();
+    }
+    if (fileOpen)
+    {
+        if (file.fclose() != 0 && cond.good())
+            cond = XRF_WriteFailed;
+        fileOpen = false;
+    }
+}
+
+OFBool TeeConsumer::good() const
+{
+    return OFTrue;
+}
+
+OFCondition TeeConsumer::status() const
+{
+    return cond;
+}
+
+OFBool TeeConsumer::isFlushed() const
+{
+    return OFTrue;
+}
+
+offile_off_t TeeConsumer::avail() const
+{
+    // like DcmFileConsumer, claim that we can always take another 10 MB
+    return 10485760;
+}
+
+void TeeConsumer::setTapsEnabled(bool enable)
+{
+    tapsEnabled = enable;
+    if (enable)
+        datasetStart = mappedFile.size();
+}
+
+void TeeConsumer::reserveFile(const void *buf, offile_off_t buflen)
+{
+    sizeScanner.feed(OFstatic_cast(const Uint8 *, buf), OFstatic_cast(size_t, buflen));
+    if (sizeScanner.failed())
+        sized = true;
+    else if (sizeScanner.done())
+    {
+        sized = true;
+        // a few short elements may follow the pixel data, there is room for them in the last page
+        if (sizeScanner.pixelDataFound() && !sizeScanner.pixelDataEncapsulated())
+        {
+            OFCondition result = mappedFile.reserve(datasetStart + sizeScanner.pixelDataOffset() + sizeScanner.pixelDataLength() + 4096);
+            if (result.bad())
+                cond = result;
+        }
+    }
+}
+
+offile_off_t TeeConsumer::write(const void *buf, offile_off_t buflen)
+{
+    if (mappedFile.isOpen() && cond.good())
+    {
+        if (tapsEnabled && !sized)
+            reserveFile(buf, buflen);
+        if (cond.good())
+        {
+            OFCondition result = mappedFile.write(buf, OFstatic_cast(size_t, buflen));
+            if (result.bad())
+                cond = result;
+            else if (digestTap)
+                digestTap->writeFile(OFstatic_cast(const Uint8 *, buf), OFstatic_cast(size_t, buflen));
+        }
+    }
+    else if (fileOpen && cond.good())
+    {
+        if (file.fwrite(buf, 1, OFstatic_cast(size_t, buflen)) != OFstatic_cast(size_t, buflen))
+            cond = XRF_WriteFailed;
+        else if (digestTap)
+            digestTap->writeFile(OFstatic_cast(const Uint8 *, buf), OFstatic_cast(size_t, buflen));
+    }
+    if (tapsEnabled)
+    {
+        for (StreamTap* tap : taps)
+            tap->write(OFstatic_cast(const Uint8 *, buf), OFstatic_cast(size_t, buflen));
+    }
+    // always consume everything, the rest of the data set has to be drained anyway
+    return buflen;
+}
+
+void TeeConsumer::flush()
+{
+    if (fileOpen)
+        file.fflush();
+}
+
+
+TeeOutputStream::TeeOutputStream()
+    : DcmOutputStream(&teeConsumer), teeConsumer()
+{
+
+}
+
+
+/* same meta header DIMSE_storeProvider() writes in front of a bit-preserved data set */
+static OFCondition writeMetaHeader(DcmOutputStream &stream, const T_DIMSE_C_StoreRQ *request,
+                                   const T_ASC_Association *assoc, const char *transferSyntax)
+{
+    DcmMetaInfo metainfo;
+    Uint8 version[2] = { 0, 1 };
+
+    OFCondition cond = metainfo.putAndInsertUint32(DCM_FileMetaInformationGroupLength, 0);
+    if (cond.good()) cond = metainfo.putAndInsertUint8Array(DCM_FileMetaInformationVersion, version, 2);
+    if (cond.good()) cond = metainfo.putAndInsertString(DCM_MediaStorageSOPClassUID, request->AffectedSOPClassUID);
+    if (cond.good()) cond = metainfo.putAndInsertString(DCM_MediaStorageSOPInstanceUID, request->AffectedSOPInstanceUID);
+    if (cond.good()) cond = metainfo.putAndInsertString(DCM_TransferSyntaxUID, transferSyntax);
+    if (cond.good()) cond = metainfo.putAndInsertString(DCM_ImplementationClassUID, OFFIS_IMPLEMENTATION_CLASS_UID);
+    if (cond.good()) cond = metainfo.putAndInsertString(DCM_ImplementationVersionName, OFFIS_DTK_IMPLEMENTATION_VERSION_NAME);
+    if (cond.good()) cond = metainfo.putAndInsertString(DCM_SourceApplicationEntityTitle, assoc->params->DULparams.callingAPTitle);
+    if (cond.good()) cond = metainfo.computeGroupLengthAndPadding(EGL_withGL, EPD_noChange, META_HEADER_DEFAULT_TRANSFERSYNTAX, EET_UndefinedLength);
+    if (cond.good())
+    {
+        metainfo.transferInit();
+        cond = metainfo.write(stream, META_HEADER_DEFAULT_TRANSFERSYNTAX, EET_ExplicitLength, NULL);
+        metainfo.transferEnd();
+    }
+    return cond;
+}
+
+struct ProviderContext
+{
+    DIMSE_StoreProviderCallback callback;
+    void *callbackData;
+    T_DIMSE_StoreProgress *progress;
+    T_DIMSE_C_StoreRQ *request;
+    char *imageFileName;
+    T_DIMSE_C_StoreRSP *response;
+};
+
+static void progressCallback(void *callbackContext, unsigned long byteCount)
+{
+    ProviderContext *ctx = OFstatic_cast(ProviderContext *, callbackContext);
+    ctx->progress->state = DIMSE_StoreProgressing;
+    ctx->progress->progressBytes = byteCount;
+    ctx->progress->callbackCount++;
+    if (ctx->callback)
+    {
+        DcmDataset *statusDetail = NULL;
+        ctx->callback(ctx->callbackData, ctx->progress, ctx->request, ctx->imageFileName, NULL, ctx->response, &statusDetail);
+        delete statusDetail;
+    }
+}
+
+OFCondition streamingStoreProvider(T_ASC_Association *assoc,
+                                   T_ASC_PresentationContextID presIdCmd,
+                                   T_DIMSE_C_StoreRQ *request,
+                                   const char *imageFileName,
+                                   int writeMetaheader,
+                                   const std::vector<StreamTap*>& taps,
+                                   DIMSE_StoreProviderCallback callback,
+                                   void *callbackData,
+                                   T_DIMSE_BlockingMode blockMode,
+                                   int timeout,
+                                   bool mapFile,
+                                   DigestTap *digests)
+{
+    OFCondition cond = EC_Normal;
+    T_ASC_PresentationContextID presIdData = 0;
+    DcmDataset *statusDetail = NULL;
+    char *fileName = OFconst_cast(char *, imageFileName);
+
+    T_DIMSE_C_StoreRSP response;
+    memset(&response, 0, sizeof(response));
+    response.DimseStatus = STATUS_Success;
+    response.MessageIDBeingRespondedTo = request->MessageID;
+    response.DataSetType = DIMSE_DATASET_NULL;
+    OFStandard::strlcpy(response.AffectedSOPClassUID, request->AffectedSOPClassUID, sizeof(response.AffectedSOPClassUID));
+    OFStandard::strlcpy(response.AffectedSOPInstanceUID, request->AffectedSOPInstanceUID, sizeof(response.AffectedSOPInstanceUID));
+    response.opts = (O_STORE_AFFECTEDSOPCLASSUID | O_STORE_AFFECTEDSOPINSTANCEUID);
+    if (request->opts & O_STORE_RQ_BLANK_PADDING) response.opts |= O_STORE_RSP_BLANK_PADDING;
+    if (dcmPeerRequiresExactUIDCopy.get()) response.opts |= O_STORE_PEER_REQUIRES_EXACT_UID_COPY;
+
+    T_DIMSE_StoreProgress progress;
+    progress.state = DIMSE_StoreBegin;
+    progress.callbackCount = 1;
+    progress.progressBytes = 0;
+    progress.totalBytes = dcmGuessModalityBytes(request->AffectedSOPClassUID);
+    if (callback)
+        callback(callbackData, &progress, request, fileName, NULL, &response, &statusDetail);
+
+    T_ASC_PresentationContext presentationContext;
+    cond = ASC_findAcceptedPresentationContext(assoc->params, presIdCmd, &presentationContext);
+
+    TeeOutputStream stream;
+    std::vector<StreamTap*> allTaps(taps);
+    if (digests)
+    {
+        stream.consumer().setDigestTap(digests);
+        allTaps.push_back(digests);
+    }
+    if (cond.good() && imageFileName != NULL)
+    {
+        cond = stream.consumer().openFile(imageFileName, mapFile, DcmXfer(presentationContext.acceptedTransferSyntax).getXfer());
+        if (cond.good() && writeMetaheader)
+            cond = writeMetaHeader(stream, request, assoc, presentationContext.acceptedTransferSyntax);
+    }
+
+    if (cond.good())
+    {
+        // the taps only see the data set, not the meta header
+        const E_TransferSyntax xfer = DcmXfer(presentationContext.acceptedTransferSyntax).getXfer();
+        for (StreamTap* tap : allTaps)
+        {
+            tap->begin(xfer);
+            stream.consumer().addTap(tap);
+        }
+        stream.consumer().setTapsEnabled(true);
+
+        ProviderContext ctx = { callback, callbackData, &progress, request, fileName, &response };
+        cond = DIMSE_receiveDataSetInFile(assoc, blockMode, timeout, &presIdData, &stream, progressCallback, &ctx);
+        stream.flush();
+        stream.consumer().closeFile(cond.good());
+
+        for (StreamTap* tap : allTaps)
+            tap->finish(cond.good() ? stream.consumer().status() : cond);
+
+        if (cond.good() && stream.consumer().status().bad())
+        {
+            // the data set was drained, but we could not store it
+            response.DimseStatus = STATUS_STORE_Refused_OutOfResources;
+        }
+        if ((cond.bad() || response.DimseStatus != STATUS_Success) && imageFileName != NULL)
+            OFStandard::deleteFile(imageFileName);
+    }
+    else
+    {
+        // we could not create the file, so ignore the data set
+        DIC_UL bytesRead = 0;
+        DIC_UL pdvCount = 0;
+        if (imageFileName != NULL)
+            OFStandard::deleteFile(imageFileName);
+        cond = DIMSE_ignoreDataSet(assoc, blockMode, timeout, &bytesRead, &pdvCount);
+        if (cond.good())
+            response.DimseStatus = STATUS_STORE_Refused_OutOfResources;
+    }
+
+    // check for presentation context mismatch
+    if (cond.good() && (presIdData != presIdCmd))
+        cond = makeDcmnetCondition(DIMSEC_INVALIDPRESENTATIONCONTEXTID, OF_error, "DIMSE: Presentation Contexts of Command and Data Differ");
+
+    // final callback
+    if (callback)
+    {
+        progress.state = DIMSE_StoreEnd;
+        progress.callbackCount++;
+        callback(callbackData, &progress, request, fileName, NULL, &response, &statusDetail);
+    }
+
+    // send a response (even if we could not store the data set, the association is still fine)
+    if (cond.good())
+        cond = DIMSE_sendStoreResponse(assoc, presIdCmd, request, &response, statusDetail);
+
+    delete statusDetail;
+    return cond;
+}
+
+}
@@ -0,0 +1,223 @@
+#pragma once
+
+#include "dcmtk/config/osconfig.h"    /* make sure OS specific configuration is included first */
+
+#include "dcmtk/ofstd/offile.h"
+#include "dcmtk/dcmdata/dcostrma.h"
+#include "dcmtk/dcmnet/dimse.h"
+
+#include "xrfdcmscan.h"
+#include "xrfdigest.h"
+#include "xrfhash.h"
+#include "xrfmappedfile.h"
+
+#include <QtGlobal>
+
+#include <memory>
+#include <vector>
+
+namespace xrf {
+
+/*
+ * Observer of the encoded data set of one C-STORE while it is being received. A tap
+ * sees the bytes of the data set (without the meta header) in order, in the chunks
+ * in which they come off the network.
+ */
+class StreamTap
+{
+public:
+    virtual ~StreamTap() {}
+
+    /* called before the first byte, with the transfer syntax of the presentation context */
+    virtual void begin(E_TransferSyntax /*xfer*/) {}
+    virtual void write(const Uint8* data, size_t length) = 0;
+    /* called after the last PDV; result tells whether the data set arrived completely */
+    virtual void finish(const OFCondition& /*result*/) {}
+    /* false once the tap has seen everything it is interested in */
+    virtual bool needsData() const { return true; }
+};
+
+/* stream tap which captures top level elements (see DatasetScanner) while receiving */
+class ScannerTap : public StreamTap
+{
+public:
+    ScannerTap() : captureTags(DatasetScanner::defaultCaptureTags()) {}
+
+    void addCaptureTags(const std::vector<DcmTagKey>& tags)  { captureTags.insert(captureTags.end(), tags.begin(), tags.end()); }
+
+    void begin(E_TransferSyntax xfer) Q_DECL_OVERRIDE;
+    void write(const Uint8* data, size_t length) Q_DECL_OVERRIDE;
+    bool needsData() const Q_DECL_OVERRIDE  { return !datasetScanner.done() && !datasetScanner.failed(); }
+
+    const DatasetScanner& scanner() const  { return datasetScanner; }
+
+private:
+    std::vector<DcmTagKey> captureTags;
+    DatasetScanner datasetScanner;
+};
+
+/* stream tap which hashes the data set exactly as it is received, see InstanceIndex */
+class HashTap : public StreamTap
+{
+public:
+    HashTap() : complete(false) {}
+
+    void begin(E_TransferSyntax) Q_DECL_OVERRIDE                    { hasher.reset(); complete = false; }
+    void write(const Uint8* data, size_t length) Q_DECL_OVERRIDE     { hasher.update(data, length); }
+    void finish(const OFCondition& result) Q_DECL_OVERRIDE          { complete = result.good(); }
+
+    /* false unless the whole data set went by */
+    bool isComplete() const                 { return complete; }
+    quint64 digest() const                  { return hasher.digest(); }
+    quint64 bytes() const                   { return hasher.length(); }
+
+private:
+    XxHash64 hasher;
+    bool complete;
+};
+
+/*
+ * Stream tap which computes the FileDigests of the file a data set is written to, as
+ * it is written: streamingStoreProvider() hands it the bytes of the file, meta header
+ * included (writeFile()), besides the data set, which is scanned for the pixel data
+ * so that its value gets a digest of its own. The pixel data of a deflated data set
+ * cannot be located and gets none. The time spent is kept, to tell what the digests
+ * cost. One tap per data set.
+ */
+class DigestTap : public StreamTap
+{
+public:
+    explicit DigestTap(DigestAlgorithm algorithm = DigestAlgorithm::Best);
+
+    void begin(E_TransferSyntax xfer) Q_DECL_OVERRIDE;
+    void write(const Uint8* data, size_t length) Q_DECL_OVERRIDE;
+    void finish(const OFCondition& result) Q_DECL_OVERRIDE;
+    /* the bytes of the file, in order */
+    void writeFile(const Uint8* data, size_t length);
+
+    /* false unless the whole data set was written */
+    bool isComplete() const                 { return mComplete; }
+    FileDigests digests() const;
+    qint64 elapsedNs() const                { return mElapsedNs; }
+
+private:
+    Digest mFile;
+    Digest mPixels;
+    DatasetScanner mScanner;
+    quint64 mDatasetOffset;                 // in the file
+    quint64 mOffset;                        // of the next byte of the data set
+    bool mComplete;
+    qint64 mElapsedNs;
+};
+
+/*
+ * Stream tap which inflates a data set received in Deflated Explicit VR Little Endian
+ * and hands the result to its own taps as plain Explicit VR Little Endian, so that
+ * they need not know about deflate. Data sets in any other transfer syntax are passed
+ * through unchanged. Inflating stops as soon as none of the taps needs more data,
+ * e.g. when only the header is scanned. Without zlib (WITH_ZLIB) a deflated data set
+ * fails the taps with EC_UnsupportedEncoding.
+ */
+class InflateTap : public StreamTap
+{
+public:
+    InflateTap();
+    ~InflateTap();
+
+    void addTap(StreamTap* tap)           { taps.push_back(tap); }
+
+    void begin(E_TransferSyntax xfer) Q_DECL_OVERRIDE;
+    void write(const Uint8* data, size_t length) Q_DECL_OVERRIDE;
+    void finish(const OFCondition& result) Q_DECL_OVERRIDE;
+    bool needsData() const Q_DECL_OVERRIDE;
+
+private:
+    void forward(const Uint8* data, size_t length);
+
+    struct Inflater;
+    std::unique_ptr<Inflater> inflater;
+    std::vector<StreamTap*> taps;
+    bool deflated;
+    OFCondition cond;
+};
+
+/*
+ * dcmdata consumer which writes to an (optional) output file and hands the same
+ * bytes to a list of taps. A write error on the file does not stop reception; it is
+ * remembered in status() so that the C-STORE can be refused after the data set has
+ * been drained from the association. A mapped file is written through a
+ * MappedFileWriter; the data set header is scanned on the way, and once the header of
+ * native pixel data has gone by the file is preallocated for the whole value.
+ */
+class TeeConsumer : public DcmConsumer
+{
+public:
+    TeeConsumer();
+    ~TeeConsumer();
+
+    /* xfer: transfer syntax of the data set, only needed for a mapped file */
+    OFCondition openFile(const OFString& fileName, bool mapped = false, E_TransferSyntax xfer = EXS_Unknown);
+    /* keep: commit a mapped file; without, it is discarded (a plain file stays for the caller to delete) */
+    void closeFile(bool keep = true);
+    void addTap(StreamTap* tap)           { taps.push_back(tap); }
+    /* tap which is handed the bytes written to the file, see DigestTap */
+    void setDigestTap(DigestTap* tap)     { digestTap = tap; }
+    /* everything written from now on is the data set */
+    void setTapsEnabled(bool enable);
+
+    OFBool good() const Q_DECL_OVERRIDE;
+    OFCondition status() const Q_DECL_OVERRIDE;
+    OFBool isFlushed() const Q_DECL_OVERRIDE;
+    offile_off_t avail() const Q_DECL_OVERRIDE;
+    offile_off_t write(const void *buf, offile_off_t buflen) Q_DECL_OVERRIDE;
+    void flush() Q_DECL_OVERRIDE;
+
+private:
+    void reserveFile(const void *buf, offile_off_t buflen);
+
+    OFFile file;
+    bool fileOpen;
+    MappedFileWriter mappedFile;
+    DatasetScanner sizeScanner;
+    quint64 datasetStart;           // in the mapped file
+    bool sized;
+    bool tapsEnabled;
+    std::vector<StreamTap*> taps;
+    DigestTap* digestTap;
+    OFCondition cond;
+};
+
+class TeeOutputStream : public DcmOutputStream
+{
+public:
+    TeeOutputStream();
+    TeeConsumer& consumer()               { return teeConsumer; }
+
+private:
+    TeeConsumer teeConsumer;
+};
+
+/*
+ * Counterpart of DIMSE_storeProvider() for the streaming store path. The data set is
+ * never parsed: its PDVs are written to imageFileName (behind a meta header if
+ * writeMetaheader is set; no file at all if imageFileName is NULL) and handed to the
+ * taps as they arrive. The callback is called like the one of DIMSE_storeProvider(),
+ * with a NULL data set, and the C-STORE-RSP is sent after its final call. With
+ * mapFile the file is written through a mapping (see MappedFileWriter) and appears
+ * under imageFileName only once it is complete. A DigestTap in digests sees the bytes
+ * of the file besides those of the data set.
+ */
+OFCondition streamingStoreProvider(T_ASC_Association *assoc,
+                                   T_ASC_PresentationContextID presIdCmd,
+                                   T_DIMSE_C_StoreRQ *request,
+                                   const char *imageFileName,
+                                   int writeMetaheader,
+                                   const std::vector<StreamTap*>& taps,
+                                   DIMSE_StoreProviderCallback callback,
+                                   void *callbackData,
+                                   T_DIMSE_BlockingMode blockMode,
+                                   int timeout,
+                                   bool mapFile = false,
+                                   DigestTap *digests = NULL);
+
+}
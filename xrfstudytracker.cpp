@@ -0,0 +1,160 @@
+#include "xrfstudytracker.h"
+
+#include <QDir>
+
+namespace xrf {
+
+/* the Study Instance UID comes from the peer and becomes part of a path; only a
+ * proper UI value (digits and dots, at most 64 characters) is used as one */
+static bool isDirectoryUID(const QString &uid)
+{
+    if (uid.isEmpty() || uid.size() > 64)
+        return false;
+    for (const QChar c : uid)
+        if ((c < QLatin1Char('0') || c > QLatin1Char('9')) && c != QLatin1Char('.'))
+            return false;
+    return true;
+}
+
+StudyTracker::StudyTracker(const QString &outputDirectory)
+    : mOutputDirectory(outputDirectory), mSubdirectories(false), mTimeout(-1)
+{
+
+}
+
+void StudyTracker::setSubdirectories(bool enable, const QString &prefix)
+{
+    QMutexLocker locker(&mMutex);
+    mSubdirectories = enable;
+    mPrefix = prefix;
+}
+
+void StudyTracker::setTimeout(qint64 msecs)
+{
+    QMutexLocker locker(&mMutex);
+    mTimeout = msecs;
+}
+
+QString StudyTracker::objectReceived(const QString &studyInstanceUID, const QString &callingAETitle, QList<CompletedStudy> &completed)
+{
+    QMutexLocker locker(&mMutex);
+
+    // the sender moved on to another study, the one it sent before is complete
+    const QString previous = mCurrentStudy.value(callingAETitle);
+    if (!previous.isEmpty() && previous != studyInstanceUID)
+        close(previous, completed);
+    mCurrentStudy.insert(callingAETitle, studyInstanceUID);
+
+    QHash<QString, Study>::iterator study = mStudies.find(studyInstanceUID);
+    if (study == mStudies.end())
+    {
+        Study opened;
+        opened.callingAETitle = callingAETitle;
+        opened.directory = mOutputDirectory;
+        if (mSubdirectories && isDirectoryUID(studyInstanceUID))
+        {
+            const QString name = mPrefix.isEmpty() ? studyInstanceUID : QString("%1_%2").arg(mPrefix, studyInstanceUID);
+            const QString path = QDir(mOutputDirectory).filePath(name);
+            if (QDir().mkpath(path))
+                opened.directory = path;
+        }
+        study = mStudies.insert(studyInstanceUID, opened);
+    }
+
+    // an object of a study which is being closed reopens it
+    study->closing = false;
+    study->pending++;
+    study->lastActivity.start();
+    return study->directory;
+}
+
+void StudyTracker::objectStored(const QString &studyInstanceUID, const QString &fileName, QList<CompletedStudy> &completed)
+{
+    QMutexLocker locker(&mMutex);
+
+    QHash<QString, Study>::iterator study = mStudies.find(studyInstanceUID);
+    if (study == mStudies.end())
+        return;
+    if (!fileName.isEmpty())
+        study->files.append(fileName);
+    study->pending--;
+    study->lastActivity.start();
+    if (study->closing)
+        close(studyInstanceUID, completed);
+}
+
+void StudyTracker::expire(QList<CompletedStudy> &completed)
+{
+    QMutexLocker locker(&mMutex);
+    if (mTimeout < 0)
+        return;
+
+    QStringList idle;
+    for (QHash<QString, Study>::const_iterator it = mStudies.constBegin(); it != mStudies.constEnd(); ++it)
+        if (it->lastActivity.hasExpired(mTimeout))
+            idle.append(it.key());
+    for (const QString& studyInstanceUID : idle)
+        close(studyInstanceUID, completed);
+}
+
+qint64 StudyTracker::msecsToNextExpiry()
+{
+    QMutexLocker locker(&mMutex);
+    if (mTimeout < 0)
+        return -1;
+
+    qint64 next = -1;
+    for (QHash<QString, Study>::const_iterator it = mStudies.constBegin(); it != mStudies.constEnd(); ++it)
+    {
+        // the timer of a study with objects in flight restarts when they are stored
+        if (it->pending > 0)
+            continue;
+        const qint64 remaining = qMax(Q_INT64_C(0), mTimeout + 1 - it->lastActivity.elapsed());
+        if (next < 0 || remaining < next)
+            next = remaining;
+    }
+    return next;
+}
+
+void StudyTracker::closeAll(QList<CompletedStudy> &completed)
+{
+    QMutexLocker locker(&mMutex);
+    const QStringList open = mStudies.keys();
+    for (const QString& studyInstanceUID : open)
+        close(studyInstanceUID, completed);
+}
+
+int StudyTracker::openStudies()
+{
+    QMutexLocker locker(&mMutex);
+    return mStudies.size();
+}
+
+void StudyTracker::close(const QString &studyInstanceUID, QList<CompletedStudy> &completed)
+{
+    QHash<QString, Study>::iterator study = mStudies.find(studyInstanceUID);
+    if (study == mStudies.end())
+        return;
+
+    // objects of the study are still being stored, the last one closes it
+    if (study->pending > 0)
+    {
+        study->closing = true;
+        return;
+    }
+
+    if (!study->files.isEmpty())
+    {
+        CompletedStudy done;
+        done.studyInstanceUID = studyInstanceUID;
+        done.directory = study->directory;
+        done.files = study->files;
+        completed.append(done);
+    }
+
+    if (mCurrentStudy.value(study->callingAETitle) == studyInstanceUID)
+        mCurrentStudy.remove(study->callingAETitle);
+    mStudies.erase(study);
+}
+
+}
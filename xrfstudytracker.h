@@ -0,0 +1,76 @@
+#pragma once
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+
+namespace xrf {
+
+/* a study the receiver considers complete, with every file stored for it */
+struct CompletedStudy
+{
+    QString studyInstanceUID;
+    QString directory;
+    QStringList files;
+};
+
+/*
+ * Groups received objects into studies. A study is opened by its first object and
+ * closed when
+ *   - the sender which opened it starts sending objects of another study,
+ *   - nothing was received for it within the end-of-study timeout, or
+ *   - closeAll() is called (receiver shutdown).
+ * A study is only reported as completed once no object of it is being stored any
+ * more, so every file is in its list. With subdirectories enabled each study gets
+ * its own directory below the output directory (prefix_StudyInstanceUID, like
+ * storescp --sort-on-study-uid); objects whose Study Instance UID is not a valid UI
+ * value stay in the output directory. The tracker may be used from several threads.
+ */
+class StudyTracker
+{
+public:
+    explicit StudyTracker(const QString& outputDirectory);
+
+    void setSubdirectories(bool enable, const QString& prefix = QString("ST"));
+    /* idle time after which a study is closed, negative: never */
+    void setTimeout(qint64 msecs);
+
+    /* an object of the study is about to be stored; returns the directory for its file.
+     * Studies closed because the sender moved on are appended to completed. */
+    QString objectReceived(const QString& studyInstanceUID, const QString& callingAETitle, QList<CompletedStudy>& completed);
+    /* the object announced by objectReceived() has been stored (fileName empty if that failed) */
+    void objectStored(const QString& studyInstanceUID, const QString& fileName, QList<CompletedStudy>& completed);
+
+    void expire(QList<CompletedStudy>& completed);
+    /* time until expire() closes the next study which has no object in flight,
+     * negative if there is none */
+    qint64 msecsToNextExpiry();
+    void closeAll(QList<CompletedStudy>& completed);
+    int openStudies();
+
+private:
+    struct Study
+    {
+        QString directory;
+        QStringList files;
+        QString callingAETitle;
+        QElapsedTimer lastActivity;
+        int pending = 0;            // objects announced but not stored yet
+        bool closing = false;
+    };
+
+    void close(const QString& studyInstanceUID, QList<CompletedStudy>& completed);
+
+    QMutex mMutex;
+    QString mOutputDirectory;
+    bool mSubdirectories;
+    QString mPrefix;
+    qint64 mTimeout;
+    QHash<QString, Study> mStudies;
+    QHash<QString, QString> mCurrentStudy;     // of each calling AE title
+};
+
+}
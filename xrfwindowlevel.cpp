@@ -0,0 +1,273 @@
+#include "xrfwindowlevel.h"
+
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define XRF_WINDOW_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// GCC and Clang only emit AVX2 in functions which ask for it; MSVC takes the intrinsics anywhere
+#if defined(XRF_WINDOW_X86) && defined(__GNUC__)
+#define XRF_TARGET_SSE2 __attribute__((target("sse2")))
+#define XRF_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define XRF_TARGET_SSE2
+#define XRF_TARGET_AVX2
+#endif
+
+namespace xrf {
+
+WindowLevel WindowLevel::make(const CineLoopInfo &info, double center, double width)
+{
+    WindowLevel window;
+    window.bitsAllocated = info.bitsAllocated > 8 ? 16 : 8;
+    window.bitsStored = std::min(std::max(int(info.bitsStored), 1), window.bitsAllocated);
+    window.highBit = std::min(std::max(int(info.highBit), window.bitsStored - 1), window.bitsAllocated - 1);
+    window.isSigned = (info.pixelRepresentation == 1);
+    window.inverse = (info.photometricInterpretation == "MONOCHROME1");
+    if (width < 1.0)
+    {
+        width = double(1 << window.bitsStored);
+        center = window.isSigned ? 0.0 : width / 2.0;
+    }
+    // (x - (c - 0.5)) / (w - 1) + 0.5, times 255; a width of 1 is a threshold at c - 0.5
+    window.low = float(center - 0.5 - (width - 1.0) / 2.0);
+    window.scale = float(255.0 / std::max(width - 1.0, 1e-3));
+    return window;
+}
+
+WindowLevel WindowLevel::fromInfo(const CineLoopInfo &info)
+{
+    return make(info, info.windowCenter, info.windowWidth);
+}
+
+bool WindowLevel::isValid() const
+{
+    return (bitsAllocated == 8 || bitsAllocated == 16) && bitsStored >= 1 && bitsStored <= bitsAllocated
+        && highBit >= bitsStored - 1 && highBit < bitsAllocated && scale > 0.0f;
+}
+
+/*
+ * All kernels take a stored value out of its 16 bit lane the same way: shift the bits
+ * above the high bit out to the left, then the stored bits down to the right,
+ * arithmetically for signed data. 8 bit data is widened to 16 bit lanes first.
+ */
+struct WindowParams
+{
+    int up;
+    int down;
+    float low;
+    float scale;
+    Uint8 invert;
+
+    explicit WindowParams(const WindowLevel& window)
+        : up(15 - window.highBit), down(16 - window.bitsStored), low(window.low), scale(window.scale),
+          invert(window.inverse ? 0xff : 0x00) {}
+};
+
+template <bool Wide, bool Signed>
+static void windowScalar(const WindowParams &p, const void *src, Uint8 *dst, size_t begin, size_t count)
+{
+    for (size_t i = begin; i < count; ++i)
+    {
+        const Uint16 raw = Wide ? OFstatic_cast(const Uint16 *, src)[i] : OFstatic_cast(const Uint8 *, src)[i];
+        const Uint16 shifted = Uint16(raw << p.up);
+        const int value = Signed ? (Sint16(shifted) >> p.down) : (shifted >> p.down);
+        float grey = (float(value) - p.low) * p.scale;
+        grey = std::min(std::max(grey, 0.0f), 255.0f);
+        dst[i] = Uint8(int(grey + 0.5f)) ^ p.invert;
+    }
+}
+
+#ifdef XRF_WINDOW_X86
+
+template <bool Signed>
+XRF_TARGET_SSE2 static inline __m128i greySse2(__m128i values, __m128 low, __m128 scale)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i extension = Signed ? _mm_srai_epi16(values, 15) : zero;
+    const __m128 max = _mm_set1_ps(255.0f);
+    const __m128 half = _mm_set1_ps(0.5f);
+    __m128 a = _mm_mul_ps(_mm_sub_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(values, extension)), low), scale);
+    __m128 b = _mm_mul_ps(_mm_sub_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(values, extension)), low), scale);
+    a = _mm_add_ps(_mm_min_ps(_mm_max_ps(a, _mm_setzero_ps()), max), half);
+    b = _mm_add_ps(_mm_min_ps(_mm_max_ps(b, _mm_setzero_ps()), max), half);
+    return _mm_packs_epi32(_mm_cvttps_epi32(a), _mm_cvttps_epi32(b));
+}
+
+template <bool Wide, bool Signed>
+XRF_TARGET_SSE2 static void windowSse2(const WindowParams &p, const void *src, Uint8 *dst, size_t count)
+{
+    const __m128i up = _mm_cvtsi32_si128(p.up);
+    const __m128i down = _mm_cvtsi32_si128(p.down);
+    const __m128 low = _mm_set1_ps(p.low);
+    const __m128 scale = _mm_set1_ps(p.scale);
+    const __m128i invert = _mm_set1_epi8(char(p.invert));
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        const __m128i raw = Wide
+            ? _mm_loadu_si128(reinterpret_cast<const __m128i *>(OFstatic_cast(const Uint16 *, src) + i))
+            : _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(OFstatic_cast(const Uint8 *, src) + i)),
+                                _mm_setzero_si128());
+        const __m128i shifted = _mm_sll_epi16(raw, up);
+        const __m128i values = Signed ? _mm_sra_epi16(shifted, down) : _mm_srl_epi16(shifted, down);
+        const __m128i words = greySse2<Signed>(values, low, scale);
+        const __m128i bytes = _mm_xor_si128(_mm_packus_epi16(words, words), invert);
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(dst + i), bytes);
+    }
+    windowScalar<Wide, Signed>(p, src, dst, i, count);
+}
+
+template <bool Signed>
+XRF_TARGET_AVX2 static inline __m256i greyAvx2(__m128i values, __m256 low, __m256 scale)
+{
+    const __m256i widened = Signed ? _mm256_cvtepi16_epi32(values) : _mm256_cvtepu16_epi32(values);
+    __m256 grey = _mm256_mul_ps(_mm256_sub_ps(_mm256_cvtepi32_ps(widened), low), scale);
+    grey = _mm256_min_ps(_mm256_max_ps(grey, _mm256_setzero_ps()), _mm256_set1_ps(255.0f));
+    return _mm256_cvttps_epi32(_mm256_add_ps(grey, _mm256_set1_ps(0.5f)));
+}
+
+template <bool Wide, bool Signed>
+XRF_TARGET_AVX2 static void windowAvx2(const WindowParams &p, const void *src, Uint8 *dst, size_t count)
+{
+    const __m128i up = _mm_cvtsi32_si128(p.up);
+    const __m128i down = _mm_cvtsi32_si128(p.down);
+    const __m256 low = _mm256_set1_ps(p.low);
+    const __m256 scale = _mm256_set1_ps(p.scale);
+    const __m128i invert = _mm_set1_epi8(char(p.invert));
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        const __m256i raw = Wide
+            ? _mm256_loadu_si256(reinterpret_cast<const __m256i *>(OFstatic_cast(const Uint16 *, src) + i))
+            : _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(OFstatic_cast(const Uint8 *, src) + i)));
+        const __m256i shifted = _mm256_sll_epi16(raw, up);
+        const __m256i values = Signed ? _mm256_sra_epi16(shifted, down) : _mm256_srl_epi16(shifted, down);
+        const __m256i a = greyAvx2<Signed>(_mm256_castsi256_si128(values), low, scale);
+        const __m256i b = greyAvx2<Signed>(_mm256_extracti128_si256(values, 1), low, scale);
+        // the packs work per 128 bit lane, put the pixels back in order
+        const __m256i words = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xD8);
+        const __m128i bytes = _mm_packus_epi16(_mm256_castsi256_si128(words), _mm256_extracti128_si256(words, 1));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_xor_si128(bytes, invert));
+    }
+    windowScalar<Wide, Signed>(p, src, dst, i, count);
+}
+
+#endif
+
+static WindowKernel detectKernel()
+{
+#ifdef XRF_WINDOW_X86
+#ifdef _MSC_VER
+    int regs[4];
+    __cpuid(regs, 0);
+    const int maxLeaf = regs[0];
+    __cpuid(regs, 1);
+    const bool sse2 = (regs[3] & (1 << 26)) != 0;
+    // AVX2 also needs the OS to save the YMM registers
+    const bool osAvx = (regs[2] & (1 << 27)) != 0 && (regs[2] & (1 << 28)) != 0 && (_xgetbv(0) & 6) == 6;
+    if (osAvx && maxLeaf >= 7)
+    {
+        __cpuidex(regs, 7, 0);
+        if (regs[1] & (1 << 5))
+            return WindowKernel::AVX2;
+    }
+    if (sse2)
+        return WindowKernel::SSE2;
+#else
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return WindowKernel::AVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return WindowKernel::SSE2;
+#endif
+#endif
+    return WindowKernel::Scalar;
+}
+
+WindowKernel bestWindowKernel()
+{
+    static const WindowKernel best = detectKernel();
+    return best;
+}
+
+bool isWindowKernelSupported(WindowKernel kernel)
+{
+    const WindowKernel best = bestWindowKernel();
+    switch (kernel)
+    {
+    case WindowKernel::Scalar:
+    case WindowKernel::Best:
+        return true;
+    case WindowKernel::SSE2:
+        return best == WindowKernel::SSE2 || best == WindowKernel::AVX2;
+    case WindowKernel::AVX2:
+        return best == WindowKernel::AVX2;
+    }
+    return false;
+}
+
+const char *windowKernelName(WindowKernel kernel)
+{
+    switch (kernel)
+    {
+    case WindowKernel::Scalar: return "scalar";
+    case WindowKernel::SSE2:   return "sse2";
+    case WindowKernel::AVX2:   return "avx2";
+    case WindowKernel::Best:   return windowKernelName(bestWindowKernel());
+    }
+    return "unknown";
+}
+
+template <bool Wide, bool Signed>
+static void dispatch(WindowKernel kernel, const WindowParams &p, const void *src, Uint8 *dst, size_t count)
+{
+    switch (kernel)
+    {
+#ifdef XRF_WINDOW_X86
+    case WindowKernel::AVX2:
+        windowAvx2<Wide, Signed>(p, src, dst, count);
+        return;
+    case WindowKernel::SSE2:
+        windowSse2<Wide, Signed>(p, src, dst, count);
+        return;
+#endif
+    default:
+        windowScalar<Wide, Signed>(p, src, dst, 0, count);
+    }
+}
+
+void applyWindow(const WindowLevel &window, const void *src, Uint8 *dst, size_t count, WindowKernel kernel)
+{
+    if (!window.isValid())
+        return;
+    if (kernel == WindowKernel::Best || !isWindowKernelSupported(kernel))
+        kernel = bestWindowKernel();
+    const WindowParams p(window);
+    if (window.bitsAllocated > 8)
+    {
+        if (window.isSigned) dispatch<true, true>(kernel, p, src, dst, count);
+        else dispatch<true, false>(kernel, p, src, dst, count);
+    }
+    else
+    {
+        if (window.isSigned) dispatch<false, true>(kernel, p, src, dst, count);
+        else dispatch<false, false>(kernel, p, src, dst, count);
+    }
+}
+
+bool applyWindow(const WindowLevel &window, const CineLoop &loop, int index, Uint8 *dst, WindowKernel kernel)
+{
+    const Uint8 *pixels = loop.frame(index);
+    if (pixels == NULL || loop.info().samplesPerPixel != 1 || window.bitsAllocated != loop.info().bitsAllocated)
+        return false;
+    applyWindow(window, pixels, dst, size_t(loop.info().rows) * loop.info().columns, kernel);
+    return true;
+}
+
+}
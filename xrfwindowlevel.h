@@ -0,0 +1,51 @@
+#pragma once
+
+#include "xrfcineloop.h"
+
+namespace xrf {
+
+/* instruction sets applyWindow() can run on */
+enum class WindowKernel {
+    Scalar,         // reference, every platform
+    SSE2,           // 8 pixels per step
+    AVX2,           // 16 pixels per step
+    Best            // the widest one the CPU supports, see bestWindowKernel()
+};
+
+/*
+ * Linear VOI LUT (PS3.3 C.11.2.1.2.1) from stored values to 8 bit grey levels.
+ * Every kernel computes the same thing in single precision, in the same order
+ * (value - low) * scale, clamped to 0..255 and rounded half up, so they agree
+ * bit for bit with the scalar reference.
+ */
+struct WindowLevel
+{
+    int   bitsAllocated = 16;       // 8 or 16
+    int   bitsStored = 16;
+    int   highBit = 15;
+    bool  isSigned = false;
+    bool  inverse = false;          // MONOCHROME1
+    float low = 0.0f;               // value which maps to 0
+    float scale = 1.0f;             // grey levels per stored value
+
+    /* center/width as in (0028,1050/1051); a width < 1 selects the full range of the stored values */
+    static WindowLevel make(const CineLoopInfo& info, double center, double width);
+    /* the window of the loop itself */
+    static WindowLevel fromInfo(const CineLoopInfo& info);
+
+    bool isValid() const;
+};
+
+/* count pixels of native pixel data (Uint8 or Uint16 by bitsAllocated) to grey levels */
+void applyWindow(const WindowLevel& window, const void* src, Uint8* dst, size_t count,
+                 WindowKernel kernel = WindowKernel::Best);
+/* one frame of a loop, dst takes rows * columns bytes; false if index is out of range */
+bool applyWindow(const WindowLevel& window, const CineLoop& loop, int index, Uint8* dst,
+                 WindowKernel kernel = WindowKernel::Best);
+
+/* decided once, on first use */
+WindowKernel bestWindowKernel();
+bool isWindowKernelSupported(WindowKernel kernel);
+const char* windowKernelName(WindowKernel kernel);
+
+}
@@ -0,0 +1,197 @@
+#include "xrfwritebehind.h"
+#include "xrfcinelooprcv.h"
+#include "xrferror.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <set>
+
+namespace xrf {
+
+bool syncToDisk(const OFString& path, bool directory)
+{
+#ifdef _WIN32
+    if (directory)
+        return true;
+    HANDLE h = CreateFileA(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                           OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (h == INVALID_HANDLE_VALUE)
+        return false;
+    bool ok = FlushFileBuffers(h) != 0;
+    CloseHandle(h);
+    return ok;
+#else
+    int fd = ::open(path.c_str(), directory ? O_RDONLY : O_WRONLY);
+    if (fd < 0)
+        return false;
+    bool ok = ::fsync(fd) == 0;
+    ::close(fd);
+    return ok;
+#endif
+}
+
+bool replaceFile(const OFString& from, const OFString& to)
+{
+#ifdef _WIN32
+    return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    return ::rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+OFCondition WriteTicket::wait()
+{
+    QMutexLocker locker(&mutex);
+    while (!finished)
+        done.wait(&mutex);
+    return cond;
+}
+
+void WriteTicket::complete(const OFCondition &result)
+{
+    QMutexLocker locker(&mutex);
+    cond = result;
+    finished = true;
+    done.wakeAll();
+}
+
+
+WriteBehindQueue::WriteBehindQueue(qint64 maxQueuedBytes, AckPolicy policy, int maxBatch, QObject *parent)
+    : QThread(parent), stopping(false), maxQueuedBytes(maxQueuedBytes), policy(policy), maxBatch(qMax(1, maxBatch))
+{
+
+}
+
+WriteBehindQueue::~WriteBehindQueue()
+{
+    shutdown();
+}
+
+std::shared_ptr<WriteTicket> WriteBehindQueue::enqueue(const Job &job)
+{
+    Entry entry;
+    entry.job = job;
+    entry.bytes = job.fileformat->getDataset()->calcElementLength(job.xfer, job.sequenceType);
+    entry.ticket = std::make_shared<WriteTicket>();
+
+    QMutexLocker locker(&mutex);
+
+    // backpressure: wait until the object fits, but never refuse an object
+    // which is larger than the whole queue when nothing else is queued
+    while (counters.queuedBytes > 0 && counters.queuedBytes + entry.bytes > maxQueuedBytes && !stopping)
+        notFull.wait(&mutex);
+
+    entry.queued.start();
+    queue.append(entry);
+
+    counters.enqueued++;
+    counters.queueDepth++;
+    counters.queuedBytes += entry.bytes;
+    counters.maxQueueDepth = qMax(counters.maxQueueDepth, counters.queueDepth);
+    counters.maxQueuedBytes = qMax(counters.maxQueuedBytes, counters.queuedBytes);
+
+    notEmpty.wakeOne();
+    return entry.ticket;
+}
+
+void WriteBehindQueue::shutdown()
+{
+    {
+        QMutexLocker locker(&mutex);
+        stopping = true;
+        notEmpty.wakeAll();
+        notFull.wakeAll();
+    }
+    wait();
+}
+
+WriteBehindStats WriteBehindQueue::stats()
+{
+    QMutexLocker locker(&mutex);
+    return counters;
+}
+
+void WriteBehindQueue::run()
+{
+    forever
+    {
+        QList<Entry> batch;
+        {
+            QMutexLocker locker(&mutex);
+            while (queue.isEmpty() && !stopping)
+                notEmpty.wait(&mutex);
+            // when stopping, everything which is still queued is written first
+            if (queue.isEmpty())
+                break;
+            while (!queue.isEmpty() && batch.size() < maxBatch)
+                batch.append(queue.takeFirst());
+        }
+
+        // write all files of the batch first and sync them afterwards, so that the
+        // disk sees one burst of writes and a single durability barrier per batch
+        QList<OFCondition> results;
+        std::set<OFString> directories;
+        for (Entry& entry : batch)
+        {
+            const Job& job = entry.job;
+            OFCondition cond = job.fileformat->saveFile(job.fileName.c_str(), job.xfer, job.sequenceType, job.groupLength,
+                                                        job.paddingType, job.filepad, job.itempad, job.writeMode);
+            if (cond.bad())
+            {
+                OFLOG_ERROR(storescpLogger, "cannot write DICOM file: " << job.fileName << ": " << cond.text());
+            }
+            // the data set is not needed anymore, give the memory back as early as possible
+            entry.job.fileformat.reset();
+            results.append(cond);
+        }
+
+        for (int i = 0; i < batch.size(); ++i)
+        {
+            if (results[i].bad())
+                continue;
+            if (!syncToDisk(batch[i].job.fileName, false))
+            {
+                OFLOG_ERROR(storescpLogger, "cannot sync DICOM file to disk: " << batch[i].job.fileName);
+                results[i] = XRF_SyncFailed;
+                continue;
+            }
+            OFString dirName;
+            directories.insert(OFStandard::getDirNameFromPath(dirName, batch[i].job.fileName));
+        }
+        // make the new directory entries durable as well
+        for (const OFString& dirName : directories)
+            syncToDisk(dirName, true);
+
+        {
+            QMutexLocker locker(&mutex);
+            counters.batches++;
+            for (int i = 0; i < batch.size(); ++i)
+            {
+                const qint64 latency = batch[i].queued.nsecsElapsed();
+                counters.queueDepth--;
+                counters.queuedBytes -= batch[i].bytes;
+                counters.lastLatencyNs = latency;
+                counters.maxLatencyNs = qMax(counters.maxLatencyNs, latency);
+                counters.totalLatencyNs += latency;
+                if (results[i].good()) counters.written++; else counters.failed++;
+            }
+            notFull.wakeAll();
+        }
+
+        for (int i = 0; i < batch.size(); ++i)
+        {
+            if (batch[i].job.completed)
+                batch[i].job.completed(results[i]);
+            batch[i].ticket->complete(results[i]);
+            if (onCompleted)
+                onCompleted(batch[i].job.fileName, results[i]);
+        }
+    }
+}
+
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include "dcmtk/config/osconfig.h"    /* make sure OS specific configuration is included first */
+
+#include "dcmtk/dcmdata/dcfilefo.h"
+
+#include <QElapsedTimer>
+#include <QList>
+#include <QMutex>
+#include <QThread>
+#include <QWaitCondition>
+
+#include <functional>
+#include <memory>
+
+namespace xrf {
+
+/* when the C-STORE-RSP is sent for an object handed to the write-behind stage */
+enum class AckPolicy {
+    OnEnqueue,      // as soon as the object is queued; write errors are only logged
+    OnDurable       // after the file has been written and synced to disk
+};
+
+/* flushes the file (or directory, which is a no-op on Windows) to stable storage */
+bool syncToDisk(const OFString& path, bool directory);
+/* renames from over to, replacing to in one step */
+bool replaceFile(const OFString& from, const OFString& to);
+
+/* counters of the write-behind stage, see WriteBehindQueue::stats() */
+struct WriteBehindStats
+{
+    quint64 enqueued = 0;
+    quint64 written = 0;
+    quint64 failed = 0;
+    quint64 batches = 0;
+    int     queueDepth = 0;          // objects waiting or being written
+    int     maxQueueDepth = 0;
+    qint64  queuedBytes = 0;
+    qint64  maxQueuedBytes = 0;
+    qint64  lastLatencyNs = 0;       // enqueue -> durable
+    qint64  maxLatencyNs = 0;
+    qint64  totalLatencyNs = 0;
+};
+
+/*
+ * Completion handle of one queued object. wait() blocks until the file is
+ * durable (or failed) and returns the result of the write.
+ */
+class WriteTicket
+{
+public:
+    OFCondition wait();
+    void complete(const OFCondition& result);
+
+private:
+    QMutex mutex;
+    QWaitCondition done;
+    bool finished = false;
+    OFCondition cond = EC_Normal;
+};
+
+/*
+ * Asynchronous write stage of the receiver. Received data sets are queued by the
+ * association workers and written by this thread, so slow disks no longer throttle
+ * how fast the socket is drained. The queue is bounded by the number of bytes it
+ * holds; enqueue() blocks while it is full. Objects are written in batches and the
+ * whole batch is synced to disk in one go after all of its files have been written.
+ */
+class WriteBehindQueue : public QThread
+{
+    Q_OBJECT
+public:
+    struct Job
+    {
+        std::shared_ptr<DcmFileFormat> fileformat;
+        OFString          fileName;
+        E_TransferSyntax  xfer = EXS_Unknown;
+        E_EncodingType    sequenceType = EET_ExplicitLength;
+        E_GrpLenEncoding  groupLength = EGL_recalcGL;
+        E_PaddingEncoding paddingType = EPD_withoutPadding;
+        Uint32            filepad = 0;
+        Uint32            itempad = 0;
+        E_FileWriteMode   writeMode = EWM_fileformat;
+        /* called on the I/O thread once the file is durable or has failed, before the
+         * ticket completes; what needs the file on disk (indexes, study records) goes here */
+        std::function<void(const OFCondition& result)> completed;
+    };
+
+    typedef std::function<void(const OFString& fileName, const OFCondition& result)> CompletionHandler;
+
+    WriteBehindQueue(qint64 maxQueuedBytes, AckPolicy policy, int maxBatch = 16, QObject *parent = 0);
+    ~WriteBehindQueue();
+
+    /* called on the I/O thread for every object, after it is durable or has failed */
+    void setCompletionHandler(const CompletionHandler& handler) { onCompleted = handler; }
+
+    AckPolicy ackPolicy() const { return policy; }
+
+    /* blocks while the queue is full */
+    std::shared_ptr<WriteTicket> enqueue(const Job& job);
+
+    /* writes what is still queued and stops the thread */
+    void shutdown();
+
+    WriteBehindStats stats();
+
+    void run() Q_DECL_OVERRIDE;
+
+private:
+    struct Entry
+    {
+        Job job;
+        qint64 bytes;
+        QElapsedTimer queued;
+        std::shared_ptr<WriteTicket> ticket;
+    };
+
+    QMutex mutex;
+    QWaitCondition notEmpty;
+    QWaitCondition notFull;
+    QList<Entry> queue;
+    bool stopping;
+
+    const qint64 maxQueuedBytes;
+    const AckPolicy policy;
+    const int maxBatch;
+    CompletionHandler onCompleted;
+
+    WriteBehindStats counters;
+};
+
+}